@@ -1,18 +1,123 @@
 #include "AudioServer.h"
+#include "OutputZone.h"
+#include "Tracing.h"
+
+//==============================================================================
+/**
+ * Wraps a device type so the device manager hears of its device list changes
+ * on the device thread. Types announce them on the message thread, where the
+ * manager would otherwise close and reopen devices behind the back of
+ * whatever thread owns them.
+ */
+class AudioServer::DeviceTypeRelay : public juce::AudioIODeviceType,
+                                     private juce::AudioIODeviceType::Listener
+{
+public:
+    DeviceTypeRelay(std::unique_ptr<juce::AudioIODeviceType> typeToWrap, AudioServer& ownerServer)
+        : juce::AudioIODeviceType(typeToWrap->getTypeName()),
+          type(std::move(typeToWrap)),
+          owner(ownerServer)
+    {
+        type->addListener(this);
+    }
+    
+    ~DeviceTypeRelay() override
+    {
+        type->removeListener(this);
+    }
+    
+    void scanForDevices() override { type->scanForDevices(); }
+    juce::StringArray getDeviceNames(bool wantInputNames) const override { return type->getDeviceNames(wantInputNames); }
+    int getDefaultDeviceIndex(bool forInput) const override { return type->getDefaultDeviceIndex(forInput); }
+    bool hasSeparateInputsAndOutputs() const override { return type->hasSeparateInputsAndOutputs(); }
+    
+    int getIndexOfDevice(juce::AudioIODevice* device, bool asInput) const override
+    {
+        return type->getIndexOfDevice(device, asInput);
+    }
+    
+    juce::AudioIODevice* createDevice(const juce::String& outputDeviceName, const juce::String& inputDeviceName) override
+    {
+        return type->createDevice(outputDeviceName, inputDeviceName);
+    }
+    
+private:
+    void audioDeviceListChanged() override
+    {
+        owner.runOnDeviceThread("Device list " + getTypeName(), [weakThis = juce::WeakReference<DeviceTypeRelay>(this)]
+        {
+            if (weakThis != nullptr)
+                weakThis->callDeviceChangeListeners();
+        });
+    }
+    
+    std::unique_ptr<juce::AudioIODeviceType> type;
+    AudioServer& owner;
+    
+    JUCE_DECLARE_WEAK_REFERENCEABLE(DeviceTypeRelay)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceTypeRelay)
+};
+
+void AudioServer::DeviceManager::createAudioDeviceTypes(juce::OwnedArray<juce::AudioIODeviceType>& types)
+{
+    juce::OwnedArray<juce::AudioIODeviceType> platformTypes;
+    juce::AudioDeviceManager::createAudioDeviceTypes(platformTypes);
+    
+    while (!platformTypes.isEmpty())
+        types.add(new DeviceTypeRelay(std::unique_ptr<juce::AudioIODeviceType>(platformTypes.removeAndReturn(0)), owner));
+}
 
 //==============================================================================
 AudioServer::AudioServer()
 {
+    addQualityStages();
+    addMetrics();
 }
 
 AudioServer::~AudioServer()
 {
+    cancelPendingUpdate();
     shutdown();
 }
 
+//==============================================================================
+void AudioServer::setDeviceThread(juce::Thread::ThreadID threadId, DeviceThreadPost post)
+{
+    const juce::ScopedLock lock(deviceThreadLock);
+    deviceThreadId = threadId;
+    postToDeviceThread = std::move(post);
+}
+
+void AudioServer::resetDeviceThread()
+{
+    setDeviceThread(nullptr, nullptr);
+}
+
+bool AudioServer::isDeviceThread() const
+{
+    const juce::ScopedLock lock(deviceThreadLock);
+    
+    if (deviceThreadId == nullptr)
+        return juce::MessageManager::existsAndIsCurrentThread();
+    
+    return juce::Thread::getCurrentThreadId() == deviceThreadId;
+}
+
+void AudioServer::runOnDeviceThread(const juce::String& key, std::function<void()> function)
+{
+    const juce::ScopedLock lock(deviceThreadLock);
+    
+    if (postToDeviceThread != nullptr)
+        postToDeviceThread(key, std::move(function));
+    else
+        juce::MessageManager::callAsync(std::move(function));
+}
+
 //==============================================================================
 bool AudioServer::initialize()
 {
+    jassert(isDeviceThread());
+    
     // Initialize the audio device manager
     auto result = deviceManager.initialiseWithDefaultDevices(2, 2);
     
@@ -27,6 +132,14 @@ bool AudioServer::initialize()
 
 void AudioServer::shutdown()
 {
+    jassert(isDeviceThread());
+    
+    stopMetricsExporter();
+    
+    while (getNumOutputZones() > 0)
+        removeOutputZone(getNumOutputZones() - 1);
+    
+    stopCapture();
     stopAudioProcessing();
     deviceManager.closeAudioDevice();
 }
@@ -34,9 +147,13 @@ void AudioServer::shutdown()
 //==============================================================================
 bool AudioServer::startAudioProcessing()
 {
+    jassert(isDeviceThread());
+    
     if (running)
         return true;
     
+    TRACE_SCOPE("Start audio processing");
+    
     // Set this object as the audio callback
     deviceManager.addAudioCallback(this);
     
@@ -59,18 +176,415 @@ bool AudioServer::startAudioProcessing()
 
 void AudioServer::stopAudioProcessing()
 {
+    jassert(isDeviceThread());
+    
     if (!running)
         return;
     
+    TRACE_SCOPE("Stop audio processing");
+    
     deviceManager.removeAudioCallback(this);
     running = false;
     
+    if (measurementEngine.isPlaying())
+        measurementEngine.cancel("Audio processing stopped during the measurement");
+    
     DBG("Audio processing stopped");
 }
 
+//==============================================================================
+bool AudioServer::startCapture(const CaptureTap::Settings& settings, juce::String& errorMessage)
+{
+    if (!running)
+    {
+        errorMessage = "Audio processing is not running";
+        return false;
+    }
+    
+    return captureTap.start(settings, currentSampleRate, currentNumProcessingChannels, errorMessage);
+}
+
+void AudioServer::stopCapture()
+{
+    captureTap.stop();
+}
+
+//==============================================================================
+bool AudioServer::startMeasurement(const MeasurementEngine::Settings& settings, MeasurementEngine::Callback onDone,
+                                   juce::String& errorMessage)
+{
+    if (!running || currentSampleRate <= 0.0)
+    {
+        errorMessage = "Start audio processing before measuring";
+        return false;
+    }
+    
+    return measurementEngine.start(settings, currentSampleRate, currentNumInputChannels, currentNumOutputChannels,
+                                   std::move(onDone), errorMessage);
+}
+
+//==============================================================================
+bool AudioServer::setRouting(const ChannelRouter::Routing& routing, juce::String& errorMessage)
+{
+    jassert(isDeviceThread());
+    
+    if (!routing.isValid(errorMessage))
+        return false;
+    
+    if (!running || routing.numProcessingChannels == currentNumProcessingChannels)
+        return channelRouter.setRouting(routing, errorMessage);
+    
+    // Re-adding the callback runs audioDeviceAboutToStart() for the new count
+    TRACE_SCOPE("Reconfigure routing");
+    deviceManager.removeAudioCallback(this);
+    auto result = channelRouter.setRouting(routing, errorMessage);
+    deviceManager.addAudioCallback(this);
+    
+    return result;
+}
+
+void AudioServer::clearRouting()
+{
+    jassert(isDeviceThread());
+    
+    // Without a routing the chain processes every device channel
+    auto needsRestart = running && juce::jmax(currentNumInputChannels, currentNumOutputChannels)
+                                       != currentNumProcessingChannels;
+    
+    TRACE_SCOPE("Clear routing");
+    
+    if (needsRestart)
+        deviceManager.removeAudioCallback(this);
+    
+    channelRouter.clearRouting();
+    
+    if (needsRestart)
+        deviceManager.addAudioCallback(this);
+}
+
+bool AudioServer::setChannelGroups(const juce::Array<juce::Array<int>>& channelGroups, juce::String& errorMessage)
+{
+    jassert(isDeviceThread());
+    
+    TRACE_SCOPE("Reconfigure channel groups");
+    
+    if (running)
+        deviceManager.removeAudioCallback(this);
+    
+    auto result = processorChain.setChannelGroups(channelGroups, errorMessage);
+    
+    if (running)
+        deviceManager.addAudioCallback(this);
+    
+    return result;
+}
+
+//==============================================================================
+void AudioServer::setProcessingMode(BackgroundProcessor::Mode mode)
+{
+    backgroundProcessor.setMode(mode);
+    
+    // Zones line up with the main path's new latency
+    updateZoneAlignment();
+}
+
+bool AudioServer::setHighLatencyBlockSize(int blockSize, juce::String& errorMessage)
+{
+    jassert(isDeviceThread());
+    
+    if (blockSize < 64 || blockSize > BackgroundProcessor::maxBlockSize)
+    {
+        errorMessage = "Block size must be between 64 and " + juce::String(BackgroundProcessor::maxBlockSize);
+        return false;
+    }
+    
+    if (blockSize == highLatencyBlockSize)
+        return true;
+    
+    TRACE_SCOPE("Resize background blocks");
+    
+    // The chain and the rings are sized for it in prepare
+    if (running)
+        deviceManager.removeAudioCallback(this);
+    
+    highLatencyBlockSize = blockSize;
+    
+    if (running)
+        deviceManager.addAudioCallback(this);
+    
+    updateZoneAlignment();
+    return true;
+}
+
+//==============================================================================
+int AudioServer::addOutputZone(const ZoneSettings& settings, juce::String& errorMessage)
+{
+    jassert(isDeviceThread());
+    
+    if (getNumOutputZones() >= maxOutputZones)
+    {
+        errorMessage = "Too many output zones";
+        return -1;
+    }
+    
+    // The zone opens its device before the capture callback can see it
+    auto zone = std::make_unique<OutputZone>(settings);
+    zone->setSource(currentSampleRate);
+    
+    // At the quality the governor has the main chain at
+    zone->getChain().setDoubleStateRatio(processorChain.getDoubleStateRatio());
+    zone->getChain().getLoudnessStage().setDoubleWeighting(processorChain.getLoudnessStage().isDoubleWeighting());
+    
+    if (!zone->open(errorMessage))
+        return -1;
+    
+    int index;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(zoneLock);
+        outputZones.add(zone.release());
+        index = outputZones.size() - 1;
+    }
+    
+    updateZoneAlignment();
+    return index;
+}
+
+void AudioServer::removeOutputZone(int zone)
+{
+    jassert(isDeviceThread());
+    
+    std::unique_ptr<OutputZone> removed;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(zoneLock);
+        removed.reset(outputZones.removeAndReturn(zone));
+    }
+    
+    // Closed outside the lock, so the capture callback never waits on it
+    removed.reset();
+    updateZoneAlignment();
+}
+
+int AudioServer::getNumOutputZones() const
+{
+    jassert(isDeviceThread());
+    
+    return outputZones.size();
+}
+
+AudioServer::ProcessorChain* AudioServer::getZoneChain(int zone)
+{
+    jassert(isDeviceThread());
+    
+    if (auto* outputZone = outputZones[zone])
+        return &outputZone->getChain();
+    
+    return nullptr;
+}
+
+AudioServer::ZoneStatus AudioServer::getZoneStatus(int zone) const
+{
+    jassert(isDeviceThread());
+    
+    if (auto* outputZone = outputZones[zone])
+        return outputZone->getStatus();
+    
+    return {};
+}
+
+void AudioServer::setZoneAlignment(bool shouldAlign, float newMainExtraDelayMs)
+{
+    jassert(isDeviceThread());
+    
+    alignZones = shouldAlign;
+    mainExtraDelayMs = juce::jmax(0.0f, newMainExtraDelayMs);
+    updateZoneAlignment();
+}
+
+void AudioServer::updateZoneAlignment()
+{
+    // Devices start on their own threads, while zones come and go on the
+    // device thread
+    if (!isDeviceThread())
+    {
+        triggerAsyncUpdate();
+        return;
+    }
+    
+    auto sampleRate = currentSampleRate.load();
+    auto mainLatencyMs = getMainPathLatencyMs();
+    auto slowestMs = mainLatencyMs;
+    
+    for (auto* zone : outputZones)
+        slowestMs = juce::jmax(slowestMs, zone->getPathLatencyMs());
+    
+    for (auto* zone : outputZones)
+        zone->setAlignmentDelayMs((alignZones ? slowestMs - zone->getPathLatencyMs() : 0.0f)
+                                  + zone->getSettings().extraDelayMs);
+    
+    // The main output only needs holding back while there are zones to meet
+    auto mainDelayMs = outputZones.isEmpty() ? 0.0f
+                                             : (alignZones ? slowestMs - mainLatencyMs : 0.0f) + mainExtraDelayMs;
+    
+    mainDelaySamples = juce::jlimit(0, (int) sampleRate, juce::roundToInt(mainDelayMs * 0.001 * sampleRate));
+    
+    DBG("Zones aligned to " + juce::String(slowestMs, 1) + " ms, main output delayed "
+        + juce::String(mainDelayMs, 1) + " ms");
+}
+
+float AudioServer::getMainPathLatencyMs()
+{
+    auto sampleRate = currentSampleRate.load();
+    
+    if (!running || sampleRate <= 0.0)
+        return 0.0f;
+    
+    auto latencySamples = currentOutputLatency.load() + processorChain.getPluginStage().getLatencySamples()
+                        + backgroundProcessor.getLatencySamples();
+    return (float) (1000.0 * latencySamples / sampleRate);
+}
+
+void AudioServer::handleAsyncUpdate()
+{
+    if (isDeviceThread())
+    {
+        updateZoneAlignment();
+        return;
+    }
+    
+    // A controller drops what it hasn't run when it goes, but without one
+    // the call may outlive the server
+    runOnDeviceThread("Align zones", [weakThis = juce::WeakReference<AudioServer>(this)]
+    {
+        if (weakThis != nullptr)
+            weakThis->updateZoneAlignment();
+    });
+}
+
+int AudioServer::getNumProcessingChannelsFor(int numInputs, int numOutputs) const
+{
+    if (channelRouter.hasRouting())
+        return channelRouter.getNumProcessingChannels();
+    
+    return juce::jmax(numInputs, numOutputs);
+}
+
+void AudioServer::addQualityStages()
+{
+    // Cheapest sacrifice first: the governor gives each up completely before
+    // touching the next
+    qualityGovernor.addStage("Metering", { "Every block", "Every 4th block" }, [this] (int tier)
+    {
+        meterInterval = tier == 0 ? 1 : 4;
+    });
+    
+    qualityGovernor.addStage("Loudness weighting", { "Double", "Float" }, [this] (int tier)
+    {
+        processorChain.getLoudnessStage().setDoubleWeighting(tier == 0);
+        
+        applyToZoneChains("Zone loudness weighting", [tier] (ProcessorChain& chain)
+        {
+            chain.getLoudnessStage().setDoubleWeighting(tier == 0);
+        });
+    });
+    
+    // Float state on bands below the default ratio adds noise near the
+    // bottom of the band, so this goes last and never all the way to float
+    qualityGovernor.addStage("EQ precision", { "Double below 2.5% of fs", "Double below 0.5% of fs" }, [this] (int tier)
+    {
+        auto ratio = tier == 0 ? EQPlan::doublePrecisionRatio : 0.005;
+        processorChain.setDoubleStateRatio(ratio);
+        
+        applyToZoneChains("Zone EQ precision", [ratio] (ProcessorChain& chain)
+        {
+            chain.setDoubleStateRatio(ratio);
+        });
+    });
+}
+
+void AudioServer::applyToZoneChains(const juce::String& key, std::function<void(ProcessorChain&)> apply)
+{
+    // The governor runs on the message thread, but zones belong to the
+    // device thread. A zone added in between copies the main chain's
+    // settings, which are already changed.
+    runOnDeviceThread(key, [weakThis = juce::WeakReference<AudioServer>(this), apply = std::move(apply)]
+    {
+        if (weakThis == nullptr)
+            return;
+        
+        for (int zone = 0; zone < weakThis->getNumOutputZones(); ++zone)
+            if (auto* chain = weakThis->getZoneChain(zone))
+                apply(*chain);
+    });
+}
+
+void AudioServer::addMetrics()
+{
+    using Type = MetricsExporter::Type;
+    auto& exporter = metricsExporter;
+    
+    auto addCount = [&exporter] (const juce::String& name, const juce::String& help,
+                                 const std::atomic<juce::int64>& counter)
+    {
+        exporter.addMetric(name, help, Type::Counter, [&counter] { return (double) counter.load(std::memory_order_relaxed); });
+    };
+    
+    exporter.addMetric("running", "1 while audio processing is running", Type::Gauge,
+                       [this] { return running.load() ? 1.0 : 0.0; });
+    
+    exporter.addHistogram("callback_load_ratio", "Audio callback time over the block's duration",
+                          health.callbackLoads);
+    addCount("callback_overruns_total", "Audio callbacks that took longer than their block", health.numOverruns);
+    exporter.addMetric("callback_load_peak_ratio", "Peak callback load over the quality governor's latest tick",
+                       Type::Gauge, [this] { return (double) qualityGovernor.getLoad(); });
+    
+    addCount("xruns_total", "Xruns reported by the audio devices", health.numXRuns);
+    addCount("device_starts_total", "Times an audio device started", health.numDeviceStarts);
+    addCount("device_changes_total", "Device starts on a different device from the last", health.numDeviceChanges);
+    addCount("device_errors_total", "Errors reported by the audio device", health.numDeviceErrors);
+    
+    // Metered blocks only, so this undercounts while the governor meters less often
+    addCount("output_clipped_blocks_total", "Metered output blocks with a peak at or above full scale",
+             health.numClippedBlocks);
+    addCount("capture_dropped_blocks_total", "Blocks the capture writer couldn't keep up with, since the capture started",
+             health.numCaptureDrops);
+    exporter.addMetric("parameter_events_dropped_total", "Scheduled band changes dropped because the queue was full",
+                       Type::Counter, [this] { return (double) processorChain.getNumDroppedEvents(); });
+    
+    exporter.addMetric("chain_load_ratio", "Time in the processor chain per second of audio, by mode", Type::Gauge,
+                       [this] { return (double) health.directLoad.load(); }, "mode=\"direct\"");
+    exporter.addMetric("chain_load_ratio", "Time in the processor chain per second of audio, by mode", Type::Gauge,
+                       [this] { return (double) health.highLatencyLoad.load(); }, "mode=\"high_latency\"");
+    addCount("background_underruns_total", "Callbacks the high-latency worker hadn't caught up with",
+             health.numBackgroundUnderruns);
+    exporter.addMetric("quality_level", "Quality governor level; 0 is full quality", Type::Gauge,
+                       [this] { return (double) health.qualityLevel.load(); });
+    
+    exporter.setRefresh([this] { refreshMetrics(); });
+}
+
+void AudioServer::refreshMetrics()
+{
+    health.numCaptureDrops = captureTap.getNumDroppedBlocks();
+    
+    auto status = backgroundProcessor.getStatus();
+    health.directLoad = status.directLoad;
+    health.highLatencyLoad = status.highLatencyLoad;
+    health.numBackgroundUnderruns = status.numUnderruns;
+    health.qualityLevel = qualityGovernor.getLevel();
+}
+
+bool AudioServer::startMetricsExporter(const MetricsExporter::Settings& settings, juce::String& errorMessage)
+{
+    return metricsExporter.start(settings, errorMessage);
+}
+
 //==============================================================================
 juce::StringArray AudioServer::getAvailableInputDevices() const
 {
+    jassert(isDeviceThread());
+    
     juce::StringArray devices;
     
     if (auto* deviceType = deviceManager.getCurrentDeviceTypeObject())
@@ -85,6 +599,8 @@ juce::StringArray AudioServer::getAvailableInputDevices() const
 
 juce::StringArray AudioServer::getAvailableOutputDevices() const
 {
+    jassert(isDeviceThread());
+    
     juce::StringArray devices;
     
     if (auto* deviceType = deviceManager.getCurrentDeviceTypeObject())
@@ -99,6 +615,10 @@ juce::StringArray AudioServer::getAvailableOutputDevices() const
 
 bool AudioServer::setInputDevice(const juce::String& deviceName)
 {
+    jassert(isDeviceThread());
+    
+    TRACE_SCOPE("Set input device");
+    
     auto setup = deviceManager.getAudioDeviceSetup();
     setup.inputDeviceName = deviceName;
     
@@ -115,6 +635,10 @@ bool AudioServer::setInputDevice(const juce::String& deviceName)
 
 bool AudioServer::setOutputDevice(const juce::String& deviceName)
 {
+    jassert(isDeviceThread());
+    
+    TRACE_SCOPE("Set output device");
+    
     auto setup = deviceManager.getAudioDeviceSetup();
     setup.outputDeviceName = deviceName;
     
@@ -131,6 +655,8 @@ bool AudioServer::setOutputDevice(const juce::String& deviceName)
 
 juce::String AudioServer::getCurrentInputDevice() const
 {
+    jassert(isDeviceThread());
+    
     if (auto* device = deviceManager.getCurrentAudioDevice())
         return device->getName();
     
@@ -139,12 +665,62 @@ juce::String AudioServer::getCurrentInputDevice() const
 
 juce::String AudioServer::getCurrentOutputDevice() const
 {
+    jassert(isDeviceThread());
+    
     if (auto* device = deviceManager.getCurrentAudioDevice())
         return device->getName();
     
     return {};
 }
 
+bool AudioServer::initializeSynthetic(const SyntheticAudioDevice::Settings& settings, juce::String& errorMessage)
+{
+    jassert(isDeviceThread());
+    
+    // Removing the old type closes its device if open
+    if (syntheticDeviceRelay != nullptr)
+        deviceManager.removeAudioDeviceType(syntheticDeviceRelay);
+    
+    auto type = std::make_unique<SyntheticAudioDeviceType>(settings);
+    syntheticDeviceType = type.get();
+    
+    auto relay = std::make_unique<DeviceTypeRelay>(std::move(type), *this);
+    syntheticDeviceRelay = relay.get();
+    deviceManager.addAudioDeviceType(std::move(relay));
+    deviceManager.setCurrentAudioDeviceType(SyntheticAudioDeviceType::typeName, true);
+    
+    auto setup = deviceManager.getAudioDeviceSetup();
+    setup.inputDeviceName = settings.deviceName;
+    setup.outputDeviceName = settings.deviceName;
+    setup.sampleRate = settings.defaultSampleRate;
+    setup.bufferSize = settings.defaultBufferSize;
+    setup.useDefaultInputChannels = false;
+    setup.useDefaultOutputChannels = false;
+    setup.inputChannels.clear();
+    setup.inputChannels.setRange(0, settings.numInputChannels, true);
+    setup.outputChannels.clear();
+    setup.outputChannels.setRange(0, settings.numOutputChannels, true);
+    
+    auto error = deviceManager.setAudioDeviceSetup(setup, true);
+    
+    if (!error.isEmpty())
+    {
+        errorMessage = "Could not open the synthetic device: " + error;
+        DBG(errorMessage);
+        return false;
+    }
+    
+    DBG("Synthetic device initialized" + juce::String(settings.accelerated ? " (accelerated)" : ""));
+    return true;
+}
+
+SyntheticAudioDevice* AudioServer::getSyntheticDevice()
+{
+    jassert(isDeviceThread());
+    
+    return dynamic_cast<SyntheticAudioDevice*>(deviceManager.getCurrentAudioDevice());
+}
+
 //==============================================================================
 void AudioServer::audioDeviceIOCallbackWithContext(const float* const* inputChannelData,
                                                    int numInputChannels,
@@ -153,47 +729,175 @@ void AudioServer::audioDeviceIOCallbackWithContext(const float* const* inputChan
                                                    int numSamples,
                                                    const juce::AudioIODeviceCallbackContext& context)
 {
-    juce::ignoreUnused(context);
+    auto callbackStart = juce::Time::getHighResolutionTicks();
     
-    // Ensure processing buffer is the right size
-    if (processingBuffer.getNumChannels() != numOutputChannels ||
-        processingBuffer.getNumSamples() < numSamples)
-    {
-        processingBuffer.setSize(numOutputChannels, numSamples, false, false, true);
+    if (promoteAudioThread.load(std::memory_order_relaxed))
+        RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Audio, "Audio");
+    
+    Tracing::setThreadName("Audio");
+    TRACE_SCOPE("Audio callback");
+    Tracing::counter("Callback samples", numSamples);
+    
+    const auto& kernels = processorChain.getKernels();
+    
+    // Without a routing, input n goes straight to output n
+    auto numRoutedChannels = channelRouter.beginBlock();
+    auto numProcessingChannels = numRoutedChannels > 0 ? numRoutedChannels : numOutputChannels;
+    
+    // Ensure processing buffer is the right size
+    if (processingBuffer.getNumChannels() != numProcessingChannels ||
+        processingBuffer.getNumSamples() < numSamples)
+    {
+        processingBuffer.setSize(numProcessingChannels, numSamples, false, false, true);
     }
     
-    // Copy input to processing buffer
-    for (int channel = 0; channel < numOutputChannels; ++channel)
+    Tracing::begin("Input routing");
+    
+    if (numRoutedChannels > 0)
     {
-        if (channel < numInputChannels && inputChannelData[channel] != nullptr)
+        channelRouter.mixInputs(kernels, inputChannelData, numInputChannels, processingBuffer, numSamples);
+    }
+    else
+    {
+        // Copy input to processing buffer
+        for (int channel = 0; channel < numOutputChannels; ++channel)
         {
-            // Copy input to output
-            processingBuffer.copyFrom(channel, 0, inputChannelData[channel], numSamples);
+            if (channel < numInputChannels && inputChannelData[channel] != nullptr)
+            {
+                // Copy input to output
+                kernels.copy(processingBuffer.getWritePointer(channel), inputChannelData[channel], numSamples);
+            }
+            else
+            {
+                // Clear channel if no input
+                processingBuffer.clear(channel, 0, numSamples);
+            }
         }
-        else
+    }
+    
+    Tracing::end("Input routing");
+    
+    captureTap.pushPreChain(processingBuffer, numSamples);
+    
+    // Zones run their own chains on the capture, on their own devices
+    {
+        const juce::SpinLock::ScopedTryLockType lock(zoneLock);
+        
+        if (lock.isLocked())
+            for (auto* zone : outputZones)
+                zone->push(processingBuffer, numSamples);
+    }
+    
+    // Apply processing chain, here or through the worker
+    {
+        TRACE_SCOPE("Processor chain");
+        
+        if (backgroundProcessor.beginBlock(processingBuffer, numSamples))
+            processorChain.process(processingBuffer, context.hostTimeNs != nullptr ? *context.hostTimeNs : 0);
+        
+        backgroundProcessor.endBlock(processingBuffer, numSamples);
+    }
+    
+    captureTap.pushPostChain(processingBuffer, numSamples);
+    
+    // Hold the main output back to line up with the zones
+    if (auto delaySamples = mainDelaySamples.load(std::memory_order_relaxed); delaySamples > 0)
+    {
+        TRACE_SCOPE("Zone alignment");
+        
+        for (int channel = 0; channel < numProcessingChannels; ++channel)
         {
-            // Clear channel if no input
-            processingBuffer.clear(channel, 0, numSamples);
+            auto* data = processingBuffer.getWritePointer(channel);
+            
+            for (int sample = 0; sample < numSamples; ++sample)
+            {
+                mainDelay.pushSample(channel, data[sample]);
+                data[sample] = mainDelay.popSample(channel, (float) delaySamples);
+            }
         }
     }
     
-    // Apply processing chain
-    processorChain.process(processingBuffer);
-    
     // Copy processed audio to output
-    for (int channel = 0; channel < numOutputChannels; ++channel)
+    Tracing::begin("Output routing");
+    
+    if (numRoutedChannels > 0)
     {
-        if (outputChannelData[channel] != nullptr)
+        channelRouter.mixOutputs(kernels, processingBuffer, outputChannelData, numOutputChannels, numSamples);
+    }
+    else
+    {
+        for (int channel = 0; channel < numOutputChannels; ++channel)
         {
-            juce::FloatVectorOperations::copy(outputChannelData[channel],
-                                              processingBuffer.getReadPointer(channel),
-                                              numSamples);
+            if (outputChannelData[channel] != nullptr)
+            {
+                kernels.copy(outputChannelData[channel], processingBuffer.getReadPointer(channel), numSamples);
+            }
         }
     }
     
+    Tracing::end("Output routing");
+    
+    // A measurement replaces the programme with its sweep
+    measurementEngine.process(inputChannelData, numInputChannels, outputChannelData, numOutputChannels, numSamples);
+    
     // Update level meters
-    updateLevels(inputChannelData, outputChannelData, 
-                numInputChannels, numOutputChannels, numSamples);
+    if (++blocksSinceMeter >= meterInterval.load(std::memory_order_relaxed))
+    {
+        TRACE_SCOPE("Metering");
+        blocksSinceMeter = 0;
+        updateLevels(kernels, inputChannelData, outputChannelData,
+                     numInputChannels, numOutputChannels, numSamples);
+    }
+    
+    auto callbackSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - callbackStart);
+    auto sampleRate = currentSampleRate.load(std::memory_order_relaxed);
+    auto blockSeconds = sampleRate > 0.0 ? numSamples / sampleRate : 0.0;
+    qualityGovernor.addCallback(callbackSeconds, blockSeconds);
+    
+    if (context.hostTimeNs != nullptr && sampleRate > 0.0)
+        measureDeviceClock(*context.hostTimeNs, numSamples, sampleRate);
+    
+    if (blockSeconds > 0.0)
+    {
+        auto load = callbackSeconds / blockSeconds;
+        health.callbackLoads.add(load);
+        
+        if (load > 1.0)
+            health.numOverruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    countXRuns();
+}
+
+void AudioServer::measureDeviceClock(juce::uint64 hostTimeNs, int numSamples, double sampleRate) noexcept
+{
+    if (clockStartNs == 0 || hostTimeNs <= clockStartNs)
+    {
+        clockStartNs = hostTimeNs;
+        clockSamples = 0;
+    }
+    else if (auto hostSeconds = (double) (hostTimeNs - clockStartNs) * 1.0e-9; hostSeconds >= 2.0)
+    {
+        // Over two seconds or more, callback jitter hardly counts
+        auto ppm = ((double) clockSamples / sampleRate / hostSeconds - 1.0) * 1.0e6;
+        deviceClockPpm.store((float) ppm, std::memory_order_relaxed);
+    }
+    
+    clockSamples += numSamples;
+}
+
+void AudioServer::countXRuns() noexcept
+{
+    if (health.xRunDevice == nullptr)
+        return;
+    
+    // A device that restarts without reopening can carry on from its count
+    auto count = juce::jmax(0, health.xRunDevice->getXRunCount());
+    
+    if (count > health.lastXRunCount)
+        health.numXRuns.fetch_add(count - health.lastXRunCount, std::memory_order_relaxed);
+    
+    health.lastXRunCount = count;
 }
 
 void AudioServer::audioDeviceAboutToStart(juce::AudioIODevice* device)
@@ -201,59 +905,164 @@ void AudioServer::audioDeviceAboutToStart(juce::AudioIODevice* device)
     if (device == nullptr)
         return;
     
-    currentSampleRate = device->getCurrentSampleRate();
-    currentBufferSize = device->getCurrentBufferSizeSamples();
-    currentNumInputChannels = device->getActiveInputChannels().countNumberOfSetBits();
-    currentNumOutputChannels = device->getActiveOutputChannels().countNumberOfSetBits();
+    TRACE_SCOPE("Device starting");
+    
+    health.numDeviceStarts.fetch_add(1);
+    
+    if (device->getName() != health.lastDeviceName)
+    {
+        // The first device isn't a change
+        if (health.lastDeviceName.isNotEmpty())
+            health.numDeviceChanges.fetch_add(1);
+        
+        health.lastDeviceName = device->getName();
+    }
+    
+    auto numInputs = device->getActiveInputChannels().countNumberOfSetBits();
+    auto numOutputs = device->getActiveOutputChannels().countNumberOfSetBits();
+    auto numProcessingChannels = getNumProcessingChannelsFor(numInputs, numOutputs);
+    auto sampleRate = device->getCurrentSampleRate();
+    auto bufferSize = device->getCurrentBufferSizeSamples();
+    
+    // A capture file can't change format midway, so end it
+    if (captureTap.isRecording() && (sampleRate != currentSampleRate.load()
+        || numProcessingChannels != currentNumProcessingChannels))
+    {
+        DBG("Device format changed, stopping capture");
+        captureTap.stop();
+    }
+    
+    // Nor can a sweep carry on across a restart
+    if (measurementEngine.isPlaying())
+        measurementEngine.cancel("The audio device restarted during the measurement");
+    
+    currentSampleRate = sampleRate;
+    currentBufferSize = bufferSize;
+    currentOutputLatency = device->getOutputLatencyInSamples();
+    currentNumInputChannels = numInputs;
+    currentNumOutputChannels = numOutputs;
+    currentNumProcessingChannels = numProcessingChannels;
+    
+    clockStartNs = 0;
+    clockSamples = 0;
+    deviceClockPpm = 0.0f;
+    
+    // Counted from here on, since devices count from when they open
+    health.xRunDevice = device;
+    health.lastXRunCount = juce::jmax(0, device->getXRunCount());
     
-    DBG("Audio device starting: " + juce::String(currentSampleRate) + " Hz, " +
-        juce::String(currentBufferSize) + " samples, " +
+    auto* synthetic = dynamic_cast<SyntheticAudioDevice*>(device);
+    promoteAudioThread = synthetic == nullptr || !synthetic->isAccelerated();
+    
+    DBG("Audio device starting: " + juce::String(sampleRate) + " Hz, " +
+        juce::String(bufferSize) + " samples, " +
         juce::String(currentNumInputChannels) + " in, " +
         juce::String(currentNumOutputChannels) + " out");
     
-    // Prepare the processor chain
-    processorChain.prepare(currentSampleRate, currentBufferSize, 
-                          juce::jmax(currentNumInputChannels, currentNumOutputChannels));
+    // Prepare the processor chain, for the worker's blocks too so modes can
+    // switch without preparing it again
+    backgroundProcessor.release();
+    processorChain.prepare(sampleRate, juce::jmax(bufferSize, highLatencyBlockSize),
+                           currentNumProcessingChannels);
+    backgroundProcessor.prepare(sampleRate, bufferSize, currentNumProcessingChannels,
+                                highLatencyBlockSize);
+    channelRouter.prepare(bufferSize);
+    
+    // Allocate processing buffer, big enough for routed or direct processing
+    processingBuffer.setSize(juce::jmax(currentNumOutputChannels, currentNumProcessingChannels), bufferSize);
     
-    // Allocate processing buffer
-    processingBuffer.setSize(currentNumOutputChannels, currentBufferSize);
+    realtimeConfig.prepareMemory();
+    
+    // Up to a second of delay for lining up with the zones
+    auto numDelayChannels = juce::jmax(currentNumOutputChannels, currentNumProcessingChannels);
+    mainDelay.setMaximumDelayInSamples((int) sampleRate);
+    mainDelay.prepare({ sampleRate, (juce::uint32) bufferSize, (juce::uint32) numDelayChannels });
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(zoneLock);
+        
+        for (auto* zone : outputZones)
+            zone->setSource(sampleRate);
+    }
+    
+    // Zones are realigned on the device thread, where they are changed
+    updateZoneAlignment();
 }
 
 void AudioServer::audioDeviceStopped()
 {
+    TRACE_SCOPE("Device stopped");
+    
+    // The last of them, before the device can go away
+    countXRuns();
+    health.xRunDevice = nullptr;
+    
     DBG("Audio device stopped");
-    processorChain.reset();
+    backgroundProcessor.release();
+    processorChain.release();
+}
+
+void AudioServer::audioDeviceError(const juce::String& errorMessage)
+{
+    DBG("Audio device error: " + errorMessage);
+    health.numDeviceErrors.fetch_add(1);
 }
 
 //==============================================================================
-void AudioServer::updateLevels(const float* const* inputData,
+void AudioServer::updateLevels(const DSPKernels& kernels,
+                               const float* const* inputData,
                                const float* const* outputData,
                                int numInputs, int numOutputs, int numSamples)
 {
+    // Raise the held peak unless the meter has taken a higher one since; the
+    // meter only ever resets it, so this rarely loops
+    auto holdPeak = [] (std::atomic<float>& peak, float level)
+    {
+        auto held = peak.load(std::memory_order_relaxed);
+        
+        while (level > held && !peak.compare_exchange_weak(held, level, std::memory_order_relaxed))
+        {
+        }
+    };
+    
+    numInputs = juce::jmin(numInputs, maxMeterChannels);
+    numOutputs = juce::jmin(numOutputs, maxMeterChannels);
+    
     // Update input levels
-    for (int ch = 0; ch < juce::jmin(numInputs, 2); ++ch)
+    for (int ch = 0; ch < numInputs; ++ch)
     {
         if (inputData[ch] != nullptr)
         {
-            auto level = juce::FloatVectorOperations::findMaximum(inputData[ch], numSamples);
+            auto level = kernels.findAbsolutePeak(inputData[ch], numSamples);
             inputLevels[ch].store(level, std::memory_order_relaxed);
+            holdPeak(inputPeaks[ch], level);
         }
     }
     
     // Update output levels
-    for (int ch = 0; ch < juce::jmin(numOutputs, 2); ++ch)
+    bool clipped = false;
+    
+    for (int ch = 0; ch < numOutputs; ++ch)
     {
         if (outputData[ch] != nullptr)
         {
-            auto level = juce::FloatVectorOperations::findMaximum(outputData[ch], numSamples);
+            auto level = kernels.findAbsolutePeak(outputData[ch], numSamples);
             outputLevels[ch].store(level, std::memory_order_relaxed);
+            holdPeak(outputPeaks[ch], level);
+            clipped = clipped || level >= 1.0f;
         }
     }
+    
+    if (clipped)
+        health.numClippedBlocks.fetch_add(1, std::memory_order_relaxed);
+    
+    numMeteredInputs.store(numInputs, std::memory_order_relaxed);
+    numMeteredOutputs.store(numOutputs, std::memory_order_relaxed);
 }
 
 float AudioServer::getInputLevel(int channel) const
 {
-    if (channel >= 0 && channel < 2)
+    if (channel >= 0 && channel < maxMeterChannels)
         return inputLevels[channel].load(std::memory_order_relaxed);
     
     return 0.0f;
@@ -261,35 +1070,508 @@ float AudioServer::getInputLevel(int channel) const
 
 float AudioServer::getOutputLevel(int channel) const
 {
-    if (channel >= 0 && channel < 2)
+    if (channel >= 0 && channel < maxMeterChannels)
         return outputLevels[channel].load(std::memory_order_relaxed);
     
     return 0.0f;
 }
 
+void AudioServer::takeMeterSnapshot(MeterSnapshot& snapshot)
+{
+    snapshot.numInputs = numMeteredInputs.load(std::memory_order_relaxed);
+    snapshot.numOutputs = numMeteredOutputs.load(std::memory_order_relaxed);
+    
+    for (int ch = 0; ch < maxMeterChannels; ++ch)
+    {
+        snapshot.inputPeaks[(size_t) ch] = inputPeaks[ch].exchange(0.0f, std::memory_order_relaxed);
+        snapshot.outputPeaks[(size_t) ch] = outputPeaks[ch].exchange(0.0f, std::memory_order_relaxed);
+    }
+}
+
 //==============================================================================
 // ProcessorChain implementation
 //==============================================================================
+AudioServer::ProcessorChain::ProcessorChain()
+{
+    groups.add(new Group());
+}
+
 void AudioServer::ProcessorChain::prepare(double sampleRate, int samplesPerBlock, int numChannels)
 {
     currentSampleRate = sampleRate;
     currentBlockSize = samplesPerBlock;
     currentNumChannels = numChannels;
+    kernels = &DSPKernels::getForChannels(numChannels);
+    
+    // Each group binds kernels as wide as its own channel count
+    for (auto* group : groups)
+    {
+        auto groupChannels = group->channels.isEmpty() ? numChannels : group->channels.size();
+        group->filterBank.prepare(groupChannels, samplesPerBlock, DSPKernels::getForChannels(groupChannels));
+        group->svfBank.prepare(groupChannels, samplesPerBlock, sampleRate, DSPKernels::getForChannels(groupChannels));
+    }
+    
+    loudnessStage.prepare(sampleRate, samplesPerBlock, numChannels, *kernels);
+    pluginStage.prepare(sampleRate, samplesPerBlock, numChannels);
+    compressorStage.prepare(sampleRate, samplesPerBlock, numChannels, *kernels);
+    crossoverStage.prepare(sampleRate, samplesPerBlock, numChannels, *kernels);
     
-    // Future: Initialize EQ bands here
+    // Coefficients depend on the sample rate, so recompile the plans
+    for (int index = 0; index < groups.size(); ++index)
+        publishPlan(*groups[index], getBands(index));
 }
 
-void AudioServer::ProcessorChain::process(juce::AudioBuffer<float>& buffer)
+void AudioServer::ProcessorChain::process(juce::AudioBuffer<float>& buffer, juce::uint64 blockHostTimeNs)
 {
+    updatePlans();
+    requestPlans();
+    collectEvents();
+    
+    auto numSamples = buffer.getNumSamples();
+    
+    if (numScheduled > 0 && blockHostTimeNs == 0)
+        blockHostTimeNs = ParameterEvent::getCurrentHostTimeNs();
+    
     if (bypassed)
+    {
+        // Keep the bands in step, though nothing is heard of them
+        while (numScheduled > 0)
+        {
+            auto sample = getEventSample(scheduled[0], blockHostTimeNs, numSamples);
+            
+            if (sample >= numSamples)
+                break;
+            
+            applyEventsAt(sample, blockHostTimeNs, numSamples);
+        }
+        
         return;
+    }
+    
+    {
+        TRACE_SCOPE("Loudness");
+        loudnessStage.process(buffer);
+    }
+    
+    // Split the EQ at every event due in this block
+    int start = 0;
     
-    // Future: Apply EQ processing here
-    // For now, audio passes through unchanged
+    while (numScheduled > 0)
+    {
+        auto sample = getEventSample(scheduled[0], blockHostTimeNs, numSamples);
+        
+        if (sample >= numSamples)
+            break;
+        
+        processGroups(buffer, start, sample - start);
+        applyEventsAt(sample, blockHostTimeNs, numSamples);
+        start = sample;
+    }
+    
+    processGroups(buffer, start, numSamples - start);
+    
+    {
+        TRACE_SCOPE("Plugins");
+        pluginStage.process(buffer);
+    }
+    
+    {
+        TRACE_SCOPE("Compressor");
+        compressorStage.process(buffer);
+    }
+    
+    TRACE_SCOPE("Crossover");
+    crossoverStage.process(buffer);
 }
 
 void AudioServer::ProcessorChain::reset()
 {
-    // Future: Reset EQ state here
+    loudnessStage.reset();
+    compressorStage.reset();
+    crossoverStage.reset();
+    
+    for (auto* group : groups)
+    {
+        group->filterBank.reset();
+        group->svfBank.reset();
+    }
+}
+
+void AudioServer::ProcessorChain::release()
+{
+    reset();
+    pluginStage.release();
 }
 
+//==============================================================================
+bool AudioServer::ProcessorChain::setChannelGroups(const juce::Array<juce::Array<int>>& channelGroups,
+                                                   juce::String& errorMessage)
+{
+    if (channelGroups.size() > maxGroups)
+    {
+        errorMessage = "At most " + juce::String(maxGroups) + " channel groups are supported";
+        return false;
+    }
+    
+    juce::BigInteger used;
+    
+    for (const auto& channels : channelGroups)
+    {
+        for (auto channel : channels)
+        {
+            if (!juce::isPositiveAndBelow(channel, ChannelRouter::maxChannels) || used[channel])
+            {
+                errorMessage = "Channel " + juce::String(channel + 1) + " is out of range or in more than one group";
+                return false;
+            }
+            
+            used.setBit(channel);
+        }
+        
+        if (channels.isEmpty() && channelGroups.size() > 1)
+        {
+            errorMessage = "Only a single group can cover every channel";
+            return false;
+        }
+    }
+    
+    // Groups keep the bands of the group they replace
+    juce::OwnedArray<Group> newGroups;
+    
+    for (int index = 0; index < juce::jmax(1, channelGroups.size()); ++index)
+    {
+        auto* group = newGroups.add(new Group());
+        
+        if (index < channelGroups.size())
+            group->channels = channelGroups.getReference(index);
+        
+        if (index < groups.size())
+            group->bands = groups[index]->bands;
+    }
+    
+    const juce::SpinLock::ScopedLockType lock(bandLock);
+    groups.swapWith(newGroups);
+    return true;
+}
+
+juce::Array<juce::Array<int>> AudioServer::ProcessorChain::getChannelGroups() const
+{
+    juce::Array<juce::Array<int>> channelGroups;
+    
+    for (auto* group : groups)
+        channelGroups.add(group->channels);
+    
+    return channelGroups;
+}
+
+//==============================================================================
+void AudioServer::ProcessorChain::setBands(const juce::Array<EQBand>& newBands)
+{
+    for (auto* group : groups)
+        publishPlan(*group, newBands);
+}
+
+void AudioServer::ProcessorChain::setGroupBands(int group, const juce::Array<EQBand>& newBands)
+{
+    if (auto* target = groups[group])
+        publishPlan(*target, newBands);
+}
+
+void AudioServer::ProcessorChain::setDoubleStateRatio(double newRatio)
+{
+    if (doubleStateRatio.exchange(newRatio) == newRatio)
+        return;
+    
+    // Filter state follows each band across the change of precision, so
+    // this doesn't click
+    for (int index = 0; index < groups.size(); ++index)
+        publishPlan(*groups[index], getBands(index));
+}
+
+juce::Array<EQBand> AudioServer::ProcessorChain::getBands(int group) const
+{
+    const juce::SpinLock::ScopedLockType lock(bandLock);
+    
+    if (auto* source = groups[group])
+        return source->bands;
+    
+    return {};
+}
+
+EQPlan AudioServer::ProcessorChain::getPlan(int group) const
+{
+    const juce::SpinLock::ScopedLockType lock(bandLock);
+    
+    if (auto* source = groups[group])
+        return source->pendingPlan;
+    
+    return {};
+}
+
+void AudioServer::ProcessorChain::publishPlan(Group& group, const juce::Array<EQBand>& newBands)
+{
+    // Compile outside the lock; the audio thread only ever copies the result
+    auto plan = EQPlan::compile(newBands.begin(), newBands.size(), currentSampleRate.load(), true,
+                                doubleStateRatio.load());
+    
+    DBG("EQ plan: " + plan.getSummary());
+    
+    auto numBands = juce::jmin(maxLiveBands, newBands.size());
+    
+    const juce::SpinLock::ScopedLockType lock(bandLock);
+    group.bands = newBands;
+    group.pendingPlan = plan;
+    std::copy(newBands.begin(), newBands.begin() + numBands, group.pendingBands.begin());
+    group.numPendingBands = numBands;
+    group.planChanged = true;
+    
+    // Whatever the audio thread asked for is replaced along with its bands
+    ++group.planRequest;
+    group.compileRequested = false;
+}
+
+void AudioServer::ProcessorChain::updatePlans()
+{
+    // Called on the audio thread: never wait for the message thread, just pick
+    // up new plans on a later block if the lock is busy
+    const juce::SpinLock::ScopedTryLockType lock(bandLock);
+    
+    if (!lock.isLocked())
+        return;
+    
+    for (auto* group : groups)
+    {
+        if (group->planChanged)
+        {
+            group->filterBank.setPlan(group->pendingPlan);
+            group->liveBands = group->pendingBands;
+            group->numLiveBands = group->numPendingBands;
+            group->svfBank.setBands(group->liveBands.data(), group->numLiveBands);
+            group->planChanged = false;
+            group->liveBandsChanged = false;
+            group->awaitingPlan = false;
+            group->installedRequest = group->planRequest;
+        }
+        else if (group->awaitingPlan && group->compiledRequest > group->installedRequest)
+        {
+            // Installed even if events have moved the bands on since, so a
+            // steady stream of them can't hold the plan back for good
+            group->filterBank.setPlan(group->compiledPlan);
+            group->installedRequest = group->compiledRequest;
+            group->awaitingPlan = group->compiledRequest != group->planRequest;
+        }
+    }
+}
+
+void AudioServer::ProcessorChain::requestPlans()
+{
+    bool anyChanged = false;
+    
+    for (auto* group : groups)
+        anyChanged = anyChanged || group->liveBandsChanged;
+    
+    if (!anyChanged)
+        return;
+    
+    {
+        // As in updatePlans(), a busy lock only means asking on a later block
+        const juce::SpinLock::ScopedTryLockType lock(bandLock);
+        
+        if (!lock.isLocked())
+            return;
+        
+        for (auto* group : groups)
+        {
+            if (!group->liveBandsChanged)
+                continue;
+            
+            group->requestedBands = group->liveBands;
+            group->numRequestedBands = group->numLiveBands;
+            group->compileRequested = true;
+            ++group->planRequest;
+            group->liveBandsChanged = false;
+            group->awaitingPlan = true;
+        }
+    }
+    
+    triggerAsyncUpdate();
+}
+
+void AudioServer::ProcessorChain::handleAsyncUpdate()
+{
+    for (auto* group : groups)
+    {
+        std::array<EQBand, maxLiveBands> bands;
+        int numBands, request;
+        
+        {
+            const juce::SpinLock::ScopedLockType lock(bandLock);
+            
+            if (!group->compileRequested)
+                continue;
+            
+            bands = group->requestedBands;
+            numBands = group->numRequestedBands;
+            request = group->planRequest;
+            group->compileRequested = false;
+        }
+        
+        // Compile outside the lock, as in publishPlan()
+        auto plan = EQPlan::compile(bands.data(), numBands, currentSampleRate.load(), true, doubleStateRatio.load());
+        
+        const juce::SpinLock::ScopedLockType lock(bandLock);
+        
+        if (request > group->compiledRequest)
+        {
+            group->compiledPlan = plan;
+            group->compiledRequest = request;
+        }
+    }
+}
+
+//==============================================================================
+bool AudioServer::ProcessorChain::scheduleBandChange(const ParameterEvent& event)
+{
+    if (eventQueue.push(event))
+        return true;
+    
+    numDroppedEvents.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void AudioServer::ProcessorChain::collectEvents()
+{
+    // With nothing queued this is a single load
+    ParameterEvent event;
+    
+    while (eventQueue.pop(event))
+    {
+        if (numScheduled == maxScheduledEvents)
+        {
+            numDroppedEvents.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        
+        // After any event for the same time, so those apply in the order sent
+        auto index = numScheduled++;
+        
+        for (; index > 0 && scheduled[(size_t) index - 1].hostTimeNs > event.hostTimeNs; --index)
+            scheduled[(size_t) index] = scheduled[(size_t) index - 1];
+        
+        scheduled[(size_t) index] = event;
+    }
+}
+
+int AudioServer::ProcessorChain::getEventSample(const ParameterEvent& event, juce::uint64 blockHostTimeNs,
+                                                int numSamples) const
+{
+    if (event.hostTimeNs <= blockHostTimeNs)
+        return 0;
+    
+    auto sample = (double) (event.hostTimeNs - blockHostTimeNs) * 1.0e-9
+                * currentSampleRate.load(std::memory_order_relaxed);
+    return sample < (double) numSamples ? (int) sample : numSamples;
+}
+
+void AudioServer::ProcessorChain::applyEventsAt(int sample, juce::uint64 blockHostTimeNs, int numSamples)
+{
+    auto sampleRate = currentSampleRate.load(std::memory_order_relaxed);
+    int numApplied = 0;
+    
+    for (; numApplied < numScheduled; ++numApplied)
+    {
+        const auto& event = scheduled[(size_t) numApplied];
+        
+        if (getEventSample(event, blockHostTimeNs, numSamples) != sample)
+            break;
+        
+        auto* group = groups[event.group];
+        
+        if (group == nullptr || !juce::isPositiveAndBelow(event.band, group->numLiveBands))
+            continue;
+        
+        auto& band = group->liveBands[(size_t) event.band];
+        auto previous = band;
+        
+        switch (event.parameter)
+        {
+            case ParameterEvent::Parameter::Gain:       band.gainDb = event.value; break;
+            case ParameterEvent::Parameter::Frequency:  band.frequency = event.value; break;
+            case ParameterEvent::Parameter::Q:          band.q = event.value; break;
+            case ParameterEvent::Parameter::Enabled:    band.enabled = event.value >= 0.5f; break;
+        }
+        
+        if (band.filter == EQBand::Filter::Svf)
+        {
+            group->liveSvfBandsChanged = true;
+            continue;
+        }
+        
+        // The installed plan is behind the bands until the message thread
+        // catches up, so there is nothing to patch until then
+        if (group->liveBandsChanged || group->awaitingPlan)
+        {
+            group->liveBandsChanged = true;
+            continue;
+        }
+        
+        // Most changes only move a band within its own section, so only that
+        // section is designed again; anything else has the plan recompiled on
+        // the message thread
+        TRACE_SCOPE("EQ event");
+        auto section = group->filterBank.getPlan().findPatchableSection(group->liveBands.data(), group->numLiveBands,
+                                                                        event.band, previous, sampleRate, true,
+                                                                        doubleStateRatio.load(std::memory_order_relaxed));
+        
+        if (section >= 0)
+            group->filterBank.setSectionCoefficients(section, BiquadCoefficients::design(band, sampleRate));
+        else
+            group->liveBandsChanged = true;
+    }
+    
+    std::copy(scheduled.begin() + numApplied, scheduled.begin() + numScheduled, scheduled.begin());
+    numScheduled -= numApplied;
+    
+    // At most one recompile per group however many of its bands changed.
+    // Filter state follows each band into the new plan, so installing it
+    // doesn't click more than the change itself.
+    requestPlans();
+    
+    for (auto* group : groups)
+    {
+        if (group->liveSvfBandsChanged)
+        {
+            group->svfBank.setBands(group->liveBands.data(), group->numLiveBands);
+            group->liveSvfBandsChanged = false;
+        }
+    }
+}
+
+void AudioServer::ProcessorChain::processGroups(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+    
+    for (auto* group : groups)
+    {
+        TRACE_SCOPE("EQ group");
+        
+        float* channelData[ChannelRouter::maxChannels];
+        int numChannels = 0;
+        
+        if (group->channels.isEmpty())
+        {
+            for (int channel = 0; channel < juce::jmin(buffer.getNumChannels(), ChannelRouter::maxChannels); ++channel)
+                channelData[numChannels++] = buffer.getWritePointer(channel, startSample);
+        }
+        else
+        {
+            for (auto channel : group->channels)
+                if (channel < buffer.getNumChannels())
+                    channelData[numChannels++] = buffer.getWritePointer(channel, startSample);
+        }
+        
+        group->filterBank.process(channelData, numChannels, numSamples);
+        group->svfBank.process(channelData, numChannels, numSamples);
+    }
+}
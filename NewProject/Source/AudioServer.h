@@ -1,13 +1,30 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "EQFilterBank.h"
+#include "SVFBank.h"
+#include "ChannelRouter.h"
+#include "CaptureTap.h"
+#include "PluginStage.h"
+#include "CrossoverStage.h"
+#include "CompressorStage.h"
+#include "LoudnessStage.h"
+#include "SyntheticAudioDevice.h"
+#include "RealtimeConfig.h"
+#include "ParameterEventQueue.h"
+#include "Reclaimer.h"
+#include "MeasurementEngine.h"
+#include "QualityGovernor.h"
+#include "BackgroundProcessor.h"
+#include "MetricsExporter.h"
 
 //==============================================================================
 /**
  * AudioServer manages the virtual audio device and routes system audio
  * through the EQ processing chain before outputting to the real hardware.
  */
-class AudioServer : public juce::AudioIODeviceCallback
+class AudioServer : public juce::AudioIODeviceCallback,
+                    private juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -15,7 +32,20 @@ public:
     ~AudioServer() override;
     
     //==============================================================================
-    // Setup and configuration
+    // The thread that owns the device manager: the message thread, unless a
+    // DeviceController takes it over. Everything below that opens, closes or
+    // restarts devices must run there, and so does JUCE's handling of device
+    // list changes, which would otherwise run on the message thread. post
+    // queues a function on that thread; a key it already has queued replaces
+    // the waiting one.
+    using DeviceThreadPost = std::function<void(const juce::String& key, std::function<void()>)>;
+    
+    void setDeviceThread(juce::Thread::ThreadID threadId, DeviceThreadPost post);
+    void resetDeviceThread();
+    bool isDeviceThread() const;
+    
+    //==============================================================================
+    // Setup and configuration (device thread)
     bool initialize();
     void shutdown();
     
@@ -25,7 +55,7 @@ public:
     bool isRunning() const { return running; }
     
     //==============================================================================
-    // Device management
+    // Device management (device thread)
     juce::StringArray getAvailableInputDevices() const;
     juce::StringArray getAvailableOutputDevices() const;
     
@@ -35,6 +65,39 @@ public:
     juce::String getCurrentInputDevice() const;
     juce::String getCurrentOutputDevice() const;
     
+    //==============================================================================
+    // Testing without hardware: opens a SyntheticAudioDevice in place of the
+    // current device (device thread). Call again to change its settings.
+    bool initializeSynthetic(const SyntheticAudioDevice::Settings& settings, juce::String& errorMessage);
+    
+    // The open synthetic device for injecting faults, or nullptr
+    SyntheticAudioDevice* getSyntheticDevice();
+    SyntheticAudioDeviceType* getSyntheticDeviceType() { return syntheticDeviceType; }
+    
+    //==============================================================================
+    // Real-time scheduling, CPU affinity and memory locking for the audio and
+    // worker threads (message thread, Linux only). The audio thread picks
+    // changes up on its next block.
+    void setRealtimeSettings(const RealtimeConfig::Settings& settings) { realtimeConfig.setSettings(settings); }
+    RealtimeConfig::Settings getRealtimeSettings() const { return realtimeConfig.getSettings(); }
+    RealtimeConfig::Report getRealtimeReport() const { return realtimeConfig.getReport(); }
+    
+    //==============================================================================
+    // Objects the audio thread has retired and those deleted since, e.g. to
+    // check that swapping plugin layouts gives its memory back. See Reclaimer.h.
+    Reclaimer::Stats getReclaimerStats() const { return Reclaimer::getStats(); }
+    
+    //==============================================================================
+    // Channel routing around the processing chain (device thread). A change
+    // in the number of processing channels or in the EQ channel groups
+    // briefly restarts processing so the chain can be prepared for it.
+    bool setRouting(const ChannelRouter::Routing& routing, juce::String& errorMessage);
+    void clearRouting();
+    
+    bool setChannelGroups(const juce::Array<juce::Array<int>>& channelGroups, juce::String& errorMessage);
+    
+    const ChannelRouter& getChannelRouter() const { return channelRouter; }
+    
     //==============================================================================
     // Audio callback from AudioIODevice
     void audioDeviceIOCallbackWithContext(const float* const* inputChannelData,
@@ -46,27 +109,160 @@ public:
     
     void audioDeviceAboutToStart(juce::AudioIODevice* device) override;
     void audioDeviceStopped() override;
+    void audioDeviceError(const juce::String& errorMessage) override;
     
     //==============================================================================
     // Audio processing chain access
-    class ProcessorChain
+    class ProcessorChain : private juce::AsyncUpdater
     {
     public:
-        ProcessorChain() = default;
+        ProcessorChain();
         
         void prepare(double sampleRate, int samplesPerBlock, int numChannels);
-        void process(juce::AudioBuffer<float>& buffer);
         void reset();
         
-        // EQ will be added here
+        // Once the device has stopped: frees what prepare() set up that is
+        // worth giving back, i.e. the hosted plugins' resources
+        void release();
+        
+        // blockHostTimeNs is the device's timestamp for the block, for placing
+        // scheduled events; 0 to use the time now
+        void process(juce::AudioBuffer<float>& buffer, juce::uint64 blockHostTimeNs = 0);
+        
+        // Kernel table bound in prepare() for this CPU
+        const DSPKernels& getKernels() const { return *kernels; }
+        
         bool isBypassed() const { return bypassed; }
         void setBypassed(bool shouldBeBypassed) { bypassed = shouldBeBypassed; }
         
+        //==========================================================================
+        // Channel groups. Each group runs its own band list over its channels,
+        // so channels can be equalised independently or linked; an empty
+        // channel list means every channel. By default one group links them
+        // all. Only call this while the chain isn't processing.
+        static constexpr int maxGroups = 16;
+        
+        bool setChannelGroups(const juce::Array<juce::Array<int>>& channelGroups, juce::String& errorMessage);
+        juce::Array<juce::Array<int>> getChannelGroups() const;
+        int getNumGroups() const { return groups.size(); }
+        
+        //==========================================================================
+        // EQ bands (message thread). The band list is compiled into an EQPlan
+        // here, so the audio thread only runs what survives; sections beyond
+        // maxBands are ignored. setBands() sets every group.
+        static constexpr int maxBands = EQFilterBank<float>::maxBands;
+        
+        void setBands(const juce::Array<EQBand>& newBands);
+        void setGroupBands(int group, const juce::Array<EQBand>& newBands);
+        juce::Array<EQBand> getBands(int group = 0) const;
+        EQPlan getPlan(int group = 0) const;
+        
+        // Bands below this frequency/sample-rate ratio keep double-precision
+        // state; see EQPlan::compile(). Setting it recompiles every group.
+        void setDoubleStateRatio(double newRatio);
+        double getDoubleStateRatio() const { return doubleStateRatio.load(); }
+        
+        //==========================================================================
+        // Sample-accurate band changes, from any thread. Each lands on the
+        // sample that plays at its hostTimeNs, or at the start of the next block
+        // if that has passed; the EQ is split at each one. Changes made this
+        // way aren't reflected in getBands(), and the next setBands() replaces
+        // them. Returns false if the queue is full.
+        static constexpr int maxScheduledEvents = 256;
+        
+        bool scheduleBandChange(const ParameterEvent& event);
+        int getNumDroppedEvents() const { return numDroppedEvents.load(); }
+        
+        //==========================================================================
+        // Loudness normalisation, run before the EQ bands so the EQ sees a
+        // steady level whatever the source
+        LoudnessStage& getLoudnessStage() { return loudnessStage; }
+        
+        // Hosted plugins, run after the EQ bands
+        PluginStage& getPluginStage() { return pluginStage; }
+        const PluginStage& getPluginStage() const { return pluginStage; }
+        
+        // Multiband compression, run after the plugins so it sees the final
+        // tonal balance
+        CompressorStage& getCompressorStage() { return compressorStage; }
+        
+        // Crossover and bass management, run last since it spreads each input
+        // over several processing channels
+        CrossoverStage& getCrossoverStage() { return crossoverStage; }
+        
     private:
-        double currentSampleRate = 44100.0;
+        // As many bands as a plan considers
+        static constexpr int maxLiveBands = 4 * EQPlan::maxSections;
+        
+        struct Group
+        {
+            juce::Array<int> channels;
+            
+            // Band settings and their compiled plan, shared with the audio
+            // thread and guarded by bandLock
+            juce::Array<EQBand> bands;
+            EQPlan pendingPlan;
+            std::array<EQBand, maxLiveBands> pendingBands;
+            int numPendingBands = 0;
+            bool planChanged = false;
+            
+            // Live bands the audio thread couldn't patch into its plan, for
+            // the message thread to compile, and the latest result; also
+            // guarded by bandLock. Every request and every publishPlan()
+            // takes a new number, so a plan compiled for bands that have
+            // since been replaced is never installed.
+            std::array<EQBand, maxLiveBands> requestedBands;
+            int numRequestedBands = 0;
+            int planRequest = 0;
+            bool compileRequested = false;
+            EQPlan compiledPlan;
+            int compiledRequest = 0;
+            
+            // Audio thread: runs the installed plan and the SVF bands, and
+            // keeps the bands behind them for events to change
+            EQFilterBank<float> filterBank;
+            SVFBank svfBank;
+            std::array<EQBand, maxLiveBands> liveBands;
+            int numLiveBands = 0;
+            bool liveBandsChanged = false;      // The plan has to be compiled again
+            bool liveSvfBandsChanged = false;
+            bool awaitingPlan = false;          // Until the plan catches up, events can't be patched in
+            int installedRequest = 0;
+        };
+        
+        void publishPlan(Group& group, const juce::Array<EQBand>& newBands);
+        void updatePlans();
+        void requestPlans();
+        void handleAsyncUpdate() override;
+        
+        void collectEvents();
+        int getEventSample(const ParameterEvent& event, juce::uint64 blockHostTimeNs, int numSamples) const;
+        void applyEventsAt(int sample, juce::uint64 blockHostTimeNs, int numSamples);
+        void processGroups(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+        
+        // Written in prepare() and read by publishPlan() on the message thread
+        std::atomic<double> currentSampleRate { 44100.0 };
         int currentBlockSize = 512;
         int currentNumChannels = 2;
         bool bypassed = false;
+        std::atomic<double> doubleStateRatio { EQPlan::doublePrecisionRatio };
+        
+        const DSPKernels* kernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+        
+        juce::OwnedArray<Group> groups;
+        mutable juce::SpinLock bandLock;
+        
+        LoudnessStage loudnessStage;
+        PluginStage pluginStage;
+        CompressorStage compressorStage;
+        CrossoverStage crossoverStage;
+        
+        // Band changes from any thread, and those waiting for a later block,
+        // in time order (audio thread)
+        ParameterEventQueue eventQueue;
+        std::array<ParameterEvent, maxScheduledEvents> scheduled;
+        int numScheduled = 0;
+        std::atomic<int> numDroppedEvents { 0 };
         
         JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ProcessorChain)
     };
@@ -74,36 +270,277 @@ public:
     ProcessorChain& getProcessorChain() { return processorChain; }
     
     //==============================================================================
-    // Monitoring
+    // Output zones: further output devices, each fed the same capture through
+    // its own chain and buffered against its own clock (device thread). See
+    // OutputZone.h.
+    static constexpr int maxOutputZones = 8;
+    
+    struct ZoneSettings
+    {
+        juce::String name;
+        juce::String deviceType;            // Empty for the default type
+        juce::String outputDeviceName;
+        double sampleRate = 0.0;            // 0 for the device's default
+        int bufferSize = 0;
+        
+        // Processing channels sent to the zone's outputs, in order; empty for
+        // the first two
+        juce::Array<int> channels;
+        
+        float bufferMs = 20.0f;             // Slack between the two device clocks
+        float extraDelayMs = 0.0f;          // On top of alignment, e.g. for speaker distance
+    };
+    
+    struct ZoneStatus
+    {
+        juce::String name;
+        juce::String deviceName;
+        double sampleRate = 0.0;
+        bool running = false;
+        float bufferedMs = 0.0f;            // Smoothed fill of the zone's buffer
+        float driftPpm = 0.0f;              // Zone clock against the capture clock
+        float latencyMs = 0.0f;             // Capture to output, alignment included
+        float alignmentDelayMs = 0.0f;
+        int numUnderruns = 0;
+        int numOverruns = 0;
+    };
+    
+    class OutputZone;
+    
+    int addOutputZone(const ZoneSettings& settings, juce::String& errorMessage);
+    void removeOutputZone(int zone);
+    int getNumOutputZones() const;
+    
+    ProcessorChain* getZoneChain(int zone);
+    ZoneStatus getZoneStatus(int zone) const;
+    
+    // With alignment on, every zone and the main output are delayed to match
+    // the slowest path; otherwise only each zone's extraDelayMs applies. Call
+    // updateZoneAlignment() again if a chain's plugin latency changes; from
+    // any other thread than the device thread it is done there later.
+    void setZoneAlignment(bool shouldAlign, float mainExtraDelayMs = 0.0f);
+    void updateZoneAlignment();
+    
+    //==============================================================================
+    // Pre/post-chain recording, e.g. for support cases
+    bool startCapture(const CaptureTap::Settings& settings, juce::String& errorMessage);
+    void stopCapture();
+    
+    const CaptureTap& getCaptureTap() const { return captureTap; }
+    
+    //==============================================================================
+    // Acoustic measurement through the running device (message thread): plays
+    // sweeps on one output and records one input, muting the programme while
+    // it runs. onDone is called on the message thread. See MeasurementEngine.h.
+    bool startMeasurement(const MeasurementEngine::Settings& settings, MeasurementEngine::Callback onDone,
+                          juce::String& errorMessage);
+    void cancelMeasurement() { measurementEngine.cancel(); }
+    
+    bool isMeasuring() const { return measurementEngine.isMeasuring(); }
+    float getMeasurementProgress() const { return measurementEngine.getProgress(); }
+    
+    //==============================================================================
+    // High-latency mode (message thread): the chain runs on a worker thread in
+    // large blocks, for less CPU where latency doesn't matter, e.g. music
+    // listening. Switching modes fades across without restarting the device;
+    // changing the block size briefly restarts processing, so it belongs on
+    // the device thread. The status reports the added latency and the
+    // chain's load in each mode. See BackgroundProcessor.h.
+    void setProcessingMode(BackgroundProcessor::Mode mode);
+    BackgroundProcessor::Mode getProcessingMode() const { return backgroundProcessor.getMode(); }
+    
+    bool setHighLatencyBlockSize(int blockSize, juce::String& errorMessage);
+    BackgroundProcessor::Status getProcessingStatus() const { return backgroundProcessor.getStatus(); }
+    
+    //==============================================================================
+    // Adaptive quality (message thread). Under CPU pressure the governor
+    // meters less often, then runs loudness K-weighting in float, then keeps
+    // fewer EQ bands in double, on the main chain and every zone; it steps
+    // back up once the load has been low for a while. See QualityGovernor.h.
+    QualityGovernor& getQualityGovernor() { return qualityGovernor; }
+    
+    //==============================================================================
+    // Engine health for fleet monitoring (message thread): serves xruns,
+    // callback load percentiles, device changes, clipping and dropped capture
+    // blocks as Prometheus metrics on a local HTTP port. Scrapes only read
+    // atomics, never waiting on the audio thread. See MetricsExporter.h.
+    bool startMetricsExporter(const MetricsExporter::Settings& settings, juce::String& errorMessage);
+    void stopMetricsExporter() { metricsExporter.stop(); }
+    
+    const MetricsExporter& getMetricsExporter() const { return metricsExporter; }
+    
+    //==============================================================================
+    // Monitoring. Levels are the peak of the latest metered block, for the
+    // first maxMeterChannels channels each way.
+    static constexpr int maxMeterChannels = 8;
+    
     float getInputLevel(int channel) const;
     float getOutputLevel(int channel) const;
     
+    // Peaks since the previous snapshot, so a meter reading less often than
+    // blocks arrive still sees every one. Lock-free and allocation-free; take
+    // snapshots from one thread only, since taking one resets the peaks.
+    struct MeterSnapshot
+    {
+        int numInputs = 0;
+        int numOutputs = 0;
+        std::array<float, maxMeterChannels> inputPeaks {};
+        std::array<float, maxMeterChannels> outputPeaks {};
+    };
+    
+    void takeMeterSnapshot(MeterSnapshot& snapshot);
+    
     double getSampleRate() const { return currentSampleRate; }
     int getBufferSize() const { return currentBufferSize; }
     
+    // How far the device clock runs from the host clock, in parts per
+    // million, from the host times of its callbacks. 0 until two seconds have
+    // been measured since the device started, or if it gives no host times.
+    float getDeviceClockPpm() const { return deviceClockPpm.load(); }
+    
 private:
     //==============================================================================
-    juce::AudioDeviceManager deviceManager;
+    // First, so it outlives everything that retires objects to it
+    Reclaimer reclaimer;
+    
+    class DeviceTypeRelay;
+    
+    // Wraps the platform's device types in relays to the device thread
+    class DeviceManager : public juce::AudioDeviceManager
+    {
+    public:
+        explicit DeviceManager(AudioServer& ownerServer) : owner(ownerServer) {}
+        
+        void createAudioDeviceTypes(juce::OwnedArray<juce::AudioIODeviceType>& types) override;
+        
+    private:
+        AudioServer& owner;
+    };
+    
+    juce::Thread::ThreadID deviceThreadId = nullptr;    // nullptr for the message thread
+    DeviceThreadPost postToDeviceThread;
+    mutable juce::CriticalSection deviceThreadLock;
+    
+    DeviceManager deviceManager { *this };
+    DeviceTypeRelay* syntheticDeviceRelay = nullptr;            // Owned by deviceManager
+    SyntheticAudioDeviceType* syntheticDeviceType = nullptr;    // Owned by the relay
+    ChannelRouter channelRouter;
     ProcessorChain processorChain;
     
-    bool running = false;
-    double currentSampleRate = 0.0;
-    int currentBufferSize = 0;
+    std::atomic<bool> running { false };
+    std::atomic<double> currentSampleRate { 0.0 };
+    std::atomic<int> currentBufferSize { 0 };
+    std::atomic<int> currentOutputLatency { 0 };    // The device's, in samples
     int currentNumInputChannels = 0;
     int currentNumOutputChannels = 0;
+    int currentNumProcessingChannels = 0;
+    
+    // The device clock against the host clock: the first host time since the
+    // device started and the samples since (audio thread)
+    void measureDeviceClock(juce::uint64 hostTimeNs, int numSamples, double sampleRate) noexcept;
+    juce::uint64 clockStartNs = 0;
+    juce::int64 clockSamples = 0;
+    std::atomic<float> deviceClockPpm { 0.0f };
     
-    // Level monitoring
-    std::atomic<float> inputLevels[2] = { 0.0f, 0.0f };
-    std::atomic<float> outputLevels[2] = { 0.0f, 0.0f };
+    // Level monitoring: the latest block's peak, and the highest since the
+    // last snapshot
+    std::atomic<float> inputLevels[maxMeterChannels] {};
+    std::atomic<float> outputLevels[maxMeterChannels] {};
+    std::atomic<float> inputPeaks[maxMeterChannels] {};
+    std::atomic<float> outputPeaks[maxMeterChannels] {};
+    std::atomic<int> numMeteredInputs { 0 };
+    std::atomic<int> numMeteredOutputs { 0 };
+    
+    // Blocks between meter updates, set by the governor, and the count
+    // since the last one (audio thread)
+    std::atomic<int> meterInterval { 1 };
+    int blocksSinceMeter = 0;
     
     // Audio buffer for processing
     juce::AudioBuffer<float> processingBuffer;
     
+    // Runs the chain on a worker in high-latency mode
+    BackgroundProcessor backgroundProcessor { [this] (juce::AudioBuffer<float>& buffer, juce::uint64 hostTimeNs)
+    {
+        processorChain.process(buffer, hostTimeNs);
+    } };
+    int highLatencyBlockSize = BackgroundProcessor::defaultBlockSize;
+    
+    CaptureTap captureTap;
+    MeasurementEngine measurementEngine;
+    RealtimeConfig realtimeConfig;
+    
+    // False for devices that never block, such as an accelerated synthetic
+    // one, whose thread would only hit the real-time CPU limit
+    std::atomic<bool> promoteAudioThread { true };
+    
+    // Output zones, shared with the audio thread and guarded by zoneLock.
+    // Only the device thread changes, reads or aligns the list, so it can
+    // iterate without the lock.
+    juce::OwnedArray<OutputZone> outputZones;
+    juce::SpinLock zoneLock;
+    bool alignZones = true;
+    float mainExtraDelayMs = 0.0f;
+    
+    // Holds the main output back to line up with the zones
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> mainDelay;
+    std::atomic<int> mainDelaySamples { 0 };
+    
+    // After everything its stages change, so its timer stops first
+    QualityGovernor qualityGovernor;
+    
+    // Health counters for the exporter. The audio callbacks bump the first
+    // two groups and the xruns; refreshMetrics() copies the rest in on the
+    // message thread, where they're safe to read.
+    struct Health
+    {
+        // Callback time over block time; above 1 the device ran late
+        MetricsExporter::Histogram callbackLoads { 0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.5, 2.0 };
+        std::atomic<juce::int64> numOverruns { 0 };
+        std::atomic<juce::int64> numClippedBlocks { 0 };
+        
+        std::atomic<juce::int64> numDeviceStarts { 0 };
+        std::atomic<juce::int64> numDeviceChanges { 0 };
+        std::atomic<juce::int64> numDeviceErrors { 0 };
+        juce::String lastDeviceName;
+        
+        std::atomic<juce::int64> numXRuns { 0 };
+        std::atomic<juce::int64> numCaptureDrops { 0 };
+        std::atomic<juce::int64> numBackgroundUnderruns { 0 };
+        std::atomic<float> directLoad { 0.0f };
+        std::atomic<float> highLatencyLoad { 0.0f };
+        std::atomic<int> qualityLevel { 0 };
+        
+        // The running device and its xrun count when last read. Only touched
+        // from its start to its stop, when it can't be deleted.
+        juce::AudioIODevice* xRunDevice = nullptr;
+        int lastXRunCount = 0;
+    };
+    
+    Health health;
+    
+    // Last, so it stops serving before anything it reads goes away
+    MetricsExporter metricsExporter;
+    
     //==============================================================================
-    void updateLevels(const float* const* inputData, 
+    int getNumProcessingChannelsFor(int numInputs, int numOutputs) const;
+    float getMainPathLatencyMs();
+    void addQualityStages();
+    void applyToZoneChains(const juce::String& key, std::function<void(ProcessorChain&)> apply);
+    void addMetrics();
+    void refreshMetrics();
+    void handleAsyncUpdate() override;
+    void runOnDeviceThread(const juce::String& key, std::function<void()> function);
+    
+    // Device or audio thread, while the device is running
+    void countXRuns() noexcept;
+    
+    void updateLevels(const DSPKernels& kernels,
+                     const float* const* inputData,
                      const float* const* outputData,
                      int numInputs, int numOutputs, int numSamples);
     
+    JUCE_DECLARE_WEAK_REFERENCEABLE(AudioServer)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioServer)
 };
 
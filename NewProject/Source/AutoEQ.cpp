@@ -0,0 +1,606 @@
+#include "AutoEQ.h"
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    bool isNumber(const juce::String& token)
+    {
+        return token.containsOnly("0123456789.-+eE") && token.containsAnyOf("0123456789");
+    }
+    
+    //==============================================================================
+    /** Log-spaced evaluation points, with the sin^2(w/2) terms the magnitude
+        formula needs precomputed once and shared by every search. */
+    struct FrequencyGrid
+    {
+        explicit FrequencyGrid(const AutoEQ::Settings& settings)
+        {
+            auto start = juce::jmax(1.0, (double) settings.gridStartFrequency);
+            auto end = juce::jlimit(start * 1.01, settings.sampleRate * 0.49, (double) settings.gridEndFrequency);
+            auto numOctaves = std::log2(end / start);
+            
+            size = juce::jmax(16, (int) std::ceil(numOctaves * juce::jmax(1, settings.pointsPerOctave)) + 1);
+            
+            frequencies.malloc((size_t) size);
+            phi.malloc((size_t) size);
+            phiSquared.malloc((size_t) size);
+            
+            for (int i = 0; i < size; ++i)
+            {
+                frequencies[i] = start * std::pow(2.0, numOctaves * i / (size - 1));
+                
+                auto sinHalfW = std::sin(juce::MathConstants<double>::pi * frequencies[i] / settings.sampleRate);
+                phi[i] = sinHalfW * sinHalfW;
+                phiSquared[i] = phi[i] * phi[i];
+            }
+        }
+        
+        int size = 0;
+        juce::HeapBlock<double> frequencies, phi, phiSquared;
+    };
+    
+    //==============================================================================
+    /** Writes the biquad's response in dB at every grid point into dest. The
+        numerator and denominator polynomials are built with vector operations
+        across the whole grid; see BiquadCoefficients::getMagnitudeSquared(). */
+    void computeResponseDb(const BiquadCoefficients& c, const FrequencyGrid& grid,
+                           double* numerator, double* denominator, double* dest)
+    {
+        using FVO = juce::FloatVectorOperations;
+        auto n = grid.size;
+        
+        auto numeratorDC = c.b0 + c.b1 + c.b2;
+        FVO::fill(numerator, numeratorDC * numeratorDC, n);
+        FVO::addWithMultiply(numerator, grid.phi.getData(), -4.0 * (c.b0 * c.b1 + 4.0 * c.b0 * c.b2 + c.b1 * c.b2), n);
+        FVO::addWithMultiply(numerator, grid.phiSquared.getData(), 16.0 * c.b0 * c.b2, n);
+        
+        auto denominatorDC = 1.0 + c.a1 + c.a2;
+        FVO::fill(denominator, denominatorDC * denominatorDC, n);
+        FVO::addWithMultiply(denominator, grid.phi.getData(), -4.0 * (c.a1 + 4.0 * c.a2 + c.a1 * c.a2), n);
+        FVO::addWithMultiply(denominator, grid.phiSquared.getData(), 16.0 * c.a2, n);
+        
+        for (int i = 0; i < n; ++i)
+            dest[i] = 10.0 * std::log10(juce::jmax(numerator[i], 1.0e-30) / juce::jmax(denominator[i], 1.0e-30));
+    }
+    
+    //==============================================================================
+    /** Band parameters in the space the search moves through. */
+    struct BandParameters
+    {
+        EQBand::Type type = EQBand::Type::Bell;
+        double logFrequency = 10.0;     // log2(Hz)
+        double gainDb = 0.0;
+        double logQ = 0.0;              // log2(Q)
+        
+        double& operator[] (int index)  { return index == 0 ? logFrequency : (index == 1 ? gainDb : logQ); }
+        
+        bool operator== (const BandParameters& other) const
+        {
+            return type == other.type && logFrequency == other.logFrequency
+                && gainDb == other.gainDb && logQ == other.logQ;
+        }
+        
+        EQBand toBand() const
+        {
+            EQBand band;
+            band.type = type;
+            band.frequency = (float) std::exp2(logFrequency);
+            band.gainDb = (float) gainDb;
+            band.q = (float) std::exp2(logQ);
+            return band;
+        }
+    };
+    
+    //==============================================================================
+    /**
+     * One independent search: a greedy initial placement followed by an
+     * adaptive coordinate descent over frequency, gain and Q of every band.
+     * Each search owns its workspace so many can run concurrently.
+     */
+    class FitSearch
+    {
+    public:
+        FitSearch(const FrequencyGrid& frequencyGrid, const double* desiredResponse,
+                  const AutoEQ::Settings& fitSettings, int startIndex)
+            : grid(frequencyGrid),
+              desired(desiredResponse),
+              settings(fitSettings),
+              random(fitSettings.randomSeed + startIndex),
+              randomise(startIndex > 0),
+              numBands(juce::jmax(1, fitSettings.numBands))
+        {
+            auto n = (size_t) grid.size;
+            
+            bandResponses.calloc(n * (size_t) numBands);
+            total.calloc(n);
+            trial.malloc(n);
+            residual.malloc(n);
+            numerator.malloc(n);
+            denominator.malloc(n);
+            
+            parameters.insertMultiple(0, BandParameters(), numBands);
+        }
+        
+        void run()
+        {
+            initialise();
+            refine();
+        }
+        
+        double getError() const                 { return error; }
+        int getNumEvaluations() const           { return numEvaluations; }
+        const double* getTotalResponse() const  { return total.getData(); }
+        
+        juce::Array<EQBand> getBands() const
+        {
+            juce::Array<EQBand> bands;
+            
+            for (const auto& p : parameters)
+                bands.add(p.toBand());
+            
+            std::sort(bands.begin(), bands.end(),
+                      [] (const EQBand& a, const EQBand& b) { return a.frequency < b.frequency; });
+            
+            return bands;
+        }
+        
+    private:
+        //==============================================================================
+        void initialise()
+        {
+            using FVO = juce::FloatVectorOperations;
+            FVO::copy(residual.getData(), desired, grid.size);
+            
+            auto firstBell = 0;
+            auto endBell = numBands;
+            
+            if (settings.useShelves && numBands >= 3)
+            {
+                BandParameters lowShelf;
+                lowShelf.type = EQBand::Type::LowShelf;
+                lowShelf.logFrequency = std::log2(105.0) + jitter(0.5);
+                lowShelf.logQ = std::log2(0.7);
+                lowShelf.gainDb = averageResidual(0.0, 150.0);
+                place(0, lowShelf);
+                
+                BandParameters highShelf;
+                highShelf.type = EQBand::Type::HighShelf;
+                highShelf.logFrequency = std::log2(8000.0) + jitter(0.5);
+                highShelf.logQ = std::log2(0.7);
+                highShelf.gainDb = averageResidual(8000.0, settings.maxFrequency);
+                place(numBands - 1, highShelf);
+                
+                firstBell = 1;
+                endBell = numBands - 1;
+            }
+            
+            auto minLogFrequency = std::log2((double) settings.minFrequency);
+            auto maxLogFrequency = std::log2((double) settings.maxFrequency);
+            
+            // Each bell goes where the remaining error is largest
+            for (int b = firstBell; b < endBell; ++b)
+            {
+                int peak = -1;
+                double peakError = 0.0;
+                
+                for (int i = 0; i < grid.size; ++i)
+                {
+                    auto logFrequency = std::log2(grid.frequencies[i]);
+                    
+                    if (logFrequency < minLogFrequency || logFrequency > maxLogFrequency)
+                        continue;
+                    
+                    auto weightedError = std::abs(residual[i]) * (randomise ? 0.5 + random.nextDouble() : 1.0);
+                    
+                    if (weightedError > peakError)
+                    {
+                        peakError = weightedError;
+                        peak = i;
+                    }
+                }
+                
+                BandParameters bell;
+                
+                if (peak >= 0)
+                {
+                    bell.logFrequency = std::log2(grid.frequencies[peak]) + jitter(0.25);
+                    bell.gainDb = residual[peak];
+                }
+                else
+                {
+                    bell.logFrequency = minLogFrequency + (maxLogFrequency - minLogFrequency) * (b + 0.5) / numBands;
+                }
+                
+                bell.logQ = randomise ? random.nextDouble() * 3.0 - 1.0 : 0.5;
+                place(b, bell);
+            }
+            
+            error = computeError(total.getData());
+        }
+        
+        void refine()
+        {
+            using FVO = juce::FloatVectorOperations;
+            
+            const double initialSteps[] = { 1.0 / 3.0, 1.5, 0.5 };
+            const double minimumSteps[] = { 1.0 / 256.0, 0.01, 1.0 / 256.0 };
+            
+            juce::HeapBlock<double> steps((size_t) numBands * 3);
+            
+            for (int b = 0; b < numBands; ++b)
+                for (int p = 0; p < 3; ++p)
+                    steps[b * 3 + p] = initialSteps[p];
+            
+            // residual holds the error with the band under test removed, so a
+            // trial only needs one band response and one O(n) error sum
+            while (numEvaluations < settings.maxEvaluationsPerStart)
+            {
+                bool anyStepActive = false;
+                
+                for (int b = 0; b < numBands; ++b)
+                {
+                    auto* bandResponse = bandResponses.getData() + b * grid.size;
+                    FVO::subtract(residual.getData(), total.getData(), bandResponse, grid.size);
+                    FVO::subtract(residual.getData(), desired, grid.size);
+                    
+                    for (int p = 0; p < 3; ++p)
+                    {
+                        auto& step = steps[b * 3 + p];
+                        
+                        if (step < minimumSteps[p])
+                            continue;
+                        
+                        anyStepActive = true;
+                        bool improved = false;
+                        
+                        for (auto direction : { 1.0, -1.0 })
+                        {
+                            auto candidate = parameters.getReference(b);
+                            candidate[p] += direction * step;
+                            constrain(candidate);
+                            
+                            if (candidate == parameters.getReference(b))
+                                continue;
+                            
+                            computeBand(candidate, trial.getData());
+                            auto trialError = computeError(residual.getData(), trial.getData());
+                            
+                            if (trialError < error)
+                            {
+                                parameters.set(b, candidate);
+                                setBandResponse(b, trial.getData());
+                                error = trialError;
+                                improved = true;
+                                break;
+                            }
+                        }
+                        
+                        step = improved ? juce::jmin(step * 1.5, initialSteps[p] * 2.0) : step * 0.5;
+                    }
+                }
+                
+                if (!anyStepActive)
+                    break;
+            }
+        }
+        
+        //==============================================================================
+        void place(int index, BandParameters p)
+        {
+            constrain(p);
+            parameters.set(index, p);
+            computeBand(p, trial.getData());
+            setBandResponse(index, trial.getData());
+            juce::FloatVectorOperations::subtract(residual.getData(), trial.getData(), grid.size);
+        }
+        
+        void setBandResponse(int index, const double* response)
+        {
+            using FVO = juce::FloatVectorOperations;
+            auto* bandResponse = bandResponses.getData() + index * grid.size;
+            
+            FVO::subtract(total.getData(), bandResponse, grid.size);
+            FVO::copy(bandResponse, response, grid.size);
+            FVO::add(total.getData(), bandResponse, grid.size);
+        }
+        
+        void computeBand(const BandParameters& p, double* dest)
+        {
+            ++numEvaluations;
+            computeResponseDb(BiquadCoefficients::design(p.toBand(), settings.sampleRate),
+                              grid, numerator.getData(), denominator.getData(), dest);
+        }
+        
+        void constrain(BandParameters& p) const
+        {
+            auto maxFrequency = juce::jmin((double) settings.maxFrequency, settings.sampleRate * 0.45);
+            auto maxQ = (double) settings.maxQ;
+            
+            // High-Q shelves overshoot, so keep them gentle
+            if (p.type != EQBand::Type::Bell)
+                maxQ = juce::jmax((double) settings.minQ, juce::jmin(maxQ, 1.0));
+            
+            p.logFrequency = juce::jlimit(std::log2((double) settings.minFrequency), std::log2(maxFrequency), p.logFrequency);
+            p.gainDb = juce::jlimit((double) settings.minGainDb, (double) settings.maxGainDb, p.gainDb);
+            p.logQ = juce::jlimit(std::log2((double) settings.minQ), std::log2(maxQ), p.logQ);
+        }
+        
+        // Mean squared error of a full response against the desired curve
+        double computeError(const double* response) const
+        {
+            double sum = 0.0;
+            
+            for (int i = 0; i < grid.size; ++i)
+            {
+                auto e = response[i] - desired[i];
+                sum += e * e;
+            }
+            
+            return sum / grid.size;
+        }
+        
+        // Mean squared error given the error without one band, plus that band
+        double computeError(const double* errorWithoutBand, const double* bandResponse) const
+        {
+            double sum = 0.0;
+            
+            for (int i = 0; i < grid.size; ++i)
+            {
+                auto e = errorWithoutBand[i] + bandResponse[i];
+                sum += e * e;
+            }
+            
+            return sum / grid.size;
+        }
+        
+        double averageResidual(double lowFrequency, double highFrequency) const
+        {
+            double sum = 0.0;
+            int count = 0;
+            
+            for (int i = 0; i < grid.size; ++i)
+            {
+                if (grid.frequencies[i] >= lowFrequency && grid.frequencies[i] <= highFrequency)
+                {
+                    sum += residual[i];
+                    ++count;
+                }
+            }
+            
+            return count > 0 ? sum / count : 0.0;
+        }
+        
+        double jitter(double range)
+        {
+            return randomise ? (random.nextDouble() * 2.0 - 1.0) * range : 0.0;
+        }
+        
+        //==============================================================================
+        const FrequencyGrid& grid;
+        const double* desired;
+        const AutoEQ::Settings& settings;
+        juce::Random random;
+        const bool randomise;
+        const int numBands;
+        
+        juce::Array<BandParameters> parameters;
+        juce::HeapBlock<double> bandResponses, total, trial, residual, numerator, denominator;
+        
+        double error = 0.0;
+        int numEvaluations = 0;
+        
+        JUCE_DECLARE_NON_COPYABLE(FitSearch)
+    };
+}
+
+//==============================================================================
+void AutoEQ::Curve::add(float frequency, float gainDb)
+{
+    frequencies.add(frequency);
+    gainsDb.add(gainDb);
+}
+
+double AutoEQ::Curve::getGainAt(double frequency) const
+{
+    auto n = frequencies.size();
+    
+    if (n == 0)
+        return 0.0;
+    
+    if (frequency <= frequencies.getFirst())
+        return gainsDb.getFirst();
+    
+    if (frequency >= frequencies.getLast())
+        return gainsDb.getLast();
+    
+    auto index = (int) (std::upper_bound(frequencies.begin(), frequencies.end(), (float) frequency) - frequencies.begin());
+    index = juce::jlimit(1, n - 1, index);
+    
+    auto logLow = std::log((double) frequencies[index - 1]);
+    auto logHigh = std::log((double) frequencies[index]);
+    auto t = logHigh > logLow ? (std::log(frequency) - logLow) / (logHigh - logLow) : 0.0;
+    
+    return gainsDb[index - 1] + t * (gainsDb[index] - gainsDb[index - 1]);
+}
+
+//==============================================================================
+bool AutoEQ::parseCurve(const juce::String& text, Curve& curve, juce::String& errorMessage)
+{
+    struct Point { float frequency, gainDb; };
+    juce::Array<Point> points;
+    
+    juce::StringArray lines;
+    lines.addLines(text);
+    
+    for (int lineIndex = 0; lineIndex < lines.size(); ++lineIndex)
+    {
+        auto line = lines[lineIndex].upToFirstOccurrenceOf("#", false, false).trim();
+        
+        if (line.isEmpty() || line.startsWith("//"))
+            continue;
+        
+        juce::StringArray items;
+        items.addTokens(line, ",;\t", "\"");
+        items.trim();
+        items.removeEmptyStrings();
+        
+        // "20 -3.1, 25 -2.9" is a list of pairs; anything else is a CSV row
+        // whose first two fields are frequency and level
+        bool isPairList = !items.isEmpty();
+        juce::StringArray fields;
+        
+        for (const auto& item : items)
+        {
+            juce::StringArray tokens;
+            tokens.addTokens(item, " ", "\"");
+            tokens.removeEmptyStrings();
+            
+            isPairList = isPairList && tokens.size() == 2 && isNumber(tokens[0]) && isNumber(tokens[1]);
+            fields.addArray(tokens);
+        }
+        
+        if (isPairList)
+        {
+            for (int i = 0; i + 1 < fields.size(); i += 2)
+                points.add({ fields[i].getFloatValue(), fields[i + 1].getFloatValue() });
+            
+            continue;
+        }
+        
+        if (fields.size() >= 2 && isNumber(fields[0]) && isNumber(fields[1]))
+        {
+            points.add({ fields[0].getFloatValue(), fields[1].getFloatValue() });
+        }
+        else if (!points.isEmpty())
+        {
+            errorMessage = "Unexpected text on line " + juce::String(lineIndex + 1) + ": " + line;
+            return false;
+        }
+        // Otherwise this is a header row
+    }
+    
+    std::sort(points.begin(), points.end(),
+              [] (const Point& a, const Point& b) { return a.frequency < b.frequency; });
+    
+    curve = {};
+    
+    for (const auto& point : points)
+    {
+        if (point.frequency <= 0.0f)
+        {
+            errorMessage = "Frequencies must be positive";
+            return false;
+        }
+        
+        if (!curve.isEmpty() && point.frequency == curve.frequencies.getLast())
+            curve.gainsDb.setUnchecked(curve.gainsDb.size() - 1, point.gainDb);
+        else
+            curve.add(point.frequency, point.gainDb);
+    }
+    
+    if (curve.frequencies.size() < 2)
+    {
+        errorMessage = "A response needs at least two frequency/level points";
+        return false;
+    }
+    
+    return true;
+}
+
+bool AutoEQ::loadCurve(const juce::File& file, Curve& curve, juce::String& errorMessage)
+{
+    if (!file.existsAsFile())
+    {
+        errorMessage = "File not found: " + file.getFullPathName();
+        return false;
+    }
+    
+    return parseCurve(file.loadFileAsString(), curve, errorMessage);
+}
+
+//==============================================================================
+AutoEQ::Result AutoEQ::fit(const Curve& measured, const Curve& target, const Settings& settings)
+{
+    Result result;
+    
+    if (measured.isEmpty() || target.isEmpty())
+        return result;
+    
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    
+    FrequencyGrid grid(settings);
+    juce::HeapBlock<double> desired((size_t) grid.size);
+    
+    for (int i = 0; i < grid.size; ++i)
+        desired[i] = target.getGainAt(grid.frequencies[i]) - measured.getGainAt(grid.frequencies[i]);
+    
+    if (settings.normaliseLevel)
+    {
+        double mean = 0.0;
+        
+        for (int i = 0; i < grid.size; ++i)
+            mean += desired[i];
+        
+        mean /= grid.size;
+        juce::FloatVectorOperations::add(desired.getData(), -mean, grid.size);
+    }
+    
+    auto numCpus = juce::jmax(1, juce::SystemStats::getNumCpus());
+    auto numStarts = settings.numStarts > 0 ? settings.numStarts : numCpus * 2;
+    
+    juce::OwnedArray<FitSearch> searches;
+    
+    for (int s = 0; s < numStarts; ++s)
+        searches.add(new FitSearch(grid, desired.getData(), settings, s));
+    
+    {
+        juce::WaitableEvent finished;
+        std::atomic<int> remaining { numStarts };
+        
+        juce::ThreadPool pool(juce::jmin(numStarts, numCpus));
+        
+        for (auto* search : searches)
+        {
+            pool.addJob([search, &remaining, &finished]
+            {
+                Tracing::setThreadName("AutoEQ Worker");
+                
+                {
+                    TRACE_SCOPE("AutoEQ search");
+                    search->run();
+                }
+                
+                if (--remaining == 0)
+                    finished.signal();
+            });
+        }
+        
+        finished.wait();
+    }
+    
+    auto* best = searches.getFirst();
+    
+    for (auto* search : searches)
+    {
+        result.numEvaluations += search->getNumEvaluations();
+        
+        if (search->getError() < best->getError())
+            best = search;
+    }
+    
+    result.bands = best->getBands();
+    result.rmsErrorDb = (float) std::sqrt(best->getError());
+    result.numStarts = numStarts;
+    
+    for (int i = 0; i < grid.size; ++i)
+        result.maxErrorDb = juce::jmax(result.maxErrorDb, (float) std::abs(best->getTotalResponse()[i] - desired[i]));
+    
+    result.elapsedMs = juce::Time::getMillisecondCounterHiRes() - startTime;
+    
+    DBG("AutoEQ: " + juce::String(result.bands.size()) + " bands, RMS error "
+        + juce::String(result.rmsErrorDb, 2) + " dB, max " + juce::String(result.maxErrorDb, 2) + " dB, "
+        + juce::String(numStarts) + " starts in " + juce::String(result.elapsedMs, 1) + " ms");
+    
+    return result;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQBand.h"
+
+//==============================================================================
+/**
+ * AutoEQ fits a set of parametric bands so that a measured response follows a
+ * target curve.
+ *
+ * Band responses are evaluated with vector operations over a dense
+ * log-frequency grid, and several independently seeded searches run in
+ * parallel across all CPU cores; the best one wins. The result is returned in
+ * the ProcessorChain's band format so it can be passed straight to setBands().
+ */
+class AutoEQ
+{
+public:
+    //==============================================================================
+    /** A frequency response as pairs of frequency (Hz) and level (dB). */
+    struct Curve
+    {
+        juce::Array<float> frequencies;
+        juce::Array<float> gainsDb;
+        
+        bool isEmpty() const { return frequencies.isEmpty(); }
+        void add(float frequency, float gainDb);
+        
+        // Interpolated linearly over log-frequency, held flat past either end
+        double getGainAt(double frequency) const;
+    };
+    
+    /** Parses CSV (frequency, dB[, ...] per row, optional header) or a plain
+        list of "frequency dB" pairs separated by newlines or commas. */
+    static bool parseCurve(const juce::String& text, Curve& curve, juce::String& errorMessage);
+    static bool loadCurve(const juce::File& file, Curve& curve, juce::String& errorMessage);
+    
+    //==============================================================================
+    struct Settings
+    {
+        int numBands = 10;
+        bool useShelves = true;         // First and last bands become low/high shelves
+        
+        // Band constraints
+        float minFrequency = 20.0f;
+        float maxFrequency = 16000.0f;
+        float minGainDb = -12.0f;
+        float maxGainDb = 12.0f;
+        float minQ = 0.3f;
+        float maxQ = 8.0f;
+        
+        // Error is measured over this range on a log-frequency grid
+        float gridStartFrequency = 20.0f;
+        float gridEndFrequency = 20000.0f;
+        int pointsPerOctave = 48;
+        
+        double sampleRate = 48000.0;
+        bool normaliseLevel = true;     // Ignore a broadband level difference, which bands can't fix
+        
+        int numStarts = 0;              // 0 = two searches per CPU core
+        int maxEvaluationsPerStart = 20000;
+        juce::int64 randomSeed = 1;
+    };
+    
+    struct Result
+    {
+        juce::Array<EQBand> bands;
+        float rmsErrorDb = 0.0f;
+        float maxErrorDb = 0.0f;
+        int numStarts = 0;
+        int numEvaluations = 0;
+        double elapsedMs = 0.0;
+    };
+    
+    static Result fit(const Curve& measured, const Curve& target, const Settings& settings);
+    static Result fit(const Curve& measured, const Curve& target) { return fit(measured, target, Settings()); }
+    
+private:
+    AutoEQ() = delete;
+};
@@ -0,0 +1,388 @@
+#include "BackgroundProcessor.h"
+#include "ParameterEventQueue.h"
+#include "RealtimeConfig.h"
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    // Loads are averaged over about this much audio
+    constexpr double loadSmoothingSeconds = 2.0;
+    
+    /** Writes numSamples from the start of source into a ring at the fifo's
+        write position; channels the source doesn't have are cleared. */
+    void writeToRing(juce::AbstractFifo& fifo, juce::AudioBuffer<float>& ring,
+                     const juce::AudioBuffer<float>* source, int numSamples)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+        
+        for (int channel = 0; channel < ring.getNumChannels(); ++channel)
+        {
+            if (source != nullptr && channel < source->getNumChannels())
+            {
+                auto* data = source->getReadPointer(channel);
+                juce::FloatVectorOperations::copy(ring.getWritePointer(channel, start1), data, size1);
+                
+                if (size2 > 0)
+                    juce::FloatVectorOperations::copy(ring.getWritePointer(channel, start2), data + size1, size2);
+            }
+            else
+            {
+                juce::FloatVectorOperations::clear(ring.getWritePointer(channel, start1), size1);
+                
+                if (size2 > 0)
+                    juce::FloatVectorOperations::clear(ring.getWritePointer(channel, start2), size2);
+            }
+        }
+        
+        fifo.finishedWrite(size1 + size2);
+    }
+    
+    /** Reads up to numSamples from a ring into the start of dest, and returns
+        how many there were. */
+    int readFromRing(juce::AbstractFifo& fifo, const juce::AudioBuffer<float>& ring,
+                     juce::AudioBuffer<float>& dest, int numSamples)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numSamples, start1, size1, start2, size2);
+        
+        for (int channel = 0; channel < dest.getNumChannels(); ++channel)
+        {
+            auto* data = dest.getWritePointer(channel);
+            
+            if (channel < ring.getNumChannels())
+            {
+                juce::FloatVectorOperations::copy(data, ring.getReadPointer(channel, start1), size1);
+                
+                if (size2 > 0)
+                    juce::FloatVectorOperations::copy(data + size1, ring.getReadPointer(channel, start2), size2);
+            }
+            else
+            {
+                juce::FloatVectorOperations::clear(data, size1 + size2);
+            }
+        }
+        
+        fifo.finishedRead(size1 + size2);
+        return size1 + size2;
+    }
+}
+
+//==============================================================================
+BackgroundProcessor::BackgroundProcessor(ProcessBlock processBlockToUse)
+    : juce::Thread("Background Chain"),
+      processBlock(std::move(processBlockToUse))
+{
+}
+
+BackgroundProcessor::~BackgroundProcessor()
+{
+    stopThread(2000);
+}
+
+//==============================================================================
+int BackgroundProcessor::getLatencySamples() const
+{
+    return requestedMode.load() == Mode::HighLatency ? 2 * blockSize.load() : 0;
+}
+
+BackgroundProcessor::Status BackgroundProcessor::getStatus() const
+{
+    Status status;
+    status.mode = heardMode.load();
+    status.blockSize = blockSize.load();
+    status.latencyMs = (float) (2000.0 * status.blockSize / sampleRate.load());
+    status.directLoad = directLoad.load();
+    status.highLatencyLoad = highLatencyLoad.load();
+    status.numUnderruns = numUnderruns.load();
+    status.numOverruns = numOverruns.load();
+    return status;
+}
+
+//==============================================================================
+void BackgroundProcessor::prepare(double newSampleRate, int deviceBlockSize, int newNumChannels, int newBlockSize)
+{
+    release();
+    
+    auto size = juce::jlimit(juce::jmax(1, deviceBlockSize), juce::jmax(maxBlockSize, deviceBlockSize), newBlockSize);
+    sampleRate = newSampleRate;
+    blockSize = size;
+    numChannels = juce::jmax(1, newNumChannels);
+    fadeSamples = juce::jmax(1, juce::roundToInt(fadeSeconds * newSampleRate));
+    
+    // A quarter of a block, so a block waits at most that long to start
+    pollMs = juce::jmax(1, (int) (250.0 * size / newSampleRate));
+    
+    // Two blocks primed, one being written and a device block of slack
+    auto ringSize = 4 * size + deviceBlockSize + 1;
+    inputRing.setSize(numChannels, ringSize);
+    outputRing.setSize(numChannels, ringSize);
+    inputFifo.setTotalSize(ringSize);
+    outputFifo.setTotalSize(ringSize);
+    workBuffer.setSize(numChannels, size);
+    
+    fadePosition = fadeSamples;
+    
+    if (requestedMode.load() == Mode::HighLatency)
+    {
+        startWorker();
+        state = State::HighLatency;
+    }
+    else
+    {
+        state = State::Direct;
+    }
+    
+    heardMode = requestedMode.load();
+    
+    if (!isThreadRunning())
+        startThread();
+}
+
+void BackgroundProcessor::release()
+{
+    stopWorker();
+    
+    while (!isWorkerIdle())
+        juce::Thread::sleep(1);
+    
+    state = State::Direct;
+}
+
+//==============================================================================
+bool BackgroundProcessor::beginBlock(juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    auto wantsHighLatency = requestedMode.load(std::memory_order_relaxed) == Mode::HighLatency;
+    blockStartTicks = juce::Time::getHighResolutionTicks();
+    
+    switch (state)
+    {
+        case State::Direct:
+            if (wantsHighLatency)
+            {
+                state = State::FadingToHighLatency;
+                fadePosition = 0;
+                fadingIn = false;
+            }
+            
+            return true;
+        
+        case State::FadingToHighLatency:
+            return true;
+        
+        case State::HighLatency:
+            if (!wantsHighLatency)
+            {
+                state = State::FadingToDirect;
+                fadePosition = 0;
+                fadingIn = false;
+            }
+            
+            exchange(buffer, numSamples);
+            return false;
+        
+        case State::FadingToDirect:
+            exchange(buffer, numSamples);
+            return false;
+        
+        case State::WaitingForWorker:
+            if (isWorkerIdle())
+            {
+                state = State::Direct;
+                fadePosition = 0;
+                fadingIn = true;
+                heardMode.store(Mode::Direct, std::memory_order_relaxed);
+                return true;
+            }
+            
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+                buffer.clear(channel, 0, numSamples);
+            
+            return false;
+    }
+    
+    return true;
+}
+
+void BackgroundProcessor::endBlock(juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    if (state == State::Direct || state == State::FadingToHighLatency)
+    {
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - blockStartTicks);
+        updateLoad(directLoad, seconds, numSamples / sampleRate.load(std::memory_order_relaxed));
+    }
+    
+    switch (state)
+    {
+        case State::Direct:
+            if (fadingIn && fadePosition < fadeSamples)
+                applyFade(buffer, numSamples, true);
+            
+            break;
+        
+        case State::FadingToHighLatency:
+            applyFade(buffer, numSamples, false);
+            
+            // Silent now, so the chain can go to the worker
+            if (fadePosition >= fadeSamples)
+            {
+                TRACE_SCOPE("Start background chain");
+                startWorker();
+                state = State::HighLatency;
+                heardMode.store(Mode::HighLatency, std::memory_order_relaxed);
+            }
+            
+            break;
+        
+        case State::FadingToDirect:
+            applyFade(buffer, numSamples, false);
+            
+            if (fadePosition >= fadeSamples)
+            {
+                stopWorker();
+                state = State::WaitingForWorker;
+            }
+            
+            break;
+        
+        case State::HighLatency:
+        case State::WaitingForWorker:
+            break;
+    }
+}
+
+//==============================================================================
+void BackgroundProcessor::exchange(juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    TRACE_SCOPE("Background exchange");
+    
+    if (inputFifo.getFreeSpace() >= numSamples)
+        writeToRing(inputFifo, inputRing, &buffer, numSamples);
+    else
+        numOverruns.fetch_add(1, std::memory_order_relaxed);
+    
+    auto numRead = readFromRing(outputFifo, outputRing, buffer, numSamples);
+    
+    if (numRead < numSamples)
+    {
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            buffer.clear(channel, numRead, numSamples - numRead);
+        
+        numUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void BackgroundProcessor::applyFade(juce::AudioBuffer<float>& buffer, int numSamples, bool fadeIn)
+{
+    auto length = juce::jlimit(0, numSamples, fadeSamples - fadePosition);
+    
+    for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+    {
+        auto* data = buffer.getWritePointer(channel);
+        
+        for (int i = 0; i < length; ++i)
+        {
+            auto gain = (float) (fadePosition + i) / (float) fadeSamples;
+            data[i] *= fadeIn ? gain : 1.0f - gain;
+        }
+        
+        // Past the end of a fade out stays silent until the switch is done
+        if (!fadeIn)
+            juce::FloatVectorOperations::clear(data + length, numSamples - length);
+    }
+    
+    fadePosition += length;
+}
+
+void BackgroundProcessor::updateLoad(std::atomic<float>& load, double seconds, double audioSeconds)
+{
+    if (audioSeconds <= 0.0)
+        return;
+    
+    auto weight = juce::jmin(1.0, audioSeconds / loadSmoothingSeconds);
+    auto previous = load.load(std::memory_order_relaxed);
+    load.store((float) (previous + weight * (seconds / audioSeconds - previous)), std::memory_order_relaxed);
+}
+
+//==============================================================================
+void BackgroundProcessor::startWorker()
+{
+    // The worker is idle, so the rings are ours: prime the output with the
+    // latency's worth of silence
+    inputFifo.reset();
+    outputFifo.reset();
+    writeToRing(outputFifo, outputRing, nullptr, 2 * blockSize.load(std::memory_order_relaxed));
+    
+    firstWorkerBlock = true;
+    workerActive.store(true);
+}
+
+void BackgroundProcessor::stopWorker()
+{
+    workerActive.store(false);
+}
+
+bool BackgroundProcessor::isWorkerIdle() const
+{
+    // Set before the worker checks workerActive, so once this reads false
+    // after workerActive was cleared, the worker can't be in the chain
+    return !workerBusy.load();
+}
+
+void BackgroundProcessor::run()
+{
+    RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Worker, "Background Chain");
+    Tracing::setThreadName("Background Chain");
+    
+    while (!threadShouldExit())
+    {
+        workerBusy.store(true);
+        
+        if (workerActive.load())
+            while (processNextBlock())
+            {
+            }
+        
+        workerBusy.store(false);
+        
+        wait(pollMs.load());
+    }
+}
+
+bool BackgroundProcessor::processNextBlock()
+{
+    auto size = blockSize.load(std::memory_order_relaxed);
+    auto rate = sampleRate.load(std::memory_order_relaxed);
+    
+    if (inputFifo.getNumReady() < size || outputFifo.getFreeSpace() < size)
+        return false;
+    
+    TRACE_SCOPE("Background block");
+    
+    readFromRing(inputFifo, inputRing, workBuffer, size);
+    
+    // The block plays once everything already in the output ring has
+    auto queuedNs = (juce::uint64) ((double) outputFifo.getNumReady() / rate * 1.0e9);
+    auto start = juce::Time::getHighResolutionTicks();
+    
+    processBlock(workBuffer, ParameterEvent::getCurrentHostTimeNs() + queuedNs);
+    
+    updateLoad(highLatencyLoad, juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start),
+               size / rate);
+    
+    // The chain starts mid-programme, so ease it in
+    if (firstWorkerBlock)
+    {
+        auto length = juce::jmin(fadeSamples, size);
+        
+        for (int channel = 0; channel < workBuffer.getNumChannels(); ++channel)
+            for (int i = 0; i < length; ++i)
+                workBuffer.getWritePointer(channel)[i] *= (float) i / (float) length;
+        
+        firstWorkerBlock = false;
+    }
+    
+    writeToRing(outputFifo, outputRing, &workBuffer, size);
+    return true;
+}
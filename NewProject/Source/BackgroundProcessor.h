@@ -0,0 +1,161 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * BackgroundProcessor moves the processing chain off the audio thread for
+ * listening, where tens of milliseconds of latency don't matter but CPU time
+ * and battery do.
+ *
+ * In high-latency mode the audio callback only copies its block into an input
+ * ring and takes the same number of processed samples from an output ring.
+ * A worker thread at normal priority takes the input blockSize samples at a
+ * time, runs the chain over them and writes the result to the output ring.
+ * Large blocks spread the chain's per-block costs (event handling, plan
+ * updates, staging) over many more samples, and the audio thread spends
+ * almost nothing per callback. The worker polls four times per block, so the
+ * audio thread never has to wake it.
+ *
+ * The output ring starts with two blocks of silence: one for the input to
+ * fill a block, one for the worker to process it. So the added latency is
+ * 2 x blockSize, and the worker has a whole block's time for each block. If
+ * it falls behind anyway, the callback plays silence for what is missing and
+ * counts an underrun.
+ *
+ * The chain only ever runs on one thread at a time. A switch between modes
+ * fades the output out over a few milliseconds, hands the chain over (waiting
+ * for the worker to finish its block, if it has one), then fades in on the
+ * new path, so a switch never clicks. Switching to high latency leaves a gap
+ * as long as the latency it adds; switching back skips as much audio.
+ *
+ * The loads the chain puts on a CPU core in each mode are measured as it runs,
+ * so the saving can be read back from getStatus().
+ */
+class BackgroundProcessor : private juce::Thread
+{
+public:
+    //==============================================================================
+    enum class Mode
+    {
+        Direct,         // The chain runs in the audio callback
+        HighLatency     // The chain runs on the worker in large blocks
+    };
+    
+    struct Status
+    {
+        Mode mode = Mode::Direct;               // As heard; lags a requested switch by the fade
+        int blockSize = 0;
+        float latencyMs = 0.0f;                 // Added by high-latency mode
+        
+        // Time in the chain per second of audio, averaged over the last few
+        // seconds in each mode
+        float directLoad = 0.0f;
+        float highLatencyLoad = 0.0f;
+        
+        int numUnderruns = 0;                   // Callbacks the worker hadn't caught up with
+        int numOverruns = 0;                    // Callbacks whose input didn't fit
+    };
+    
+    // Runs the chain over a whole buffer. hostTimeNs is when its first sample
+    // plays, for placing scheduled events.
+    using ProcessBlock = std::function<void(juce::AudioBuffer<float>& buffer, juce::uint64 hostTimeNs)>;
+    
+    static constexpr int defaultBlockSize = 4096;
+    static constexpr int maxBlockSize = 32768;
+    static constexpr double fadeSeconds = 0.005;
+    
+    //==============================================================================
+    explicit BackgroundProcessor(ProcessBlock processBlock);
+    ~BackgroundProcessor() override;
+    
+    // Message thread. Takes effect after a fade; see getStatus() for when the
+    // switch is complete.
+    void setMode(Mode newMode) { requestedMode.store(newMode); }
+    Mode getMode() const { return requestedMode.load(); }
+    
+    // Latency the requested mode adds, for lining other paths up with it
+    int getLatencySamples() const;
+    
+    Status getStatus() const;
+    
+    //==============================================================================
+    // Device thread, while no callbacks run: sizes the rings and starts the
+    // worker. The chain has to be prepared for blockSize samples as well as the
+    // device's blocks. A device restart begins straight on the requested path.
+    void prepare(double sampleRate, int deviceBlockSize, int numChannels, int blockSize);
+    
+    // Stops the worker, so the chain is the caller's again
+    void release();
+    
+    //==============================================================================
+    // Audio thread, around the chain. beginBlock() returns true if the chain
+    // should run on the buffer directly; in high latency it has already
+    // replaced the buffer with processed audio. endBlock() applies any fade.
+    bool beginBlock(juce::AudioBuffer<float>& buffer, int numSamples);
+    void endBlock(juce::AudioBuffer<float>& buffer, int numSamples);
+    
+private:
+    //==============================================================================
+    // What the audio thread is doing; audio thread only
+    enum class State
+    {
+        Direct,
+        FadingToHighLatency,
+        HighLatency,
+        FadingToDirect,
+        WaitingForWorker        // Silent until the worker has let go of the chain
+    };
+    
+    void run() override;
+    bool processNextBlock();
+    
+    void startWorker();
+    void stopWorker();
+    bool isWorkerIdle() const;
+    
+    void exchange(juce::AudioBuffer<float>& buffer, int numSamples);
+    void applyFade(juce::AudioBuffer<float>& buffer, int numSamples, bool fadingIn);
+    static void updateLoad(std::atomic<float>& load, double seconds, double audioSeconds);
+    
+    //==============================================================================
+    const ProcessBlock processBlock;
+    std::atomic<Mode> requestedMode { Mode::Direct };
+    
+    // Set in prepare(); atomic because getStatus() reads them from any thread
+    std::atomic<double> sampleRate { 48000.0 };
+    std::atomic<int> blockSize { defaultBlockSize };
+    int numChannels = 0;
+    int fadeSamples = 1;
+    
+    // Rings between the audio thread and the worker
+    juce::AbstractFifo inputFifo { 1 };
+    juce::AbstractFifo outputFifo { 1 };
+    juce::AudioBuffer<float> inputRing;
+    juce::AudioBuffer<float> outputRing;
+    
+    // Handshake: the worker only touches the chain while workerActive is set,
+    // and clears workerBusy once it has seen it cleared
+    std::atomic<bool> workerActive { false };
+    std::atomic<bool> workerBusy { false };
+    std::atomic<int> pollMs { 20 };
+    
+    // Audio thread
+    State state = State::Direct;
+    int fadePosition = 0;
+    bool fadingIn = false;
+    juce::int64 blockStartTicks = 0;
+    
+    // Worker
+    juce::AudioBuffer<float> workBuffer;
+    bool firstWorkerBlock = true;
+    
+    // Status
+    std::atomic<Mode> heardMode { Mode::Direct };
+    std::atomic<float> directLoad { 0.0f };
+    std::atomic<float> highLatencyLoad { 0.0f };
+    std::atomic<int> numUnderruns { 0 };
+    std::atomic<int> numOverruns { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BackgroundProcessor)
+};
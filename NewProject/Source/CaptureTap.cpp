@@ -0,0 +1,281 @@
+#include "CaptureTap.h"
+#include "Tracing.h"
+#include "RealtimeConfig.h"
+
+//==============================================================================
+CaptureTap::Stream::Stream(int numChannels, int ringSize)
+    : ring(numChannels, ringSize),
+      fifo(ringSize)
+{
+    ring.clear();
+    readPointers.malloc((size_t) numChannels);
+}
+
+bool CaptureTap::Stream::push(const juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    // Whole blocks or nothing, so the file never contains a partial block
+    if (fifo.getFreeSpace() < numSamples)
+        return false;
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+    
+    for (int channel = 0; channel < ring.getNumChannels(); ++channel)
+    {
+        if (channel < buffer.getNumChannels())
+        {
+            auto* source = buffer.getReadPointer(channel);
+            juce::FloatVectorOperations::copy(ring.getWritePointer(channel, start1), source, size1);
+            
+            if (size2 > 0)
+                juce::FloatVectorOperations::copy(ring.getWritePointer(channel, start2), source + size1, size2);
+        }
+        else
+        {
+            juce::FloatVectorOperations::clear(ring.getWritePointer(channel, start1), size1);
+            
+            if (size2 > 0)
+                juce::FloatVectorOperations::clear(ring.getWritePointer(channel, start2), size2);
+        }
+    }
+    
+    fifo.finishedWrite(size1 + size2);
+    return true;
+}
+
+void CaptureTap::Stream::drain(int minimumSamples)
+{
+    auto numReady = fifo.getNumReady();
+    Tracing::counter("Capture queued samples", numReady);
+    
+    if (numReady == 0 || numReady < minimumSamples || writer == nullptr)
+        return;
+    
+    TRACE_SCOPE("Capture write");
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(numReady, start1, size1, start2, size2);
+    
+    for (auto [start, size] : { std::make_pair(start1, size1), std::make_pair(start2, size2) })
+    {
+        if (size <= 0)
+            continue;
+        
+        for (int channel = 0; channel < ring.getNumChannels(); ++channel)
+            readPointers[channel] = ring.getReadPointer(channel, start);
+        
+        writer->writeFromFloatArrays(readPointers.getData(), ring.getNumChannels(), size);
+    }
+    
+    fifo.finishedRead(size1 + size2);
+    samplesWritten += size1 + size2;
+}
+
+//==============================================================================
+CaptureTap::CaptureTap()
+    : juce::Thread("Capture Writer")
+{
+}
+
+CaptureTap::~CaptureTap()
+{
+    stop();
+}
+
+//==============================================================================
+bool CaptureTap::start(const Settings& settings, double sampleRate, int numChannels, juce::String& errorMessage)
+{
+    stop();
+    
+    numChannels = juce::jlimit(1, juce::jmax(1, settings.maxChannels), numChannels);
+    
+    if (sampleRate <= 0.0)
+    {
+        errorMessage = "Audio device is not running";
+        return false;
+    }
+    
+    if (settings.preChainFile == juce::File() && settings.postChainFile == juce::File())
+    {
+        errorMessage = "No capture file specified";
+        return false;
+    }
+    
+    if (settings.format == Format::Flac && numChannels > 8)
+    {
+        errorMessage = "FLAC supports at most 8 channels; use WAV for " + juce::String(numChannels) + " channels";
+        return false;
+    }
+    
+    auto ringSize = juce::jmax(8192, (int) (settings.bufferSeconds * sampleRate));
+    
+    // Write in chunks of about a quarter of a second
+    minimumWriteSize = juce::jmin(ringSize / 4, (int) (sampleRate * 0.25));
+    
+    auto createStream = [&] (const juce::File& file) -> std::unique_ptr<Stream>
+    {
+        if (file == juce::File())
+            return {};
+        
+        auto stream = std::make_unique<Stream>(numChannels, ringSize);
+        stream->writer = createWriter(file, settings, sampleRate, numChannels, errorMessage);
+        
+        if (stream->writer == nullptr)
+            return {};
+        
+        return stream;
+    };
+    
+    numDroppedBlocks = 0;
+    numSamplesWritten = 0;
+    
+    preChain = createStream(settings.preChainFile);
+    postChain = createStream(settings.postChainFile);
+    
+    if ((settings.preChainFile != juce::File() && preChain == nullptr)
+        || (settings.postChainFile != juce::File() && postChain == nullptr))
+    {
+        preChain.reset();
+        postChain.reset();
+        return false;
+    }
+    
+    startThread();
+    recording.store(true);
+    
+    DBG("Capture started: " + juce::String(numChannels) + " channels, "
+        + juce::String(settings.bufferSeconds, 1) + " s ring per tap point");
+    return true;
+}
+
+void CaptureTap::stop()
+{
+    if (!recording.exchange(false))
+        return;
+    
+    // Wait out a push that saw the flag before it was cleared
+    while (pushInProgress.load())
+        juce::Thread::yield();
+    
+    // The writer thread flushes whatever is left before it exits
+    stopThread(10000);
+    
+    for (auto* stream : { preChain.get(), postChain.get() })
+        if (stream != nullptr)
+            stream->writer.reset();
+    
+    DBG("Capture stopped: " + juce::String(getNumSamplesWritten()) + " samples written, "
+        + juce::String(getNumDroppedBlocks()) + " blocks dropped");
+}
+
+//==============================================================================
+void CaptureTap::pushPreChain(const juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    if (recording.load(std::memory_order_relaxed))
+        push(preChain, buffer, numSamples);
+}
+
+void CaptureTap::pushPostChain(const juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    if (recording.load(std::memory_order_relaxed))
+        push(postChain, buffer, numSamples);
+}
+
+void CaptureTap::push(const std::unique_ptr<Stream>& stream, const juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    // Re-check the flag inside the window stop() waits on, so the streams
+    // can't be torn down or replaced while a block is being copied
+    pushInProgress.store(true);
+    
+    if (recording.load() && stream != nullptr && !stream->push(buffer, numSamples))
+        numDroppedBlocks.fetch_add(1, std::memory_order_relaxed);
+    
+    pushInProgress.store(false);
+}
+
+//==============================================================================
+juce::int64 CaptureTap::getNumDroppedBlocks() const
+{
+    return numDroppedBlocks.load(std::memory_order_relaxed);
+}
+
+juce::int64 CaptureTap::getNumSamplesWritten() const
+{
+    return numSamplesWritten.load(std::memory_order_relaxed);
+}
+
+//==============================================================================
+void CaptureTap::run()
+{
+    RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Worker, "Capture Writer");
+    Tracing::setThreadName("Capture Writer");
+    
+    // Both tap points record the same blocks, so the furthest one counts
+    auto drainAll = [this] (int minimumSamples)
+    {
+        juce::int64 written = 0;
+        
+        for (auto* stream : { preChain.get(), postChain.get() })
+        {
+            if (stream != nullptr)
+            {
+                stream->drain(minimumSamples);
+                written = juce::jmax(written, stream->samplesWritten);
+            }
+        }
+        
+        numSamplesWritten.store(written, std::memory_order_relaxed);
+    };
+    
+    while (!threadShouldExit())
+    {
+        drainAll(minimumWriteSize);
+        wait(20);
+    }
+    
+    drainAll(0);
+}
+
+std::unique_ptr<juce::AudioFormatWriter> CaptureTap::createWriter(const juce::File& file,
+                                                                  const Settings& settings,
+                                                                  double sampleRate,
+                                                                  int numChannels,
+                                                                  juce::String& errorMessage)
+{
+    std::unique_ptr<juce::AudioFormat> format;
+    
+    if (settings.format == Format::Flac)
+        format = std::make_unique<juce::FlacAudioFormat>();
+    else
+        format = std::make_unique<juce::WavAudioFormat>();
+    
+    file.deleteFile();
+    
+    // A large stream buffer turns the drain into big sequential writes
+    auto outputStream = file.createOutputStream(1 << 20);
+    
+    if (outputStream == nullptr || outputStream->failedToOpen())
+    {
+        errorMessage = "Could not open " + file.getFullPathName() + " for writing";
+        return {};
+    }
+    
+    std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(outputStream.get(),
+                                                                            sampleRate,
+                                                                            (unsigned int) numChannels,
+                                                                            settings.bitsPerSample,
+                                                                            {},
+                                                                            0));
+    
+    if (writer == nullptr)
+    {
+        errorMessage = "Could not create a " + juce::String(settings.format == Format::Flac ? "FLAC" : "WAV")
+                     + " writer for " + juce::String(numChannels) + " channels at "
+                     + juce::String(settings.bitsPerSample) + " bits";
+        return {};
+    }
+    
+    // The writer now owns the stream
+    outputStream.release();
+    return writer;
+}
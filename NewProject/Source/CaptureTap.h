@@ -0,0 +1,98 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * CaptureTap records what the EQ is doing: the audio going into and/or coming
+ * out of the ProcessorChain, written to WAV (RF64 past 4 GB) or FLAC.
+ *
+ * The audio thread only copies each block into a preallocated lock-free ring
+ * per tap point; it never blocks, allocates or touches the disk. If the ring
+ * is full the block is dropped and counted. A background thread drains the
+ * rings to disk in large sequential writes, so memory use stays fixed no
+ * matter how long the recording runs.
+ */
+class CaptureTap : private juce::Thread
+{
+public:
+    //==============================================================================
+    enum class Format
+    {
+        Wav,
+        Flac    // Limited to 8 channels by the FLAC format
+    };
+    
+    struct Settings
+    {
+        juce::File preChainFile;        // Leave empty to skip this tap point
+        juce::File postChainFile;       // Leave empty to skip this tap point
+        Format format = Format::Wav;
+        int bitsPerSample = 24;
+        int maxChannels = 16;
+        double bufferSeconds = 4.0;     // Ring size per tap point; absorbs disk stalls
+    };
+    
+    //==============================================================================
+    CaptureTap();
+    ~CaptureTap() override;
+    
+    // Message thread
+    bool start(const Settings& settings, double sampleRate, int numChannels, juce::String& errorMessage);
+    void stop();
+    
+    bool isRecording() const { return recording.load(); }
+    
+    //==============================================================================
+    // Audio thread: copy a block into the ring, or count it as dropped
+    void pushPreChain(const juce::AudioBuffer<float>& buffer, int numSamples);
+    void pushPostChain(const juce::AudioBuffer<float>& buffer, int numSamples);
+    
+    //==============================================================================
+    // Statistics, safe to read from any thread
+    juce::int64 getNumDroppedBlocks() const;
+    juce::int64 getNumSamplesWritten() const;
+    
+private:
+    //==============================================================================
+    struct Stream
+    {
+        Stream(int numChannels, int ringSize);
+        
+        // False if the ring was full and the block dropped
+        bool push(const juce::AudioBuffer<float>& buffer, int numSamples);
+        void drain(int minimumSamples);
+        
+        juce::AudioBuffer<float> ring;
+        juce::AbstractFifo fifo;
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+        juce::HeapBlock<const float*> readPointers;
+        
+        juce::int64 samplesWritten = 0;     // Writer thread
+    };
+    
+    //==============================================================================
+    void run() override;
+    void push(const std::unique_ptr<Stream>& stream, const juce::AudioBuffer<float>& buffer, int numSamples);
+    
+    static std::unique_ptr<juce::AudioFormatWriter> createWriter(const juce::File& file,
+                                                                 const Settings& settings,
+                                                                 double sampleRate,
+                                                                 int numChannels,
+                                                                 juce::String& errorMessage);
+    
+    //==============================================================================
+    std::unique_ptr<Stream> preChain;
+    std::unique_ptr<Stream> postChain;
+    int minimumWriteSize = 0;
+    
+    std::atomic<bool> recording { false };
+    std::atomic<bool> pushInProgress { false };
+    
+    // Kept here rather than in the streams, which start() replaces while
+    // other threads may be reading the counts
+    std::atomic<juce::int64> numDroppedBlocks { 0 };
+    std::atomic<juce::int64> numSamplesWritten { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CaptureTap)
+};
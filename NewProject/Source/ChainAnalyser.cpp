@@ -0,0 +1,613 @@
+#include "ChainAnalyser.h"
+#include "ResponseEvaluator.h"
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    using Complex = std::complex<double>;
+    
+    constexpr double twoPi = juce::MathConstants<double>::twoPi;
+    
+    // Reported when there is nothing to measure, e.g. a residual of exactly zero
+    constexpr double quietestDb = -200.0;
+    
+    double toDecibels(double gain)
+    {
+        return juce::Decibels::gainToDecibels(gain, quietestDb);
+    }
+    
+    //==============================================================================
+    /** The curve the UI draws, at any frequency: the product of each enabled
+        band's RBJ design, as ResponseEvaluator computes it on its grid. */
+    Complex getCurveResponse(const juce::Array<EQBand>& bands, double frequency, double sampleRate)
+    {
+        auto w = twoPi * frequency / sampleRate;
+        auto z1 = std::polar(1.0, -w);
+        auto z2 = std::polar(1.0, -2.0 * w);
+        Complex response(1.0);
+        
+        for (const auto& band : bands)
+        {
+            if (!band.enabled)
+                continue;
+            
+            auto c = BiquadCoefficients::design(band, sampleRate);
+            response *= (c.b0 + c.b1 * z1 + c.b2 * z2) / (1.0 + c.a1 * z1 + c.a2 * z2);
+        }
+        
+        return response;
+    }
+    
+    /** Samples until the slowest band's impulse response has decayed by about
+        160 dB, from the radius of its poles. */
+    int getDecaySamples(const juce::Array<EQBand>& bands, double sampleRate)
+    {
+        double maxRadius = 0.0;
+        
+        for (const auto& band : bands)
+        {
+            if (!band.enabled)
+                continue;
+            
+            // Roots of z^2 + a1 z + a2
+            auto c = BiquadCoefficients::design(band, sampleRate);
+            auto discriminant = c.a1 * c.a1 - 4.0 * c.a2;
+            auto radius = discriminant < 0.0 ? std::sqrt(c.a2) : 0.5 * (std::abs(c.a1) + std::sqrt(discriminant));
+            maxRadius = juce::jmax(maxRadius, radius);
+        }
+        
+        auto longest = sampleRate * 10.0;
+        
+        if (maxRadius >= 1.0)
+            return (int) longest;
+        
+        if (maxRadius <= 0.0)
+            return 0;
+        
+        // Repeated poles decay as n r^n, so allow half as long again
+        auto samples = 1.5 * std::log(1.0e-8) / std::log(maxRadius);
+        return (int) std::ceil(juce::jlimit(0.0, longest, samples));
+    }
+    
+    /** Spectra of several signals at one frequency. The phasor is rotated
+        sample by sample and re-anchored every so often, so rounding can't build
+        up over a long sweep. */
+    void getSpectra(const float* const* signals, int numSignals, int numSamples, double omega, Complex* results)
+    {
+        constexpr int anchorInterval = 1024;
+        
+        std::fill(results, results + numSignals, Complex());
+        auto step = std::polar(1.0, -omega);
+        
+        for (int start = 0; start < numSamples; start += anchorInterval)
+        {
+            auto phasor = std::polar(1.0, -omega * start);
+            auto end = juce::jmin(numSamples, start + anchorInterval);
+            
+            for (int i = start; i < end; ++i)
+            {
+                for (int s = 0; s < numSignals; ++s)
+                    results[s] += (double) signals[s][i] * phasor;
+                
+                phasor *= step;
+            }
+        }
+    }
+    
+    //==============================================================================
+    /** DFT bins of one period of a periodic signal. Phases are exact integer
+        multiples of the period, so the highest bin is as accurate as the first. */
+    struct PeriodTable
+    {
+        explicit PeriodTable(int periodLength)
+            : length(periodLength)
+        {
+            cosTable.malloc((size_t) length);
+            sinTable.malloc((size_t) length);
+            
+            for (int i = 0; i < length; ++i)
+            {
+                cosTable[i] = std::cos(twoPi * i / length);
+                sinTable[i] = std::sin(twoPi * i / length);
+            }
+        }
+        
+        int getPhase(int bin, int sample) const
+        {
+            return (int) ((juce::int64) bin * sample % length);
+        }
+        
+        Complex getBin(const float* signal, int bin) const
+        {
+            double real = 0.0, imag = 0.0;
+            
+            for (int i = 0, phase = 0; i < length; ++i, phase = (phase + bin) % length)
+            {
+                real += signal[i] * cosTable[phase];
+                imag -= signal[i] * sinTable[phase];
+            }
+            
+            return { real, imag };
+        }
+        
+        // Subtracts the sinusoid a bin describes, over one period
+        void removeBin(double* residual, Complex value, int bin) const
+        {
+            auto scale = 2.0 / length;
+            
+            for (int i = 0, phase = 0; i < length; ++i, phase = (phase + bin) % length)
+                residual[i] -= scale * (value.real() * cosTable[phase] - value.imag() * sinTable[phase]);
+        }
+        
+        double getRms(const double* signal) const
+        {
+            double sum = 0.0;
+            
+            for (int i = 0; i < length; ++i)
+                sum += signal[i] * signal[i];
+            
+            return std::sqrt(sum / length);
+        }
+        
+        int length = 0;
+        juce::HeapBlock<double> cosTable, sinTable;
+    };
+    
+    //==============================================================================
+    /** One preset at one sample rate, run through its own chain. */
+    class CaseAnalysis
+    {
+    public:
+        // The chain is built on the calling thread, since it sets up its plugin
+        // formats; only run() happens on the pool
+        CaseAnalysis(const ChainAnalyser::Preset& presetToRun, double rate, const ChainAnalyser::Settings& analysisSettings)
+            : preset(presetToRun),
+              settings(analysisSettings),
+              sampleRate(rate),
+              numChannels(juce::jlimit(1, ChannelRouter::maxChannels, analysisSettings.numChannels)),
+              blockSize(juce::jmax(1, analysisSettings.blockSize)),
+              gain(juce::Decibels::decibelsToGain((double) analysisSettings.stimulusLevelDb)),
+              topFrequency(juce::jmin((double) analysisSettings.maxFrequency, rate * 0.45))
+        {
+            result.presetName = preset.name;
+            result.sampleRate = sampleRate;
+            result.thdPlusNoiseDb = (float) quietestDb;
+            result.noiseFloorDb = (float) quietestDb;
+            result.floatDeviationDb = (float) quietestDb;
+            
+            chain.setBands(preset.bands);
+        }
+        
+        void run()
+        {
+            chain.prepare(sampleRate, blockSize, numChannels);
+            decaySamples = getDecaySamples(preset.bands, sampleRate);
+            
+            measureSweep();
+            measureMultitone();
+            measureThdPlusNoise();
+            measureFloatDeviation();
+            check();
+        }
+        
+        const ChainAnalyser::CaseResult& getResult() const { return result; }
+        
+    private:
+        //==============================================================================
+        // Runs a stimulus through the chain from a clean state, on every channel
+        void process(const float* stimulus, int numSamples)
+        {
+            chain.reset();
+            output.setSize(numChannels, numSamples);
+            
+            juce::AudioBuffer<float> block(numChannels, blockSize);
+            
+            for (int start = 0; start < numSamples; start += blockSize)
+            {
+                auto length = juce::jmin(blockSize, numSamples - start);
+                block.setSize(numChannels, length, false, false, true);
+                
+                for (int channel = 0; channel < numChannels; ++channel)
+                    block.copyFrom(channel, 0, stimulus + start, length);
+                
+                chain.process(block);
+                
+                for (int channel = 0; channel < numChannels; ++channel)
+                    output.copyFrom(channel, start, block, channel, 0, length);
+            }
+        }
+        
+        void compare(Complex measured, Complex expected, double frequency)
+        {
+            auto ratio = measured / expected;
+            auto magnitudeError = (float) std::abs(20.0 * std::log10(std::abs(ratio)));
+            auto phaseError = (float) std::abs(juce::radiansToDegrees(std::arg(ratio)));
+            
+            if (magnitudeError > result.magnitudeErrorDb)
+            {
+                result.magnitudeErrorDb = magnitudeError;
+                result.magnitudeErrorFrequency = (float) frequency;
+            }
+            
+            if (phaseError > result.phaseErrorDegrees)
+            {
+                result.phaseErrorDegrees = phaseError;
+                result.phaseErrorFrequency = (float) frequency;
+            }
+        }
+        
+        // Power-of-two period of about a quarter of a second, so tone bins are
+        // a few Hz apart
+        int getPeriodLength() const
+        {
+            return juce::nextPowerOfTwo(juce::roundToInt(sampleRate * 0.25));
+        }
+        
+        int getBin(double frequency, int period) const
+        {
+            return juce::jlimit(1, period / 2 - 1, juce::roundToInt(frequency * period / sampleRate));
+        }
+        
+        //==============================================================================
+        void measureSweep()
+        {
+            ResponseEvaluator curve;
+            curve.prepare(settings.numPoints, settings.minFrequency, topFrequency, sampleRate);
+            curve.setBands(preset.bands);
+            
+            // Exponential sweep from an octave below the grid to just short of
+            // Nyquist, followed by silence while the chain rings out
+            auto startFrequency = juce::jmax(1.0, 0.5 * settings.minFrequency);
+            auto endFrequency = sampleRate * 0.49;
+            auto sweepLength = juce::jmax(1, juce::roundToInt(sampleRate * settings.sweepSeconds));
+            auto numSamples = sweepLength + decaySamples;
+            auto logRatio = std::log(endFrequency / startFrequency);
+            
+            juce::HeapBlock<float> stimulus((size_t) numSamples, true);
+            
+            for (int i = 0; i < sweepLength; ++i)
+            {
+                auto phase = twoPi * startFrequency * sweepLength / (sampleRate * logRatio)
+                           * (std::exp(logRatio * i / sweepLength) - 1.0);
+                stimulus[i] = (float) (gain * std::sin(phase));
+            }
+            
+            process(stimulus, numSamples);
+            
+            // The input and every output channel, so each point is one pass
+            const float* signals[1 + ChannelRouter::maxChannels];
+            Complex spectra[1 + ChannelRouter::maxChannels];
+            signals[0] = stimulus;
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                signals[1 + channel] = output.getReadPointer(channel);
+            
+            for (int point = 0; point < curve.getNumPoints(); ++point)
+            {
+                auto expectedDb = curve.getMagnitudeDb()[point];
+                
+                if (expectedDb < settings.minCompareDb)
+                    continue;
+                
+                auto frequency = (double) curve.getFrequencies()[point];
+                auto expected = std::polar(juce::Decibels::decibelsToGain((double) expectedDb, quietestDb),
+                                           (double) curve.getPhase()[point]);
+                
+                getSpectra(signals, 1 + numChannels, numSamples, twoPi * frequency / sampleRate, spectra);
+                
+                for (int channel = 0; channel < numChannels; ++channel)
+                    compare(spectra[1 + channel] / spectra[0], expected, frequency);
+            }
+        }
+        
+        void measureMultitone()
+        {
+            auto period = getPeriodLength();
+            PeriodTable table(period);
+            
+            juce::Array<int> bins;
+            auto numTones = juce::jmax(2, settings.numTones);
+            
+            for (int tone = 0; tone < numTones; ++tone)
+            {
+                auto frequency = settings.minFrequency * std::pow(topFrequency / settings.minFrequency, tone / (numTones - 1.0));
+                bins.addIfNotAlreadyThere(getBin(frequency, period));
+            }
+            
+            // Random phases keep the crest factor down; the tones together have
+            // the RMS of a single sine at the stimulus level
+            juce::Random random(settings.randomSeed);
+            auto amplitude = gain / std::sqrt((double) bins.size());
+            
+            // Whole periods of settling, so the analysed period starts at phase 0
+            auto settleSamples = (decaySamples + period - 1) / period * period;
+            auto numSamples = settleSamples + period;
+            
+            juce::HeapBlock<double> sum((size_t) numSamples, true);
+            
+            for (auto bin : bins)
+            {
+                auto phase = random.nextDouble() * twoPi;
+                auto cosPhase = amplitude * std::cos(phase), sinPhase = amplitude * std::sin(phase);
+                
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    auto index = table.getPhase(bin, i);
+                    sum[i] += cosPhase * table.cosTable[index] - sinPhase * table.sinTable[index];
+                }
+            }
+            
+            juce::HeapBlock<float> stimulus((size_t) numSamples);
+            
+            for (int i = 0; i < numSamples; ++i)
+                stimulus[i] = (float) sum[i];
+            
+            process(stimulus, numSamples);
+            
+            // What went in, measured the same way as what comes out
+            juce::Array<Complex> sent;
+            
+            for (auto bin : bins)
+                sent.add(table.getBin(stimulus + settleSamples, bin));
+            
+            juce::HeapBlock<double> residual((size_t) period);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* received = output.getReadPointer(channel, settleSamples);
+                
+                for (int i = 0; i < period; ++i)
+                    residual[i] = received[i];
+                
+                for (int tone = 0; tone < bins.size(); ++tone)
+                {
+                    auto bin = bins[tone];
+                    auto frequency = bin * sampleRate / period;
+                    auto measured = table.getBin(received, bin);
+                    auto expected = getCurveResponse(preset.bands, frequency, sampleRate);
+                    
+                    if (toDecibels(std::abs(expected)) >= settings.minCompareDb)
+                        compare(measured / sent[tone], expected, frequency);
+                    
+                    table.removeBin(residual, measured, bin);
+                }
+                
+                result.noiseFloorDb = juce::jmax(result.noiseFloorDb, (float) toDecibels(table.getRms(residual)));
+            }
+        }
+        
+        void measureThdPlusNoise()
+        {
+            auto period = getPeriodLength();
+            PeriodTable table(period);
+            
+            auto settleSamples = (decaySamples + period - 1) / period * period;
+            auto numSamples = settleSamples + period;
+            
+            juce::HeapBlock<float> stimulus((size_t) numSamples);
+            juce::HeapBlock<double> residual((size_t) period);
+            
+            for (auto toneFrequency : settings.thdFrequencies)
+            {
+                if (toneFrequency <= 0.0f || toneFrequency >= topFrequency)
+                    continue;
+                
+                auto bin = getBin(toneFrequency, period);
+                auto frequency = bin * sampleRate / period;
+                
+                // A tone the EQ all but removes leaves nothing to measure against
+                if (toDecibels(std::abs(getCurveResponse(preset.bands, frequency, sampleRate))) < settings.minCompareDb)
+                    continue;
+                
+                for (int i = 0; i < numSamples; ++i)
+                    stimulus[i] = (float) (gain * table.sinTable[table.getPhase(bin, i)]);
+                
+                process(stimulus, numSamples);
+                
+                for (int channel = 0; channel < numChannels; ++channel)
+                {
+                    auto* received = output.getReadPointer(channel, settleSamples);
+                    auto fundamental = table.getBin(received, bin);
+                    
+                    for (int i = 0; i < period; ++i)
+                        residual[i] = received[i];
+                    
+                    table.removeBin(residual, fundamental, bin);
+                    
+                    auto toneRms = std::abs(fundamental) * std::sqrt(2.0) / period;
+                    auto thdPlusNoise = toDecibels(table.getRms(residual) / toneRms);
+                    result.thdPlusNoiseDb = juce::jmax(result.thdPlusNoiseDb, (float) thdPlusNoise);
+                }
+            }
+        }
+        
+        void measureFloatDeviation()
+        {
+            auto numSamples = juce::jmax(1, juce::roundToInt(sampleRate * settings.noiseSeconds));
+            juce::Random random(settings.randomSeed);
+            juce::HeapBlock<float> stimulus((size_t) numSamples);
+            
+            for (int i = 0; i < numSamples; ++i)
+                stimulus[i] = (float) (gain * (2.0 * random.nextDouble() - 1.0));
+            
+            process(stimulus, numSamples);
+            
+            // The same bands with every section in double, from the same
+            // float input, so the difference is down to the float path alone
+            EQFilterBank<double> reference;
+            reference.prepare(1, blockSize);
+            reference.setBands(preset.bands.begin(), preset.bands.size(), sampleRate);
+            
+            juce::HeapBlock<double> expected((size_t) numSamples);
+            
+            for (int i = 0; i < numSamples; ++i)
+                expected[i] = stimulus[i];
+            
+            for (int start = 0; start < numSamples; start += blockSize)
+            {
+                double* channels[] = { expected + start };
+                reference.process(channels, 1, juce::jmin(blockSize, numSamples - start));
+            }
+            
+            double referenceEnergy = 0.0;
+            
+            for (int i = 0; i < numSamples; ++i)
+                referenceEnergy += expected[i] * expected[i];
+            
+            if (referenceEnergy <= 0.0)
+                return;
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* received = output.getReadPointer(channel);
+                double errorEnergy = 0.0;
+                
+                for (int i = 0; i < numSamples; ++i)
+                    errorEnergy += (received[i] - expected[i]) * (received[i] - expected[i]);
+                
+                auto deviation = toDecibels(std::sqrt(errorEnergy / referenceEnergy));
+                result.floatDeviationDb = juce::jmax(result.floatDeviationDb, (float) deviation);
+            }
+        }
+        
+        void check()
+        {
+            auto fail = [this] (bool failed, const juce::String& message)
+            {
+                if (failed)
+                    result.failures.add(message);
+            };
+            
+            fail(result.magnitudeErrorDb > settings.maxMagnitudeErrorDb,
+                 "Magnitude off the curve by " + juce::String(result.magnitudeErrorDb, 4) + " dB at "
+                 + juce::String(result.magnitudeErrorFrequency, 1) + " Hz (limit "
+                 + juce::String(settings.maxMagnitudeErrorDb, 4) + " dB)");
+            
+            fail(result.phaseErrorDegrees > settings.maxPhaseErrorDegrees,
+                 "Phase off the curve by " + juce::String(result.phaseErrorDegrees, 3) + " degrees at "
+                 + juce::String(result.phaseErrorFrequency, 1) + " Hz (limit "
+                 + juce::String(settings.maxPhaseErrorDegrees, 3) + " degrees)");
+            
+            fail(result.thdPlusNoiseDb > settings.maxThdPlusNoiseDb,
+                 "THD+N " + juce::String(result.thdPlusNoiseDb, 1) + " dB (limit "
+                 + juce::String(settings.maxThdPlusNoiseDb, 1) + " dB)");
+            
+            fail(result.noiseFloorDb > settings.maxNoiseFloorDb,
+                 "Noise floor " + juce::String(result.noiseFloorDb, 1) + " dB (limit "
+                 + juce::String(settings.maxNoiseFloorDb, 1) + " dB)");
+            
+            fail(result.floatDeviationDb > settings.maxFloatDeviationDb,
+                 "Float path deviates from double by " + juce::String(result.floatDeviationDb, 1) + " dB (limit "
+                 + juce::String(settings.maxFloatDeviationDb, 1) + " dB)");
+            
+            result.passed = result.failures.isEmpty();
+        }
+        
+        //==============================================================================
+        const ChainAnalyser::Preset& preset;
+        const ChainAnalyser::Settings& settings;
+        const double sampleRate;
+        const int numChannels;
+        const int blockSize;
+        const double gain;
+        const double topFrequency;
+        
+        AudioServer::ProcessorChain chain;
+        juce::AudioBuffer<float> output;
+        int decaySamples = 0;
+        
+        ChainAnalyser::CaseResult result;
+    };
+}
+
+//==============================================================================
+juce::String ChainAnalyser::CaseResult::toString() const
+{
+    auto text = juce::String(passed ? "PASS " : "FAIL ") + presetName + " @ " + juce::String(sampleRate, 0) + " Hz: "
+              + "magnitude " + juce::String(magnitudeErrorDb, 4) + " dB, "
+              + "phase " + juce::String(phaseErrorDegrees, 3) + " degrees, "
+              + "THD+N " + juce::String(thdPlusNoiseDb, 1) + " dB, "
+              + "noise floor " + juce::String(noiseFloorDb, 1) + " dB, "
+              + "float deviation " + juce::String(floatDeviationDb, 1) + " dB";
+    
+    for (const auto& failure : failures)
+        text << "\n    " << failure;
+    
+    return text;
+}
+
+juce::String ChainAnalyser::Report::toString() const
+{
+    juce::StringArray lines;
+    
+    for (const auto& result : cases)
+        lines.add(result.toString());
+    
+    if (cases.isEmpty())
+        lines.add("No cases run");
+    else if (numFailed == 0)
+        lines.add("All " + juce::String(cases.size()) + " cases passed");
+    else
+        lines.add(juce::String(numFailed) + " of " + juce::String(cases.size()) + " cases failed");
+    
+    return lines.joinIntoString("\n");
+}
+
+//==============================================================================
+ChainAnalyser::Report ChainAnalyser::run(const juce::Array<Preset>& presets, const Settings& settings)
+{
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    Report report;
+    
+    juce::OwnedArray<CaseAnalysis> analyses;
+    
+    for (const auto& preset : presets)
+        for (auto sampleRate : settings.sampleRates)
+            if (sampleRate > 0.0)
+                analyses.add(new CaseAnalysis(preset, sampleRate, settings));
+    
+    if (!analyses.isEmpty())
+    {
+        auto numCpus = juce::jmax(1, juce::SystemStats::getNumCpus());
+        auto numThreads = settings.numThreads > 0 ? settings.numThreads : numCpus;
+        
+        juce::WaitableEvent finished;
+        std::atomic<int> remaining { analyses.size() };
+        
+        juce::ThreadPool pool(juce::jmin(analyses.size(), numThreads));
+        
+        for (auto* analysis : analyses)
+        {
+            pool.addJob([analysis, &remaining, &finished]
+            {
+                Tracing::setThreadName("Chain Analyser");
+                
+                {
+                    TRACE_SCOPE("Chain analysis");
+                    analysis->run();
+                }
+                
+                if (--remaining == 0)
+                    finished.signal();
+            });
+        }
+        
+        finished.wait();
+    }
+    
+    for (auto* analysis : analyses)
+    {
+        report.cases.add(analysis->getResult());
+        
+        if (!analysis->getResult().passed)
+            ++report.numFailed;
+    }
+    
+    report.elapsedMs = juce::Time::getMillisecondCounterHiRes() - startTime;
+    
+    DBG("ChainAnalyser: " + juce::String(report.cases.size()) + " cases, " + juce::String(report.numFailed)
+        + " failed in " + juce::String(report.elapsedMs, 1) + " ms");
+    
+    return report;
+}
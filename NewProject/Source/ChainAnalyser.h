@@ -0,0 +1,106 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioServer.h"
+
+//==============================================================================
+/**
+ * ChainAnalyser runs presets through a real ProcessorChain offline and checks
+ * that what the chain does matches the curve the UI draws, and that the float
+ * fast paths keep their precision.
+ *
+ * Each preset gets a fresh chain at each sample rate and four stimuli:
+ *
+ * - an exponential sine sweep; dividing the output spectrum by the input's at
+ *   each ResponseEvaluator grid point gives the measured magnitude and phase
+ * - a multitone of sines on exact DFT bins, measured in steady state; what is
+ *   left once the tones are removed is the noise floor
+ * - single sines, for THD+N
+ * - white noise, compared with an all-double EQFilterBank for the deviation
+ *   of the float path
+ *
+ * Analysis is all in double, and cases run in parallel across all CPU cores.
+ * Every measurement is checked against a tolerance, so the report can gate a
+ * build or a change to the kernels.
+ */
+class ChainAnalyser
+{
+public:
+    //==============================================================================
+    struct Preset
+    {
+        juce::String name;
+        juce::Array<EQBand> bands;
+    };
+    
+    struct Settings
+    {
+        juce::Array<double> sampleRates { 44100.0, 48000.0, 96000.0, 192000.0 };
+        int numChannels = 2;            // More channels bind wider kernel variants
+        int blockSize = 512;
+        
+        // Response grid, as drawn by the UI; the top is kept below 0.45 x the
+        // sample rate, where the sweep still has energy
+        int numPoints = 256;
+        float minFrequency = 20.0f;
+        float maxFrequency = 20000.0f;
+        
+        // Response is only compared where the curve is above this, since deep
+        // notches and stop bands measure the noise rather than the filter
+        float minCompareDb = -60.0f;
+        
+        float stimulusLevelDb = -6.0f;
+        float sweepSeconds = 1.0f;
+        float noiseSeconds = 0.5f;
+        int numTones = 48;
+        juce::Array<float> thdFrequencies { 100.0f, 1000.0f, 10000.0f };
+        
+        // Tolerances
+        float maxMagnitudeErrorDb = 0.01f;
+        float maxPhaseErrorDegrees = 0.1f;
+        float maxThdPlusNoiseDb = -100.0f;
+        float maxNoiseFloorDb = -110.0f;
+        float maxFloatDeviationDb = -90.0f;
+        
+        int numThreads = 0;             // 0 = one per CPU core
+        juce::int64 randomSeed = 1;
+    };
+    
+    struct CaseResult
+    {
+        juce::String presetName;
+        double sampleRate = 0.0;
+        
+        // Worst over the sweep and multitone points, against the UI curve
+        float magnitudeErrorDb = 0.0f;
+        float magnitudeErrorFrequency = 0.0f;
+        float phaseErrorDegrees = 0.0f;
+        float phaseErrorFrequency = 0.0f;
+        
+        float thdPlusNoiseDb = 0.0f;        // Worst test tone, relative to the tone
+        float noiseFloorDb = 0.0f;          // Multitone residual, RMS relative to full scale
+        float floatDeviationDb = 0.0f;      // Float chain error relative to the double reference
+        
+        bool passed = false;
+        juce::StringArray failures;
+        
+        juce::String toString() const;
+    };
+    
+    struct Report
+    {
+        juce::Array<CaseResult> cases;
+        int numFailed = 0;
+        double elapsedMs = 0.0;
+        
+        bool passed() const { return numFailed == 0 && !cases.isEmpty(); }
+        juce::String toString() const;
+    };
+    
+    //==============================================================================
+    static Report run(const juce::Array<Preset>& presets, const Settings& settings);
+    static Report run(const juce::Array<Preset>& presets) { return run(presets, Settings()); }
+    
+private:
+    ChainAnalyser() = delete;
+};
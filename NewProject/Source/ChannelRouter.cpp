@@ -0,0 +1,265 @@
+#include "ChannelRouter.h"
+
+//==============================================================================
+ChannelRouter::Matrix::Matrix(int destinations, int sources)
+    : numDestinations(juce::jmax(0, destinations)),
+      numSources(juce::jmax(0, sources))
+{
+    gains.insertMultiple(0, 0.0f, numDestinations * numSources);
+}
+
+ChannelRouter::Matrix ChannelRouter::Matrix::identity(int destinations, int sources)
+{
+    Matrix matrix(destinations, sources);
+    
+    for (int channel = 0; channel < juce::jmin(destinations, sources); ++channel)
+        matrix.setGain(channel, channel, 1.0f);
+    
+    return matrix;
+}
+
+float ChannelRouter::Matrix::getGain(int destination, int source) const
+{
+    if (!juce::isPositiveAndBelow(destination, numDestinations) || !juce::isPositiveAndBelow(source, numSources))
+        return 0.0f;
+    
+    return gains[destination * numSources + source];
+}
+
+void ChannelRouter::Matrix::setGain(int destination, int source, float gain)
+{
+    if (juce::isPositiveAndBelow(destination, numDestinations) && juce::isPositiveAndBelow(source, numSources))
+        gains.set(destination * numSources + source, gain);
+}
+
+//==============================================================================
+ChannelRouter::Routing ChannelRouter::Routing::passthrough(int numInputs, int numOutputs, int numProcessingChannels)
+{
+    Routing routing;
+    routing.numProcessingChannels = numProcessingChannels;
+    routing.input = Matrix::identity(numProcessingChannels, numInputs);
+    routing.output = Matrix::identity(numOutputs, numProcessingChannels);
+    return routing;
+}
+
+bool ChannelRouter::Routing::isValid(juce::String& errorMessage) const
+{
+    if (!juce::isPositiveAndNotGreaterThan(numProcessingChannels, maxChannels))
+    {
+        errorMessage = "Routing needs between 1 and " + juce::String(maxChannels) + " processing channels";
+        return false;
+    }
+    
+    if (input.getNumDestinations() != numProcessingChannels || output.getNumSources() != numProcessingChannels)
+    {
+        errorMessage = "Input matrix rows and output matrix columns must match the "
+                       + juce::String(numProcessingChannels) + " processing channels";
+        return false;
+    }
+    
+    if (input.getNumSources() > maxChannels || output.getNumDestinations() > maxChannels)
+    {
+        errorMessage = "Routing supports at most " + juce::String(maxChannels) + " device channels each way";
+        return false;
+    }
+    
+    juce::BigInteger used;
+    
+    for (auto first : midSidePairs)
+    {
+        if (first < 0 || first + 1 >= numProcessingChannels || used[first] || used[first + 1])
+        {
+            errorMessage = "Invalid mid/side pair at processing channel " + juce::String(first + 1);
+            return false;
+        }
+        
+        used.setRange(first, 2, true);
+    }
+    
+    return true;
+}
+
+//==============================================================================
+bool ChannelRouter::setRouting(const Routing& newRouting, juce::String& errorMessage)
+{
+    if (!newRouting.isValid(errorMessage))
+        return false;
+    
+    // Compile outside the lock, and swap so the old routing is freed here
+    // rather than on the audio thread
+    auto compiled = compile(newRouting);
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(routingLock);
+        routing = newRouting;
+        std::swap(pending, compiled);
+        routingChanged = true;
+    }
+    
+    return true;
+}
+
+void ChannelRouter::clearRouting()
+{
+    Compiled none;
+    
+    const juce::SpinLock::ScopedLockType lock(routingLock);
+    routing = {};
+    std::swap(pending, none);
+    routingChanged = true;
+}
+
+bool ChannelRouter::hasRouting() const
+{
+    const juce::SpinLock::ScopedLockType lock(routingLock);
+    return pending.active;
+}
+
+ChannelRouter::Routing ChannelRouter::getRouting() const
+{
+    const juce::SpinLock::ScopedLockType lock(routingLock);
+    return routing;
+}
+
+int ChannelRouter::getNumProcessingChannels() const
+{
+    const juce::SpinLock::ScopedLockType lock(routingLock);
+    return pending.active ? pending.numProcessingChannels : 0;
+}
+
+//==============================================================================
+ChannelRouter::SparseMatrix ChannelRouter::compress(const Matrix& matrix)
+{
+    SparseMatrix sparse;
+    sparse.numDestinations = matrix.getNumDestinations();
+    sparse.numSources = matrix.getNumSources();
+    sparse.rowStart.add(0);
+    
+    for (int destination = 0; destination < sparse.numDestinations; ++destination)
+    {
+        for (int source = 0; source < sparse.numSources; ++source)
+        {
+            auto gain = matrix.getGain(destination, source);
+            
+            if (gain != 0.0f)
+            {
+                sparse.sourceIndex.add(source);
+                sparse.gains.add(gain);
+            }
+        }
+        
+        sparse.rowStart.add(sparse.gains.size());
+    }
+    
+    return sparse;
+}
+
+ChannelRouter::Compiled ChannelRouter::compile(const Routing& routing)
+{
+    auto input = routing.input;
+    auto output = routing.output;
+    
+    // With processing channels a and b carrying M = (a + b) / 2 and
+    // S = (a - b) / 2, the input rows become half the sum and difference of
+    // the original rows, and the output columns the sum and difference of
+    // the original columns, since a = M + S and b = M - S
+    for (auto a : routing.midSidePairs)
+    {
+        auto b = a + 1;
+        
+        for (int source = 0; source < input.getNumSources(); ++source)
+        {
+            auto gainA = input.getGain(a, source), gainB = input.getGain(b, source);
+            input.setGain(a, source, 0.5f * (gainA + gainB));
+            input.setGain(b, source, 0.5f * (gainA - gainB));
+        }
+        
+        for (int destination = 0; destination < output.getNumDestinations(); ++destination)
+        {
+            auto gainA = output.getGain(destination, a), gainB = output.getGain(destination, b);
+            output.setGain(destination, a, gainA + gainB);
+            output.setGain(destination, b, gainA - gainB);
+        }
+    }
+    
+    Compiled compiled;
+    compiled.active = true;
+    compiled.numProcessingChannels = routing.numProcessingChannels;
+    compiled.input = compress(input);
+    compiled.output = compress(output);
+    return compiled;
+}
+
+//==============================================================================
+void ChannelRouter::prepare(int maxBlockSize)
+{
+    maxBlockSize = juce::jmax(1, maxBlockSize);
+    silence.setSize(1, maxBlockSize);
+    silence.clear();
+    discard.setSize(1, maxBlockSize);
+}
+
+int ChannelRouter::beginBlock()
+{
+    // Called on the audio thread: swapping leaves the old routing in pending,
+    // where the next setRouting() frees it
+    const juce::SpinLock::ScopedTryLockType lock(routingLock);
+    
+    if (lock.isLocked() && routingChanged)
+    {
+        std::swap(current, pending);
+        routingChanged = false;
+    }
+    
+    return current.active ? current.numProcessingChannels : 0;
+}
+
+void ChannelRouter::mixInputs(const DSPKernels& kernels, const float* const* inputs, int numInputs,
+                              juce::AudioBuffer<float>& processing, int numSamples)
+{
+    mix(kernels, current.input, processing.getArrayOfWritePointers(), processing.getNumChannels(),
+        inputs, numInputs, numSamples);
+}
+
+void ChannelRouter::mixOutputs(const DSPKernels& kernels, const juce::AudioBuffer<float>& processing,
+                               float* const* outputs, int numOutputs, int numSamples)
+{
+    mix(kernels, current.output, outputs, numOutputs, processing.getArrayOfReadPointers(),
+        processing.getNumChannels(), numSamples);
+}
+
+void ChannelRouter::mix(const DSPKernels& kernels, const SparseMatrix& matrix, float* const* destinations, int numDestinations,
+                        const float* const* sources, int numSources, int numSamples)
+{
+    // Missing sources read silence and missing destinations write to a
+    // scratch channel, so the kernel never sees a null pointer. Those are
+    // sized in prepare(), so a longer block than the device promised is mixed
+    // in chunks rather than growing them here.
+    auto chunkSize = silence.getNumSamples();
+    jassert(chunkSize > 0);
+    
+    const float* rowSources[maxChannels];
+    float* rowDestinations[maxChannels];
+    auto numRows = juce::jmin(matrix.numDestinations, numDestinations);
+    
+    for (int start = 0; chunkSize > 0 && start < numSamples; start += chunkSize)
+    {
+        auto numChunkSamples = juce::jmin(chunkSize, numSamples - start);
+        
+        for (int source = 0; source < matrix.numSources; ++source)
+            rowSources[source] = source < numSources && sources[source] != nullptr ? sources[source] + start
+                                                                                   : silence.getReadPointer(0);
+        
+        for (int destination = 0; destination < numRows; ++destination)
+            rowDestinations[destination] = destinations[destination] != nullptr ? destinations[destination] + start
+                                                                                 : discard.getWritePointer(0);
+        
+        kernels.sparseMix(rowDestinations, numRows, rowSources, matrix.rowStart.begin(),
+                          matrix.sourceIndex.begin(), matrix.gains.begin(), numChunkSamples);
+    }
+    
+    // Destinations the matrix has no row for stay silent
+    for (int destination = numRows; destination < numDestinations; ++destination)
+        if (destinations[destination] != nullptr)
+            juce::FloatVectorOperations::clear(destinations[destination], numSamples);
+}
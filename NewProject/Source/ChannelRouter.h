@@ -0,0 +1,134 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DSPKernels.h"
+
+//==============================================================================
+/**
+ * ChannelRouter maps device inputs to processing channels and processing
+ * channels to device outputs through two gain matrices, which covers
+ * downmixes, crossfeed and speaker arrays.
+ *
+ * Processing channel pairs can be carried as mid/side. The encode and decode
+ * are folded into the two matrices when the routing is compiled, so they cost
+ * nothing extra per sample.
+ *
+ * Most matrix entries are zero, so the compiled routing keeps only the
+ * non-zero entries of each row and mixes them with DSPKernels::sparseMix. An
+ * input-to-output pass costs one multiply-add per sample per entry rather
+ * than per matrix cell.
+ *
+ * Routing is set on the message thread and picked up by the audio thread on
+ * its next block, so gains can be changed while running.
+ */
+class ChannelRouter
+{
+public:
+    //==============================================================================
+    static constexpr int maxChannels = 64;
+    
+    // Dense gains, one row per destination and one column per source
+    struct Matrix
+    {
+        Matrix() = default;
+        Matrix(int numDestinations, int numSources);
+        
+        // Destination n takes source n at unity gain
+        static Matrix identity(int numDestinations, int numSources);
+        
+        int getNumDestinations() const  { return numDestinations; }
+        int getNumSources() const       { return numSources; }
+        
+        float getGain(int destination, int source) const;
+        void setGain(int destination, int source, float gain);
+        
+    private:
+        int numDestinations = 0;
+        int numSources = 0;
+        juce::Array<float> gains;
+    };
+    
+    struct Routing
+    {
+        int numProcessingChannels = 2;
+        
+        Matrix input;       // Processing channels from device inputs
+        Matrix output;      // Device outputs from processing channels
+        
+        // First channel of each processing channel pair carried as mid/side
+        juce::Array<int> midSidePairs;
+        
+        // Straight through: input n and output n both map to processing channel n
+        static Routing passthrough(int numInputs, int numOutputs, int numProcessingChannels);
+        
+        bool isValid(juce::String& errorMessage) const;
+    };
+    
+    //==============================================================================
+    ChannelRouter() = default;
+    
+    // Message thread. Without a routing the audio server uses its direct
+    // channel-for-channel path.
+    bool setRouting(const Routing& routing, juce::String& errorMessage);
+    void clearRouting();
+    
+    bool hasRouting() const;
+    Routing getRouting() const;
+    
+    // Processing channels the routing needs, or 0 without one
+    int getNumProcessingChannels() const;
+    
+    //==============================================================================
+    // Audio thread
+    void prepare(int maxBlockSize);
+    
+    // Picks up a newly set routing. Returns its processing channel count, or
+    // 0 if there is no routing to apply.
+    int beginBlock();
+    
+    void mixInputs(const DSPKernels& kernels, const float* const* inputs, int numInputs,
+                   juce::AudioBuffer<float>& processing, int numSamples);
+    void mixOutputs(const DSPKernels& kernels, const juce::AudioBuffer<float>& processing,
+                    float* const* outputs, int numOutputs, int numSamples);
+                    
+private:
+    //==============================================================================
+    // One matrix keeping only its non-zero entries, row by row
+    struct SparseMatrix
+    {
+        int numDestinations = 0;
+        int numSources = 0;
+        juce::Array<int> rowStart;      // numDestinations + 1 entries
+        juce::Array<int> sourceIndex;
+        juce::Array<float> gains;
+    };
+    
+    struct Compiled
+    {
+        bool active = false;
+        int numProcessingChannels = 0;
+        SparseMatrix input, output;
+    };
+    
+    static SparseMatrix compress(const Matrix& matrix);
+    static Compiled compile(const Routing& routing);
+    
+    void mix(const DSPKernels& kernels, const SparseMatrix& matrix, float* const* destinations, int numDestinations,
+             const float* const* sources, int numSources, int numSamples);
+    
+    //==============================================================================
+    // Message thread copy, and the compiled routing waiting for the audio
+    // thread, guarded by routingLock
+    Routing routing;
+    Compiled pending;
+    mutable juce::SpinLock routingLock;
+    bool routingChanged = false;
+    
+    // Audio thread
+    Compiled current;
+    
+    // Stand in for missing device channels, one prepared block long
+    juce::AudioBuffer<float> silence, discard;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ChannelRouter)
+};
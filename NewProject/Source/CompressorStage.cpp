@@ -0,0 +1,418 @@
+#include "CompressorStage.h"
+
+namespace
+{
+    float getCoefficient(float timeMs, double sampleRate)
+    {
+        return (float) std::exp(-1.0 / (juce::jmax(0.01, (double) timeMs) * 0.001 * sampleRate));
+    }
+    
+    CompressorStage::Band getBand(const CompressorStage::Settings& settings, int band)
+    {
+        return juce::isPositiveAndBelow(band, settings.bands.size()) ? settings.bands.getReference(band)
+                                                                     : CompressorStage::Band();
+    }
+}
+
+//==============================================================================
+bool CompressorStage::Settings::isValid(juce::String& errorMessage) const
+{
+    if (getNumBands() < minBands || getNumBands() > maxBands)
+    {
+        errorMessage = "Compressor needs between " + juce::String(minBands) + " and " + juce::String(maxBands) + " bands";
+        return false;
+    }
+    
+    for (int i = 0; i < frequencies.size(); ++i)
+    {
+        if (frequencies[i] < 10.0f || (i > 0 && frequencies[i] <= frequencies[i - 1]))
+        {
+            errorMessage = "Compressor crossover frequencies must be above 10 Hz and rising";
+            return false;
+        }
+    }
+    
+    for (const auto& band : bands)
+    {
+        if (band.ratio < 1.0f || band.kneeDb < 0.0f || band.attackMs <= 0.0f || band.releaseMs <= 0.0f)
+        {
+            errorMessage = "Compressor bands need a ratio of at least 1, a knee of at least 0 dB and positive times";
+            return false;
+        }
+        
+        if (std::abs(band.makeupDb) > maxMakeupDb)
+        {
+            errorMessage = "Compressor make-up gain must be within " + juce::String(maxMakeupDb) + " dB";
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+//==============================================================================
+bool CompressorStage::setSettings(const Settings& newSettings, juce::String& errorMessage)
+{
+    if (!newSettings.isValid(errorMessage))
+        return false;
+    
+    double sampleRate;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        sampleRate = preparedSampleRate;
+    }
+    
+    // Compile outside the lock; the audio thread only ever copies the result
+    auto compiled = compile(newSettings, sampleRate);
+    
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    settings = newSettings;
+    pending = compiled;
+    settingsChanged = true;
+    return true;
+}
+
+CompressorStage::Settings CompressorStage::getSettings() const
+{
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    return settings;
+}
+
+CompressorStage::Compiled CompressorStage::compile(const Settings& settings, double sampleRate)
+{
+    Compiled compiled;
+    compiled.enabled = settings.enabled;
+    compiled.numBands = settings.getNumBands();
+    compiled.detector = settings.detector;
+    compiled.link = settings.link;
+    
+    // Low crossovers put poles close to z = 1, as with low EQ bands
+    EQBand lowest;
+    lowest.frequency = settings.frequencies.getFirst();
+    auto useDoubleState = EQPlan::needsDoublePrecision(lowest, sampleRate);
+    
+    juce::Array<BiquadCoefficients> sections;
+    
+    for (int index = 0; index < compiled.numBands; ++index)
+    {
+        auto b = (size_t) index;
+        
+        CrossoverStage::designWay(settings.slope, settings.frequencies.begin(), settings.frequencies.size(), index,
+                                  sampleRate, sections);
+        compiled.plans[b] = EQPlan::fromSections(sections.begin(), sections.size(), useDoubleState);
+        
+        auto band = getBand(settings, index);
+        compiled.attack[b] = getCoefficient(band.attackMs, sampleRate);
+        compiled.release[b] = getCoefficient(band.releaseMs, sampleRate);
+        compiled.thresholdDb[b] = band.thresholdDb;
+        compiled.halfKneeDb[b] = band.kneeDb * 0.5f;
+        compiled.kneeScale[b] = band.kneeDb > 0.0f ? 0.5f / band.kneeDb : 0.0f;
+        
+        // A bypassed band still passes through its split, at unity gain
+        compiled.slope[b] = band.bypassed ? 0.0f : 1.0f / juce::jmax(1.0f, band.ratio) - 1.0f;
+        compiled.makeupDb[b] = band.bypassed ? 0.0f : band.makeupDb;
+    }
+    
+    return compiled;
+}
+
+//==============================================================================
+float CompressorStage::getGainReductionDb(int band) const
+{
+    if (juce::isPositiveAndBelow(band, maxBands))
+        return gainReductionDb[(size_t) band].load(std::memory_order_relaxed);
+    
+    return 0.0f;
+}
+
+void CompressorStage::takeMeterSnapshot(Meter& meter)
+{
+    meter.numBands = numMeteredBands.load(std::memory_order_relaxed);
+    
+    for (size_t band = 0; band < (size_t) maxBands; ++band)
+        meter.gainReductionDb[band] = heldReductionDb[band].exchange(0.0f, std::memory_order_relaxed);
+}
+
+//==============================================================================
+void CompressorStage::prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernelsToUse)
+{
+    numPreparedChannels = juce::jlimit(1, maxChannels, numChannels);
+    numLaneChannels = numPreparedChannels;
+    kernels = &kernelsToUse;
+    
+    // The detectors run as many lanes as bands times link groups, so they can
+    // use wider vectors than the band split
+    detectorKernels = &DSPKernels::getForChannels(maxBands * numPreparedChannels);
+    
+    auto blockSize = juce::jmax(1, maxBlockSize);
+    
+    for (auto& bank : banks)
+        bank.prepare(numPreparedChannels, blockSize, kernelsToUse);
+    
+    // Lanes are padded to a multiple of the widest kernel's 16
+    bandSignals.setSize(maxBands * numPreparedChannels, blockSize);
+    frames.calloc((size_t) (juce::jmin(CompressorLanes::maxLanes, (maxBands * numPreparedChannels + 15) / 16 * 16) * blockSize));
+    
+    // Coefficients and time constants depend on the sample rate, so recompile
+    Settings current;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        preparedSampleRate = sampleRate;
+        current = settings;
+    }
+    
+    auto compiled = compile(current, sampleRate);
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        pending = compiled;
+        settingsChanged = true;
+    }
+    
+    active = {};
+    updateSettings();
+    reset();
+}
+
+void CompressorStage::reset()
+{
+    for (auto& bank : banks)
+        bank.reset();
+    
+    envelopes.fill(0.0f);
+    
+    for (auto& reduction : gainReductionDb)
+        reduction.store(0.0f, std::memory_order_relaxed);
+}
+
+void CompressorStage::updateSettings()
+{
+    // Called on the audio thread: never wait for the message thread, just pick
+    // up new settings on a later block if the lock is busy
+    const juce::SpinLock::ScopedTryLockType lock(settingsLock);
+    
+    if (!lock.isLocked() || !settingsChanged)
+        return;
+    
+    auto layoutChanged = pending.numBands != active.numBands || pending.link != active.link
+                      || pending.detector != active.detector;
+    
+    active = pending;
+    settingsChanged = false;
+    
+    for (int band = 0; band < maxBands; ++band)
+        banks[(size_t) band].setPlan(active.plans[(size_t) band]);
+    
+    updateLanes();
+    
+    // Envelopes belong to lanes that may have moved, or hold a different measure
+    if (layoutChanged)
+        reset();
+}
+
+int CompressorStage::getNumLinkGroups() const
+{
+    switch (active.link)
+    {
+        case Link::None:    return numLaneChannels;
+        case Link::Stereo:  return (numLaneChannels + 1) / 2;
+        case Link::All:     return 1;
+    }
+    
+    return numLaneChannels;
+}
+
+int CompressorStage::getLinkGroupSize(int group) const
+{
+    switch (active.link)
+    {
+        case Link::None:    return 1;
+        case Link::Stereo:  return juce::jmin(2, numLaneChannels - group * 2);
+        case Link::All:     return numLaneChannels;
+    }
+    
+    return 1;
+}
+
+int CompressorStage::getLinkGroup(int channel) const
+{
+    switch (active.link)
+    {
+        case Link::None:    return channel;
+        case Link::Stereo:  return channel / 2;
+        case Link::All:     return 0;
+    }
+    
+    return channel;
+}
+
+void CompressorStage::updateLanes()
+{
+    numLinkGroups = getNumLinkGroups();
+    
+    auto numUsed = active.numBands * numLinkGroups;
+    auto width = detectorKernels->biquadLanes;
+    numLanes = juce::jmin(CompressorLanes::maxLanes, (numUsed + width - 1) / width * width);
+    
+    // Padding lanes see silence and all-zero parameters, which is unity gain
+    lanes = {};
+    
+    auto levelScale = active.detector == Detector::Peak ? 6.0205999f : 3.0103000f;
+    
+    for (int band = 0; band < active.numBands; ++band)
+    {
+        auto b = (size_t) band;
+        
+        for (int group = 0; group < numLinkGroups; ++group)
+        {
+            auto lane = band * numLinkGroups + group;
+            
+            if (lane >= CompressorLanes::maxLanes)
+                break;
+            
+            lanes.attack[lane] = active.attack[b];
+            lanes.release[lane] = active.release[b];
+            lanes.levelScale[lane] = levelScale;
+            lanes.thresholdDb[lane] = active.thresholdDb[b];
+            lanes.halfKneeDb[lane] = active.halfKneeDb[b];
+            lanes.kneeScale[lane] = active.kneeScale[b];
+            lanes.slope[lane] = active.slope[b];
+            lanes.makeupDb[lane] = active.makeupDb[b];
+        }
+    }
+    
+    numMeteredBands.store(active.enabled ? active.numBands : 0, std::memory_order_relaxed);
+}
+
+//==============================================================================
+void CompressorStage::process(juce::AudioBuffer<float>& buffer)
+{
+    updateSettings();
+    
+    auto numChannels = juce::jmin(buffer.getNumChannels(), numPreparedChannels);
+    auto numSamples = buffer.getNumSamples();
+    
+    if (!active.enabled || numChannels < 1)
+        return;
+    
+    // Link groups follow the channels actually processed, so a narrower
+    // block doesn't leave its groups averaging channels it doesn't have
+    if (numChannels != numLaneChannels)
+    {
+        numLaneChannels = numChannels;
+        updateLanes();
+        envelopes.fill(0.0f);
+    }
+    
+    laneReductionDb.fill(0.0f);
+    
+    auto blockSize = bandSignals.getNumSamples();
+    
+    for (int start = 0; start < numSamples; start += blockSize)
+    {
+        auto blockSamples = juce::jmin(blockSize, numSamples - start);
+        
+        // Every band filters its own copy of the input
+        for (int band = 0; band < active.numBands; ++band)
+        {
+            float* targets[maxChannels];
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                targets[channel] = bandSignals.getWritePointer(band * numPreparedChannels + channel);
+                kernels->copy(targets[channel], buffer.getReadPointer(channel, start), blockSamples);
+            }
+            
+            banks[(size_t) band].process(targets, numChannels, blockSamples);
+        }
+        
+        gatherDetectorInputs(numChannels, blockSamples);
+        detectorKernels->compressorGain(frames, blockSamples, numLanes, lanes, envelopes.data(), laneReductionDb.data());
+        applyGains(buffer, numChannels, start, blockSamples);
+    }
+    
+    publishReduction();
+}
+
+void CompressorStage::gatherDetectorInputs(int numChannels, int numSamples)
+{
+    juce::FloatVectorOperations::clear(frames.get(), numLanes * numSamples);
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        auto group = getLinkGroup(channel);
+        
+        // Mean square over the channels in the group
+        auto scale = 1.0f / (float) getLinkGroupSize(group);
+        
+        for (int band = 0; band < active.numBands; ++band)
+        {
+            auto lane = band * numLinkGroups + group;
+            auto* source = bandSignals.getReadPointer(band * numPreparedChannels + channel);
+            auto* dest = frames + lane;
+            
+            if (active.detector == Detector::Peak)
+            {
+                for (int i = 0; i < numSamples; ++i)
+                    dest[i * numLanes] = juce::jmax(dest[i * numLanes], std::abs(source[i]));
+            }
+            else
+            {
+                for (int i = 0; i < numSamples; ++i)
+                    dest[i * numLanes] += source[i] * source[i] * scale;
+            }
+        }
+    }
+}
+
+void CompressorStage::applyGains(juce::AudioBuffer<float>& buffer, int numChannels, int startSample, int numSamples)
+{
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        auto* dest = buffer.getWritePointer(channel, startSample);
+        auto group = getLinkGroup(channel);
+        
+        for (int band = 0; band < active.numBands; ++band)
+        {
+            auto lane = band * numLinkGroups + group;
+            auto* source = bandSignals.getReadPointer(band * numPreparedChannels + channel);
+            const float* gains = frames + lane;
+            
+            if (band == 0)
+            {
+                for (int i = 0; i < numSamples; ++i)
+                    dest[i] = source[i] * gains[i * numLanes];
+            }
+            else
+            {
+                for (int i = 0; i < numSamples; ++i)
+                    dest[i] += source[i] * gains[i * numLanes];
+            }
+        }
+    }
+}
+
+void CompressorStage::publishReduction()
+{
+    for (int band = 0; band < active.numBands; ++band)
+    {
+        auto deepest = 0.0f;
+        
+        for (int group = 0; group < numLinkGroups; ++group)
+        {
+            deepest = juce::jmax(deepest, laneReductionDb[(size_t) (band * numLinkGroups + group)]);
+        }
+        
+        auto b = (size_t) band;
+        gainReductionDb[b].store(deepest, std::memory_order_relaxed);
+        
+        // Raise the held reduction unless the meter has taken a deeper one since
+        auto held = heldReductionDb[b].load(std::memory_order_relaxed);
+        
+        while (deepest > held && !heldReductionDb[b].compare_exchange_weak(held, deepest, std::memory_order_relaxed))
+        {
+        }
+    }
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQFilterBank.h"
+#include "CrossoverStage.h"
+
+//==============================================================================
+/**
+ * CompressorStage is a 3-5 band compressor for gentle dynamics control of
+ * system audio, e.g. for late-night listening.
+ *
+ * The bands are split with the same phase-compensated Linkwitz-Riley cascades
+ * as CrossoverStage, so with no gain reduction they sum back to an all-pass
+ * and the stage leaves the magnitude response flat. Each band's cascade is
+ * the same for every channel, so it runs as one EQFilterBank across all of
+ * them on the SIMD kernels.
+ *
+ * Detection and gain computing for every band and channel then run in a
+ * single DSPKernels::compressorGain pass: one lane per band and link group,
+ * side by side in vector registers. A lane's detector follows the peak or
+ * the mean square of its channels with its band's attack and release; its
+ * gain computer applies a soft-knee threshold and ratio and the make-up gain.
+ * Linked channels share one lane, so they always get the same gain and the
+ * stereo image holds.
+ *
+ * Gain reduction is metered per band with atomics, so the UI reads it without
+ * locks. Nothing on the audio thread allocates: all buffers are sized in
+ * prepare(). The stage adds no latency.
+ */
+class CompressorStage
+{
+public:
+    //==============================================================================
+    static constexpr int minBands = 3;
+    static constexpr int maxBands = 5;
+    static constexpr int maxChannels = 64;          // As many as the chain can have
+    static constexpr float maxMakeupDb = 24.0f;
+    
+    enum class Detector
+    {
+        Peak,
+        Rms             // Mean square, smoothed by the attack and release
+    };
+    
+    enum class Link
+    {
+        None,           // Each channel compressed on its own
+        Stereo,         // Channels in pairs: 1-2, 3-4 and so on
+        All             // One gain per band for every channel
+    };
+    
+    struct Band
+    {
+        float thresholdDb = -24.0f;
+        float ratio = 2.0f;
+        float kneeDb = 6.0f;
+        float attackMs = 10.0f;
+        float releaseMs = 150.0f;
+        float makeupDb = 0.0f;
+        bool bypassed = false;
+    };
+    
+    struct Settings
+    {
+        bool enabled = false;
+        
+        // One fewer than the number of bands, rising
+        juce::Array<float> frequencies { 150.0f, 2500.0f };
+        CrossoverStage::Slope slope = CrossoverStage::Slope::LR4;
+        
+        // Lowest band first; bands without an entry use the defaults
+        juce::Array<Band> bands;
+        
+        Detector detector = Detector::Rms;
+        Link link = Link::Stereo;
+        
+        int getNumBands() const { return frequencies.size() + 1; }
+        bool isValid(juce::String& errorMessage) const;
+    };
+    
+    // Gain reduction in dB, positive, for each band
+    struct Meter
+    {
+        int numBands = 0;
+        std::array<float, maxBands> gainReductionDb {};
+    };
+    
+    //==============================================================================
+    CompressorStage() = default;
+    
+    // Message thread. Takes effect on the next block.
+    bool setSettings(const Settings& newSettings, juce::String& errorMessage);
+    Settings getSettings() const;
+    
+    // The deepest reduction of the latest block, from any thread
+    float getGainReductionDb(int band) const;
+    
+    // The deepest reduction since the previous snapshot, so a meter reading
+    // less often than blocks arrive still sees every one. Take snapshots from
+    // one thread only, since taking one resets them.
+    void takeMeterSnapshot(Meter& meter);
+    
+    //==============================================================================
+    // Audio thread
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernels);
+    void process(juce::AudioBuffer<float>& buffer);
+    void reset();
+    
+private:
+    //==============================================================================
+    // Settings resolved for one sample rate: plain data, so the audio thread
+    // can copy it under the lock
+    struct Compiled
+    {
+        bool enabled = false;
+        int numBands = 0;
+        Detector detector = Detector::Rms;
+        Link link = Link::Stereo;
+        
+        std::array<EQPlan, maxBands> plans;
+        
+        // Per band, ready for CompressorLanes
+        std::array<float, maxBands> attack {}, release {}, thresholdDb {}, halfKneeDb {}, kneeScale {},
+                                    slope {}, makeupDb {};
+    };
+    
+    static Compiled compile(const Settings& settings, double sampleRate);
+    
+    void updateSettings();
+    void updateLanes();
+    int getNumLinkGroups() const;
+    int getLinkGroupSize(int group) const;
+    int getLinkGroup(int channel) const;
+    
+    void gatherDetectorInputs(int numChannels, int numSamples);
+    void applyGains(juce::AudioBuffer<float>& buffer, int numChannels, int startSample, int numSamples);
+    void publishReduction();
+    
+    //==============================================================================
+    // Message thread copy and the compiled version waiting for the audio
+    // thread, guarded by settingsLock
+    Settings settings;
+    Compiled pending;
+    mutable juce::SpinLock settingsLock;
+    bool settingsChanged = false;
+    double preparedSampleRate = 48000.0;
+    
+    // Audio thread
+    Compiled active;
+    int numPreparedChannels = 0;
+    int numLaneChannels = 0;                    // Channels the lanes are laid out for: the latest block's
+    const DSPKernels* kernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+    const DSPKernels* detectorKernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+    
+    std::array<EQFilterBank<float>, maxBands> banks;
+    juce::AudioBuffer<float> bandSignals;       // Band b of channel c in channel b * numChannels + c
+    
+    // One frame of detector inputs, then gains, per sample: numLanes wide,
+    // lane b * numLinkGroups + g for band b and link group g
+    CompressorLanes lanes {};
+    juce::HeapBlock<float> frames;
+    int numLanes = 0;
+    int numLinkGroups = 0;
+    static_assert(maxBands * maxChannels <= CompressorLanes::maxLanes, "Every band and channel needs a lane");
+    std::array<float, CompressorLanes::maxLanes> envelopes {};
+    std::array<float, CompressorLanes::maxLanes> laneReductionDb {};
+    
+    std::array<std::atomic<float>, maxBands> gainReductionDb {};
+    std::array<std::atomic<float>, maxBands> heldReductionDb {};
+    std::atomic<int> numMeteredBands { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CompressorStage)
+};
@@ -0,0 +1,417 @@
+#include "CrossoverStage.h"
+
+namespace
+{
+    // RBJ all-pass, with the same frequency warping as the cookbook low- and
+    // high-passes, so a crossover's two halves still sum to it exactly
+    BiquadCoefficients designAllPass(double frequency, double q, double sampleRate)
+    {
+        frequency = juce::jlimit(1.0, sampleRate * 0.49, frequency);
+        
+        auto w0 = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+        auto cosW0 = std::cos(w0);
+        auto alpha = std::sin(w0) / (2.0 * q);
+        auto a0 = 1.0 + alpha;
+        
+        BiquadCoefficients c;
+        c.b0 = (1.0 - alpha) / a0;
+        c.b1 = -2.0 * cosW0 / a0;
+        c.b2 = 1.0;
+        c.a1 = c.b1;
+        c.a2 = c.b0;
+        return c;
+    }
+    
+    // An LR filter is a Butterworth filter of half its order, applied twice
+    int getButterworthOrder(CrossoverStage::Slope slope)
+    {
+        return slope == CrossoverStage::Slope::LR8 ? 4 : 2;
+    }
+    
+    double getButterworthQ(int order, int section)
+    {
+        return 1.0 / (2.0 * std::cos(juce::MathConstants<double>::pi * (2 * section + 1) / (2.0 * order)));
+    }
+    
+    float getWayFactor(const CrossoverStage::Settings& settings, int way)
+    {
+        if (!juce::isPositiveAndBelow(way, settings.ways.size()))
+            return 1.0f;
+        
+        const auto& settingsForWay = settings.ways.getReference(way);
+        auto gain = juce::Decibels::decibelsToGain(settingsForWay.gainDb);
+        
+        return settingsForWay.invertPolarity ? -gain : gain;
+    }
+    
+    float getWayDelayMs(const CrossoverStage::Settings& settings, int way)
+    {
+        return juce::isPositiveAndBelow(way, settings.ways.size()) ? settings.ways.getReference(way).delayMs : 0.0f;
+    }
+}
+
+//==============================================================================
+int CrossoverStage::Settings::getNumOutputs() const
+{
+    auto waysPerMain = bassManagement ? getNumWays() - 1 : getNumWays();
+    auto hasSub = bassManagement || lfeInput >= 0;
+    
+    return getNumMains() * waysPerMain + (hasSub ? 1 : 0);
+}
+
+int CrossoverStage::Settings::getOutputChannel(int input, int way) const
+{
+    if (input == lfeInput || !juce::isPositiveAndBelow(input, numInputs) || !juce::isPositiveAndBelow(way, getNumWays()))
+        return -1;
+    
+    auto firstWay = bassManagement ? 1 : 0;
+    
+    if (way < firstWay)
+        return -1;
+    
+    auto main = lfeInput >= 0 && input > lfeInput ? input - 1 : input;
+    return main * (getNumWays() - firstWay) + way - firstWay;
+}
+
+int CrossoverStage::Settings::getSubOutputChannel() const
+{
+    return bassManagement || lfeInput >= 0 ? getNumOutputs() - 1 : -1;
+}
+
+bool CrossoverStage::Settings::isValid(juce::String& errorMessage) const
+{
+    if (!juce::isPositiveAndNotGreaterThan(numInputs, maxInputs))
+    {
+        errorMessage = "Crossover needs between 1 and " + juce::String(maxInputs) + " inputs";
+        return false;
+    }
+    
+    if (frequencies.isEmpty() || getNumWays() > maxWays)
+    {
+        errorMessage = "Crossover needs between 2 and " + juce::String(maxWays) + " ways";
+        return false;
+    }
+    
+    for (int i = 0; i < frequencies.size(); ++i)
+    {
+        if (frequencies[i] < 10.0f || (i > 0 && frequencies[i] <= frequencies[i - 1]))
+        {
+            errorMessage = "Crossover frequencies must be above 10 Hz and rising";
+            return false;
+        }
+    }
+    
+    if (lfeInput >= numInputs || lfeInput < -1 || getNumMains() < 1)
+    {
+        errorMessage = "Crossover LFE input " + juce::String(lfeInput) + " leaves no inputs to split";
+        return false;
+    }
+    
+    for (const auto& way : ways)
+    {
+        if (way.delayMs < 0.0f || way.delayMs > maxDelayMs)
+        {
+            errorMessage = "Crossover delays must be between 0 and " + juce::String(maxDelayMs) + " ms";
+            return false;
+        }
+    }
+    
+    if (getNumProcessingChannels() > maxOutputs)
+    {
+        errorMessage = "Crossover needs " + juce::String(getNumProcessingChannels()) + " processing channels, more than "
+                       + juce::String(maxOutputs);
+        return false;
+    }
+    
+    return true;
+}
+
+//==============================================================================
+bool CrossoverStage::setSettings(const Settings& newSettings, juce::String& errorMessage)
+{
+    if (!newSettings.isValid(errorMessage))
+        return false;
+    
+    double sampleRate;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        sampleRate = preparedSampleRate;
+    }
+    
+    // Compile outside the lock; the audio thread only ever copies the result
+    auto compiled = compile(newSettings, sampleRate);
+    
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    settings = newSettings;
+    pending = compiled;
+    settingsChanged = true;
+    return true;
+}
+
+CrossoverStage::Settings CrossoverStage::getSettings() const
+{
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    return settings;
+}
+
+void CrossoverStage::designWay(Slope slope, const float* frequencies, int numFrequencies, int way,
+                               double sampleRate, juce::Array<BiquadCoefficients>& sections)
+{
+    sections.clearQuick();
+    
+    auto order = getButterworthOrder(slope);
+    
+    auto addPass = [&] (EQBand::Type type, float frequency)
+    {
+        EQBand band;
+        band.type = type;
+        band.frequency = frequency;
+        
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int section = 0; section < order / 2; ++section)
+            {
+                band.q = (float) getButterworthQ(order, section);
+                sections.add(BiquadCoefficients::design(band, sampleRate));
+            }
+        }
+    };
+    
+    // Below this way's band, its own upper edge, then the phase of the
+    // crossovers above it, which the ways below pick up from their splits
+    for (int f = 0; f < juce::jmin(way, numFrequencies); ++f)
+        addPass(EQBand::Type::HighPass, frequencies[f]);
+    
+    if (way < numFrequencies)
+        addPass(EQBand::Type::LowPass, frequencies[way]);
+    
+    for (int f = way + 1; f < numFrequencies; ++f)
+        for (int section = 0; section < order / 2; ++section)
+            sections.add(designAllPass(frequencies[f], getButterworthQ(order, section), sampleRate));
+}
+
+CrossoverStage::Compiled CrossoverStage::compile(const Settings& settings, double sampleRate)
+{
+    Compiled compiled;
+    compiled.enabled = settings.enabled;
+    compiled.numInputs = settings.numInputs;
+    compiled.numWays = settings.getNumWays();
+    compiled.numOutputs = settings.getNumOutputs();
+    compiled.lfeInput = settings.lfeInput;
+    compiled.bassManagement = settings.bassManagement;
+    compiled.subOutput = settings.getSubOutputChannel();
+    
+    for (int input = 0; input < settings.numInputs; ++input)
+        if (input != settings.lfeInput)
+            compiled.mains[(size_t) compiled.numMains++] = input;
+    
+    // Low crossovers put poles close to z = 1, as with low EQ bands
+    EQBand lowest;
+    lowest.frequency = settings.frequencies.getFirst();
+    auto useDoubleState = EQPlan::needsDoublePrecision(lowest, sampleRate);
+    
+    juce::Array<BiquadCoefficients> sections;
+    
+    for (int way = 0; way < compiled.numWays; ++way)
+    {
+        designWay(settings.slope, settings.frequencies.begin(), settings.frequencies.size(), way, sampleRate, sections);
+        
+        auto factor = (double) getWayFactor(settings, way);
+        auto& first = sections.getReference(0);
+        first.b0 *= factor;
+        first.b1 *= factor;
+        first.b2 *= factor;
+        
+        compiled.plans[(size_t) way] = EQPlan::fromSections(sections.begin(), sections.size(), useDoubleState);
+        
+        auto delaySamples = juce::roundToInt(getWayDelayMs(settings, way) * 0.001 * sampleRate);
+        
+        for (int input = 0; input < settings.numInputs; ++input)
+        {
+            auto output = settings.getOutputChannel(input, way);
+            
+            if (juce::isPositiveAndBelow(output, maxOutputs))
+                compiled.outputDelay[(size_t) output] = delaySamples;
+        }
+    }
+    
+    // Managed, the LFE joins the lowest way on the subwoofer and takes its
+    // gain, polarity and delay too
+    compiled.lfeGain = juce::Decibels::decibelsToGain(settings.lfeGainDb);
+    
+    if (settings.bassManagement)
+    {
+        compiled.lfeGain *= getWayFactor(settings, 0);
+        compiled.outputDelay[(size_t) compiled.subOutput] = juce::roundToInt(getWayDelayMs(settings, 0) * 0.001 * sampleRate);
+    }
+    
+    return compiled;
+}
+
+bool CrossoverStage::Compiled::hasSameLayout(const Compiled& other) const
+{
+    return numInputs == other.numInputs && numWays == other.numWays && numOutputs == other.numOutputs
+        && mains == other.mains && lfeInput == other.lfeInput && bassManagement == other.bassManagement;
+}
+
+//==============================================================================
+void CrossoverStage::prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernels)
+{
+    numPreparedChannels = juce::jlimit(1, maxOutputs, numChannels);
+    auto blockSize = juce::jmax(1, maxBlockSize);
+    
+    for (auto& bank : banks)
+        bank.prepare(juce::jmin(maxInputs, numPreparedChannels), blockSize, kernels);
+    
+    inputs.setSize(maxInputs, blockSize);
+    lows.setSize(maxInputs, blockSize);
+    delayLines.setSize(numPreparedChannels, (int) std::ceil(maxDelayMs * 0.001 * sampleRate) + 1);
+    
+    // Coefficients and delays depend on the sample rate, so recompile
+    Settings current;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        preparedSampleRate = sampleRate;
+        current = settings;
+    }
+    
+    auto compiled = compile(current, sampleRate);
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        pending = compiled;
+        settingsChanged = true;
+    }
+    
+    active = {};
+    updateSettings();
+    reset();
+}
+
+void CrossoverStage::reset()
+{
+    for (auto& bank : banks)
+        bank.reset();
+    
+    delayLines.clear();
+    delayPosition = 0;
+}
+
+void CrossoverStage::updateSettings()
+{
+    // Called on the audio thread: never wait for the message thread, just pick
+    // up new settings on a later block if the lock is busy
+    const juce::SpinLock::ScopedTryLockType lock(settingsLock);
+    
+    if (!lock.isLocked() || !settingsChanged)
+        return;
+    
+    auto layoutChanged = !pending.hasSameLayout(active);
+    auto delaysChanged = pending.outputDelay != active.outputDelay;
+    
+    active = pending;
+    settingsChanged = false;
+    
+    for (int way = 0; way < maxWays; ++way)
+        banks[(size_t) way].setPlan(active.plans[(size_t) way]);
+    
+    // Filter state belongs to channels that may have moved
+    if (layoutChanged)
+        reset();
+    else if (delaysChanged)
+        delayLines.clear();
+}
+
+//==============================================================================
+void CrossoverStage::process(juce::AudioBuffer<float>& buffer)
+{
+    updateSettings();
+    
+    auto numChannels = buffer.getNumChannels();
+    auto numSamples = buffer.getNumSamples();
+    
+    if (!active.enabled || numChannels < juce::jmax(active.numInputs, active.numOutputs)
+        || active.numOutputs > numPreparedChannels || active.numInputs > juce::jmin(maxInputs, numPreparedChannels))
+        return;
+    
+    auto firstWay = active.bassManagement ? 1 : 0;
+    auto waysPerMain = active.numWays - firstWay;
+    
+    for (int start = 0; start < numSamples; start += inputs.getNumSamples())
+    {
+        auto blockSamples = juce::jmin(inputs.getNumSamples(), numSamples - start);
+        
+        // Outputs overwrite the inputs, so split from copies
+        for (int input = 0; input < active.numInputs; ++input)
+            inputs.copyFrom(input, 0, buffer, input, start, blockSamples);
+        
+        for (int way = 0; way < active.numWays; ++way)
+        {
+            float* targets[maxInputs];
+            
+            for (int main = 0; main < active.numMains; ++main)
+            {
+                targets[main] = way < firstWay ? lows.getWritePointer(main)
+                                            : buffer.getWritePointer(main * waysPerMain + way - firstWay, start);
+                
+                juce::FloatVectorOperations::copy(targets[main], inputs.getReadPointer(active.mains[(size_t) main]),
+                                                  blockSamples);
+            }
+            
+            banks[(size_t) way].process(targets, active.numMains, blockSamples);
+        }
+        
+        if (active.subOutput >= 0)
+        {
+            auto* sub = buffer.getWritePointer(active.subOutput, start);
+            juce::FloatVectorOperations::clear(sub, blockSamples);
+            
+            if (active.bassManagement)
+                for (int main = 0; main < active.numMains; ++main)
+                    juce::FloatVectorOperations::add(sub, lows.getReadPointer(main), blockSamples);
+            
+            if (active.lfeInput >= 0)
+                juce::FloatVectorOperations::addWithMultiply(sub, inputs.getReadPointer(active.lfeInput),
+                                                             active.lfeGain, blockSamples);
+        }
+        
+        for (int channel = active.numOutputs; channel < numChannels; ++channel)
+            buffer.clear(channel, start, blockSamples);
+    }
+    
+    applyDelays(buffer, numSamples);
+}
+
+void CrossoverStage::applyDelays(juce::AudioBuffer<float>& buffer, int numSamples)
+{
+    auto length = delayLines.getNumSamples();
+    
+    for (int channel = 0; channel < active.numOutputs; ++channel)
+    {
+        auto delay = juce::jmin(length - 1, active.outputDelay[(size_t) channel]);
+        
+        if (delay <= 0)
+            continue;
+        
+        auto* samples = buffer.getWritePointer(channel);
+        auto* line = delayLines.getWritePointer(channel);
+        auto write = delayPosition;
+        auto read = (write - delay + length) % length;
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            line[write] = samples[i];
+            samples[i] = line[read];
+            
+            if (++write == length)
+                write = 0;
+            
+            if (++read == length)
+                read = 0;
+        }
+    }
+    
+    delayPosition = (delayPosition + numSamples) % length;
+}
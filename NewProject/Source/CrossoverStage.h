@@ -0,0 +1,154 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQFilterBank.h"
+
+//==============================================================================
+/**
+ * CrossoverStage splits each input channel into 2-4 ways with Linkwitz-Riley
+ * crossovers, for active speakers and subwoofers, and manages the bass.
+ *
+ * Each way is designed as one cascade straight from the input: high-passes at
+ * the crossovers below it, a low-pass at its own upper edge, and all-passes
+ * matching the crossovers above it. The ways then sum back to an all-pass,
+ * whatever the number of ways, and every way of every channel is in phase
+ * with the others. A way's cascade is the same for every channel, so it runs
+ * as one EQFilterBank across all of them, on the SIMD kernels, and a 7.1
+ * three-way split is three kernel calls.
+ *
+ * Each way has its own gain, polarity and delay. Gain and polarity are folded
+ * into the way's first section, so they cost nothing per sample.
+ *
+ * With bass management the lowest way of every input is summed, with the LFE,
+ * into a single subwoofer output. Without it each input keeps all its ways and
+ * the LFE has an output of its own.
+ *
+ * The stage reads the first numInputs processing channels and writes its
+ * outputs from channel 0, input by input and way by way from the lowest, then
+ * the subwoofer last; the routing's output matrix sends them to the device.
+ * The chain needs max(numInputs, getNumOutputs()) processing channels; with
+ * fewer the stage passes audio through unchanged.
+ *
+ * Settings are compiled on the message thread and picked up by the audio
+ * thread on its next block.
+ */
+class CrossoverStage
+{
+public:
+    //==============================================================================
+    static constexpr int maxInputs = 16;
+    static constexpr int maxWays = 4;
+    static constexpr int maxOutputs = 64;
+    static constexpr float maxDelayMs = 50.0f;
+    
+    enum class Slope
+    {
+        LR4,        // 24 dB/octave
+        LR8         // 48 dB/octave
+    };
+    
+    struct Way
+    {
+        float gainDb = 0.0f;
+        float delayMs = 0.0f;
+        bool invertPolarity = false;
+    };
+    
+    struct Settings
+    {
+        bool enabled = false;
+        int numInputs = 2;
+        
+        // One fewer than the number of ways, rising
+        juce::Array<float> frequencies { 80.0f };
+        Slope slope = Slope::LR4;
+        
+        // Lowest way first; ways without an entry use the defaults
+        juce::Array<Way> ways;
+        
+        int lfeInput = -1;                  // Not split, e.g. 3 for 5.1 and 7.1; -1 for none
+        float lfeGainDb = 10.0f;            // The usual in-band LFE gain
+        bool bassManagement = false;
+        
+        int getNumWays() const              { return frequencies.size() + 1; }
+        int getNumMains() const             { return lfeInput >= 0 ? numInputs - 1 : numInputs; }
+        int getNumOutputs() const;
+        int getNumProcessingChannels() const { return juce::jmax(numInputs, getNumOutputs()); }
+        
+        // Where a way of an input ends up, or -1 for the LFE input and for
+        // ways summed into the subwoofer
+        int getOutputChannel(int input, int way) const;
+        
+        // The subwoofer, or the LFE's own output; -1 if there is neither
+        int getSubOutputChannel() const;
+        
+        bool isValid(juce::String& errorMessage) const;
+    };
+    
+    //==============================================================================
+    CrossoverStage() = default;
+    
+    // Message thread. Takes effect on the next block.
+    bool setSettings(const Settings& newSettings, juce::String& errorMessage);
+    Settings getSettings() const;
+    
+    // The sections of one way's cascade, without its gain
+    static void designWay(Slope slope, const float* frequencies, int numFrequencies, int way,
+                          double sampleRate, juce::Array<BiquadCoefficients>& sections);
+    
+    //==============================================================================
+    // Audio thread
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernels);
+    void process(juce::AudioBuffer<float>& buffer);
+    void reset();
+    
+private:
+    //==============================================================================
+    // Settings resolved for one sample rate: plain data, so the audio thread
+    // can copy it under the lock
+    struct Compiled
+    {
+        bool enabled = false;
+        int numInputs = 0;
+        int numWays = 0;
+        int numOutputs = 0;
+        
+        std::array<int, maxInputs> mains {};
+        int numMains = 0;
+        int lfeInput = -1;
+        float lfeGain = 1.0f;
+        bool bassManagement = false;
+        int subOutput = -1;
+        
+        std::array<EQPlan, maxWays> plans;
+        std::array<int, maxOutputs> outputDelay {};
+        
+        bool hasSameLayout(const Compiled& other) const;
+    };
+    
+    static Compiled compile(const Settings& settings, double sampleRate);
+    
+    void updateSettings();
+    void applyDelays(juce::AudioBuffer<float>& buffer, int numSamples);
+    
+    //==============================================================================
+    // Message thread copy and the compiled version waiting for the audio
+    // thread, guarded by settingsLock
+    Settings settings;
+    Compiled pending;
+    mutable juce::SpinLock settingsLock;
+    bool settingsChanged = false;
+    double preparedSampleRate = 48000.0;
+    
+    // Audio thread
+    Compiled active;
+    int numPreparedChannels = 0;
+    
+    std::array<EQFilterBank<float>, maxWays> banks;
+    juce::AudioBuffer<float> inputs;        // Copies of the inputs, before outputs overwrite them
+    juce::AudioBuffer<float> lows;          // Lowest way of each main, on its way to the subwoofer
+    juce::AudioBuffer<float> delayLines;
+    int delayPosition = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CrossoverStage)
+};
@@ -0,0 +1,790 @@
+#include "DSPKernels.h"
+
+// Every variant has to round identically, so multiplies and adds must not be
+// fused into FMAs where the instruction set happens to have them
+#if JUCE_CLANG
+ #pragma STDC FP_CONTRACT OFF
+#elif JUCE_GCC
+ #pragma GCC optimize("fp-contract=off")
+#endif
+
+#if JUCE_INTEL && (JUCE_CLANG || JUCE_GCC)
+ #define MACEQ_X86_VARIANTS 1
+#endif
+
+// GCC unrolls some lane loops completely and then can't vectorise the
+// straight-line code; kept as loops, they vectorise across the lanes
+#if JUCE_GCC
+ #define MACEQ_LANE_LOOP _Pragma("GCC unroll 1")
+#else
+ #define MACEQ_LANE_LOOP
+#endif
+
+namespace
+{
+    //==============================================================================
+    // Kernel bodies, written so the compiler can vectorise them for whatever
+    // instruction set the calling variant targets
+    
+    // Reductions always use this many partial results, whatever the vector width
+    constexpr int numPartials = 16;
+    
+    template <int Lanes, typename StateType>
+    forcedinline void biquadSection(float* frames, int numFrames, const BiquadKernel<StateType>& k, StateType* state)
+    {
+        StateType s1[Lanes], s2[Lanes];
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            s1[lane] = state[lane];
+            s2[lane] = state[Lanes + lane];
+        }
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * Lanes;
+            
+            for (int lane = 0; lane < Lanes; ++lane)
+            {
+                auto x = (StateType) frame[lane];
+                auto y = k.b0 * x + s1[lane];
+                s1[lane] = k.b1 * x - k.a1 * y + s2[lane];
+                s2[lane] = k.b2 * x - k.a2 * y;
+                frame[lane] = (float) y;
+            }
+        }
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            state[lane] = s1[lane];
+            state[Lanes + lane] = s2[lane];
+        }
+    }
+    
+    // Two sections in one pass over the frames. Each recursion is latency
+    // bound, and running two independent ones side by side lets the CPU
+    // overlap them. The arithmetic is the same as two single passes.
+    template <int Lanes, typename StateType>
+    forcedinline void biquadSectionPair(float* frames, int numFrames, const BiquadKernel<StateType>& k,
+                                        const BiquadKernel<StateType>& m, StateType* kState, StateType* mState)
+    {
+        StateType ks1[Lanes], ks2[Lanes], ms1[Lanes], ms2[Lanes];
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            ks1[lane] = kState[lane];
+            ks2[lane] = kState[Lanes + lane];
+            ms1[lane] = mState[lane];
+            ms2[lane] = mState[Lanes + lane];
+        }
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * Lanes;
+            
+            for (int lane = 0; lane < Lanes; ++lane)
+            {
+                auto x = (StateType) frame[lane];
+                auto y = k.b0 * x + ks1[lane];
+                ks1[lane] = k.b1 * x - k.a1 * y + ks2[lane];
+                ks2[lane] = k.b2 * x - k.a2 * y;
+                
+                // Rounding to float between sections matches the single pass
+                auto u = (StateType) (float) y;
+                auto z = m.b0 * u + ms1[lane];
+                ms1[lane] = m.b1 * u - m.a1 * z + ms2[lane];
+                ms2[lane] = m.b2 * u - m.a2 * z;
+                frame[lane] = (float) z;
+            }
+        }
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            kState[lane] = ks1[lane];
+            kState[Lanes + lane] = ks2[lane];
+            mState[lane] = ms1[lane];
+            mState[Lanes + lane] = ms2[lane];
+        }
+    }
+    
+    template <int Lanes, typename StateType>
+    forcedinline void biquadCascadeBody(float* frames, int numFrames, const BiquadKernel<StateType>* sections,
+                                        int numSections, StateType* state)
+    {
+        int s = 0;
+        
+        for (; s + 1 < numSections; s += 2)
+            biquadSectionPair<Lanes>(frames, numFrames, sections[s], sections[s + 1],
+                                     state + s * 2 * Lanes, state + (s + 1) * 2 * Lanes);
+        
+        if (s < numSections)
+            biquadSection<Lanes>(frames, numFrames, sections[s], state + s * 2 * Lanes);
+    }
+    
+    template <int Lanes>
+    forcedinline void interleaveBody(float* frames, const float* const* channels, int numChannels, int startSample, int numFrames)
+    {
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            if (lane < numChannels)
+            {
+                auto* source = channels[lane] + startSample;
+                
+                for (int i = 0; i < numFrames; ++i)
+                    frames[i * Lanes + lane] = source[i];
+            }
+            else
+            {
+                for (int i = 0; i < numFrames; ++i)
+                    frames[i * Lanes + lane] = 0.0f;
+            }
+        }
+    }
+    
+    template <int Lanes>
+    forcedinline void deinterleaveBody(float* const* channels, int numChannels, int startSample, const float* frames, int numFrames)
+    {
+        for (int lane = 0; lane < juce::jmin(Lanes, numChannels); ++lane)
+        {
+            auto* dest = channels[lane] + startSample;
+            
+            for (int i = 0; i < numFrames; ++i)
+                dest[i] = frames[i * Lanes + lane];
+        }
+    }
+    
+    forcedinline float findAbsolutePeakBody(const float* samples, int numSamples)
+    {
+        float partials[numPartials] = {};
+        int i = 0;
+        
+        for (; i + numPartials <= numSamples; i += numPartials)
+            for (int p = 0; p < numPartials; ++p)
+                partials[p] = juce::jmax(partials[p], std::abs(samples[i + p]));
+        
+        for (; i < numSamples; ++i)
+            partials[0] = juce::jmax(partials[0], std::abs(samples[i]));
+        
+        auto peak = 0.0f;
+        
+        for (auto partial : partials)
+            peak = juce::jmax(peak, partial);
+        
+        return peak;
+    }
+    
+    forcedinline float sumOfSquaresBody(const float* samples, int numSamples)
+    {
+        float partials[numPartials] = {};
+        int i = 0;
+        
+        for (; i + numPartials <= numSamples; i += numPartials)
+            for (int p = 0; p < numPartials; ++p)
+                partials[p] += samples[i + p] * samples[i + p];
+        
+        for (; i < numSamples; ++i)
+            partials[0] += samples[i] * samples[i];
+        
+        auto sum = 0.0f;
+        
+        for (auto partial : partials)
+            sum += partial;
+        
+        return sum;
+    }
+    
+    template <typename Dest, typename Source>
+    forcedinline void convertBody(Dest* dest, const Source* source, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = (Dest) source[i];
+    }
+    
+    // Samples accumulated per pass. Summing into a local array of fixed
+    // length, rather than into the destination, lets the compiler vectorise
+    // without proving that rows and sources don't alias.
+    constexpr int mixChunkSize = 64;
+    
+    template <bool IsFullChunk>
+    forcedinline void sparseMixChunk(float* dest, const float* const* sources, const int* sourceIndex,
+                                     const float* gains, int first, int last, int start, int numSamples)
+    {
+        float sum[mixChunkSize] = {};
+        auto n = IsFullChunk ? mixChunkSize : numSamples;
+        int e = first;
+        
+        // Entries in pairs halve the passes over sum; the additions happen in
+        // the same order as one entry at a time
+        for (; e + 1 < last; e += 2)
+        {
+            auto* source1 = sources[sourceIndex[e]] + start;
+            auto* source2 = sources[sourceIndex[e + 1]] + start;
+            auto gain1 = gains[e], gain2 = gains[e + 1];
+            
+            for (int i = 0; i < n; ++i)
+                sum[i] = (sum[i] + source1[i] * gain1) + source2[i] * gain2;
+        }
+        
+        if (e < last)
+        {
+            auto* source = sources[sourceIndex[e]] + start;
+            auto gain = gains[e];
+            
+            for (int i = 0; i < n; ++i)
+                sum[i] += source[i] * gain;
+        }
+        
+        for (int i = 0; i < n; ++i)
+            dest[start + i] = sum[i];
+    }
+    
+    forcedinline void sparseMixBody(float* const* destinations, int numDestinations, const float* const* sources,
+                                    const int* rowStart, const int* sourceIndex, const float* gains, int numSamples)
+    {
+        for (int d = 0; d < numDestinations; ++d)
+        {
+            auto first = rowStart[d], last = rowStart[d + 1];
+            int start = 0;
+            
+            for (; start + mixChunkSize <= numSamples; start += mixChunkSize)
+                sparseMixChunk<true>(destinations[d], sources, sourceIndex, gains, first, last, start, mixChunkSize);
+            
+            if (start < numSamples)
+                sparseMixChunk<false>(destinations[d], sources, sourceIndex, gains, first, last, start, numSamples - start);
+        }
+    }
+    
+    forcedinline void applyWindowBody(float* dest, const float* source, const float* window, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = source[i] * window[i];
+    }
+    
+    forcedinline void magnitudeSquaredBody(float* dest, const float* complexData, int numBins)
+    {
+        for (int i = 0; i < numBins; ++i)
+            dest[i] = complexData[i * 2] * complexData[i * 2] + complexData[i * 2 + 1] * complexData[i * 2 + 1];
+    }
+    
+    // The compressor kernel compares through integers and takes maxima by
+    // arithmetic, since a float comparison may trap and compilers then won't
+    // turn a select into a blend
+    forcedinline juce::int32 toBits(float x)
+    {
+        juce::int32 bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return bits;
+    }
+    
+    forcedinline float fromBits(juce::int32 bits)
+    {
+        float x;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+    
+    // max(x, 0), exactly
+    forcedinline float positivePart(float x)
+    {
+        return 0.5f * (x + fromBits(toBits(x) & 0x7fffffff));
+    }
+    
+    // log2 and exp2 from the float's bits and a polynomial, so they vectorise
+    // where the library calls wouldn't; within 1e-5 octaves, i.e. 0.0001 dB
+    forcedinline float fastLog2(float x)
+    {
+        auto bits = toBits(x);
+        auto exponent = (float) ((bits >> 23) - 127);
+        
+        // log2(1 + t) for t in [0, 1), exact at t = 0
+        auto t = fromBits((bits & 0x007fffff) | 0x3f800000) - 1.0f;
+        auto p = -0.034595213f;
+        p = p * t + 0.14643362f;
+        p = p * t - 0.30338967f;
+        p = p * t + 0.46930169f;
+        p = p * t - 0.72044237f;
+        p = p * t + 1.44268325f;
+        
+        return exponent + p * t;
+    }
+    
+    // For x up to 126
+    forcedinline float fastExp2(float x)
+    {
+        x = positivePart(x + 126.0f) - 126.0f;
+        
+        // Truncating a positive number floors it
+        auto whole = (juce::int32) (x + 128.0f) - 128;
+        auto fraction = x - (float) whole;
+        
+        // 2^f for f in [0, 1), exact at f = 0 so unity gain stays unity
+        auto p = 0.0018951057f;
+        p = p * fraction + 0.0089462187f;
+        p = p * fraction + 0.0558632791f;
+        p = p * fraction + 0.2401407714f;
+        p = p * fraction + 0.6931546198f;
+        p = p * fraction + 1.0f;
+        
+        return p * fromBits((whole + 127) << 23);
+    }
+    
+    // Each vector of lanes keeps its envelopes in registers across the frames.
+    // There are no branches, so the lanes stay in step.
+    template <int Lanes>
+    forcedinline void compressorGainBody(float* frames, int numFrames, int numLanes, const CompressorLanes& lanes,
+                                         float* envelope, float* maxReductionDb)
+    {
+        constexpr float dbToOctaves = 0.16609640f;      // log2(10) / 20
+        
+        for (int base = 0; base < numLanes; base += Lanes)
+        {
+            float attack[Lanes], release[Lanes], levelScale[Lanes], threshold[Lanes], halfKnee[Lanes],
+                  kneeScale[Lanes], slope[Lanes], makeup[Lanes], env[Lanes];
+            juce::int32 deepest[Lanes];
+            
+            for (int lane = 0; lane < Lanes; ++lane)
+            {
+                attack[lane] = lanes.attack[base + lane];
+                release[lane] = lanes.release[base + lane];
+                levelScale[lane] = lanes.levelScale[base + lane];
+                threshold[lane] = lanes.thresholdDb[base + lane];
+                halfKnee[lane] = lanes.halfKneeDb[base + lane];
+                kneeScale[lane] = lanes.kneeScale[base + lane];
+                slope[lane] = lanes.slope[base + lane];
+                makeup[lane] = lanes.makeupDb[base + lane];
+                env[lane] = envelope[base + lane];
+                deepest[lane] = toBits(maxReductionDb[base + lane]);
+            }
+            
+            for (int i = 0; i < numFrames; ++i)
+            {
+                auto* frame = frames + i * numLanes + base;
+                
+                for (int lane = 0; lane < Lanes; ++lane)
+                {
+                    // Attack while the input is above the envelope
+                    auto x = frame[lane];
+                    auto rising = -(juce::int32) (toBits(x - env[lane]) > 0);
+                    auto coefficient = fromBits((toBits(attack[lane]) & rising) | (toBits(release[lane]) & ~rising));
+                    
+                    // The offset keeps the envelope out of denormals and its log finite
+                    env[lane] = x + coefficient * (env[lane] - x) + 1.0e-20f;
+                    
+                    // Soft knee: the part of the knee reached, squared, plus
+                    // anything above it; a hard knee has no knee to reach
+                    auto over = levelScale[lane] * fastLog2(env[lane]) - threshold[lane];
+                    auto aboveKnee = positivePart(over - halfKnee[lane]);
+                    auto inKnee = positivePart(over + halfKnee[lane]) - aboveKnee;
+                    auto gainDb = slope[lane] * (aboveKnee + inKnee * inKnee * kneeScale[lane]);
+                    
+                    // Reductions are never negative, so their bits order as integers
+                    auto reduction = toBits(-gainDb);
+                    deepest[lane] = reduction > deepest[lane] ? reduction : deepest[lane];
+                    
+                    frame[lane] = fastExp2((gainDb + makeup[lane]) * dbToOctaves);
+                }
+            }
+            
+            for (int lane = 0; lane < Lanes; ++lane)
+            {
+                envelope[base + lane] = env[lane];
+                maxReductionDb[base + lane] = fromBits(deepest[lane]);
+            }
+        }
+    }
+    
+    // Trapezoidal SVF update, the same for fixed and per-frame coefficients.
+    // s1 and s2 are the section's two integrator states.
+    #define MACEQ_SVF_TICK(input, output, s1, s2, a1, a2, a3, m0, m1, m2) \
+        { \
+            auto v0 = (input); \
+            auto v3 = v0 - (s2); \
+            auto v1 = (a1) * (s1) + (a2) * v3; \
+            auto v2 = (s2) + (a2) * (s1) + (a3) * v3; \
+            (s1) = 2.0f * v1 - (s1); \
+            (s2) = 2.0f * v2 - (s2); \
+            (output) = (m0) * v0 + (m1) * v1 + (m2) * v2; \
+        }
+    
+    template <int Lanes>
+    forcedinline void svfSection(float* frames, int numFrames, const SvfKernel& kernel, float* state)
+    {
+        // A local copy, which the frame stores can't alias
+        const auto k = kernel;
+        float ic1[Lanes], ic2[Lanes];
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            ic1[lane] = state[lane];
+            ic2[lane] = state[Lanes + lane];
+        }
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * Lanes;
+            
+            MACEQ_LANE_LOOP
+            for (int lane = 0; lane < Lanes; ++lane)
+                MACEQ_SVF_TICK(frame[lane], frame[lane], ic1[lane], ic2[lane], k.a1, k.a2, k.a3, k.m0, k.m1, k.m2)
+        }
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            state[lane] = ic1[lane];
+            state[Lanes + lane] = ic2[lane];
+        }
+    }
+    
+    // Two sections per pass, as for the biquads: the second section's work on
+    // a frame overlaps the first's on the next, which hides the latency of
+    // the recursion where there are few lanes
+    template <int Lanes>
+    forcedinline void svfSectionPair(float* frames, int numFrames, const SvfKernel& kernelK, const SvfKernel& kernelM,
+                                     float* kState, float* mState)
+    {
+        const auto k = kernelK;
+        const auto m = kernelM;
+        float k1[Lanes], k2[Lanes], m1[Lanes], m2[Lanes];
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            k1[lane] = kState[lane];
+            k2[lane] = kState[Lanes + lane];
+            m1[lane] = mState[lane];
+            m2[lane] = mState[Lanes + lane];
+        }
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * Lanes;
+            
+            MACEQ_LANE_LOOP
+            for (int lane = 0; lane < Lanes; ++lane)
+            {
+                float u;
+                MACEQ_SVF_TICK(frame[lane], u, k1[lane], k2[lane], k.a1, k.a2, k.a3, k.m0, k.m1, k.m2)
+                MACEQ_SVF_TICK(u, frame[lane], m1[lane], m2[lane], m.a1, m.a2, m.a3, m.m0, m.m1, m.m2)
+            }
+        }
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            kState[lane] = k1[lane];
+            kState[Lanes + lane] = k2[lane];
+            mState[lane] = m1[lane];
+            mState[Lanes + lane] = m2[lane];
+        }
+    }
+    
+    template <int Lanes>
+    forcedinline void svfCascadeBody(float* frames, int numFrames, const SvfKernel* sections, int numSections,
+                                     float* state)
+    {
+        int s = 0;
+        
+        for (; s + 1 < numSections; s += 2)
+            svfSectionPair<Lanes>(frames, numFrames, sections[s], sections[s + 1],
+                                  state + s * 2 * Lanes, state + (s + 1) * 2 * Lanes);
+        
+        if (s < numSections)
+            svfSection<Lanes>(frames, numFrames, sections[s], state + s * 2 * Lanes);
+    }
+    
+    template <int Lanes>
+    forcedinline void svfModulatedBody(float* frames, int numFrames, const SvfFrames& c, float* state)
+    {
+        float ic1[Lanes], ic2[Lanes];
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            ic1[lane] = state[lane];
+            ic2[lane] = state[Lanes + lane];
+        }
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            auto* frame = frames + i * Lanes;
+            
+            MACEQ_LANE_LOOP
+            for (int lane = 0; lane < Lanes; ++lane)
+                MACEQ_SVF_TICK(frame[lane], frame[lane], ic1[lane], ic2[lane],
+                               c.a1[i], c.a2[i], c.a3[i], c.m0[i], c.m1[i], c.m2[i])
+        }
+        
+        for (int lane = 0; lane < Lanes; ++lane)
+        {
+            state[lane] = ic1[lane];
+            state[Lanes + lane] = ic2[lane];
+        }
+    }
+    
+    #undef MACEQ_SVF_TICK
+    
+    // tan(x) for x in [0, 0.49 pi], as the ratio of sine and cosine series
+    // taken far enough to be exact in float; near the top, where the cosine is
+    // small, the error grows to a few parts per million
+    forcedinline float fastTan(float x)
+    {
+        auto x2 = x * x;
+        
+        auto s = -2.5052108e-8f;
+        s = s * x2 + 2.7557319e-6f;
+        s = s * x2 - 1.9841270e-4f;
+        s = s * x2 + 8.3333333e-3f;
+        s = s * x2 - 1.6666667e-1f;
+        s = s * x2 + 1.0f;
+        
+        auto c = 2.0876757e-9f;
+        c = c * x2 - 2.7557319e-7f;
+        c = c * x2 + 2.4801587e-5f;
+        c = c * x2 - 1.3888889e-3f;
+        c = c * x2 + 4.1666667e-2f;
+        c = c * x2 - 0.5f;
+        c = c * x2 + 1.0f;
+        
+        return x * s / c;
+    }
+    
+    // The same formulas as SvfCoefficients::design(), in float, one frame per
+    // iteration with nothing carried between them
+    template <EQBand::Type Type>
+    forcedinline void svfDesignBody(SvfFrames& c, int numFrames, const float* log2Frequency, const float* log2Q,
+                                    const float* gainDb)
+    {
+        constexpr float pi = 3.14159265f;
+        constexpr float maxLog2Frequency = -1.02914635f;   // log2(0.49)
+        constexpr float dbToSqrtA = 0.041524101f;           // log2(10) / 80, so sqrt(A) = 2^(gainDb x this)
+        
+        for (int i = 0; i < numFrames; ++i)
+        {
+            // Below 0.49 of the rate, as the biquad design keeps it
+            auto octaves = maxLog2Frequency - positivePart(maxLog2Frequency - log2Frequency[i]);
+            auto g = fastTan(pi * fastExp2(octaves));
+            auto k = fastExp2(-log2Q[i]);
+            auto sqrtA = fastExp2(gainDb[i] * dbToSqrtA);
+            auto A = sqrtA * sqrtA;
+            auto m0 = 1.0f, m1 = 0.0f, m2 = 0.0f;
+            
+            if constexpr (Type == EQBand::Type::Bell)
+            {
+                k = k / A;
+                m1 = k * (A * A - 1.0f);
+            }
+            else if constexpr (Type == EQBand::Type::LowShelf)
+            {
+                g = g / sqrtA;
+                m1 = k * (A - 1.0f);
+                m2 = A * A - 1.0f;
+            }
+            else if constexpr (Type == EQBand::Type::HighShelf)
+            {
+                g = g * sqrtA;
+                m0 = A * A;
+                m1 = k * (1.0f - A) * A;
+                m2 = 1.0f - A * A;
+            }
+            else if constexpr (Type == EQBand::Type::LowPass)
+            {
+                m0 = 0.0f;
+                m2 = 1.0f;
+            }
+            else if constexpr (Type == EQBand::Type::HighPass)
+            {
+                m1 = -k;
+                m2 = -1.0f;
+            }
+            else
+            {
+                m1 = -k;
+            }
+            
+            auto a = 1.0f / (1.0f + g * (g + k));
+            c.a1[i] = a;
+            c.a2[i] = g * a;
+            c.a3[i] = g * g * a;
+            c.m0[i] = m0;
+            c.m1[i] = m1;
+            c.m2[i] = m2;
+        }
+    }
+    
+    forcedinline void svfDesignDispatch(SvfFrames& c, int numFrames, EQBand::Type type, const float* log2Frequency,
+                                        const float* log2Q, const float* gainDb)
+    {
+        switch (type)
+        {
+            case EQBand::Type::Bell:        svfDesignBody<EQBand::Type::Bell>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+            case EQBand::Type::LowShelf:    svfDesignBody<EQBand::Type::LowShelf>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+            case EQBand::Type::HighShelf:   svfDesignBody<EQBand::Type::HighShelf>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+            case EQBand::Type::LowPass:     svfDesignBody<EQBand::Type::LowPass>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+            case EQBand::Type::HighPass:    svfDesignBody<EQBand::Type::HighPass>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+            case EQBand::Type::Notch:       svfDesignBody<EQBand::Type::Notch>(c, numFrames, log2Frequency, log2Q, gainDb); break;
+        }
+    }
+    
+    //==============================================================================
+    // Stamps out one set of entry points compiled for an instruction set. The
+    // bodies above are force-inlined, so they are generated for that target.
+    #define MACEQ_DEFINE_KERNELS(Namespace, Lanes, TargetAttribute) \
+        namespace Namespace \
+        { \
+            TargetAttribute void biquadFloat(float* f, int n, const BiquadKernel<float>* k, int ns, float* s)     { biquadCascadeBody<Lanes>(f, n, k, ns, s); } \
+            TargetAttribute void biquadDouble(float* f, int n, const BiquadKernel<double>* k, int ns, double* s)  { biquadCascadeBody<Lanes>(f, n, k, ns, s); } \
+            TargetAttribute void interleave(float* f, const float* const* c, int nc, int start, int n)     { interleaveBody<Lanes>(f, c, nc, start, n); } \
+            TargetAttribute void deinterleave(float* const* c, int nc, int start, const float* f, int n)   { deinterleaveBody<Lanes>(c, nc, start, f, n); } \
+            TargetAttribute float findAbsolutePeak(const float* s, int n)                                 { return findAbsolutePeakBody(s, n); } \
+            TargetAttribute float sumOfSquares(const float* s, int n)                                     { return sumOfSquaresBody(s, n); } \
+            TargetAttribute void copy(float* d, const float* s, int n)                                    { convertBody(d, s, n); } \
+            TargetAttribute void floatToDouble(double* d, const float* s, int n)                          { convertBody(d, s, n); } \
+            TargetAttribute void doubleToFloat(float* d, const double* s, int n)                          { convertBody(d, s, n); } \
+            TargetAttribute void sparseMix(float* const* d, int nd, const float* const* s, const int* r, const int* si, const float* g, int n) \
+                                                                                                          { sparseMixBody(d, nd, s, r, si, g, n); } \
+            TargetAttribute void applyWindow(float* d, const float* s, const float* w, int n)             { applyWindowBody(d, s, w, n); } \
+            TargetAttribute void magnitudeSquared(float* d, const float* c, int n)                        { magnitudeSquaredBody(d, c, n); } \
+            TargetAttribute void compressorGain(float* f, int n, int nl, const CompressorLanes& l, float* e, float* r) \
+                                                                                                          { compressorGainBody<Lanes>(f, n, nl, l, e, r); } \
+            TargetAttribute void svfCascade(float* f, int n, const SvfKernel* k, int ns, float* s)         { svfCascadeBody<Lanes>(f, n, k, ns, s); } \
+            TargetAttribute void svfModulated(float* f, int n, const SvfFrames& c, float* s)               { svfModulatedBody<Lanes>(f, n, c, s); } \
+            TargetAttribute void svfDesign(SvfFrames& c, int n, EQBand::Type t, const float* lf, const float* lq, const float* g) \
+                                                                                                          { svfDesignDispatch(c, n, t, lf, lq, g); } \
+            \
+            DSPKernels create(DSPKernels::Variant variant) \
+            { \
+                DSPKernels kernels; \
+                kernels.variant = variant; \
+                kernels.biquadLanes = Lanes; \
+                kernels.biquadFloat = biquadFloat; \
+                kernels.biquadDouble = biquadDouble; \
+                kernels.interleave = interleave; \
+                kernels.deinterleave = deinterleave; \
+                kernels.findAbsolutePeak = findAbsolutePeak; \
+                kernels.sumOfSquares = sumOfSquares; \
+                kernels.copy = copy; \
+                kernels.floatToDouble = floatToDouble; \
+                kernels.doubleToFloat = doubleToFloat; \
+                kernels.sparseMix = sparseMix; \
+                kernels.applyWindow = applyWindow; \
+                kernels.magnitudeSquared = magnitudeSquared; \
+                kernels.compressorGain = compressorGain; \
+                kernels.svfCascade = svfCascade; \
+                kernels.svfModulated = svfModulated; \
+                kernels.svfDesign = svfDesign; \
+                return kernels; \
+            } \
+        }
+    
+    MACEQ_DEFINE_KERNELS(GenericKernels, 1, )
+   
+   #if MACEQ_X86_VARIANTS
+    MACEQ_DEFINE_KERNELS(SSE2Kernels, 4, __attribute__((target("sse2"))))
+    MACEQ_DEFINE_KERNELS(AVX2Kernels, 8, __attribute__((target("avx2"))))
+    MACEQ_DEFINE_KERNELS(AVX512Kernels, 16, __attribute__((target("avx512f"))))
+   #endif
+   
+   #if JUCE_ARM
+    // NEON is part of the baseline on 64-bit ARM, so no target attribute is needed
+    MACEQ_DEFINE_KERNELS(NeonKernels, 4, )
+   #endif
+    
+    #undef MACEQ_DEFINE_KERNELS
+    
+    std::atomic<int> forcedVariant { -1 };
+}
+
+//==============================================================================
+bool DSPKernels::isSupported(Variant variant)
+{
+    switch (variant)
+    {
+        case Variant::Generic:  return true;
+       #if MACEQ_X86_VARIANTS
+        case Variant::SSE2:     return juce::SystemStats::hasSSE2();
+        case Variant::AVX2:     return juce::SystemStats::hasAVX2();
+        case Variant::AVX512:   return juce::SystemStats::hasAVX512F();
+       #endif
+       #if JUCE_ARM
+        case Variant::Neon:     return juce::SystemStats::hasNeon();
+       #endif
+        default:                return false;
+    }
+}
+
+DSPKernels::Variant DSPKernels::detectBestVariant()
+{
+    for (auto variant : { Variant::AVX512, Variant::AVX2, Variant::SSE2, Variant::Neon })
+        if (isSupported(variant))
+            return variant;
+    
+    return Variant::Generic;
+}
+
+juce::String DSPKernels::getVariantName(Variant variant)
+{
+    switch (variant)
+    {
+        case Variant::Generic:  return "Generic";
+        case Variant::SSE2:     return "SSE2";
+        case Variant::AVX2:     return "AVX2";
+        case Variant::AVX512:   return "AVX-512";
+        case Variant::Neon:     return "NEON";
+    }
+    
+    return {};
+}
+
+//==============================================================================
+const DSPKernels& DSPKernels::get(Variant variant)
+{
+    static const auto generic = GenericKernels::create(Variant::Generic);
+    
+    if (!isSupported(variant))
+        return generic;
+    
+    switch (variant)
+    {
+       #if MACEQ_X86_VARIANTS
+        case Variant::SSE2:     { static const auto k = SSE2Kernels::create(variant);   return k; }
+        case Variant::AVX2:     { static const auto k = AVX2Kernels::create(variant);   return k; }
+        case Variant::AVX512:   { static const auto k = AVX512Kernels::create(variant); return k; }
+       #endif
+       #if JUCE_ARM
+        case Variant::Neon:     { static const auto k = NeonKernels::create(variant);   return k; }
+       #endif
+        default:                return generic;
+    }
+}
+
+const DSPKernels& DSPKernels::get()
+{
+    static const auto best = detectBestVariant();
+    auto forced = forcedVariant.load();
+    
+    return get(forced >= 0 ? (Variant) forced : best);
+}
+
+const DSPKernels& DSPKernels::getForChannels(int numChannels)
+{
+    if (forcedVariant.load() >= 0)
+        return get();
+    
+    auto maxLanes = juce::nextPowerOfTwo(numChannels);
+    
+    for (auto variant : { Variant::AVX512, Variant::AVX2, Variant::SSE2, Variant::Neon })
+        if (isSupported(variant) && get(variant).biquadLanes <= maxLanes)
+            return get(variant);
+    
+    return get(Variant::Generic);
+}
+
+void DSPKernels::forceVariant(Variant variant)
+{
+    if (!isSupported(variant))
+        DBG("DSPKernels: " + getVariantName(variant) + " is not supported on this CPU, using Generic");
+    
+    forcedVariant.store((int) variant);
+}
+
+void DSPKernels::clearForcedVariant()
+{
+    forcedVariant.store(-1);
+}
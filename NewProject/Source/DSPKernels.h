@@ -0,0 +1,149 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQBand.h"
+
+//==============================================================================
+/**
+ * Per-lane parameters for DSPKernels::compressorGain, one lane per compressor
+ * detector. They are stored as arrays rather than one struct per lane, so a
+ * block of lanes loads each parameter as one vector.
+ */
+struct CompressorLanes
+{
+    // A multiple of every variant's lane count, and enough for every band
+    // of a compressor over 64 unlinked channels
+    static constexpr int maxLanes = 320;
+    
+    float attack[maxLanes];         // Envelope coefficients per sample
+    float release[maxLanes];
+    float levelScale[maxLanes];     // dB per octave of envelope: 6.02 for peak, 3.01 for mean square
+    float thresholdDb[maxLanes];
+    float halfKneeDb[maxLanes];
+    float kneeScale[maxLanes];      // 1 / (2 x knee), or 0 for a hard knee
+    float slope[maxLanes];          // 1 / ratio - 1
+    float makeupDb[maxLanes];
+};
+
+//==============================================================================
+/**
+ * Per-frame SVF coefficients for DSPKernels::svfModulated, as SvfKernel has
+ * them, for one section over up to maxFrames frames. Arrays rather than one
+ * SvfKernel per frame, so the design kernel writes each as one vector.
+ */
+struct SvfFrames
+{
+    static constexpr int maxFrames = 256;
+    
+    float a1[maxFrames];
+    float a2[maxFrames];
+    float a3[maxFrames];
+    float m0[maxFrames];
+    float m1[maxFrames];
+    float m2[maxFrames];
+};
+
+//==============================================================================
+/**
+ * DSPKernels is a table of the hot inner loops, compiled once per instruction
+ * set so a single binary runs well on SSE-only, AVX2 and AVX-512 machines as
+ * well as ARM.
+ *
+ * The best variant the CPU supports is picked on first use. Callers fetch the
+ * table once (ProcessorChain does it in prepare()) and call through the
+ * function pointers, so the audio thread never tests CPU features.
+ *
+ * All variants produce bit-identical results: each lane runs the same
+ * operations in the same order, reductions use a fixed number of partial
+ * results, and floating-point contraction is disabled. forceVariant() lets
+ * each one be benchmarked and compared against the others.
+ */
+struct DSPKernels
+{
+    //==============================================================================
+    enum class Variant
+    {
+        Generic,    // Portable C++, one channel at a time
+        SSE2,
+        AVX2,
+        AVX512,
+        Neon
+    };
+    
+    Variant variant = Variant::Generic;
+    
+    // Number of channels the biquad kernels process side by side
+    int biquadLanes = 1;
+    
+    //==============================================================================
+    // A cascade of biquad sections over lane-interleaved frames: biquadLanes
+    // samples per frame, one per channel. Each section's state is biquadLanes
+    // s1 values then s2 values, one section after another.
+    void (*biquadFloat) (float* frames, int numFrames, const BiquadKernel<float>* sections, int numSections, float* state) = nullptr;
+    void (*biquadDouble) (float* frames, int numFrames, const BiquadKernel<double>* sections, int numSections, double* state) = nullptr;
+    
+    // Between channel buffers and frames; lanes past numChannels are zeroed
+    void (*interleave) (float* frames, const float* const* channels, int numChannels, int startSample, int numFrames) = nullptr;
+    void (*deinterleave) (float* const* channels, int numChannels, int startSample, const float* frames, int numFrames) = nullptr;
+    
+    // Metering
+    float (*findAbsolutePeak) (const float* samples, int numSamples) = nullptr;
+    float (*sumOfSquares) (const float* samples, int numSamples) = nullptr;
+    
+    // Copying and conversion
+    void (*copy) (float* dest, const float* source, int numSamples) = nullptr;
+    void (*floatToDouble) (double* dest, const float* source, int numSamples) = nullptr;
+    void (*doubleToFloat) (float* dest, const double* source, int numSamples) = nullptr;
+    
+    // Sparse matrix mix. Destination d is the sum of gains[e] * sources[sourceIndex[e]]
+    // over entries rowStart[d] to rowStart[d + 1]; rows without entries are
+    // cleared. Destinations must not alias sources.
+    void (*sparseMix) (float* const* destinations, int numDestinations, const float* const* sources,
+                       const int* rowStart, const int* sourceIndex, const float* gains, int numSamples) = nullptr;
+    
+    // Compressor detectors and gain computers over lane-interleaved frames:
+    // numLanes detector inputs per frame (|x| or x^2), numLanes a multiple of
+    // biquadLanes. Each input is replaced by its linear gain;
+    // envelope carries each lane's detector state from block to block, and
+    // maxReductionDb is raised to the deepest gain reduction seen.
+    void (*compressorGain) (float* frames, int numFrames, int numLanes, const CompressorLanes& lanes,
+                            float* envelope, float* maxReductionDb) = nullptr;
+    
+    // State-variable filters over lane-interleaved frames, like the biquads:
+    // each section's state is biquadLanes ic1 values then ic2 values. The
+    // cascade runs fixed sections, the modulated one a single section with
+    // new coefficients every frame.
+    void (*svfCascade) (float* frames, int numFrames, const SvfKernel* sections, int numSections, float* state) = nullptr;
+    void (*svfModulated) (float* frames, int numFrames, const SvfFrames& coefficients, float* state) = nullptr;
+    
+    // SVF coefficients for every frame from per-frame settings: log2 of the
+    // frequency as a fraction of the sample rate, log2 of Q, and gain. tan and
+    // exp2 are polynomial approximations, so this vectorises; the response is
+    // within 0.002 dB of SvfCoefficients::design() up to 0.49 of the rate.
+    void (*svfDesign) (SvfFrames& coefficients, int numFrames, EQBand::Type type,
+                       const float* log2Frequency, const float* log2Q, const float* gainDb) = nullptr;
+    
+    // FFT pre- and post-processing; complexData is interleaved real/imaginary
+    void (*applyWindow) (float* dest, const float* source, const float* window, int numSamples) = nullptr;
+    void (*magnitudeSquared) (float* dest, const float* complexData, int numBins) = nullptr;
+    
+    //==============================================================================
+    // The forced variant if one is set, otherwise the best supported one
+    static const DSPKernels& get();
+    
+    // As get(), but without lanes wider than the channel count: padded lanes
+    // cost more than the scalar cascade gains from running sections in pairs,
+    // so mono and stereo use Generic
+    static const DSPKernels& getForChannels(int numChannels);
+    
+    // Falls back to Generic if the variant isn't supported here
+    static const DSPKernels& get(Variant variant);
+    
+    static bool isSupported(Variant variant);
+    static Variant detectBestVariant();
+    static juce::String getVariantName(Variant variant);
+    
+    // Takes effect the next time kernels are fetched, i.e. on the next prepare()
+    static void forceVariant(Variant variant);
+    static void clearForcedVariant();
+};
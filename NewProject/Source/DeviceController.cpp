@@ -0,0 +1,222 @@
+#include "DeviceController.h"
+#include "Tracing.h"
+
+//==============================================================================
+DeviceController::DeviceController(AudioServer& serverToControl)
+    : juce::Thread("Device Control"),
+      server(serverToControl)
+{
+    self = this;
+    startThread();
+}
+
+DeviceController::~DeviceController()
+{
+    {
+        const juce::ScopedLock lock(queueLock);
+        queue.clear();
+    }
+    
+    // An open or close in progress is left to finish; drivers don't take
+    // kindly to being abandoned halfway
+    signalThreadShouldExit();
+    notify();
+    stopThread(10000);
+    
+    server.resetDeviceThread();
+}
+
+//==============================================================================
+void DeviceController::initialize(Callback onDone)
+{
+    post("Initialize", [] (AudioServer& audioServer, juce::String& errorMessage)
+    {
+        if (audioServer.initialize())
+            return true;
+        
+        errorMessage = "Could not open the default audio devices";
+        return false;
+    }, std::move(onDone), true);
+}
+
+void DeviceController::refreshDevices(Callback onDone)
+{
+    // Nothing to do but read the device lists back, which every operation does
+    post("Refresh", [] (AudioServer&, juce::String&) { return true; }, std::move(onDone), true);
+}
+
+void DeviceController::setInputDevice(const juce::String& deviceName, Callback onDone)
+{
+    post("Input", [deviceName] (AudioServer& audioServer, juce::String& errorMessage)
+    {
+        if (audioServer.setInputDevice(deviceName))
+            return true;
+        
+        errorMessage = "Could not open " + deviceName + " for input";
+        return false;
+    }, std::move(onDone));
+}
+
+void DeviceController::setOutputDevice(const juce::String& deviceName, Callback onDone)
+{
+    post("Output", [deviceName] (AudioServer& audioServer, juce::String& errorMessage)
+    {
+        if (audioServer.setOutputDevice(deviceName))
+            return true;
+        
+        errorMessage = "Could not open " + deviceName + " for output";
+        return false;
+    }, std::move(onDone));
+}
+
+void DeviceController::start(Callback onDone)
+{
+    post("Transport", [] (AudioServer& audioServer, juce::String& errorMessage)
+    {
+        if (audioServer.startAudioProcessing())
+            return true;
+        
+        errorMessage = "Could not start audio processing";
+        return false;
+    }, std::move(onDone));
+}
+
+void DeviceController::stop(Callback onDone)
+{
+    post("Transport", [] (AudioServer& audioServer, juce::String&)
+    {
+        audioServer.stopAudioProcessing();
+        return true;
+    }, std::move(onDone));
+}
+
+void DeviceController::perform(const juce::String& key, Operation operation, Callback onDone)
+{
+    post(key, std::move(operation), std::move(onDone));
+}
+
+DeviceController::State DeviceController::getState() const
+{
+    const juce::ScopedLock lock(stateLock);
+    return state;
+}
+
+//==============================================================================
+void DeviceController::post(const juce::String& key, Operation operation, Callback onDone, bool refreshesVirtualSetup)
+{
+    const juce::ScopedLock lock(queueLock);
+    
+    for (auto& waiting : queue)
+    {
+        if (waiting.key == key)
+        {
+            waiting.operation = std::move(operation);
+            waiting.refreshesVirtualSetup = waiting.refreshesVirtualSetup || refreshesVirtualSetup;
+            ++waiting.numCoalesced;
+            
+            if (onDone != nullptr)
+                waiting.callbacks.add(std::move(onDone));
+            
+            return;
+        }
+    }
+    
+    Pending pending;
+    pending.key = key;
+    pending.operation = std::move(operation);
+    pending.refreshesVirtualSetup = refreshesVirtualSetup;
+    
+    if (onDone != nullptr)
+        pending.callbacks.add(std::move(onDone));
+    
+    queue.add(std::move(pending));
+    ++numPending;
+    notify();
+}
+
+void DeviceController::run()
+{
+    Tracing::setThreadName("Device Control");
+    
+    // From here on the server's devices belong to this thread, device list
+    // changes included, so those refresh the state like any other operation
+    server.setDeviceThread(getCurrentThreadId(), [this] (const juce::String& key, std::function<void()> function)
+    {
+        perform(key, [function = std::move(function)] (AudioServer&, juce::String&)
+        {
+            function();
+            return true;
+        });
+    });
+    
+    while (!threadShouldExit())
+    {
+        Pending next;
+        bool hasNext = false;
+        
+        {
+            const juce::ScopedLock lock(queueLock);
+            
+            if (!queue.isEmpty())
+            {
+                next = queue.removeAndReturn(0);
+                hasNext = true;
+            }
+        }
+        
+        if (!hasNext)
+        {
+            wait(-1);
+            continue;
+        }
+        
+        Result result;
+        result.numCoalesced = next.numCoalesced;
+        
+        {
+            TRACE_SCOPE("Device operation");
+            auto startTime = juce::Time::getMillisecondCounterHiRes();
+            result.succeeded = next.operation(server, result.errorMessage);
+            
+            DBG("Device operation " + next.key + (result.succeeded ? " done" : " failed: " + result.errorMessage)
+                + " in " + juce::String(juce::Time::getMillisecondCounterHiRes() - startTime, 1) + " ms"
+                + (next.numCoalesced > 0 ? ", replacing " + juce::String(next.numCoalesced) : juce::String()));
+        }
+        
+        updateState(next.refreshesVirtualSetup, next.key == "Initialize");
+        --numPending;
+        
+        juce::MessageManager::callAsync([weakThis = self, callbacks = std::move(next.callbacks), result]
+        {
+            if (weakThis == nullptr)
+                return;
+            
+            if (weakThis->onStateChanged != nullptr)
+                weakThis->onStateChanged();
+            
+            for (auto& callback : callbacks)
+                callback(result);
+        });
+    }
+}
+
+void DeviceController::updateState(bool refreshVirtualSetup, bool finishedInitialize)
+{
+    TRACE_SCOPE("Read device state");
+    
+    auto previous = getState();
+    
+    State newState;
+    newState.ready = previous.ready || finishedInitialize;
+    newState.running = server.isRunning();
+    newState.inputDevices = server.getAvailableInputDevices();
+    newState.outputDevices = server.getAvailableOutputDevices();
+    newState.currentInput = server.getCurrentInputDevice();
+    newState.currentOutput = server.getCurrentOutputDevice();
+    newState.sampleRate = server.getSampleRate();
+    newState.bufferSize = server.getBufferSize();
+    newState.virtualSetup = refreshVirtualSetup ? VirtualAudioDevice::checkVirtualDeviceSetup() : previous.virtualSetup;
+    
+    const juce::ScopedLock lock(stateLock);
+    state = newState;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioServer.h"
+#include "VirtualAudioDevice.h"
+
+//==============================================================================
+/**
+ * DeviceController runs the AudioServer's device operations on a control
+ * thread of its own, so opening and closing devices, which can take hundreds
+ * of milliseconds, never blocks the UI.
+ *
+ * Each call queues an operation and returns straight away. When it finishes,
+ * its callback runs on the message thread with the outcome, after
+ * onStateChanged has announced the new device state.
+ *
+ * Operations are keyed by what they change: one for the input device, one
+ * for the output device, one for starting and stopping, and so on. Queuing an
+ * operation while another with the same key is still waiting replaces the
+ * waiting one in its place in the queue, and both callbacks get the result,
+ * so flicking through a device list reopens the device once rather than for
+ * every entry.
+ *
+ * While it exists the control thread is the server's device thread (see
+ * AudioServer::setDeviceThread()), so only it may touch the server's devices;
+ * perform() queues any other device work, such as routing changes that
+ * restart the callback. JUCE's handling of device list changes is queued
+ * there too. Operations still queued when the controller is destroyed are
+ * dropped without their callbacks; one already running is finished first.
+ */
+class DeviceController : private juce::Thread
+{
+public:
+    //==============================================================================
+    struct Result
+    {
+        bool succeeded = false;
+        juce::String errorMessage;
+        int numCoalesced = 0;               // Requests replaced by this one
+    };
+    
+    using Callback = std::function<void(const Result&)>;
+    using Operation = std::function<bool(AudioServer&, juce::String&)>;
+    
+    // As of the last finished operation
+    struct State
+    {
+        bool ready = false;                 // The first initialize() has finished
+        bool running = false;
+        
+        juce::StringArray inputDevices;
+        juce::StringArray outputDevices;
+        juce::String currentInput;
+        juce::String currentOutput;
+        
+        double sampleRate = 0.0;
+        int bufferSize = 0;
+        
+        // From initialize() and refreshDevices()
+        VirtualAudioDevice::VirtualDeviceSetup virtualSetup {};
+    };
+    
+    //==============================================================================
+    explicit DeviceController(AudioServer& server);
+    ~DeviceController() override;
+    
+    // Message thread. Callbacks run on the message thread.
+    void initialize(Callback onDone = nullptr);
+    void refreshDevices(Callback onDone = nullptr);
+    
+    void setInputDevice(const juce::String& deviceName, Callback onDone = nullptr);
+    void setOutputDevice(const juce::String& deviceName, Callback onDone = nullptr);
+    
+    // Share a key, so the last of a run of starts and stops wins
+    void start(Callback onDone = nullptr);
+    void stop(Callback onDone = nullptr);
+    
+    // Any other device work, run on the control thread
+    void perform(const juce::String& key, Operation operation, Callback onDone = nullptr);
+    
+    State getState() const;
+    
+    // Whether operations are queued or running
+    bool isBusy() const { return numPending.load() > 0; }
+    
+    // Message thread, after every operation
+    std::function<void()> onStateChanged;
+    
+private:
+    //==============================================================================
+    struct Pending
+    {
+        juce::String key;
+        Operation operation;
+        bool refreshesVirtualSetup = false;
+        juce::Array<Callback> callbacks;
+        int numCoalesced = 0;
+    };
+    
+    void post(const juce::String& key, Operation operation, Callback onDone, bool refreshesVirtualSetup = false);
+    void run() override;
+    void updateState(bool refreshVirtualSetup, bool finishedInitialize);
+    
+    //==============================================================================
+    AudioServer& server;
+    
+    juce::Array<Pending> queue;
+    juce::CriticalSection queueLock;
+    std::atomic<int> numPending { 0 };
+    
+    State state;
+    mutable juce::CriticalSection stateLock;
+    
+    // Created up front, so the control thread only ever copies it
+    juce::WeakReference<DeviceController> self;
+    
+    JUCE_DECLARE_WEAK_REFERENCEABLE(DeviceController)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceController)
+};
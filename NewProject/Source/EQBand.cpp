@@ -0,0 +1,186 @@
+#include "EQBand.h"
+
+//==============================================================================
+juce::String EQBand::getTypeName(Type type)
+{
+    switch (type)
+    {
+        case Type::Bell:      return "Bell";
+        case Type::LowShelf:  return "Low Shelf";
+        case Type::HighShelf: return "High Shelf";
+        case Type::LowPass:   return "Low Pass";
+        case Type::HighPass:  return "High Pass";
+        case Type::Notch:     return "Notch";
+    }
+    
+    return {};
+}
+
+//==============================================================================
+BiquadCoefficients BiquadCoefficients::design(const EQBand& band, double sampleRate)
+{
+    BiquadCoefficients c;
+    
+    if (!band.enabled || sampleRate <= 0.0)
+        return c;
+    
+    // Keep the design away from DC and Nyquist where the formulas degenerate
+    auto frequency = juce::jlimit(1.0, sampleRate * 0.49, (double) band.frequency);
+    auto q = juce::jmax(0.01, (double) band.q);
+    
+    auto w0 = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+    auto cosW0 = std::cos(w0);
+    auto alpha = std::sin(w0) / (2.0 * q);
+    auto A = std::pow(10.0, band.gainDb / 40.0);
+    auto sqrtA = std::sqrt(A);
+    
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0;
+    
+    switch (band.type)
+    {
+        case EQBand::Type::Bell:
+            b0 = 1.0 + alpha * A;
+            b1 = -2.0 * cosW0;
+            b2 = 1.0 - alpha * A;
+            a0 = 1.0 + alpha / A;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha / A;
+            break;
+        
+        case EQBand::Type::LowShelf:
+            b0 = A * ((A + 1.0) - (A - 1.0) * cosW0 + 2.0 * sqrtA * alpha);
+            b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosW0);
+            b2 = A * ((A + 1.0) - (A - 1.0) * cosW0 - 2.0 * sqrtA * alpha);
+            a0 = (A + 1.0) + (A - 1.0) * cosW0 + 2.0 * sqrtA * alpha;
+            a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosW0);
+            a2 = (A + 1.0) + (A - 1.0) * cosW0 - 2.0 * sqrtA * alpha;
+            break;
+        
+        case EQBand::Type::HighShelf:
+            b0 = A * ((A + 1.0) + (A - 1.0) * cosW0 + 2.0 * sqrtA * alpha);
+            b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosW0);
+            b2 = A * ((A + 1.0) + (A - 1.0) * cosW0 - 2.0 * sqrtA * alpha);
+            a0 = (A + 1.0) - (A - 1.0) * cosW0 + 2.0 * sqrtA * alpha;
+            a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosW0);
+            a2 = (A + 1.0) - (A - 1.0) * cosW0 - 2.0 * sqrtA * alpha;
+            break;
+        
+        case EQBand::Type::LowPass:
+            b0 = (1.0 - cosW0) * 0.5;
+            b1 = 1.0 - cosW0;
+            b2 = (1.0 - cosW0) * 0.5;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha;
+            break;
+        
+        case EQBand::Type::HighPass:
+            b0 = (1.0 + cosW0) * 0.5;
+            b1 = -(1.0 + cosW0);
+            b2 = (1.0 + cosW0) * 0.5;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha;
+            break;
+        
+        case EQBand::Type::Notch:
+            b0 = 1.0;
+            b1 = -2.0 * cosW0;
+            b2 = 1.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW0;
+            a2 = 1.0 - alpha;
+            break;
+    }
+    
+    c.b0 = b0 / a0;
+    c.b1 = b1 / a0;
+    c.b2 = b2 / a0;
+    c.a1 = a1 / a0;
+    c.a2 = a2 / a0;
+    
+    return c;
+}
+
+double BiquadCoefficients::getMagnitudeSquared(double frequency, double sampleRate) const
+{
+    // Written in terms of phi = sin^2(w/2), which stays well conditioned for
+    // low frequency bands where the cos(w) expansion cancels badly
+    auto sinHalfW = std::sin(juce::MathConstants<double>::pi * frequency / sampleRate);
+    auto phi = sinHalfW * sinHalfW;
+    
+    auto numeratorDC = b0 + b1 + b2;
+    auto numerator = numeratorDC * numeratorDC
+                   - 4.0 * (b0 * b1 + 4.0 * b0 * b2 + b1 * b2) * phi
+                   + 16.0 * b0 * b2 * phi * phi;
+    
+    auto denominatorDC = 1.0 + a1 + a2;
+    auto denominator = denominatorDC * denominatorDC
+                     - 4.0 * (a1 + 4.0 * a2 + a1 * a2) * phi
+                     + 16.0 * a2 * phi * phi;
+    
+    return juce::jmax(0.0, numerator) / juce::jmax(denominator, 1.0e-30);
+}
+
+double BiquadCoefficients::getMagnitudeDb(double frequency, double sampleRate) const
+{
+    return 10.0 * std::log10(juce::jmax(getMagnitudeSquared(frequency, sampleRate), 1.0e-30));
+}
+
+//==============================================================================
+SvfCoefficients SvfCoefficients::design(const EQBand& band, double sampleRate)
+{
+    SvfCoefficients c;
+    
+    if (!band.enabled || sampleRate <= 0.0)
+        return c;
+    
+    // The same limits as the biquad design
+    auto frequency = juce::jlimit(1.0, sampleRate * 0.49, (double) band.frequency);
+    auto q = juce::jmax(0.01, (double) band.q);
+    
+    auto g = std::tan(juce::MathConstants<double>::pi * frequency / sampleRate);
+    auto k = 1.0 / q;
+    auto A = std::pow(10.0, band.gainDb / 40.0);
+    auto sqrtA = std::sqrt(A);
+    
+    c.g = g;
+    c.k = k;
+    
+    switch (band.type)
+    {
+        case EQBand::Type::Bell:
+            c.k = k / A;
+            c.m1 = c.k * (A * A - 1.0);
+            break;
+        
+        case EQBand::Type::LowShelf:
+            c.g = g / sqrtA;
+            c.m1 = k * (A - 1.0);
+            c.m2 = A * A - 1.0;
+            break;
+        
+        case EQBand::Type::HighShelf:
+            c.g = g * sqrtA;
+            c.m0 = A * A;
+            c.m1 = k * (1.0 - A) * A;
+            c.m2 = 1.0 - A * A;
+            break;
+        
+        case EQBand::Type::LowPass:
+            c.m0 = 0.0;
+            c.m2 = 1.0;
+            break;
+        
+        case EQBand::Type::HighPass:
+            c.m1 = -k;
+            c.m2 = -1.0;
+            break;
+        
+        case EQBand::Type::Notch:
+            c.m1 = -k;
+            break;
+    }
+    
+    return c;
+}
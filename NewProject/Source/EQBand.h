@@ -0,0 +1,150 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * A single parametric EQ band, as stored and processed by the ProcessorChain.
+ *
+ * This is the chain's band format: anything that produces EQ settings (the UI,
+ * presets, the AutoEQ fitter) hands the chain a juce::Array<EQBand>.
+ */
+struct EQBand
+{
+    enum class Type
+    {
+        Bell,
+        LowShelf,
+        HighShelf,
+        LowPass,
+        HighPass,
+        Notch
+    };
+    
+    // How the chain runs the band. Both have the same static response; an
+    // SVF band glides to new settings sample by sample instead of stepping,
+    // for bands that are automated or moved while listening.
+    enum class Filter
+    {
+        Biquad,
+        Svf
+    };
+    
+    Type type = Type::Bell;
+    float frequency = 1000.0f;  // Hz
+    float gainDb = 0.0f;        // Ignored by pass and notch filters
+    float q = 0.707f;
+    bool enabled = true;
+    Filter filter = Filter::Biquad;
+    
+    bool operator== (const EQBand& other) const
+    {
+        return type == other.type && frequency == other.frequency && gainDb == other.gainDb
+            && q == other.q && enabled == other.enabled && filter == other.filter;
+    }
+    
+    bool operator!= (const EQBand& other) const { return !operator== (other); }
+    
+    static juce::String getTypeName(Type type);
+};
+
+//==============================================================================
+/**
+ * Normalised (a0 == 1) biquad coefficients designed from an EQBand using the
+ * RBJ Audio EQ Cookbook formulas.
+ */
+struct BiquadCoefficients
+{
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0;
+    double a1 = 0.0, a2 = 0.0;
+    
+    static BiquadCoefficients design(const EQBand& band, double sampleRate);
+    
+    // Squared magnitude response at the given frequency
+    double getMagnitudeSquared(double frequency, double sampleRate) const;
+    double getMagnitudeDb(double frequency, double sampleRate) const;
+};
+
+//==============================================================================
+/**
+ * A biquad section specialised at compile time for the precision of its
+ * coefficients and state. The sample type is converted once on the way in and
+ * out, so the recursion runs entirely in StateType.
+ */
+template <typename StateType>
+struct BiquadKernel
+{
+    StateType b0 = 1, b1 = 0, b2 = 0;
+    StateType a1 = 0, a2 = 0;
+    
+    BiquadKernel() = default;
+    
+    explicit BiquadKernel(const BiquadCoefficients& c)
+        : b0((StateType) c.b0), b1((StateType) c.b1), b2((StateType) c.b2),
+          a1((StateType) c.a1), a2((StateType) c.a2)
+    {
+    }
+    
+    // Transposed direct form II; state holds s1 and s2
+    template <typename SampleType>
+    void process(SampleType* samples, StateType* state, int numSamples) const
+    {
+        auto s1 = state[0];
+        auto s2 = state[1];
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            auto x = (StateType) samples[i];
+            auto y = b0 * x + s1;
+            s1 = b1 * x - a1 * y + s2;
+            s2 = b2 * x - a2 * y;
+            samples[i] = (SampleType) y;
+        }
+        
+        state[0] = s1;
+        state[1] = s2;
+    }
+};
+
+//==============================================================================
+/**
+ * Coefficients for Simper's trapezoidal state-variable filter, designed from
+ * an EQBand. The bilinear prewarping is the same as the RBJ designs', so the
+ * static response matches BiquadCoefficients::design() exactly.
+ *
+ * The output is m0 x the input, plus m1 x the band-pass and m2 x the low-pass
+ * outputs; g is the prewarped cutoff and k the damping. Unlike a direct-form
+ * biquad, the filter stays stable however fast g and k move, so they can be
+ * changed every sample.
+ */
+struct SvfCoefficients
+{
+    double g = 0.0, k = 1.0;
+    double m0 = 1.0, m1 = 0.0, m2 = 0.0;
+    
+    static SvfCoefficients design(const EQBand& band, double sampleRate);
+};
+
+//==============================================================================
+/**
+ * An SVF section ready for the kernels, in float. a1 to a3 fold g and k into
+ * the multipliers of the trapezoidal update.
+ */
+struct SvfKernel
+{
+    float a1 = 1.0f, a2 = 0.0f, a3 = 0.0f;
+    float m0 = 1.0f, m1 = 0.0f, m2 = 0.0f;
+    
+    SvfKernel() = default;
+    
+    explicit SvfKernel(const SvfCoefficients& c)
+    {
+        auto a = 1.0 / (1.0 + c.g * (c.g + c.k));
+        a1 = (float) a;
+        a2 = (float) (c.g * a);
+        a3 = (float) (c.g * c.g * a);
+        m0 = (float) c.m0;
+        m1 = (float) c.m1;
+        m2 = (float) c.m2;
+    }
+};
@@ -0,0 +1,173 @@
+#include "EQFilterBank.h"
+
+//==============================================================================
+template <typename SampleType>
+void EQFilterBank<SampleType>::prepare(int newNumChannels, int maxBlockSize, const DSPKernels& kernelsToUse)
+{
+    kernels = &kernelsToUse;
+    blockSize = juce::jmax(1, maxBlockSize);
+    
+    // The double path has no interleaved kernels and runs channel by channel
+    lanes = usesFloatState ? kernels->biquadLanes : 1;
+    numGroups = (juce::jmax(1, newNumChannels) + lanes - 1) / lanes;
+    
+    floatState.calloc((size_t) getStateSize());
+    previousFloatState.calloc((size_t) getStateSize());
+    doubleState.calloc((size_t) getStateSize());
+    previousDoubleState.calloc((size_t) getStateSize());
+    
+    if (usesFloatState)
+        frames.calloc((size_t) (blockSize * lanes));
+}
+
+template <typename SampleType>
+void EQFilterBank<SampleType>::reset()
+{
+    if (floatState != nullptr)
+    {
+        juce::zeromem(floatState.getData(), sizeof(float) * (size_t) getStateSize());
+        juce::zeromem(doubleState.getData(), sizeof(double) * (size_t) getStateSize());
+    }
+}
+
+//==============================================================================
+template <typename SampleType>
+void EQFilterBank<SampleType>::setBands(const EQBand* bands, int numBands, double sampleRate)
+{
+    setPlan(EQPlan::compile(bands, numBands, sampleRate, usesFloatState));
+}
+
+template <typename SampleType>
+void EQFilterBank<SampleType>::setPlan(const EQPlan& newPlan)
+{
+    if (floatState == nullptr)
+    {
+        plan = newPlan;
+        return;
+    }
+    
+    floatState.swapWith(previousFloatState);
+    doubleState.swapWith(previousDoubleState);
+    
+    for (int section = 0; section < newPlan.numSections; ++section)
+    {
+        // Find where this band ran in the old plan; new bands start from silence
+        int previousSection = -1;
+        
+        for (int s = 0; s < plan.numSections && previousSection < 0; ++s)
+            if (plan.sourceBand[(size_t) s] == newPlan.sourceBand[(size_t) section])
+                previousSection = s;
+        
+        auto isDouble = newPlan.isDouble[(size_t) section];
+        auto wasDouble = previousSection >= 0 && plan.isDouble[(size_t) previousSection];
+        
+        for (int group = 0; group < numGroups; ++group)
+        {
+            auto* f = floatState.getData() + getStateOffset(group, section);
+            auto* d = doubleState.getData() + getStateOffset(group, section);
+            
+            if (previousSection < 0)
+            {
+                juce::zeromem(f, sizeof(float) * (size_t) (2 * lanes));
+                juce::zeromem(d, sizeof(double) * (size_t) (2 * lanes));
+                continue;
+            }
+            
+            auto* oldF = previousFloatState.getData() + getStateOffset(group, previousSection);
+            auto* oldD = previousDoubleState.getData() + getStateOffset(group, previousSection);
+            
+            // A band that crossed the precision threshold carries its state over
+            for (int i = 0; i < 2 * lanes; ++i)
+            {
+                if (isDouble)
+                    d[i] = wasDouble ? oldD[i] : (double) oldF[i];
+                else
+                    f[i] = wasDouble ? (float) oldD[i] : oldF[i];
+            }
+        }
+    }
+    
+    plan = newPlan;
+}
+
+template <typename SampleType>
+void EQFilterBank<SampleType>::setSectionCoefficients(int section, const BiquadCoefficients& coefficients)
+{
+    if (!juce::isPositiveAndBelow(section, plan.numSections))
+        return;
+    
+    auto index = (size_t) section;
+    
+    if (plan.isDouble[index])
+        plan.doubleKernels[index] = BiquadKernel<double>(coefficients);
+    else
+        plan.floatKernels[index] = BiquadKernel<float>(coefficients);
+}
+
+//==============================================================================
+template <typename SampleType>
+void EQFilterBank<SampleType>::process(juce::AudioBuffer<SampleType>& buffer)
+{
+    process(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), buffer.getNumSamples());
+}
+
+template <typename SampleType>
+void EQFilterBank<SampleType>::process(SampleType* const* channelData, int numChannels, int numSamples)
+{
+    if (plan.numSections == 0 || floatState == nullptr)
+        return;
+    
+    auto channels = juce::jmin(numChannels, numGroups * lanes);
+    
+    if constexpr (usesFloatState)
+    {
+        for (int group = 0; group * lanes < channels; ++group)
+        {
+            auto firstChannel = group * lanes;
+            auto groupChannels = juce::jmin(lanes, channels - firstChannel);
+            
+            for (int start = 0; start < numSamples; start += blockSize)
+            {
+                auto numFrames = juce::jmin(blockSize, numSamples - start);
+                
+                kernels->interleave(frames, channelData + firstChannel, groupChannels, start, numFrames);
+                
+                for (int b = 0; b < plan.numBatches; ++b)
+                {
+                    const auto& batch = plan.batches[(size_t) b];
+                    auto offset = getStateOffset(group, batch.firstSection);
+                    
+                    if (batch.isDouble)
+                        kernels->biquadDouble(frames, numFrames, &plan.doubleKernels[(size_t) batch.firstSection],
+                                              batch.numSections, doubleState + offset);
+                    else
+                        kernels->biquadFloat(frames, numFrames, &plan.floatKernels[(size_t) batch.firstSection],
+                                             batch.numSections, floatState + offset);
+                }
+                
+                kernels->deinterleave(channelData + firstChannel, groupChannels, start, frames, numFrames);
+            }
+        }
+    }
+    else
+    {
+        for (int channel = 0; channel < channels; ++channel)
+        {
+            auto* samples = channelData[channel];
+            
+            for (int section = 0; section < plan.numSections; ++section)
+            {
+                auto offset = getStateOffset(channel, section);
+                
+                if (plan.isDouble[(size_t) section])
+                    plan.doubleKernels[(size_t) section].process(samples, doubleState + offset, numSamples);
+                else
+                    plan.floatKernels[(size_t) section].process(samples, floatState + offset, numSamples);
+            }
+        }
+    }
+}
+
+//==============================================================================
+template class EQFilterBank<float>;
+template class EQFilterBank<double>;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DSPKernels.h"
+#include "EQPlan.h"
+
+//==============================================================================
+/**
+ * EQFilterBank executes a compiled EQPlan over a buffer of SampleType (float
+ * for the device path, double for offline work).
+ *
+ * The plan decides each section's state precision: bands whose frequency is a
+ * small fraction of the sample rate (low bells and shelves at high rates) have
+ * poles close to z = 1 and lose accuracy in float, so they run in double.
+ * Everything else runs in float. Each batch of same-precision sections is a
+ * single kernel call, so nothing is decided inside the sample loop.
+ *
+ * The float path runs on the DSPKernels table bound in prepare(): channels are
+ * interleaved into groups as wide as the variant's vector lanes and every
+ * section processes the whole group at once.
+ *
+ * setPlan() neither allocates nor locks, so it can be called on the audio
+ * thread. State follows each band from one plan to the next.
+ */
+template <typename SampleType>
+class EQFilterBank
+{
+public:
+    //==============================================================================
+    static constexpr int maxBands = EQPlan::maxSections;
+    static constexpr bool usesFloatState = std::is_same_v<SampleType, float>;
+    
+    EQFilterBank() = default;
+    
+    void prepare(int numChannels, int maxBlockSize, const DSPKernels& kernelsToUse = DSPKernels::get());
+    void reset();
+    
+    void setPlan(const EQPlan& newPlan);
+    
+    // New coefficients for one section of the installed plan, keeping its
+    // state; see EQPlan::findPatchableSection()
+    void setSectionCoefficients(int section, const BiquadCoefficients& coefficients);
+    
+    // Compiles and installs a plan in one go, for offline use. A float bank
+    // leaves SVF bands out, as EQPlan::compile() does.
+    void setBands(const EQBand* bands, int numBands, double sampleRate);
+    
+    void process(juce::AudioBuffer<SampleType>& buffer);
+    
+    // For a subset of a buffer's channels, e.g. one channel group
+    void process(SampleType* const* channels, int numChannels, int numSamples);
+    
+    const EQPlan& getPlan() const           { return plan; }
+    const DSPKernels& getKernels() const    { return *kernels; }
+    
+private:
+    //==============================================================================
+    // Each group of lanes channels keeps its state as s1 for every lane, then
+    // s2, for each section in plan order
+    int getStateOffset(int group, int section) const    { return (group * maxBands + section) * 2 * lanes; }
+    int getStateSize() const                            { return numGroups * maxBands * 2 * lanes; }
+    
+    //==============================================================================
+    const DSPKernels* kernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+    int lanes = 1;
+    int numGroups = 0;
+    int blockSize = 0;
+    
+    EQPlan plan;
+    
+    // State in each precision, plus a second set to remap into when the plan
+    // changes
+    juce::HeapBlock<float> floatState, previousFloatState;
+    juce::HeapBlock<double> doubleState, previousDoubleState;
+    
+    // One block of lane-interleaved frames
+    juce::HeapBlock<float> frames;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(EQFilterBank)
+};
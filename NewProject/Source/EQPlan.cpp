@@ -0,0 +1,212 @@
+#include "EQPlan.h"
+
+namespace
+{
+    bool hasGain(EQBand::Type type)
+    {
+        return type == EQBand::Type::Bell || type == EQBand::Type::LowShelf || type == EQBand::Type::HighShelf;
+    }
+    
+    // Pass filters first so later sections never see out-of-band content,
+    // then notches, then cuts before boosts
+    int getOrderClass(const EQBand& band)
+    {
+        switch (band.type)
+        {
+            case EQBand::Type::HighPass:
+            case EQBand::Type::LowPass:     return 0;
+            case EQBand::Type::Notch:       return 1;
+            default:                        return band.gainDb < 0.0f ? 2 : 3;
+        }
+    }
+}
+
+//==============================================================================
+bool EQPlan::needsDoublePrecision(const EQBand& band, double sampleRate, double doubleStateRatio)
+{
+    return sampleRate <= 0.0 || band.frequency < sampleRate * doubleStateRatio;
+}
+
+bool EQPlan::isUnity(const EQBand& band)
+{
+    // At 0 dB the RBJ bell and shelf numerators equal their denominators
+    return hasGain(band.type) && std::abs(band.gainDb) < unityToleranceDb;
+}
+
+bool EQPlan::cancelsOut(const EQBand& a, const EQBand& b)
+{
+    // Negating the gain swaps an RBJ bell's or shelf's numerator and
+    // denominator, so the two sections multiply to exactly one
+    return hasGain(a.type) && a.type == b.type && a.enabled && b.enabled
+        && a.frequency == b.frequency && a.q == b.q && a.gainDb == -b.gainDb;
+}
+
+//==============================================================================
+EQPlan EQPlan::compile(const EQBand* bands, int numBands, double sampleRate, bool allowFloatState,
+                       double doubleStateRatio)
+{
+    EQPlan plan;
+    
+    constexpr int maxCandidates = 4 * maxSections;
+    std::array<int, maxCandidates> candidates;
+    int numCandidates = 0;
+    
+    for (int b = 0; b < numBands; ++b)
+    {
+        const auto& band = bands[b];
+        
+        if (!band.enabled)
+            ++plan.numDisabled;
+        else if (allowFloatState && band.filter == EQBand::Filter::Svf)
+            ++plan.numSvf;
+        else if (isUnity(band))
+            ++plan.numUnity;
+        else if (numCandidates < maxCandidates)
+            candidates[(size_t) numCandidates++] = b;
+        else
+            ++plan.numOverflow;
+    }
+    
+    // Remove exact inverse pairs
+    for (int i = 0; i < numCandidates; ++i)
+    {
+        for (int j = i + 1; j < numCandidates; ++j)
+        {
+            if (cancelsOut(bands[candidates[(size_t) i]], bands[candidates[(size_t) j]]))
+            {
+                for (int k = j; k < numCandidates - 1; ++k)
+                    candidates[(size_t) k] = candidates[(size_t) k + 1];
+                
+                for (int k = i; k < numCandidates - 2; ++k)
+                    candidates[(size_t) k] = candidates[(size_t) k + 1];
+                
+                numCandidates -= 2;
+                plan.numCancelled += 2;
+                --i;
+                break;
+            }
+        }
+    }
+    
+    if (numCandidates > maxSections)
+    {
+        plan.numOverflow += numCandidates - maxSections;
+        numCandidates = maxSections;
+    }
+    
+    // Order by class, and within a class put double sections first so each
+    // precision forms as few batches as possible
+    auto useDouble = [&] (int bandIndex)
+    {
+        return !allowFloatState || needsDoublePrecision(bands[bandIndex], sampleRate, doubleStateRatio);
+    };
+    
+    auto comesBefore = [&] (int a, int b)
+    {
+        auto classA = getOrderClass(bands[a]), classB = getOrderClass(bands[b]);
+        
+        if (classA != classB)
+            return classA < classB;
+        
+        return useDouble(a) && !useDouble(b);
+    };
+    
+    // A stable insertion sort, as std::stable_sort may allocate and plans are
+    // compiled on the audio thread too
+    for (int i = 1; i < numCandidates; ++i)
+    {
+        auto candidate = candidates[(size_t) i];
+        auto j = i;
+        
+        for (; j > 0 && comesBefore(candidate, candidates[(size_t) j - 1]); --j)
+            candidates[(size_t) j] = candidates[(size_t) j - 1];
+        
+        candidates[(size_t) j] = candidate;
+    }
+    
+    for (int s = 0; s < numCandidates; ++s)
+    {
+        auto bandIndex = candidates[(size_t) s];
+        auto coefficients = BiquadCoefficients::design(bands[bandIndex], sampleRate);
+        auto index = (size_t) s;
+        
+        plan.isDouble[index] = useDouble(bandIndex);
+        plan.sourceBand[index] = bandIndex;
+        
+        if (plan.isDouble[index])
+            plan.doubleKernels[index] = BiquadKernel<double>(coefficients);
+        else
+            plan.floatKernels[index] = BiquadKernel<float>(coefficients);
+        
+        if (plan.numBatches == 0 || plan.batches[(size_t) plan.numBatches - 1].isDouble != plan.isDouble[index])
+            plan.batches[(size_t) plan.numBatches++] = { plan.isDouble[index], s, 0 };
+        
+        ++plan.batches[(size_t) plan.numBatches - 1].numSections;
+    }
+    
+    plan.numSections = numCandidates;
+    return plan;
+}
+
+int EQPlan::findPatchableSection(const EQBand* bands, int numBands, int bandIndex, const EQBand& previous,
+                                 double sampleRate, bool allowFloatState, double doubleStateRatio) const
+{
+    int section = 0;
+    
+    while (section < numSections && sourceBand[(size_t) section] != bandIndex)
+        ++section;
+    
+    // Bands the plan doesn't run may have to be added to it
+    if (section == numSections)
+        return -1;
+    
+    const auto& band = bands[bandIndex];
+    auto useDouble = !allowFloatState || needsDoublePrecision(band, sampleRate, doubleStateRatio);
+    
+    // The section would be dropped, moved or change batch
+    if (!band.enabled || band.type != previous.type || band.filter != previous.filter || isUnity(band)
+        || getOrderClass(band) != getOrderClass(previous) || useDouble != isDouble[(size_t) section])
+        return -1;
+    
+    // Or cancel out with another band
+    for (int b = 0; b < numBands; ++b)
+    {
+        if (b != bandIndex && !(allowFloatState && bands[b].filter == EQBand::Filter::Svf)
+            && cancelsOut(band, bands[b]))
+            return -1;
+    }
+    
+    return section;
+}
+
+EQPlan EQPlan::fromSections(const BiquadCoefficients* sections, int numSections, bool useDoubleState)
+{
+    EQPlan plan;
+    plan.numSections = juce::jlimit(0, maxSections, numSections);
+    
+    for (int s = 0; s < plan.numSections; ++s)
+    {
+        auto index = (size_t) s;
+        plan.isDouble[index] = useDoubleState;
+        plan.sourceBand[index] = s;
+        
+        if (useDoubleState)
+            plan.doubleKernels[index] = BiquadKernel<double>(sections[s]);
+        else
+            plan.floatKernels[index] = BiquadKernel<float>(sections[s]);
+    }
+    
+    if (plan.numSections > 0)
+        plan.batches[0] = { useDoubleState, 0, plan.numSections };
+    
+    plan.numBatches = plan.numSections > 0 ? 1 : 0;
+    return plan;
+}
+
+juce::String EQPlan::getSummary() const
+{
+    return juce::String(numSections) + " sections in " + juce::String(numBatches) + " batches ("
+         + juce::String(numDisabled) + " disabled, " + juce::String(numUnity) + " at 0 dB, "
+         + juce::String(numCancelled) + " cancelled, " + juce::String(numSvf) + " left to SVFs, "
+         + juce::String(numOverflow) + " over the limit)";
+}
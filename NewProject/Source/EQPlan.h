@@ -0,0 +1,92 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQBand.h"
+
+//==============================================================================
+/**
+ * EQPlan is a band list compiled into the minimal set of biquad sections the
+ * audio thread has to run.
+ *
+ * Compiling drops disabled and 0 dB bands and cancels bell/shelf pairs that
+ * are exact inverses of each other (same type, frequency and Q, opposite
+ * gain). The sections that remain are ordered so that pass filters come
+ * first and cuts come before boosts, which keeps intermediate levels no higher
+ * than necessary. Sections with the same state precision are then run
+ * together as batches, so each batch is one kernel call.
+ *
+ * Nothing else is merged: apart from inverse pairs, two sections never make
+ * one biquad with the same response. Batches mix filter types, since every
+ * type runs the same recursion.
+ *
+ * A plan is plain data and compiling it never allocates, so it can be
+ * compiled on the message thread and copied to the audio thread under a spin
+ * lock. Compiling designs every section, though; on the audio thread a change
+ * to one band that leaves the plan's shape alone only needs that band's
+ * section designed again, which findPatchableSection() checks for.
+ */
+struct EQPlan
+{
+    //==============================================================================
+    static constexpr int maxSections = 32;
+    
+    // Bands below this frequency/sample-rate ratio keep double-precision state
+    static constexpr double doublePrecisionRatio = 0.025;
+    
+    // Bells and shelves closer to 0 dB than this are treated as unity
+    static constexpr float unityToleranceDb = 0.001f;
+    
+    struct Batch
+    {
+        bool isDouble = false;
+        int firstSection = 0;
+        int numSections = 0;
+    };
+    
+    // Sections in execution order. Section i uses floatKernels[i] or
+    // doubleKernels[i] depending on its batch.
+    std::array<BiquadKernel<float>, maxSections> floatKernels;
+    std::array<BiquadKernel<double>, maxSections> doubleKernels;
+    std::array<bool, maxSections> isDouble {};
+    std::array<int, maxSections> sourceBand {};     // Index in the band list, so state can follow a band
+    int numSections = 0;
+    
+    std::array<Batch, maxSections> batches;
+    int numBatches = 0;
+    
+    // What the compiler removed
+    int numDisabled = 0;
+    int numUnity = 0;
+    int numCancelled = 0;
+    int numSvf = 0;             // Run by an SVFBank instead
+    int numOverflow = 0;        // Bands beyond maxSections
+    
+    //==============================================================================
+    // With allowFloatState false every section uses double state, as the
+    // double signal path wants. A lower doubleStateRatio keeps fewer bands in
+    // double, for less CPU at some cost in noise on low bands.
+    //
+    // SVF bands are left out for the float path, which runs them in an
+    // SVFBank. The double path has no SVFs and runs them as biquads, with the
+    // same static response.
+    static EQPlan compile(const EQBand* bands, int numBands, double sampleRate, bool allowFloatState = true,
+                          double doubleStateRatio = doublePrecisionRatio);
+    
+    // A plan that runs the given sections as they are, in order, e.g. for
+    // filters that aren't EQ bands
+    static EQPlan fromSections(const BiquadCoefficients* sections, int numSections, bool useDoubleState);
+    
+    // The section running bands[bandIndex], if changing it from previous
+    // leaves every section where it was, in the same batch; -1 if the plan
+    // has to be compiled again
+    int findPatchableSection(const EQBand* bands, int numBands, int bandIndex, const EQBand& previous,
+                             double sampleRate, bool allowFloatState = true,
+                             double doubleStateRatio = doublePrecisionRatio) const;
+    
+    static bool needsDoublePrecision(const EQBand& band, double sampleRate,
+                                     double doubleStateRatio = doublePrecisionRatio);
+    static bool isUnity(const EQBand& band);
+    static bool cancelsOut(const EQBand& a, const EQBand& b);
+    
+    juce::String getSummary() const;
+};
@@ -0,0 +1,318 @@
+#include "LevelMeter.h"
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    constexpr float fallDbPerSecond = 24.0f;
+    constexpr double holdSeconds = 1.5;
+    constexpr int channelGap = 2;
+    constexpr int markerWidth = 2;
+    
+    const juce::Colour backgroundColour { 0xff1e1e1e };
+    
+    // Green, then amber from -12 dB and red from -3 dB
+    struct Zone
+    {
+        float startDb;
+        juce::Colour colour;
+    };
+    
+    const Zone zones[] =
+    {
+        { LevelMeter::minDb,    juce::Colour(0xff3cb043) },
+        { -12.0f,               juce::Colour(0xffe0b020) },
+        { -3.0f,                juce::Colour(0xffe03030) }
+    };
+    
+    juce::Colour getZoneColour(float db)
+    {
+        auto colour = zones[0].colour;
+        
+        for (const auto& zone : zones)
+            if (db >= zone.startDb)
+                colour = zone.colour;
+        
+        return colour;
+    }
+}
+
+//==============================================================================
+void LevelMeter::setNumChannels(int newNumChannels)
+{
+    newNumChannels = juce::jlimit(1, maxChannels, newNumChannels);
+    
+    if (newNumChannels == numChannels)
+        return;
+    
+    numChannels = newNumChannels;
+    resized();
+    repaint();
+}
+
+bool LevelMeter::update(const float* peaks, int numPeaks, double elapsedSeconds)
+{
+    auto fall = fallDbPerSecond * (float) elapsedSeconds;
+    bool moving = false;
+    
+    for (int index = 0; index < numChannels; ++index)
+    {
+        auto& channel = channels[(size_t) index];
+        auto peakDb = index < numPeaks ? juce::Decibels::gainToDecibels(peaks[index], minDb) : minDb;
+        
+        channel.levelDb = juce::jmax(peakDb, channel.levelDb - fall);
+        
+        if (peakDb >= channel.holdDb)
+        {
+            channel.holdDb = peakDb;
+            channel.holdSecondsLeft = holdSeconds;
+        }
+        else if (channel.holdSecondsLeft > 0.0)
+        {
+            channel.holdSecondsLeft -= elapsedSeconds;
+        }
+        else
+        {
+            channel.holdDb = juce::jmax(channel.levelDb, channel.holdDb - fall);
+        }
+        
+        moving = moving || channel.levelDb > peakDb || channel.holdDb > channel.levelDb;
+        
+        moveBar(index, toPixels(channel.levelDb));
+        moveMarker(index, channel.holdDb > minDb ? toPixels(channel.holdDb) : -1);
+    }
+    
+    return moving;
+}
+
+//==============================================================================
+juce::Rectangle<int> LevelMeter::getBarArea(int channel) const
+{
+    auto rowHeight = getHeight() / numChannels;
+    return { 0, channel * rowHeight, getWidth(), juce::jmax(1, rowHeight - channelGap) };
+}
+
+juce::Rectangle<int> LevelMeter::getMarkerArea(int channel, int markerX) const
+{
+    auto area = getBarArea(channel);
+    return area.withX(area.getX() + juce::jmax(0, markerX - markerWidth)).withWidth(markerWidth);
+}
+
+int LevelMeter::toPixels(float db) const
+{
+    return juce::roundToInt(juce::jmap(juce::jlimit(minDb, maxDb, db), minDb, maxDb, 0.0f, (float) getWidth()));
+}
+
+void LevelMeter::moveBar(int index, int newBarWidth)
+{
+    auto& channel = channels[(size_t) index];
+    
+    if (newBarWidth == channel.barWidth)
+        return;
+    
+    // Only the strip between the old and new ends changes
+    auto area = getBarArea(index);
+    auto left = juce::jmin(channel.barWidth, newBarWidth);
+    auto right = juce::jmax(channel.barWidth, newBarWidth);
+    repaint(area.getX() + left, area.getY(), right - left, area.getHeight());
+    
+    channel.barWidth = newBarWidth;
+}
+
+void LevelMeter::moveMarker(int index, int newMarkerX)
+{
+    auto& channel = channels[(size_t) index];
+    
+    if (newMarkerX == channel.markerX)
+        return;
+    
+    if (channel.markerX >= 0)
+        repaint(getMarkerArea(index, channel.markerX));
+    
+    if (newMarkerX >= 0)
+        repaint(getMarkerArea(index, newMarkerX));
+    
+    channel.markerX = newMarkerX;
+}
+
+//==============================================================================
+void LevelMeter::paint(juce::Graphics& g)
+{
+    for (int index = 0; index < numChannels; ++index)
+    {
+        const auto& channel = channels[(size_t) index];
+        auto area = getBarArea(index);
+        
+        g.setColour(backgroundColour);
+        g.fillRect(area);
+        
+        for (size_t zone = 0; zone < std::size(zones); ++zone)
+        {
+            auto start = toPixels(zones[zone].startDb);
+            auto end = zone + 1 < std::size(zones) ? toPixels(zones[zone + 1].startDb) : area.getWidth();
+            end = juce::jmin(end, channel.barWidth);
+            
+            if (end > start)
+            {
+                g.setColour(zones[zone].colour);
+                g.fillRect(area.getX() + start, area.getY(), end - start, area.getHeight());
+            }
+        }
+        
+        if (channel.markerX >= 0)
+        {
+            g.setColour(getZoneColour(channel.holdDb));
+            g.fillRect(getMarkerArea(index, channel.markerX));
+        }
+    }
+}
+
+void LevelMeter::resized()
+{
+    // The whole meter repaints after a resize, so just re-derive the pixels
+    for (auto& channel : channels)
+    {
+        channel.barWidth = toPixels(channel.levelDb);
+        channel.markerX = channel.holdDb > minDb ? toPixels(channel.holdDb) : -1;
+    }
+}
+
+//==============================================================================
+LevelMeterPanel::LevelMeterPanel()
+{
+    inputLabel.setText("Input:", juce::dontSendNotification);
+    addAndMakeVisible(inputLabel);
+    
+    outputLabel.setText("Output:", juce::dontSendNotification);
+    addAndMakeVisible(outputLabel);
+    
+    addAndMakeVisible(inputMeter);
+    addAndMakeVisible(outputMeter);
+}
+
+LevelMeterPanel::~LevelMeterPanel()
+{
+    stopTimer();
+    vBlank.reset();
+}
+
+void LevelMeterPanel::setAudioServer(AudioServer* server)
+{
+    audioServer = server;
+    updateActivity();
+}
+
+//==============================================================================
+void LevelMeterPanel::resized()
+{
+    auto bounds = getLocalBounds();
+    auto rowHeight = bounds.getHeight() / 2;
+    
+    auto inputRow = bounds.removeFromTop(rowHeight);
+    inputLabel.setBounds(inputRow.removeFromLeft(60));
+    inputMeter.setBounds(inputRow.reduced(5, 4));
+    
+    auto outputRow = bounds;
+    outputLabel.setBounds(outputRow.removeFromLeft(60));
+    outputMeter.setBounds(outputRow.reduced(5, 4));
+}
+
+void LevelMeterPanel::visibilityChanged()
+{
+    updateActivity();
+}
+
+void LevelMeterPanel::parentHierarchyChanged()
+{
+    updateActivity();
+}
+
+//==============================================================================
+void LevelMeterPanel::updateActivity()
+{
+    if (audioServer != nullptr && isVisible())
+    {
+        if (!animating)
+            startTimerHz(idleChecksPerSecond);
+        
+        return;
+    }
+    
+    animating = false;
+    vBlank.reset();
+    stopTimer();
+}
+
+void LevelMeterPanel::startAnimating()
+{
+    stopTimer();
+    animating = true;
+    
+    if (vBlank == nullptr)
+        vBlank = std::make_unique<juce::VBlankAttachment>(this, [this] { vBlankCallback(); });
+}
+
+void LevelMeterPanel::stopAnimating()
+{
+    // Called from the vblank callback, so the attachment is released on the
+    // next idle check rather than from inside its own callback
+    animating = false;
+    startTimerHz(idleChecksPerSecond);
+}
+
+void LevelMeterPanel::timerCallback()
+{
+    vBlank.reset();
+    
+    if (audioServer == nullptr || !isShowing())
+        return;
+    
+    TRACE_SCOPE("Meter idle check");
+    
+    if (updateMeters())
+        startAnimating();
+}
+
+void LevelMeterPanel::vBlankCallback()
+{
+    if (!animating)
+        return;
+    
+    // Displays can refresh faster than the meters need
+    auto now = juce::Time::getMillisecondCounterHiRes();
+    
+    if (now - lastUpdateMs < 1000.0 / maxUpdatesPerSecond - 1.0)
+        return;
+    
+    TRACE_SCOPE("Meter frame");
+    
+    if (!isShowing() || !updateMeters())
+        stopAnimating();
+}
+
+bool LevelMeterPanel::updateMeters()
+{
+    auto now = juce::Time::getMillisecondCounterHiRes();
+    auto elapsedSeconds = juce::jlimit(0.0, 0.5, (now - lastUpdateMs) * 0.001);
+    lastUpdateMs = now;
+    
+    audioServer->takeMeterSnapshot(snapshot);
+    
+    if (snapshot.numInputs > 0)
+        inputMeter.setNumChannels(snapshot.numInputs);
+    
+    if (snapshot.numOutputs > 0)
+        outputMeter.setNumChannels(snapshot.numOutputs);
+    
+    auto moving = inputMeter.update(snapshot.inputPeaks.data(), snapshot.numInputs, elapsedSeconds);
+    moving = outputMeter.update(snapshot.outputPeaks.data(), snapshot.numOutputs, elapsedSeconds) || moving;
+    
+    // Any signal the meters can show means more may follow next frame
+    auto floor = juce::Decibels::decibelsToGain(LevelMeter::minDb);
+    
+    for (int channel = 0; channel < AudioServer::maxMeterChannels; ++channel)
+        if (snapshot.inputPeaks[(size_t) channel] > floor || snapshot.outputPeaks[(size_t) channel] > floor)
+            return true;
+    
+    return moving;
+}
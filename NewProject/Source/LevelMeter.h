@@ -0,0 +1,120 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioServer.h"
+
+//==============================================================================
+/**
+ * LevelMeter draws one horizontal bar per channel, with a peak-hold marker.
+ *
+ * Bars fall at a steady rate rather than dropping, and peaks hold for a
+ * moment before falling too, so short transients stay readable. Each update
+ * works out, in whole pixels, where every bar end and marker has moved and
+ * repaints only the strips in between, so a steady signal repaints nothing.
+ * Painting is solid fills only, so no frame allocates.
+ */
+class LevelMeter : public juce::Component
+{
+public:
+    //==============================================================================
+    static constexpr int maxChannels = AudioServer::maxMeterChannels;
+    static constexpr float minDb = -60.0f;
+    static constexpr float maxDb = 6.0f;
+    
+    LevelMeter() = default;
+    
+    void setNumChannels(int numChannels);
+    int getNumChannels() const { return numChannels; }
+    
+    // Takes the peaks (as gains) since the last update. Returns true while
+    // bars or markers are still falling or holding, i.e. the next update would
+    // change the display even with no signal.
+    bool update(const float* peaks, int numPeaks, double elapsedSeconds);
+    
+    //==============================================================================
+    void paint(juce::Graphics& g) override;
+    void resized() override;
+    
+private:
+    //==============================================================================
+    struct Channel
+    {
+        float levelDb = minDb;
+        float holdDb = minDb;
+        double holdSecondsLeft = 0.0;
+        
+        // What is currently drawn, in pixels from the bar's left edge
+        int barWidth = 0;
+        int markerX = -1;
+    };
+    
+    juce::Rectangle<int> getBarArea(int channel) const;
+    juce::Rectangle<int> getMarkerArea(int channel, int markerX) const;
+    int toPixels(float db) const;
+    
+    void moveBar(int channel, int newBarWidth);
+    void moveMarker(int channel, int newMarkerX);
+    
+    //==============================================================================
+    std::array<Channel, maxChannels> channels;
+    int numChannels = 2;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LevelMeter)
+};
+
+//==============================================================================
+/**
+ * LevelMeterPanel shows input and output meters for an AudioServer, read from
+ * its lock-free meter snapshot.
+ *
+ * While there is signal, or the meters are still falling, the panel updates
+ * on the display's vertical blank, at most 60 times a second. Once they have
+ * settled on silence, or the window is hidden, it drops the vblank callback
+ * and nothing repaints; a check a few times a second picks up new signal or
+ * the window showing again. While the panel itself is hidden it stops
+ * entirely.
+ */
+class LevelMeterPanel : public juce::Component,
+                        private juce::Timer
+{
+public:
+    //==============================================================================
+    LevelMeterPanel();
+    ~LevelMeterPanel() override;
+    
+    // The server must outlive the panel, or be cleared first
+    void setAudioServer(AudioServer* server);
+    
+    //==============================================================================
+    void resized() override;
+    void visibilityChanged() override;
+    void parentHierarchyChanged() override;
+    
+private:
+    //==============================================================================
+    static constexpr double maxUpdatesPerSecond = 60.0;
+    static constexpr int idleChecksPerSecond = 4;
+    
+    void timerCallback() override;
+    void vBlankCallback();
+    
+    void updateActivity();
+    void startAnimating();
+    void stopAnimating();
+    
+    // Returns whether the meters need updating again on the next frame
+    bool updateMeters();
+    
+    //==============================================================================
+    AudioServer* audioServer = nullptr;
+    AudioServer::MeterSnapshot snapshot;
+    
+    juce::Label inputLabel, outputLabel;
+    LevelMeter inputMeter, outputMeter;
+    
+    std::unique_ptr<juce::VBlankAttachment> vBlank;
+    bool animating = false;
+    double lastUpdateMs = 0.0;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LevelMeterPanel)
+};
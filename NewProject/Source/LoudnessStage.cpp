@@ -0,0 +1,352 @@
+#include "LoudnessStage.h"
+
+namespace
+{
+    // 5.1 and 7.1 in L R C LFE order: the LFE is excluded, and surrounds
+    // between 60 and 120 degrees count 1.41 (+1.5 dB)
+    void fillDefaultWeights(float* weights, int numChannels)
+    {
+        std::fill(weights, weights + numChannels, 1.0f);
+        
+        if (numChannels == 6 || numChannels == 8)
+        {
+            weights[3] = 0.0f;
+            weights[4] = 1.41f;
+            weights[5] = 1.41f;
+        }
+    }
+}
+
+//==============================================================================
+void LoudnessStage::setSettings(const Settings& newSettings)
+{
+    ActiveSettings next;
+    next.enabled = newSettings.enabled;
+    next.targetLufs = newSettings.targetLufs;
+    next.maxBoostDb = juce::jmax(0.0f, newSettings.maxBoostDb);
+    next.maxCutDb = juce::jmax(0.0f, newSettings.maxCutDb);
+    next.silenceThresholdLufs = newSettings.silenceThresholdLufs;
+    next.smoothingSeconds = juce::jmax(0.01f, newSettings.smoothingSeconds);
+    next.measure = newSettings.measure;
+    next.useDefaultWeights = newSettings.channelWeights.isEmpty();
+    
+    for (int channel = 0; channel < juce::jmin(maxChannels, newSettings.channelWeights.size()); ++channel)
+        next.channelWeights[(size_t) channel] = newSettings.channelWeights[channel];
+    
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    settings = newSettings;
+    pending = next;
+    settingsChanged = true;
+}
+
+LoudnessStage::Settings LoudnessStage::getSettings() const
+{
+    const juce::SpinLock::ScopedLockType lock(settingsLock);
+    return settings;
+}
+
+void LoudnessStage::resetIntegrated()
+{
+    integratedResetRequested.store(true);
+}
+
+//==============================================================================
+juce::Array<float> LoudnessStage::getDefaultChannelWeights(int numChannels)
+{
+    std::array<float, maxChannels> weights;
+    numChannels = juce::jlimit(0, maxChannels, numChannels);
+    fillDefaultWeights(weights.data(), numChannels);
+    
+    return juce::Array<float>(weights.data(), numChannels);
+}
+
+void LoudnessStage::designKWeighting(double sampleRate, BiquadCoefficients sections[2])
+{
+    // BS.1770 specifies these at 48 kHz; the analogue prototypes below give the
+    // same response at any rate
+    {
+        // Head-related high shelf, +4 dB above about 1.7 kHz
+        const double f0 = 1681.974450955533, gainDb = 3.999843853973347, q = 0.7071752369554196;
+        
+        auto k = std::tan(juce::MathConstants<double>::pi * f0 / sampleRate);
+        auto vh = std::pow(10.0, gainDb / 20.0);
+        auto vb = std::pow(vh, 0.4996667741545416);
+        auto a0 = 1.0 + k / q + k * k;
+        
+        sections[0].b0 = (vh + vb * k / q + k * k) / a0;
+        sections[0].b1 = 2.0 * (k * k - vh) / a0;
+        sections[0].b2 = (vh - vb * k / q + k * k) / a0;
+        sections[0].a1 = 2.0 * (k * k - 1.0) / a0;
+        sections[0].a2 = (1.0 - k / q + k * k) / a0;
+    }
+    
+    {
+        // RLB high-pass at about 38 Hz
+        const double f0 = 38.13547087602444, q = 0.5003270373238773;
+        
+        auto k = std::tan(juce::MathConstants<double>::pi * f0 / sampleRate);
+        auto a0 = 1.0 + k / q + k * k;
+        
+        sections[1].b0 = 1.0;
+        sections[1].b1 = -2.0;
+        sections[1].b2 = 1.0;
+        sections[1].a1 = 2.0 * (k * k - 1.0) / a0;
+        sections[1].a2 = (1.0 - k / q + k * k) / a0;
+    }
+}
+
+float LoudnessStage::energyToLufs(double meanSquare)
+{
+    if (meanSquare <= 0.0)
+        return silenceLufs;
+    
+    return juce::jmax(silenceLufs, (float) (-0.691 + 10.0 * std::log10(meanSquare)));
+}
+
+//==============================================================================
+void LoudnessStage::prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernelsToUse)
+{
+    currentSampleRate = sampleRate;
+    numPreparedChannels = juce::jlimit(1, maxChannels, numChannels);
+    kernels = &kernelsToUse;
+    subBlockLength = juce::jmax(1, juce::roundToInt(sampleRate * 0.1));
+    
+    weighted.setSize(numPreparedChannels, juce::jmax(1, maxBlockSize));
+    gainRamp.calloc((size_t) weighted.getNumSamples());
+    
+    // K-weighting runs in double unless asked otherwise: the 38 Hz high-pass
+    // is far below where float state stays accurate
+    designKWeighting(sampleRate, kWeightingSections.data());
+    doubleWeighting = doubleWeightingRequested.load();
+    
+    kWeighting.prepare(numPreparedChannels, juce::jmax(1, maxBlockSize), DSPKernels::getForChannels(numPreparedChannels));
+    kWeighting.setPlan(EQPlan::fromSections(kWeightingSections.data(), 2, doubleWeighting));
+    
+    updateSettings();
+    updateWeights();
+    gain.reset(sampleRate, active.smoothingSeconds);
+    reset();
+}
+
+void LoudnessStage::reset()
+{
+    kWeighting.reset();
+    
+    subBlockFill = 0;
+    subBlockEnergy = 0.0;
+    subBlocks.fill(0.0);
+    subBlockIndex = 0;
+    numSubBlocks = 0;
+    momentarySum = 0.0;
+    shortTermSum = 0.0;
+    
+    histogramCounts.fill(0);
+    histogramEnergy.fill(0.0);
+    gatedBlockCount = 0;
+    gatedEnergy = 0.0;
+    
+    gain.setCurrentAndTargetValue(1.0f);
+    
+    momentaryLufs.store(silenceLufs);
+    shortTermLufs.store(silenceLufs);
+    integratedLufs.store(silenceLufs);
+    gainDb.store(0.0f);
+}
+
+void LoudnessStage::updateSettings()
+{
+    // Called on the audio thread: never wait for the message thread, just pick
+    // up the new settings on a later block if the lock is busy
+    const juce::SpinLock::ScopedTryLockType lock(settingsLock);
+    
+    if (!lock.isLocked() || !settingsChanged)
+        return;
+    
+    auto smoothingChanged = active.smoothingSeconds != pending.smoothingSeconds;
+    active = pending;
+    settingsChanged = false;
+    
+    updateWeights();
+    
+    // Changing the ramp length ends the current ramp; carry on from where it got to
+    if (smoothingChanged)
+    {
+        auto current = gain.getCurrentValue();
+        gain.reset(currentSampleRate, active.smoothingSeconds);
+        gain.setCurrentAndTargetValue(current);
+    }
+}
+
+void LoudnessStage::updateWeights()
+{
+    if (active.useDefaultWeights)
+        fillDefaultWeights(weights.data(), numPreparedChannels);
+    else
+        weights = active.channelWeights;
+}
+
+//==============================================================================
+void LoudnessStage::process(juce::AudioBuffer<float>& buffer)
+{
+    updateSettings();
+    
+    if (auto requested = doubleWeightingRequested.load(std::memory_order_relaxed); requested != doubleWeighting)
+    {
+        doubleWeighting = requested;
+        kWeighting.setPlan(EQPlan::fromSections(kWeightingSections.data(), 2, doubleWeighting));
+    }
+    
+    if (integratedResetRequested.exchange(false))
+    {
+        histogramCounts.fill(0);
+        histogramEnergy.fill(0.0);
+        gatedBlockCount = 0;
+        gatedEnergy = 0.0;
+        integratedLufs.store(silenceLufs, std::memory_order_relaxed);
+    }
+    
+    if (!active.enabled)
+    {
+        gain.setCurrentAndTargetValue(1.0f);
+        gainDb.store(0.0f, std::memory_order_relaxed);
+        return;
+    }
+    
+    auto numChannels = juce::jmin(buffer.getNumChannels(), numPreparedChannels);
+    auto numSamples = buffer.getNumSamples();
+    
+    // Measure in chunks no longer than the weighting buffer, so an oversized
+    // block never needs a bigger one
+    for (int chunkStart = 0; chunkStart < numSamples; chunkStart += weighted.getNumSamples())
+    {
+        auto chunkLength = juce::jmin(weighted.getNumSamples(), numSamples - chunkStart);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            kernels->copy(weighted.getWritePointer(channel), buffer.getReadPointer(channel, chunkStart), chunkLength);
+        
+        kWeighting.process(weighted.getArrayOfWritePointers(), numChannels, chunkLength);
+        
+        // Split the chunk where sub-blocks end
+        for (int position = 0; position < chunkLength;)
+        {
+            auto length = juce::jmin(chunkLength - position, subBlockLength - subBlockFill);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                if (weights[(size_t) channel] != 0.0f)
+                    subBlockEnergy += weights[(size_t) channel]
+                                    * kernels->sumOfSquares(weighted.getReadPointer(channel, position), length);
+            
+            position += length;
+            subBlockFill += length;
+            
+            if (subBlockFill == subBlockLength)
+                finishSubBlock();
+        }
+        
+        applyGain(buffer, chunkStart, chunkLength);
+    }
+    
+    gainDb.store(juce::Decibels::gainToDecibels(gain.getCurrentValue()), std::memory_order_relaxed);
+}
+
+void LoudnessStage::applyGain(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    if (!gain.isSmoothing())
+    {
+        auto value = gain.getTargetValue();
+        
+        if (value != 1.0f)
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+                juce::FloatVectorOperations::multiply(buffer.getWritePointer(channel, startSample), value, numSamples);
+        
+        return;
+    }
+    
+    // One ramp shared by every channel
+    for (int i = 0; i < numSamples; ++i)
+        gainRamp[i] = gain.getNextValue();
+    
+    for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        juce::FloatVectorOperations::multiply(buffer.getWritePointer(channel, startSample), gainRamp.get(), numSamples);
+}
+
+void LoudnessStage::finishSubBlock()
+{
+    auto meanSquare = subBlockEnergy / subBlockLength;
+    subBlockEnergy = 0.0;
+    subBlockFill = 0;
+    
+    // Each window gains the new sub-block and loses its oldest one. The ring
+    // starts zeroed, so this holds before the windows fill too.
+    auto leavingMomentary = subBlocks[(size_t) ((subBlockIndex + shortTermSubBlocks - momentarySubBlocks) % shortTermSubBlocks)];
+    auto leavingShortTerm = subBlocks[(size_t) subBlockIndex];
+    
+    momentarySum = juce::jmax(0.0, momentarySum + meanSquare - leavingMomentary);
+    shortTermSum = juce::jmax(0.0, shortTermSum + meanSquare - leavingShortTerm);
+    
+    subBlocks[(size_t) subBlockIndex] = meanSquare;
+    subBlockIndex = (subBlockIndex + 1) % shortTermSubBlocks;
+    numSubBlocks = juce::jmin(numSubBlocks + 1, shortTermSubBlocks);
+    
+    if (numSubBlocks < momentarySubBlocks)
+        return;
+    
+    // Each momentary window is one 400 ms gating block, overlapping the last by 75%
+    auto blockEnergy = momentarySum / momentarySubBlocks;
+    auto blockLufs = energyToLufs(blockEnergy);
+    
+    momentaryLufs.store(blockLufs, std::memory_order_relaxed);
+    shortTermLufs.store(numSubBlocks == shortTermSubBlocks ? energyToLufs(shortTermSum / shortTermSubBlocks) : silenceLufs,
+                        std::memory_order_relaxed);
+    
+    if (blockLufs > absoluteGateLufs)
+    {
+        auto bin = juce::jlimit(0, numHistogramBins - 1, (int) ((blockLufs - absoluteGateLufs) * histogramBinsPerLu));
+        ++histogramCounts[(size_t) bin];
+        histogramEnergy[(size_t) bin] += blockEnergy;
+        ++gatedBlockCount;
+        gatedEnergy += blockEnergy;
+    }
+    
+    integratedLufs.store(computeIntegrated(), std::memory_order_relaxed);
+    
+    updateGainTarget();
+}
+
+float LoudnessStage::computeIntegrated() const
+{
+    if (gatedBlockCount == 0)
+        return silenceLufs;
+    
+    // The relative gate sits 10 LU below the mean of the blocks above the
+    // absolute gate; only bins wholly above it count. The partial block since
+    // the last sub-block isn't included, as BS.1770 gates complete blocks only.
+    auto relativeGate = energyToLufs(gatedEnergy / gatedBlockCount) + relativeGateLu;
+    auto firstBin = juce::jlimit(0, numHistogramBins, (int) std::ceil((relativeGate - absoluteGateLufs) * histogramBinsPerLu));
+    
+    int count = 0;
+    double energy = 0.0;
+    
+    for (int bin = firstBin; bin < numHistogramBins; ++bin)
+    {
+        count += histogramCounts[(size_t) bin];
+        energy += histogramEnergy[(size_t) bin];
+    }
+    
+    return count > 0 ? energyToLufs(energy / count) : silenceLufs;
+}
+
+void LoudnessStage::updateGainTarget()
+{
+    // Short-term loudness over whatever part of the 3 s window has filled, so
+    // the gain starts adapting after the first gating block
+    auto measured = active.measure == Measure::Integrated ? integratedLufs.load(std::memory_order_relaxed)
+                                                          : energyToLufs(shortTermSum / numSubBlocks);
+    
+    // Hold through quiet passages rather than boosting the noise floor
+    if (measured <= active.silenceThresholdLufs)
+        return;
+    
+    auto targetDb = juce::jlimit(-active.maxCutDb, active.maxBoostDb, active.targetLufs - measured);
+    gain.setTargetValue(juce::Decibels::decibelsToGain(targetDb));
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQFilterBank.h"
+
+//==============================================================================
+/**
+ * LoudnessStage measures loudness as specified by EBU R128 / ITU-R BS.1770 and
+ * drives a smoothed make-up gain toward a target, so programmes from
+ * different apps play back at a similar level.
+ *
+ * A copy of the block is K-weighted by an EQFilterBank, so the two filter
+ * sections run as a SIMD cascade. Its energy is weighted per channel and
+ * summed into 100 ms sub-blocks:
+ *
+ * - momentary (400 ms) and short-term (3 s) loudness are running sums over a
+ *   ring of sub-block energies, so each update costs the same however long
+ *   the window
+ * - integrated loudness keeps a histogram of 400 ms block loudness in 0.1 LU
+ *   bins, with the energy of the blocks in each bin, so the absolute and
+ *   relative gates never rescan old blocks. As in BS.1770 only complete
+ *   gating blocks count: up to the last 100 ms isn't included yet, and
+ *   nothing is reported before the first 400 ms.
+ *
+ * Every sub-block the gain target is moved toward the target loudness, within
+ * the boost and cut limits. Quiet passages below the silence threshold hold
+ * the gain rather than boosting the noise floor.
+ *
+ * Nothing on the audio thread allocates: all buffers are sized in prepare().
+ */
+class LoudnessStage
+{
+public:
+    //==============================================================================
+    static constexpr int maxChannels = 64;
+    
+    // Reported for anything below the absolute gate, or before a full window
+    static constexpr float silenceLufs = -100.0f;
+    
+    enum class Measure
+    {
+        ShortTerm,      // Follows changes in material within a few seconds
+        Integrated      // Settles on the programme as a whole
+    };
+    
+    struct Settings
+    {
+        bool enabled = false;
+        float targetLufs = -16.0f;
+        float maxBoostDb = 12.0f;
+        float maxCutDb = 20.0f;
+        float silenceThresholdLufs = -50.0f;
+        float smoothingSeconds = 1.0f;
+        Measure measure = Measure::ShortTerm;
+        
+        // BS.1770 channel weights; leave empty for the defaults for the
+        // channel count (surrounds at 1.41, LFE excluded)
+        juce::Array<float> channelWeights;
+    };
+    
+    //==============================================================================
+    LoudnessStage() = default;
+    
+    // Message thread. Takes effect on the next block.
+    void setSettings(const Settings& newSettings);
+    Settings getSettings() const;
+    
+    // Starts integrated loudness over, e.g. when the programme changes
+    void resetIntegrated();
+    
+    // K-weighting in double (the default) or, to save CPU, float state, which
+    // reads slightly high on programme with a lot of deep bass. Any thread;
+    // the filter state carries over, so the switch doesn't disturb readings.
+    void setDoubleWeighting(bool shouldUseDouble) { doubleWeightingRequested.store(shouldUseDouble); }
+    bool isDoubleWeighting() const { return doubleWeightingRequested.load(); }
+    
+    // Readings, safe from any thread
+    float getMomentaryLufs() const      { return momentaryLufs.load(std::memory_order_relaxed); }
+    float getShortTermLufs() const      { return shortTermLufs.load(std::memory_order_relaxed); }
+    float getIntegratedLufs() const     { return integratedLufs.load(std::memory_order_relaxed); }
+    float getGainDb() const             { return gainDb.load(std::memory_order_relaxed); }
+    
+    // Defaults for a channel count, in the usual L R C LFE Ls Rs order
+    static juce::Array<float> getDefaultChannelWeights(int numChannels);
+    
+    // The two K-weighting sections (high shelf, then high-pass) for a sample rate
+    static void designKWeighting(double sampleRate, BiquadCoefficients sections[2]);
+    
+    //==============================================================================
+    // Audio thread
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, const DSPKernels& kernels);
+    void process(juce::AudioBuffer<float>& buffer);
+    void reset();
+    
+private:
+    //==============================================================================
+    static constexpr int momentarySubBlocks = 4;        // 400 ms
+    static constexpr int shortTermSubBlocks = 30;       // 3 s
+    static constexpr float absoluteGateLufs = -70.0f;
+    static constexpr float relativeGateLu = -10.0f;
+    
+    // Integrated loudness histogram: 0.1 LU bins from the absolute gate up
+    static constexpr int numHistogramBins = 1000;
+    static constexpr float histogramBinsPerLu = 10.0f;
+    
+    struct ActiveSettings
+    {
+        bool enabled = false;
+        float targetLufs = -16.0f;
+        float maxBoostDb = 12.0f;
+        float maxCutDb = 20.0f;
+        float silenceThresholdLufs = -50.0f;
+        float smoothingSeconds = 1.0f;
+        Measure measure = Measure::ShortTerm;
+        bool useDefaultWeights = true;
+        std::array<float, maxChannels> channelWeights {};
+    };
+    
+    static float energyToLufs(double meanSquare);
+    
+    void updateSettings();
+    void updateWeights();
+    void applyGain(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void finishSubBlock();
+    float computeIntegrated() const;
+    void updateGainTarget();
+    
+    //==============================================================================
+    // Message thread copy and the version waiting for the audio thread,
+    // guarded by settingsLock
+    Settings settings;
+    ActiveSettings pending;
+    mutable juce::SpinLock settingsLock;
+    bool settingsChanged = false;
+    std::atomic<bool> integratedResetRequested { false };
+    
+    // Audio thread
+    ActiveSettings active;
+    double currentSampleRate = 48000.0;
+    int numPreparedChannels = 0;
+    std::array<float, maxChannels> weights {};
+    
+    EQFilterBank<float> kWeighting;
+    std::array<BiquadCoefficients, 2> kWeightingSections;
+    std::atomic<bool> doubleWeightingRequested { true };
+    bool doubleWeighting = true;
+    juce::AudioBuffer<float> weighted;
+    juce::HeapBlock<float> gainRamp;
+    const DSPKernels* kernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+    
+    int subBlockLength = 4800;
+    int subBlockFill = 0;
+    double subBlockEnergy = 0.0;
+    
+    std::array<double, shortTermSubBlocks> subBlocks {};
+    int subBlockIndex = 0;
+    int numSubBlocks = 0;
+    double momentarySum = 0.0;
+    double shortTermSum = 0.0;
+    
+    std::array<int, numHistogramBins> histogramCounts {};
+    std::array<double, numHistogramBins> histogramEnergy {};
+    int gatedBlockCount = 0;
+    double gatedEnergy = 0.0;
+    
+    juce::SmoothedValue<float, juce::ValueSmoothingTypes::Multiplicative> gain { 1.0f };
+    
+    std::atomic<float> momentaryLufs { silenceLufs };
+    std::atomic<float> shortTermLufs { silenceLufs };
+    std::atomic<float> integratedLufs { silenceLufs };
+    std::atomic<float> gainDb { 0.0f };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LoudnessStage)
+};
@@ -8,6 +8,8 @@
 
 #include <JuceHeader.h>
 #include "MainComponent.h"
+#include "SelfTest.h"
+#include "Tracing.h"
 
 //==============================================================================
 class NewProjectApplication  : public juce::JUCEApplication
@@ -25,6 +27,24 @@ public:
     {
         // This method is where you should put your application's initialisation code..
 
+        // --trace=<file> records from here on and writes the trace on quit
+        traceFile = Tracing::getRequestedFile (commandLine);
+
+        if (traceFile != juce::File())
+            Tracing::setEnabled (true);
+
+        // Headless checks for CI, see SelfTest.h
+        if (SelfTest::isRequested (commandLine))
+        {
+            selfTest = std::make_unique<SelfTest> (commandLine, [this] (int numFailedChecks)
+            {
+                setApplicationReturnValue (numFailedChecks);
+                quit();
+            });
+
+            return;
+        }
+
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
 
@@ -33,6 +53,17 @@ public:
         // Add your application's shutdown code here..
 
         mainWindow = nullptr; // (deletes our window)
+        selfTest = nullptr;
+
+        if (traceFile != juce::File())
+        {
+            Tracing::setEnabled (false);
+
+            juce::String error;
+
+            if (! Tracing::writeJson (traceFile, error))
+                DBG (error);
+        }
     }
 
     //==============================================================================
@@ -98,6 +129,8 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    std::unique_ptr<SelfTest> selfTest;
+    juce::File traceFile;
 };
 
 //==============================================================================
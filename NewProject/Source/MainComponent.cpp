@@ -5,9 +5,11 @@ MainComponent::MainComponent()
 {
     setSize(800, 600);
     
-    // Initialize audio server
+    // Initialize audio server. Devices open on the control thread, so the
+    // window shows straight away.
     audioServer = std::make_unique<AudioServer>();
-    audioServer->initialize();
+    deviceController = std::make_unique<DeviceController>(*audioServer);
+    deviceController->onStateChanged = [this] { updateDeviceLists(); updateUIState(); };
     
     // Setup device group
     deviceGroup.setText("Audio Devices");
@@ -61,7 +63,7 @@ MainComponent::MainComponent()
     statusText.setMultiLine(true);
     statusText.setReadOnly(true);
     statusText.setCaretVisible(false);
-    statusText.setText("Audio server initialized. Select devices and press Start.");
+    statusText.setText("Opening audio devices...");
     addAndMakeVisible(statusText);
     
     // Level meters group
@@ -69,23 +71,9 @@ MainComponent::MainComponent()
     levelGroup.setTextLabelPosition(juce::Justification::centredLeft);
     addAndMakeVisible(levelGroup);
     
-    inputLevelLabel.setText("Input:", juce::dontSendNotification);
-    addAndMakeVisible(inputLevelLabel);
-    
-    outputLevelLabel.setText("Output:", juce::dontSendNotification);
-    addAndMakeVisible(outputLevelLabel);
-    
-    inputLevelValueL.setText("L: 0.0", juce::dontSendNotification);
-    addAndMakeVisible(inputLevelValueL);
-    
-    inputLevelValueR.setText("R: 0.0", juce::dontSendNotification);
-    addAndMakeVisible(inputLevelValueR);
-    
-    outputLevelValueL.setText("L: 0.0", juce::dontSendNotification);
-    addAndMakeVisible(outputLevelValueL);
-    
-    outputLevelValueR.setText("R: 0.0", juce::dontSendNotification);
-    addAndMakeVisible(outputLevelValueR);
+    // Meters read the server's meter snapshot and schedule their own repaints
+    levelMeters.setAudioServer(audioServer.get());
+    addAndMakeVisible(levelMeters);
     
     // Info group
     infoGroup.setText("Setup Information");
@@ -98,16 +86,25 @@ MainComponent::MainComponent()
     addAndMakeVisible(infoText);
     
     // Initialize
-    updateDeviceLists();
-    checkVirtualDeviceSetup();
+    updateUIState();
     
-    // Start UI update timer
-    startTimerHz(10); // 10 Hz update rate for level meters
+    deviceController->initialize([this] (const DeviceController::Result& result)
+    {
+        if (result.succeeded)
+            statusText.setText("Audio server initialized. Select devices and press Start.");
+        else
+            statusText.setText("Failed to open audio devices: " + result.errorMessage);
+        
+        checkVirtualDeviceSetup();
+    });
 }
 
 MainComponent::~MainComponent()
 {
-    stopTimer();
+    levelMeters.setAudioServer(nullptr);
+    
+    // Finishes any device operation in progress and drops the rest
+    deviceController.reset();
     
     if (audioServer)
     {
@@ -167,19 +164,7 @@ void MainComponent::resized()
     auto levelBounds = bounds.removeFromTop(100);
     levelGroup.setBounds(levelBounds);
     
-    auto levelContent = levelBounds.reduced(10, 25);
-    
-    auto inputRow = levelContent.removeFromTop(25);
-    inputLevelLabel.setBounds(inputRow.removeFromLeft(60));
-    inputLevelValueL.setBounds(inputRow.removeFromLeft(100).reduced(5, 0));
-    inputLevelValueR.setBounds(inputRow.removeFromLeft(100).reduced(5, 0));
-    
-    levelContent.removeFromTop(10);
-    
-    auto outputRow = levelContent.removeFromTop(25);
-    outputLevelLabel.setBounds(outputRow.removeFromLeft(60));
-    outputLevelValueL.setBounds(outputRow.removeFromLeft(100).reduced(5, 0));
-    outputLevelValueR.setBounds(outputRow.removeFromLeft(100).reduced(5, 0));
+    levelMeters.setBounds(levelBounds.reduced(10, 25));
     
     bounds.removeFromTop(10);
     
@@ -188,84 +173,91 @@ void MainComponent::resized()
     infoText.setBounds(bounds.reduced(10, 25));
 }
 
-//==============================================================================
-void MainComponent::timerCallback()
-{
-    // Update level meters
-    if (audioServer && audioServer->isRunning())
-    {
-        float inL = audioServer->getInputLevel(0);
-        float inR = audioServer->getInputLevel(1);
-        float outL = audioServer->getOutputLevel(0);
-        float outR = audioServer->getOutputLevel(1);
-        
-        inputLevelValueL.setText("L: " + juce::String(inL, 3), juce::dontSendNotification);
-        inputLevelValueR.setText("R: " + juce::String(inR, 3), juce::dontSendNotification);
-        outputLevelValueL.setText("L: " + juce::String(outL, 3), juce::dontSendNotification);
-        outputLevelValueR.setText("R: " + juce::String(outR, 3), juce::dontSendNotification);
-    }
-}
-
 //==============================================================================
 void MainComponent::startButtonClicked()
 {
-    if (!audioServer)
+    if (!deviceController)
         return;
     
-    if (audioServer->startAudioProcessing())
-    {
-        statusText.setText("Audio processing started!\n" +
-                          juce::String("Sample Rate: ") + juce::String(audioServer->getSampleRate()) + " Hz\n" +
-                          juce::String("Buffer Size: ") + juce::String(audioServer->getBufferSize()) + " samples");
-        updateUIState();
-    }
-    else
+    statusText.setText("Starting audio processing...");
+    
+    deviceController->start([this] (const DeviceController::Result& result)
     {
-        statusText.setText("Failed to start audio processing. Check device selection.");
-    }
+        auto state = deviceController->getState();
+        
+        if (result.succeeded && state.running)
+        {
+            statusText.setText("Audio processing started!\n" +
+                              juce::String("Sample Rate: ") + juce::String(state.sampleRate) + " Hz\n" +
+                              juce::String("Buffer Size: ") + juce::String(state.bufferSize) + " samples");
+        }
+        else if (!result.succeeded)
+        {
+            statusText.setText("Failed to start audio processing. Check device selection.");
+        }
+    });
 }
 
 void MainComponent::stopButtonClicked()
 {
-    if (!audioServer)
+    if (!deviceController)
         return;
     
-    audioServer->stopAudioProcessing();
-    statusText.setText("Audio processing stopped.");
-    updateUIState();
+    deviceController->stop([this] (const DeviceController::Result&)
+    {
+        if (!deviceController->getState().running)
+            statusText.setText("Audio processing stopped.");
+    });
 }
 
 void MainComponent::refreshDevicesButtonClicked()
 {
-    updateDeviceLists();
-    checkVirtualDeviceSetup();
+    if (!deviceController)
+        return;
+    
+    deviceController->refreshDevices([this] (const DeviceController::Result&) { checkVirtualDeviceSetup(); });
 }
 
 void MainComponent::inputDeviceChanged()
 {
-    if (!audioServer)
+    if (!deviceController)
         return;
     
     auto selectedIndex = inputDeviceCombo.getSelectedItemIndex();
     if (selectedIndex >= 0)
     {
         auto deviceName = inputDeviceCombo.getItemText(selectedIndex);
-        audioServer->setInputDevice(deviceName);
-        statusText.setText("Input device changed to: " + deviceName);
+        statusText.setText("Opening input device: " + deviceName);
+        
+        // Quick changes coalesce, so report whichever device was opened last
+        deviceController->setInputDevice(deviceName, [this] (const DeviceController::Result& result)
+        {
+            if (result.succeeded)
+                statusText.setText("Input device changed to: " + inputDeviceCombo.getText());
+            else
+                statusText.setText(result.errorMessage);
+        });
     }
 }
 
 void MainComponent::outputDeviceChanged()
 {
-    if (!audioServer)
+    if (!deviceController)
         return;
     
     auto selectedIndex = outputDeviceCombo.getSelectedItemIndex();
     if (selectedIndex >= 0)
     {
         auto deviceName = outputDeviceCombo.getItemText(selectedIndex);
-        audioServer->setOutputDevice(deviceName);
-        statusText.setText("Output device changed to: " + deviceName);
+        statusText.setText("Opening output device: " + deviceName);
+        
+        deviceController->setOutputDevice(deviceName, [this] (const DeviceController::Result& result)
+        {
+            if (result.succeeded)
+                statusText.setText("Output device changed to: " + outputDeviceCombo.getText());
+            else
+                statusText.setText(result.errorMessage);
+        });
     }
 }
 
@@ -285,16 +277,18 @@ void MainComponent::bypassChanged()
 //==============================================================================
 void MainComponent::updateDeviceLists()
 {
-    if (!audioServer)
+    if (!deviceController)
         return;
     
     // Save current selections
     auto currentInput = inputDeviceCombo.getText();
     auto currentOutput = outputDeviceCombo.getText();
+    auto state = deviceController->getState();
     
-    // Update input devices
-    inputDeviceCombo.clear();
-    auto inputDevices = audioServer->getAvailableInputDevices();
+    // Update input devices. Called after every device operation, so never
+    // notify: a change here would queue another one.
+    inputDeviceCombo.clear(juce::dontSendNotification);
+    auto inputDevices = state.inputDevices;
     for (int i = 0; i < inputDevices.size(); ++i)
         inputDeviceCombo.addItem(inputDevices[i], i + 1);
     
@@ -303,8 +297,8 @@ void MainComponent::updateDeviceLists()
     inputDeviceCombo.setSelectedItemIndex(inputIndex >= 0 ? inputIndex : 0, juce::dontSendNotification);
     
     // Update output devices
-    outputDeviceCombo.clear();
-    auto outputDevices = audioServer->getAvailableOutputDevices();
+    outputDeviceCombo.clear(juce::dontSendNotification);
+    auto outputDevices = state.outputDevices;
     for (int i = 0; i < outputDevices.size(); ++i)
         outputDeviceCombo.addItem(outputDevices[i], i + 1);
     
@@ -315,9 +309,10 @@ void MainComponent::updateDeviceLists()
 
 void MainComponent::updateUIState()
 {
-    bool running = audioServer && audioServer->isRunning();
+    auto state = deviceController ? deviceController->getState() : DeviceController::State();
+    bool running = state.running;
     
-    startButton.setEnabled(!running);
+    startButton.setEnabled(state.ready && !running);
     stopButton.setEnabled(running);
     inputDeviceCombo.setEnabled(!running);
     outputDeviceCombo.setEnabled(!running);
@@ -326,13 +321,15 @@ void MainComponent::updateUIState()
 
 void MainComponent::checkVirtualDeviceSetup()
 {
-    auto setup = VirtualAudioDevice::checkVirtualDeviceSetup();
+    // Looked up on the control thread with the device lists
+    auto state = deviceController->getState();
+    const auto& setup = state.virtualSetup;
     infoText.setText(setup.setupInstructions);
     
     if (setup.hasVirtualDevice)
     {
         // Try to auto-select the virtual device as input
-        auto inputDevices = audioServer->getAvailableInputDevices();
+        const auto& inputDevices = state.inputDevices;
         int virtualIndex = inputDevices.indexOf(setup.recommendedDevice);
         if (virtualIndex >= 0)
         {
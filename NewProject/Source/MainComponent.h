@@ -2,15 +2,16 @@
 
 #include <JuceHeader.h>
 #include "AudioServer.h"
+#include "DeviceController.h"
 #include "VirtualAudioDevice.h"
+#include "LevelMeter.h"
 
 //==============================================================================
 /*
     Main control interface for the MacEQ audio server.
     Provides device selection, audio routing control, and monitoring.
 */
-class MainComponent  : public juce::Component,
-                       private juce::Timer
+class MainComponent  : public juce::Component
 {
 public:
     //==============================================================================
@@ -23,8 +24,6 @@ public:
 
 private:
     //==============================================================================
-    void timerCallback() override;
-    
     void startButtonClicked();
     void stopButtonClicked();
     void refreshDevicesButtonClicked();
@@ -37,8 +36,9 @@ private:
     void checkVirtualDeviceSetup();
     
     //==============================================================================
-    // Audio engine
+    // Audio engine, and the thread that opens and closes its devices
     std::unique_ptr<AudioServer> audioServer;
+    std::unique_ptr<DeviceController> deviceController;
     
     //==============================================================================
     // UI Components
@@ -61,14 +61,7 @@ private:
     juce::TextEditor statusText;
     
     juce::GroupComponent levelGroup;
-    juce::Label inputLevelLabel;
-    juce::Label outputLevelLabel;
-    
-    // Level meters (simple text display for now)
-    juce::Label inputLevelValueL;
-    juce::Label inputLevelValueR;
-    juce::Label outputLevelValueL;
-    juce::Label outputLevelValueR;
+    LevelMeterPanel levelMeters;
     
     juce::GroupComponent infoGroup;
     juce::TextEditor infoText;
@@ -0,0 +1,601 @@
+#include "MeasurementEngine.h"
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    constexpr double twoPi = juce::MathConstants<double>::twoPi;
+    constexpr double quietestDb = -200.0;
+    
+    // Kept ahead of each response's peak, for what rings before it
+    constexpr double preRingSeconds = 0.001;
+    
+    // Analysis FFTs are at least this long, for resolution at the bottom of
+    // the range
+    constexpr int minSpectrumOrder = 16;
+    
+    int getOrderFor(int numSamples)
+    {
+        int order = 1;
+        
+        while ((1 << order) < numSamples)
+            ++order;
+        
+        return order;
+    }
+    
+    /** An exponential sweep, faded in over its first sixth of an octave and out
+        over its last twenty-fourth, so it starts and stops without a click. */
+    void generateSweep(float* destination, int length, double startFrequency, double endFrequency,
+                       double sampleRate, double gain)
+    {
+        auto logRatio = std::log(endFrequency / startFrequency);
+        auto samplesPerOctave = length * std::log(2.0) / logRatio;
+        auto fadeIn = juce::jlimit(1, juce::jmax(1, length / 4), (int) (samplesPerOctave / 6.0));
+        auto fadeOut = juce::jlimit(1, juce::jmax(1, length / 4), (int) (samplesPerOctave / 24.0));
+        
+        for (int i = 0; i < length; ++i)
+        {
+            auto phase = twoPi * startFrequency * length / (sampleRate * logRatio)
+                       * (std::exp(logRatio * i / length) - 1.0);
+            auto envelope = 1.0;
+            
+            if (i < fadeIn)
+                envelope = 0.5 - 0.5 * std::cos(juce::MathConstants<double>::pi * i / fadeIn);
+            else if (i >= length - fadeOut)
+                envelope = 0.5 - 0.5 * std::cos(juce::MathConstants<double>::pi * (length - 1 - i) / fadeOut);
+            
+            destination[i] = (float) (gain * envelope * std::sin(phase));
+        }
+    }
+    
+    //==============================================================================
+    /** Power spectrum of one window of a response, with running sums so any
+        fraction of an octave averages in constant time. */
+    struct PowerSpectrum
+    {
+        // The window starts at start in a circular buffer of bufferLength and
+        // peaks preRing samples in; it is faded in up to there and out over
+        // its last eighth
+        PowerSpectrum(const float* buffer, int bufferLength, int start, int length, int preRing, double sampleRate)
+        {
+            auto order = juce::jmax(minSpectrumOrder, getOrderFor(length));
+            auto fftSize = 1 << order;
+            auto fadeOut = juce::jmax(1, length / 8);
+            
+            juce::HeapBlock<float> data((size_t) fftSize * 2, true);
+            
+            for (int i = 0; i < length; ++i)
+            {
+                auto index = ((start + i) % bufferLength + bufferLength) % bufferLength;
+                auto envelope = 1.0f;
+                
+                if (i < preRing)
+                    envelope = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::pi * (float) i / (float) preRing);
+                else if (i >= length - fadeOut)
+                    envelope = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::pi * (float) (length - 1 - i) / (float) fadeOut);
+                
+                data[i] = buffer[index] * envelope;
+            }
+            
+            juce::dsp::FFT fft(order);
+            fft.performRealOnlyForwardTransform(data, true);
+            
+            numBins = fftSize / 2 + 1;
+            binWidth = sampleRate / fftSize;
+            sums.calloc((size_t) numBins + 1);
+            
+            for (int bin = 0; bin < numBins; ++bin)
+            {
+                auto real = (double) data[bin * 2];
+                auto imag = (double) data[bin * 2 + 1];
+                sums[bin + 1] = sums[bin] + real * real + imag * imag;
+            }
+        }
+        
+        // Mean power of the bins within octaves around frequency, or of the
+        // nearest bin where there are none
+        double getPower(double frequency, double octaves) const
+        {
+            auto halfWidth = std::exp2(0.5 * octaves);
+            auto first = juce::jmax(0, (int) std::ceil(frequency / halfWidth / binWidth));
+            auto last = juce::jmin(numBins - 1, (int) std::floor(frequency * halfWidth / binWidth));
+            
+            if (first > last)
+            {
+                first = last = juce::jlimit(0, numBins - 1, juce::roundToInt(frequency / binWidth));
+            }
+            
+            return (sums[last + 1] - sums[first]) / (last - first + 1);
+        }
+        
+        juce::HeapBlock<double> sums;
+        int numBins = 0;
+        double binWidth = 1.0;
+    };
+    
+    double powerToDecibels(double power)
+    {
+        return power > 0.0 ? juce::jmax(quietestDb, 10.0 * std::log10(power)) : quietestDb;
+    }
+}
+
+//==============================================================================
+struct MeasurementEngine::Session
+{
+    Settings settings;
+    double sampleRate = 0.0;
+    int generation = 0;
+    
+    juce::AudioBuffer<float> stimulus;
+    juce::AudioBuffer<float> recording;
+    
+    // Audio thread
+    int position = 0;
+    std::atomic<bool> finished { false };
+};
+
+//==============================================================================
+double MeasurementEngine::Settings::getEndFrequency(double sampleRate) const
+{
+    return juce::jmin((double) endFrequency, 0.48 * sampleRate);
+}
+
+int MeasurementEngine::Settings::getTotalSamples(double sampleRate) const
+{
+    auto sweepLength = juce::roundToInt(sweepSeconds * sampleRate);
+    auto silenceLength = juce::roundToInt(silenceSeconds * sampleRate);
+    
+    return silenceLength + numRuns * (sweepLength + silenceLength);
+}
+
+bool MeasurementEngine::Settings::isValid(double sampleRate, juce::String& errorMessage) const
+{
+    if (sampleRate <= 0.0)
+        errorMessage = "No sample rate to measure at";
+    else if (startFrequency <= 0.0f || getEndFrequency(sampleRate) < 2.0 * startFrequency)
+        errorMessage = "The sweep must cover at least an octave below 0.48 x the sample rate";
+    else if (sweepSeconds < 0.1f || silenceSeconds < 0.05f)
+        errorMessage = "The sweep must last at least 0.1 s, and the silence 0.05 s";
+    else if (levelDb > 0.0f)
+        errorMessage = "The sweep level must be at most 0 dB full scale";
+    else if (!juce::isPositiveAndNotGreaterThan(numRuns, 64))
+        errorMessage = "Between 1 and 64 runs";
+    else if (getTotalSamples(sampleRate) > (int) (sampleRate * 600.0))
+        errorMessage = "A measurement can last at most ten minutes";
+    else if (impulseSeconds <= 0.0f || !juce::isPositiveAndNotGreaterThan(maxHarmonic, 16))
+        errorMessage = "The impulse must be longer than zero, and the highest harmonic between 1 and 16";
+    else if (smoothingOctaves < 0.0f || pointsPerOctave < 1)
+        errorMessage = "Smoothing can't be negative, and the curves need at least a point per octave";
+    else if (outputChannel < 0 || inputChannel < 0)
+        errorMessage = "No such channel";
+    else
+        return true;
+    
+    return false;
+}
+
+//==============================================================================
+MeasurementEngine::MeasurementEngine()
+{
+    self = this;
+}
+
+MeasurementEngine::~MeasurementEngine()
+{
+    stopTimer();
+    cancel();
+    analysisPool.removeAllJobs(true, 10000);
+}
+
+//==============================================================================
+bool MeasurementEngine::start(const Settings& settings, double sampleRate, int numInputs, int numOutputs,
+                              Callback onDone, juce::String& errorMessage)
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    if (measuring.load())
+    {
+        errorMessage = "A measurement is already running";
+        return false;
+    }
+    
+    if (!settings.isValid(sampleRate, errorMessage))
+        return false;
+    
+    if (settings.outputChannel >= numOutputs || settings.inputChannel >= numInputs)
+    {
+        errorMessage = "The device has no output " + juce::String(settings.outputChannel + 1)
+                     + " or no input " + juce::String(settings.inputChannel + 1);
+        return false;
+    }
+    
+    // Everything the audio thread touches is allocated here
+    auto newSession = std::make_unique<Session>();
+    newSession->settings = settings;
+    newSession->sampleRate = sampleRate;
+    newSession->generation = generation.load();
+    generateStimulus(settings, sampleRate, newSession->stimulus);
+    newSession->recording.setSize(1, newSession->stimulus.getNumSamples());
+    newSession->recording.clear();
+    
+    DBG("Measurement: " + juce::String(settings.numRuns) + " sweeps of " + juce::String(settings.sweepSeconds, 1)
+        + " s, " + juce::String(settings.startFrequency, 0) + " to "
+        + juce::String(settings.getEndFrequency(sampleRate), 0) + " Hz");
+    
+    doneCallback = std::move(onDone);
+    progress.store(0.0f);
+    measuring.store(true);
+    playing.store(true);
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(sessionLock);
+        session = std::move(newSession);
+    }
+    
+    startTimer(50);
+    return true;
+}
+
+void MeasurementEngine::cancel(const juce::String& reason)
+{
+    std::unique_ptr<Session> removed;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(sessionLock);
+        removed = std::move(session);
+    }
+    
+    playing.store(false);
+    
+    if (!measuring.load())
+        return;
+    
+    // An analysis still running is left to finish, and its result dropped
+    juce::MessageManager::callAsync([weakThis = self, sessionGeneration = generation.load(), reason]
+    {
+        if (weakThis != nullptr)
+            weakThis->finish(sessionGeneration, {}, reason);
+    });
+}
+
+void MeasurementEngine::timerCallback()
+{
+    // The audio thread clears playing once it has recorded the last sample,
+    // and cancel() once it has taken the session, so the lock is never taken
+    // while the audio thread still needs it
+    if (playing.load())
+        return;
+    
+    stopTimer();
+    std::shared_ptr<Session> finished;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(sessionLock);
+        
+        if (session != nullptr && session->finished.load())
+            finished.reset(session.release());
+    }
+    
+    // Cancelled
+    if (finished == nullptr)
+        return;
+    
+    analysisPool.addJob([weakThis = self, finished]
+    {
+        Tracing::setThreadName("Measurement");
+        
+        Result result;
+        juce::String errorMessage;
+        
+        {
+            TRACE_SCOPE("Measurement analysis");
+            analyse(finished->settings, finished->sampleRate, finished->recording.getReadPointer(0),
+                    finished->recording.getNumSamples(), result, errorMessage);
+        }
+        
+        juce::MessageManager::callAsync([weakThis, sessionGeneration = finished->generation, result, errorMessage]
+        {
+            if (weakThis != nullptr)
+                weakThis->finish(sessionGeneration, result, errorMessage);
+        });
+    });
+}
+
+void MeasurementEngine::finish(int sessionGeneration, const Result& result, const juce::String& errorMessage)
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    // Whichever of the analysis and a cancel gets here first ends the session
+    if (sessionGeneration != generation.load() || !measuring.load())
+        return;
+    
+    ++generation;
+    measuring.store(false);
+    
+    DBG("Measurement " + (errorMessage.isEmpty() ? "done in " + juce::String(result.analysisMs, 1) + " ms"
+                                                 : "failed: " + errorMessage));
+    
+    auto callback = std::move(doneCallback);
+    doneCallback = nullptr;
+    
+    if (callback != nullptr)
+        callback(result, errorMessage);
+}
+
+//==============================================================================
+void MeasurementEngine::process(const float* const* inputs, int numInputs, float* const* outputs, int numOutputs,
+                                int numSamples) noexcept
+{
+    const juce::SpinLock::ScopedTryLockType lock(sessionLock);
+    
+    if (!lock.isLocked())
+    {
+        // A session is being installed or taken away; the programme stays
+        // muted while one may be playing
+        if (playing.load(std::memory_order_relaxed))
+            for (int channel = 0; channel < numOutputs; ++channel)
+                if (outputs[channel] != nullptr)
+                    juce::FloatVectorOperations::clear(outputs[channel], numSamples);
+        
+        return;
+    }
+    
+    if (session == nullptr)
+        return;
+    
+    auto& current = *session;
+    
+    // Nothing but the sweep, for as long as the session is installed
+    for (int channel = 0; channel < numOutputs; ++channel)
+        if (outputs[channel] != nullptr)
+            juce::FloatVectorOperations::clear(outputs[channel], numSamples);
+    
+    auto total = current.stimulus.getNumSamples();
+    auto numToPlay = juce::jmin(numSamples, total - current.position);
+    
+    if (numToPlay <= 0)
+        return;
+    
+    auto outputChannel = current.settings.outputChannel;
+    auto inputChannel = current.settings.inputChannel;
+    
+    if (outputChannel < numOutputs && outputs[outputChannel] != nullptr)
+        juce::FloatVectorOperations::copy(outputs[outputChannel],
+                                          current.stimulus.getReadPointer(0, current.position), numToPlay);
+    
+    if (inputChannel < numInputs && inputs[inputChannel] != nullptr)
+        current.recording.copyFrom(0, current.position, inputs[inputChannel], numToPlay);
+    
+    current.position += numToPlay;
+    progress.store((float) current.position / (float) total, std::memory_order_relaxed);
+    
+    if (current.position == total)
+    {
+        current.finished.store(true);
+        playing.store(false);
+    }
+}
+
+//==============================================================================
+void MeasurementEngine::generateStimulus(const Settings& settings, double sampleRate,
+                                         juce::AudioBuffer<float>& stimulus)
+{
+    auto sweepLength = juce::roundToInt(settings.sweepSeconds * sampleRate);
+    auto silenceLength = juce::roundToInt(settings.silenceSeconds * sampleRate);
+    
+    stimulus.setSize(1, settings.getTotalSamples(sampleRate));
+    stimulus.clear();
+    
+    generateSweep(stimulus.getWritePointer(0, silenceLength), sweepLength, settings.startFrequency,
+                  settings.getEndFrequency(sampleRate), sampleRate,
+                  juce::Decibels::decibelsToGain((double) settings.levelDb));
+    
+    for (int run = 1; run < settings.numRuns; ++run)
+        stimulus.copyFrom(0, silenceLength + run * (sweepLength + silenceLength), stimulus, 0, silenceLength, sweepLength);
+}
+
+bool MeasurementEngine::analyse(const Settings& settings, double sampleRate, const float* recording, int numSamples,
+                                Result& result, juce::String& errorMessage)
+{
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    
+    if (!settings.isValid(sampleRate, errorMessage))
+        return false;
+    
+    if (numSamples < settings.getTotalSamples(sampleRate))
+    {
+        errorMessage = "The recording is shorter than the measurement";
+        return false;
+    }
+    
+    auto startFrequency = (double) settings.startFrequency;
+    auto endFrequency = settings.getEndFrequency(sampleRate);
+    auto logRatio = std::log(endFrequency / startFrequency);
+    auto sweepLength = juce::roundToInt(settings.sweepSeconds * sampleRate);
+    auto silenceLength = juce::roundToInt(settings.silenceSeconds * sampleRate);
+    auto runLength = sweepLength + silenceLength;
+    
+    // Long enough that the harmonics, which land before time zero, don't wrap
+    // round onto the linear response
+    auto order = getOrderFor(runLength + sweepLength);
+    auto fftSize = 1 << order;
+    auto numBins = fftSize / 2 + 1;
+    
+    // The sweep's inverse: conj(X) / (|X|^2 + e), with e 60 dB below the
+    // strongest bin, so bins the sweep never reached stay quiet
+    juce::HeapBlock<std::complex<float>> inverse((size_t) numBins);
+    
+    {
+        juce::HeapBlock<float> sweep((size_t) fftSize * 2, true);
+        generateSweep(sweep, sweepLength, startFrequency, endFrequency, sampleRate,
+                      juce::Decibels::decibelsToGain((double) settings.levelDb));
+        
+        juce::dsp::FFT fft(order);
+        fft.performRealOnlyForwardTransform(sweep, true);
+        
+        auto* bins = reinterpret_cast<const std::complex<float>*>(sweep.getData());
+        auto maxPower = 0.0f;
+        
+        for (int bin = 0; bin < numBins; ++bin)
+            maxPower = juce::jmax(maxPower, std::norm(bins[bin]));
+        
+        auto regularisation = maxPower * 1.0e-6f;
+        
+        for (int bin = 0; bin < numBins; ++bin)
+            inverse[bin] = std::conj(bins[bin]) / (std::norm(bins[bin]) + regularisation);
+    }
+    
+    // One run per job: FFT, divide and transform back
+    juce::AudioBuffer<float> runs(settings.numRuns, fftSize * 2);
+    
+    {
+        auto numCpus = juce::jmax(1, juce::SystemStats::getNumCpus());
+        auto numThreads = settings.numThreads > 0 ? settings.numThreads : numCpus;
+        
+        juce::WaitableEvent finished;
+        std::atomic<int> remaining { settings.numRuns };
+        
+        juce::ThreadPool pool(juce::jmin(settings.numRuns, numThreads));
+        
+        for (int run = 0; run < settings.numRuns; ++run)
+        {
+            pool.addJob([&, run]
+            {
+                Tracing::setThreadName("Measurement");
+                
+                {
+                    TRACE_SCOPE("Deconvolve sweep");
+                    
+                    auto* data = runs.getWritePointer(run);
+                    juce::FloatVectorOperations::clear(data, fftSize * 2);
+                    juce::FloatVectorOperations::copy(data, recording + silenceLength + run * runLength, runLength);
+                    
+                    juce::dsp::FFT fft(order);
+                    fft.performRealOnlyForwardTransform(data, true);
+                    
+                    auto* bins = reinterpret_cast<std::complex<float>*>(data);
+                    
+                    for (int bin = 0; bin < numBins; ++bin)
+                        bins[bin] *= inverse[bin];
+                    
+                    fft.performRealOnlyInverseTransform(data);
+                }
+                
+                if (--remaining == 0)
+                    finished.signal();
+            });
+        }
+        
+        finished.wait();
+    }
+    
+    juce::HeapBlock<float> response((size_t) fftSize, true);
+    
+    for (int run = 0; run < settings.numRuns; ++run)
+        juce::FloatVectorOperations::add(response.getData(), runs.getReadPointer(run), fftSize);
+    
+    juce::FloatVectorOperations::multiply(response.getData(), 1.0f / (float) settings.numRuns, fftSize);
+    
+    // The linear response peaks at the round-trip latency, which the silence
+    // after each sweep has to cover
+    auto latency = 0;
+    
+    for (int i = 1; i < silenceLength; ++i)
+        if (std::abs(response[i]) > std::abs(response[latency]))
+            latency = i;
+    
+    // Against the background noise before the first sweep arrives
+    auto noiseRms = 0.0;
+    
+    for (int i = 0; i < silenceLength; ++i)
+        noiseRms += (double) recording[i] * recording[i];
+    
+    noiseRms = std::sqrt(noiseRms / silenceLength);
+    
+    auto signalRms = 0.0;
+    auto signalStart = silenceLength + latency;
+    
+    for (int i = signalStart; i < signalStart + sweepLength; ++i)
+        signalRms += (double) recording[i] * recording[i];
+    
+    signalRms = std::sqrt(signalRms / sweepLength);
+    
+    if (response[latency] == 0.0f || signalRms < 2.0 * noiseRms)
+    {
+        errorMessage = "No sweep found on input " + juce::String(settings.inputChannel + 1)
+                     + "; check the microphone and output " + juce::String(settings.outputChannel + 1);
+        return false;
+    }
+    
+    result.sampleRate = sampleRate;
+    result.numRuns = settings.numRuns;
+    result.latencySamples = latency;
+    result.signalToNoiseDb = (float) (-juce::Decibels::gainToDecibels(noiseRms / signalRms, quietestDb)
+                                      + 10.0 * std::log10((double) settings.numRuns));
+    
+    // The linear response, up to where the next sweep's silence ran out
+    auto preRing = juce::jmax(1, juce::roundToInt(preRingSeconds * sampleRate));
+    auto impulseLength = juce::jmin(juce::roundToInt(settings.impulseSeconds * sampleRate),
+                                    silenceLength - latency) + preRing;
+    
+    result.impulseResponse.setSize(1, impulseLength);
+    
+    for (int i = 0; i < impulseLength; ++i)
+        result.impulseResponse.setSample(0, i, response[((latency - preRing + i) % fftSize + fftSize) % fftSize]);
+    
+    PowerSpectrum linear(response, fftSize, latency - preRing, impulseLength, preRing, sampleRate);
+    
+    // The k-th harmonic lands ln(k) / ln(end / start) of the sweep early; its
+    // window runs up to where the one after it starts
+    auto samplesPerLog = sweepLength / logRatio;
+    juce::OwnedArray<PowerSpectrum> harmonics;
+    
+    for (int harmonic = 2; harmonic <= settings.maxHarmonic; ++harmonic)
+    {
+        auto offset = samplesPerLog * std::log((double) harmonic);
+        auto spacing = offset - samplesPerLog * std::log((double) (harmonic - 1));
+        auto length = juce::jmin(impulseLength, (int) spacing);
+        
+        if (length < 2 * preRing || offset >= sweepLength)
+            break;
+        
+        auto start = latency - juce::roundToInt(offset) - preRing;
+        harmonics.add(new PowerSpectrum(response, fftSize, start, length, preRing, sampleRate));
+    }
+    
+    // Curves on a log-frequency grid
+    auto octaves = (double) settings.smoothingOctaves;
+    auto step = std::exp2(1.0 / settings.pointsPerOctave);
+    
+    for (int i = 0; i < harmonics.size(); ++i)
+        result.harmonics.add({});
+    
+    for (auto frequency = startFrequency; frequency <= endFrequency * 1.0001; frequency *= step)
+    {
+        auto fundamental = linear.getPower(frequency, octaves);
+        result.magnitude.add((float) frequency, (float) powerToDecibels(fundamental));
+        
+        auto total = 0.0;
+        auto hasAny = false;
+        
+        for (int i = 0; i < harmonics.size() && fundamental > 0.0; ++i)
+        {
+            auto harmonicFrequency = frequency * (i + 2);
+            
+            if (harmonicFrequency > endFrequency)
+                break;
+            
+            auto power = harmonics[i]->getPower(harmonicFrequency, octaves);
+            result.harmonics.getReference(i).add((float) frequency, (float) powerToDecibels(power / fundamental));
+            total += power;
+            hasAny = true;
+        }
+        
+        if (hasAny)
+            result.totalHarmonicDistortion.add((float) frequency, (float) powerToDecibels(total / fundamental));
+    }
+    
+    result.analysisMs = juce::Time::getMillisecondCounterHiRes() - startTime;
+    return true;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AutoEQ.h"
+
+//==============================================================================
+/**
+ * MeasurementEngine measures a room, speaker or headphone through the audio
+ * device: it plays exponential sine sweeps on one output, records a
+ * microphone on one input in the same callbacks, so the two stay sample
+ * aligned, and deconvolves the recording into an impulse response.
+ *
+ * A session plays silence, then numRuns sweeps each followed by silence while
+ * the room decays. The device's programme is muted while it runs.
+ *
+ * Deconvolution divides each run's spectrum by the sweep's, regularised
+ * where the sweep has no energy, with one FFT job per run on a background
+ * thread pool. Harmonic distortion then shows up as copies of the impulse
+ * response ahead of the linear one, the k-th harmonic earlier by
+ * ln(k) / ln(end / start) of the sweep's length, so each harmonic can be cut
+ * out with its own window. The runs are averaged before windowing, which
+ * lowers the noise by 10 log10(numRuns) dB.
+ *
+ * Magnitude responses are smoothed over a fraction of an octave and returned
+ * as AutoEQ curves, so a measurement can go straight into AutoEQ::fit().
+ * Distortion is given against the fundamental, by fundamental frequency.
+ *
+ * analyse() is public, so a recording made elsewhere can be analysed offline;
+ * generateStimulus() makes the matching stimulus.
+ */
+class MeasurementEngine : private juce::Timer
+{
+public:
+    //==============================================================================
+    struct Settings
+    {
+        float startFrequency = 20.0f;
+        float endFrequency = 20000.0f;      // Kept below 0.48 x the sample rate
+        float sweepSeconds = 4.0f;
+        float levelDb = -12.0f;             // Sweep peak, in dB full scale
+        int numRuns = 3;
+        
+        // Before the first sweep and after each, for the device's latency and
+        // the room's decay; both must fit in it
+        float silenceSeconds = 1.0f;
+        
+        int outputChannel = 0;              // Device channels
+        int inputChannel = 0;
+        
+        // Analysis
+        float impulseSeconds = 0.5f;        // Of the linear response kept
+        int maxHarmonic = 5;
+        float smoothingOctaves = 1.0f / 6.0f;   // 0 for none
+        int pointsPerOctave = 48;
+        int numThreads = 0;                 // 0 = one per CPU core
+        
+        double getEndFrequency(double sampleRate) const;
+        int getTotalSamples(double sampleRate) const;
+        bool isValid(double sampleRate, juce::String& errorMessage) const;
+    };
+    
+    struct Result
+    {
+        double sampleRate = 0.0;
+        int numRuns = 0;
+        int latencySamples = 0;             // Output to input: device, converters and air
+        float signalToNoiseDb = 0.0f;       // Of the averaged response
+        
+        // Linear part, averaged over the runs, from 1 ms before its peak
+        juce::AudioBuffer<float> impulseResponse;
+        
+        // Smoothed gain from output to input
+        AutoEQ::Curve magnitude;
+        
+        // 2nd harmonic first, then 3rd and so on, each in dB against the
+        // fundamental; and all of them together
+        juce::Array<AutoEQ::Curve> harmonics;
+        AutoEQ::Curve totalHarmonicDistortion;
+        
+        double analysisMs = 0.0;
+    };
+    
+    // errorMessage is empty if the measurement succeeded
+    using Callback = std::function<void(const Result& result, const juce::String& errorMessage)>;
+    
+    //==============================================================================
+    MeasurementEngine();
+    ~MeasurementEngine() override;
+    
+    // Message thread, for the running device. onDone is called on the message
+    // thread once the analysis has finished, or the session has failed.
+    bool start(const Settings& settings, double sampleRate, int numInputs, int numOutputs,
+               Callback onDone, juce::String& errorMessage);
+    
+    // Any thread but the audio thread
+    void cancel(const juce::String& reason = "Measurement cancelled");
+    
+    // From start() until onDone is called
+    bool isMeasuring() const { return measuring.load(); }
+    
+    // While the sweeps are playing, until the last sample is recorded
+    bool isPlaying() const { return playing.load(); }
+    
+    // Fraction of the session played so far
+    float getProgress() const { return progress.load(); }
+    
+    //==============================================================================
+    // Audio thread. While measuring, replaces every output with the stimulus
+    // and records the input.
+    void process(const float* const* inputs, int numInputs, float* const* outputs, int numOutputs,
+                 int numSamples) noexcept;
+    
+    //==============================================================================
+    // Offline. The stimulus is one channel with the whole session.
+    static void generateStimulus(const Settings& settings, double sampleRate, juce::AudioBuffer<float>& stimulus);
+    
+    static bool analyse(const Settings& settings, double sampleRate, const float* recording, int numSamples,
+                        Result& result, juce::String& errorMessage);
+                        
+private:
+    //==============================================================================
+    struct Session;
+    
+    void timerCallback() override;
+    void finish(int sessionGeneration, const Result& result, const juce::String& errorMessage);
+    
+    //==============================================================================
+    // Shared with the audio thread and guarded by sessionLock, which the
+    // other threads only take to install or remove a session
+    std::unique_ptr<Session> session;
+    juce::SpinLock sessionLock;
+    
+    // Message thread
+    Callback doneCallback;
+    
+    // Bumped as each session ends, so it only ends once
+    std::atomic<int> generation { 0 };
+    std::atomic<bool> measuring { false };
+    std::atomic<bool> playing { false };
+    std::atomic<float> progress { 0.0f };
+    
+    juce::ThreadPool analysisPool { 1 };
+    
+    // Created up front, so other threads only ever copy it
+    juce::WeakReference<MeasurementEngine> self;
+    
+    JUCE_DECLARE_WEAK_REFERENCEABLE(MeasurementEngine)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeasurementEngine)
+};
@@ -0,0 +1,295 @@
+#include "MetricsExporter.h"
+
+namespace
+{
+    // Enough for any scraper's request line and headers
+    constexpr int maxRequestBytes = 8192;
+    constexpr int requestTimeoutMs = 2000;
+    
+    void sendResponse(juce::StreamingSocket& client, const juce::String& status, const juce::String& contentType,
+                      const juce::String& body)
+    {
+        auto bodyUtf8 = body.toStdString();
+        auto head = "HTTP/1.1 " + status + "\r\n"
+                  + "Content-Type: " + contentType + "\r\n"
+                  + "Content-Length: " + juce::String((juce::int64) bodyUtf8.size()) + "\r\n"
+                  + "Connection: close\r\n\r\n";
+        auto response = head.toStdString() + bodyUtf8;
+        
+        for (size_t sent = 0; sent < response.size();)
+        {
+            auto n = client.write(response.data() + sent, (int) (response.size() - sent));
+            
+            if (n <= 0)
+                return;
+            
+            sent += (size_t) n;
+        }
+    }
+}
+
+//==============================================================================
+MetricsExporter::Histogram::Histogram(std::initializer_list<double> upperBounds)
+{
+    jassert((int) upperBounds.size() <= maxBuckets);
+    
+    for (auto bound : upperBounds)
+    {
+        if (numBounds == maxBuckets)
+            break;
+        
+        jassert(numBounds == 0 || bound > bounds[(size_t) numBounds - 1]);
+        bounds[(size_t) numBounds++] = bound;
+    }
+}
+
+void MetricsExporter::Histogram::add(double value) noexcept
+{
+    int bucket = 0;
+    
+    while (bucket < numBounds && value > bounds[(size_t) bucket])
+        ++bucket;
+    
+    counts[(size_t) bucket].fetch_add(1, std::memory_order_relaxed);
+    
+    // One writer, so a load and a store can't lose an addition
+    sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+juce::uint64 MetricsExporter::Histogram::getCumulativeCount(int bucket) const
+{
+    juce::uint64 total = 0;
+    
+    for (int b = 0; b <= juce::jmin(bucket, numBounds); ++b)
+        total += counts[(size_t) b].load(std::memory_order_relaxed);
+    
+    return total;
+}
+
+double MetricsExporter::Histogram::getQuantile(double quantile) const
+{
+    auto count = getCount();
+    
+    if (count == 0 || numBounds == 0)
+        return 0.0;
+    
+    auto rank = juce::jlimit(0.0, 1.0, quantile) * (double) count;
+    juce::uint64 below = 0;
+    
+    for (int b = 0; b < numBounds; ++b)
+    {
+        auto inBucket = counts[(size_t) b].load(std::memory_order_relaxed);
+        
+        if ((double) (below + inBucket) >= rank && inBucket > 0)
+        {
+            auto lower = b > 0 ? bounds[(size_t) b - 1] : 0.0;
+            return lower + (bounds[(size_t) b] - lower) * (rank - (double) below) / (double) inBucket;
+        }
+        
+        below += inBucket;
+    }
+    
+    // In the +Inf bucket: the highest bound is all that is known
+    return bounds[(size_t) numBounds - 1];
+}
+
+//==============================================================================
+MetricsExporter::MetricsExporter()
+    : juce::Thread("Metrics Exporter")
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+//==============================================================================
+void MetricsExporter::addMetric(const juce::String& name, const juce::String& help, Type type, Read read,
+                                const juce::String& labels)
+{
+    jassert(!isServing() && read != nullptr);
+    metrics.add({ name, help, labels, type, std::move(read), nullptr });
+}
+
+void MetricsExporter::addHistogram(const juce::String& name, const juce::String& help, const Histogram& histogram)
+{
+    jassert(!isServing());
+    metrics.add({ name, help, {}, Type::Gauge, nullptr, &histogram });
+}
+
+void MetricsExporter::setRefresh(std::function<void()> newRefresh)
+{
+    refresh = std::move(newRefresh);
+}
+
+//==============================================================================
+bool MetricsExporter::start(const Settings& settings, juce::String& errorMessage)
+{
+    stop();
+    
+    listener = std::make_unique<juce::StreamingSocket>();
+    
+    if (!listener->createListener(settings.port, settings.localOnly ? "127.0.0.1" : juce::String()))
+    {
+        errorMessage = "Couldn't listen on port " + juce::String(settings.port) + "; is it already in use?";
+        listener.reset();
+        return false;
+    }
+    
+    boundPort = listener->getBoundPort();
+    
+    // So the first scrape already sees refreshed values
+    timerCallback();
+    startTimer(refreshMs);
+    
+    serving = true;
+    startThread();
+    
+    DBG("Serving metrics on port " + juce::String(boundPort.load()));
+    return true;
+}
+
+void MetricsExporter::stop()
+{
+    stopTimer();
+    
+    if (listener == nullptr)
+        return;
+    
+    signalThreadShouldExit();
+    stopThread(requestTimeoutMs + 1000);
+    
+    listener->close();
+    listener.reset();
+    serving = false;
+    boundPort = 0;
+}
+
+//==============================================================================
+juce::String MetricsExporter::formatValue(double value)
+{
+    if (std::isnan(value))
+        return "NaN";
+    
+    if (std::isinf(value))
+        return value > 0.0 ? "+Inf" : "-Inf";
+    
+    // Counts as integers, everything else with enough digits to round-trip
+    if (value == std::floor(value) && std::abs(value) < 1.0e15)
+        return juce::String((juce::int64) value);
+    
+    return juce::String::formatted("%.9g", value);
+}
+
+juce::String MetricsExporter::render() const
+{
+    juce::String text;
+    juce::String previousName;
+    
+    for (const auto& metric : metrics)
+    {
+        auto name = prefix + metric.name;
+        
+        if (name != previousName)
+        {
+            auto type = metric.histogram != nullptr ? "histogram"
+                      : metric.type == Type::Counter ? "counter" : "gauge";
+            
+            text << "# HELP " << name << " " << metric.help << "\n"
+                 << "# TYPE " << name << " " << type << "\n";
+            previousName = name;
+        }
+        
+        if (const auto* histogram = metric.histogram)
+        {
+            // Read the count last, so it is never below any bucket's count
+            for (int b = 0; b < histogram->getNumBuckets(); ++b)
+                text << name << "_bucket{le=\"" << formatValue(histogram->getUpperBound(b)) << "\"} "
+                     << formatValue((double) histogram->getCumulativeCount(b)) << "\n";
+            
+            auto count = histogram->getCount();
+            text << name << "_bucket{le=\"+Inf\"} " << formatValue((double) count) << "\n"
+                 << name << "_sum " << formatValue(histogram->getSum()) << "\n"
+                 << name << "_count " << formatValue((double) count) << "\n";
+        }
+        else
+        {
+            text << name;
+            
+            if (metric.labels.isNotEmpty())
+                text << "{" << metric.labels << "}";
+            
+            text << " " << formatValue(metric.read()) << "\n";
+        }
+    }
+    
+    return text;
+}
+
+//==============================================================================
+void MetricsExporter::timerCallback()
+{
+    if (refresh != nullptr)
+        refresh();
+}
+
+void MetricsExporter::run()
+{
+    while (!threadShouldExit())
+    {
+        // Wakes regularly to check for stop()
+        if (listener->waitUntilReady(true, 100) != 1)
+            continue;
+        
+        std::unique_ptr<juce::StreamingSocket> client(listener->waitForNextConnection());
+        
+        if (client != nullptr)
+            serve(*client);
+    }
+}
+
+void MetricsExporter::serve(juce::StreamingSocket& client)
+{
+    // Read up to the end of the headers; the request has no body we need
+    std::string request;
+    char buffer[1024];
+    auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32) requestTimeoutMs;
+    
+    while (request.find("\r\n\r\n") == std::string::npos && (int) request.size() < maxRequestBytes)
+    {
+        auto now = juce::Time::getMillisecondCounter();
+        
+        if (now >= deadline || threadShouldExit())
+            return;
+        
+        if (client.waitUntilReady(true, (int) (deadline - now)) != 1)
+            return;
+        
+        auto n = client.read(buffer, (int) sizeof(buffer), false);
+        
+        if (n <= 0)
+            return;
+        
+        request.append(buffer, (size_t) n);
+    }
+    
+    auto requestLine = juce::StringArray::fromTokens(juce::String(request.substr(0, request.find("\r\n"))), " ", "");
+    auto method = requestLine[0];
+    auto path = requestLine[1].upToFirstOccurrenceOf("?", false, false);
+    
+    if (method != "GET" && method != "HEAD")
+    {
+        sendResponse(client, "405 Method Not Allowed", "text/plain; charset=utf-8", "Only GET is supported\n");
+        return;
+    }
+    
+    if (path != "/metrics" && path != "/")
+    {
+        sendResponse(client, "404 Not Found", "text/plain; charset=utf-8", "Metrics are at /metrics\n");
+        return;
+    }
+    
+    numScrapes.fetch_add(1);
+    sendResponse(client, "200 OK", "text/plain; version=0.0.4; charset=utf-8", method == "HEAD" ? juce::String() : render());
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * MetricsExporter serves the engine's health counters in the Prometheus text
+ * format over HTTP, for a monitoring agent on the same machine to scrape.
+ *
+ * Metrics are registered with a function that reads their value. Scrapes run
+ * on the exporter's own thread and only ever read: the functions must be
+ * lock-free, typically loading an atomic the audio thread bumps, so a scrape
+ * can't hold up the audio thread or depend on it running. Values that can
+ * only be read on the message thread, like a device's own xrun count, are
+ * copied into atomics by a refresh function the exporter calls on a timer.
+ *
+ * The server answers GET /metrics (and GET /) with the whole exposition, one
+ * request per connection, and binds to the loopback interface unless told
+ * otherwise.
+ */
+class MetricsExporter : private juce::Thread,
+                        private juce::Timer
+{
+public:
+    //==============================================================================
+    enum class Type
+    {
+        Counter,        // Only ever goes up, e.g. xruns since start
+        Gauge           // Goes both ways, e.g. load
+    };
+    
+    // Called on the server thread for every scrape; must not lock or allocate
+    using Read = std::function<double()>;
+    
+    struct Settings
+    {
+        int port = 9464;                // 0 for any free port; see getPort()
+        bool localOnly = true;          // Listen on 127.0.0.1 only
+    };
+    
+    //==============================================================================
+    /**
+     * A histogram the audio thread can feed: add() is a bucket search and two
+     * relaxed atomic adds. One thread adds; any thread can read.
+     */
+    class Histogram
+    {
+    public:
+        static constexpr int maxBuckets = 16;
+        
+        // Upper bounds, ascending; a final +Inf bucket is implied
+        explicit Histogram(std::initializer_list<double> upperBounds);
+        
+        void add(double value) noexcept;
+        
+        int getNumBuckets() const                           { return numBounds; }
+        double getUpperBound(int bucket) const              { return bounds[(size_t) bucket]; }
+        
+        // Observations up to and including the bucket's bound, as Prometheus
+        // wants them; getNumBuckets() for all of them
+        juce::uint64 getCumulativeCount(int bucket) const;
+        juce::uint64 getCount() const                       { return getCumulativeCount(numBounds); }
+        double getSum() const                               { return sum.load(std::memory_order_relaxed); }
+        
+        // Estimated by interpolating within the bucket, as histogram_quantile()
+        // does
+        double getQuantile(double quantile) const;
+        
+    private:
+        std::array<double, maxBuckets> bounds {};
+        int numBounds = 0;
+        std::array<std::atomic<juce::uint64>, maxBuckets + 1> counts {};
+        std::atomic<double> sum { 0.0 };
+        
+        JUCE_DECLARE_NON_COPYABLE(Histogram)
+    };
+    
+    static constexpr int refreshMs = 1000;
+    
+    //==============================================================================
+    MetricsExporter();
+    ~MetricsExporter() override;
+    
+    // Message thread, before start(). Names go out with the prefix, e.g.
+    // "maceq_xruns_total"; labels are Prometheus syntax without the braces,
+    // e.g. "mode=\"direct\"". Series of one metric are added one after another.
+    void addMetric(const juce::String& name, const juce::String& help, Type type, Read read,
+                   const juce::String& labels = {});
+    void addHistogram(const juce::String& name, const juce::String& help, const Histogram& histogram);
+    
+    // Message thread, called every refreshMs while serving
+    void setRefresh(std::function<void()> refresh);
+    
+    //==============================================================================
+    // Message thread
+    bool start(const Settings& settings, juce::String& errorMessage);
+    void stop();
+    
+    bool isServing() const { return serving.load(); }
+    int getPort() const { return boundPort.load(); }
+    int getNumScrapes() const { return numScrapes.load(); }
+    
+    // The exposition as a scrape would get it, from any thread
+    juce::String render() const;
+    
+    static constexpr const char* prefix = "maceq_";
+    
+private:
+    //==============================================================================
+    struct Metric
+    {
+        juce::String name, help, labels;
+        Type type = Type::Gauge;
+        Read read;
+        const Histogram* histogram = nullptr;
+    };
+    
+    void run() override;
+    void timerCallback() override;
+    void serve(juce::StreamingSocket& client);
+    
+    static juce::String formatValue(double value);
+    
+    //==============================================================================
+    juce::Array<Metric> metrics;
+    std::function<void()> refresh;
+    
+    std::unique_ptr<juce::StreamingSocket> listener;
+    std::atomic<bool> serving { false };
+    std::atomic<int> boundPort { 0 };
+    std::atomic<int> numScrapes { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MetricsExporter)
+};
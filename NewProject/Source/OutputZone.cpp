@@ -0,0 +1,308 @@
+#include "OutputZone.h"
+#include "Tracing.h"
+
+//==============================================================================
+AudioServer::OutputZone::OutputZone(const ZoneSettings& zoneSettings)
+    : settings(zoneSettings),
+      numChannels(juce::jlimit(1, ChannelRouter::maxChannels,
+                               zoneSettings.channels.isEmpty() ? 2 : zoneSettings.channels.size()))
+{
+    auto capacity = (int) (maxSourceRate * maxBufferedSeconds);
+    fifo.setTotalSize(capacity);
+    ring.setSize(numChannels, capacity);
+    ring.clear();
+}
+
+AudioServer::OutputZone::~OutputZone()
+{
+    close();
+}
+
+//==============================================================================
+bool AudioServer::OutputZone::open(juce::String& errorMessage)
+{
+    if (settings.deviceType.isNotEmpty())
+        deviceManager.setCurrentAudioDeviceType(settings.deviceType, false);
+    
+    juce::AudioDeviceManager::AudioDeviceSetup setup;
+    setup.outputDeviceName = settings.outputDeviceName;
+    setup.sampleRate = settings.sampleRate;
+    setup.bufferSize = settings.bufferSize;
+    setup.useDefaultInputChannels = false;
+    setup.useDefaultOutputChannels = false;
+    setup.outputChannels.setRange(0, numChannels, true);
+    
+    auto error = deviceManager.initialise(0, numChannels, nullptr, false, {}, &setup);
+    
+    if (error.isEmpty() && deviceManager.getCurrentAudioDevice() == nullptr)
+        error = "Device not found";
+    
+    if (!error.isEmpty())
+    {
+        errorMessage = "Could not open " + settings.outputDeviceName + " for zone " + settings.name + ": " + error;
+        DBG(errorMessage);
+        return false;
+    }
+    
+    deviceManager.addAudioCallback(this);
+    
+    DBG("Zone " + settings.name + " playing on " + deviceManager.getCurrentAudioDevice()->getName());
+    return true;
+}
+
+void AudioServer::OutputZone::close()
+{
+    deviceManager.removeAudioCallback(this);
+    deviceManager.closeAudioDevice();
+}
+
+AudioServer::ZoneStatus AudioServer::OutputZone::getStatus() const
+{
+    ZoneStatus status;
+    status.name = settings.name;
+    status.running = running.load();
+    status.bufferedMs = bufferedMs.load();
+    status.driftPpm = driftPpm.load();
+    status.alignmentDelayMs = alignmentDelayMs.load();
+    status.numUnderruns = numUnderruns.load();
+    status.numOverruns = numOverruns.load();
+    
+    if (auto* device = deviceManager.getCurrentAudioDevice())
+    {
+        status.deviceName = device->getName();
+        status.sampleRate = device->getCurrentSampleRate();
+    }
+    
+    status.latencyMs = getPathLatencyMs() + status.alignmentDelayMs;
+    return status;
+}
+
+float AudioServer::OutputZone::getPathLatencyMs() const
+{
+    auto* device = deviceManager.getCurrentAudioDevice();
+    
+    if (device == nullptr || device->getCurrentSampleRate() <= 0.0)
+        return settings.bufferMs;
+    
+    auto pluginLatency = chain.getPluginStage().getLatencySamples();
+    
+    return settings.bufferMs
+         + (float) (1000.0 * (outputLatencySamples.load() + pluginLatency) / device->getCurrentSampleRate());
+}
+
+void AudioServer::OutputZone::setAlignmentDelayMs(float newDelayMs)
+{
+    newDelayMs = juce::jlimit(0.0f, (float) (maxBufferedSeconds * 1000.0) - settings.bufferMs - 50.0f, newDelayMs);
+    
+    // The drift controller would take minutes to move the fill this far, so
+    // the zone refills to its new target instead
+    if (std::abs(alignmentDelayMs.exchange(newDelayMs) - newDelayMs) > 1.0f)
+        refillRequested = true;
+}
+
+//==============================================================================
+void AudioServer::OutputZone::setSource(double sampleRate)
+{
+    if (sourceSampleRate.exchange(sampleRate) != sampleRate)
+        refillRequested = true;
+}
+
+void AudioServer::OutputZone::push(const juce::AudioBuffer<float>& capture, int numSamples)
+{
+    if (fifo.getFreeSpace() < numSamples)
+    {
+        numOverruns.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        auto source = settings.channels.isEmpty() ? channel : settings.channels.getUnchecked(channel);
+        
+        if (juce::isPositiveAndBelow(source, capture.getNumChannels()))
+        {
+            if (size1 > 0)
+                ring.copyFrom(channel, start1, capture, source, 0, size1);
+            
+            if (size2 > 0)
+                ring.copyFrom(channel, start2, capture, source, size1, size2);
+        }
+        else
+        {
+            if (size1 > 0)
+                ring.clear(channel, start1, size1);
+            
+            if (size2 > 0)
+                ring.clear(channel, start2, size2);
+        }
+    }
+    
+    fifo.finishedWrite(size1 + size2);
+}
+
+//==============================================================================
+double AudioServer::OutputZone::getTargetFill(double sourceRate) const
+{
+    return (settings.bufferMs + alignmentDelayMs.load(std::memory_order_relaxed)) * 0.001 * sourceRate;
+}
+
+bool AudioServer::OutputZone::render(int numSamples)
+{
+    auto sourceRate = sourceSampleRate.load(std::memory_order_relaxed);
+    
+    if (sourceRate <= 0.0)
+        return false;
+    
+    if (refillRequested.exchange(false))
+    {
+        fifo.finishedRead(fifo.getNumReady());
+        primed = false;
+    }
+    
+    auto ready = fifo.getNumReady();
+    auto target = getTargetFill(sourceRate);
+    
+    if (!primed)
+    {
+        if (ready < target)
+            return false;
+        
+        // Start from the target, whatever arrived while waiting
+        fifo.finishedRead(ready - (int) target);
+        ready = fifo.getNumReady();
+        
+        for (auto& interpolator : interpolators)
+            interpolator.reset();
+        
+        smoothedFill = ready;
+        integral = 0.0;
+        primed = true;
+    }
+    
+    // The fill rises in capture-sized steps and falls in zone-sized ones, so
+    // the controller follows its average
+    auto blockSeconds = numSamples / zoneSampleRate;
+    smoothedFill += (ready - smoothedFill) * juce::jmin(1.0, blockSeconds / fillSmoothingSeconds);
+    
+    auto excessSeconds = (smoothedFill - target) / sourceRate;
+    integral = juce::jlimit(-maxCorrection / integralGain, maxCorrection / integralGain,
+                            integral + excessSeconds * blockSeconds);
+    
+    auto correction = juce::jlimit(-maxCorrection, maxCorrection,
+                                   proportionalGain * excessSeconds + integralGain * integral);
+    auto ratio = sourceRate / zoneSampleRate * (1.0 + correction);
+    
+    auto needed = (int) std::ceil(numSamples * ratio) + 1;
+    
+    if (ready < needed || needed > scratch.getNumSamples())
+    {
+        numUnderruns.fetch_add(1, std::memory_order_relaxed);
+        primed = false;
+        return false;
+    }
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(needed, start1, size1, start2, size2);
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        scratch.copyFrom(channel, 0, ring, channel, start1, size1);
+        
+        if (size2 > 0)
+            scratch.copyFrom(channel, size1, ring, channel, start2, size2);
+    }
+    
+    // Every channel moves through the input in step, so any one says how
+    // much was used
+    int used = 0;
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        used = interpolators[(size_t) channel].process(ratio, scratch.getReadPointer(channel),
+                                                       zoneBuffer.getWritePointer(channel), numSamples, needed, 0);
+    
+    fifo.finishedRead(used);
+    
+    bufferedMs.store((float) (1000.0 * smoothedFill / sourceRate), std::memory_order_relaxed);
+    driftPpm.store((float) (integralGain * integral * 1.0e6), std::memory_order_relaxed);
+    return true;
+}
+
+void AudioServer::OutputZone::audioDeviceIOCallbackWithContext(const float* const* inputChannelData,
+                                                               int numInputChannels,
+                                                               float* const* outputChannelData,
+                                                               int numOutputChannels,
+                                                               int numSamples,
+                                                               const juce::AudioIODeviceCallbackContext& context)
+{
+    juce::ignoreUnused(inputChannelData, numInputChannels, context);
+    
+    RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Audio, "Output Zone");
+    Tracing::setThreadName("Output Zone");
+    TRACE_SCOPE("Zone callback");
+    
+    // The buffers and the chain are sized for the device's block in
+    // audioDeviceAboutToStart(), so a longer block is run in pieces
+    auto chunkSize = zoneBuffer.getNumSamples();
+    
+    for (int channel = 0; channel < numOutputChannels; ++channel)
+        if (outputChannelData[channel] != nullptr && (channel >= numChannels || chunkSize == 0))
+            juce::FloatVectorOperations::clear(outputChannelData[channel], numSamples);
+    
+    if (chunkSize == 0)
+        return;
+    
+    for (int start = 0; start < numSamples; start += chunkSize)
+    {
+        auto length = juce::jmin(chunkSize, numSamples - start);
+        juce::AudioBuffer<float> block(zoneBuffer.getArrayOfWritePointers(), numChannels, length);
+        
+        if (render(length))
+        {
+            TRACE_SCOPE("Zone chain");
+            chain.process(block);
+        }
+        else
+        {
+            block.clear();
+        }
+        
+        for (int channel = 0; channel < juce::jmin(numChannels, numOutputChannels); ++channel)
+            if (outputChannelData[channel] != nullptr)
+                juce::FloatVectorOperations::copy(outputChannelData[channel] + start, block.getReadPointer(channel), length);
+    }
+}
+
+void AudioServer::OutputZone::audioDeviceAboutToStart(juce::AudioIODevice* device)
+{
+    if (device == nullptr)
+        return;
+    
+    zoneSampleRate = device->getCurrentSampleRate();
+    auto blockSize = device->getCurrentBufferSizeSamples();
+    
+    chain.prepare(zoneSampleRate, blockSize, numChannels);
+    
+    // Room for the widest ratio, from the fastest capture rate
+    auto maxInput = (int) std::ceil(blockSize * maxSourceRate / zoneSampleRate * (1.0 + maxCorrection)) + 8;
+    scratch.setSize(numChannels, maxInput);
+    zoneBuffer.setSize(numChannels, blockSize);
+    interpolators.clear();
+    interpolators.resize((size_t) numChannels);
+    
+    outputLatencySamples = device->getOutputLatencyInSamples();
+    primed = false;
+    refillRequested = true;
+    running = true;
+    
+    DBG("Zone " + settings.name + " starting: " + juce::String(zoneSampleRate) + " Hz, "
+        + juce::String(blockSize) + " samples");
+}
+
+void AudioServer::OutputZone::audioDeviceStopped()
+{
+    running = false;
+    chain.release();
+}
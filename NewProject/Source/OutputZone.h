@@ -0,0 +1,114 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioServer.h"
+
+//==============================================================================
+/**
+ * An OutputZone plays the captured audio on a further output device, through
+ * its own ProcessorChain, so e.g. monitors, headphones and a recorder can each
+ * have their own EQ.
+ *
+ * The capture callback copies each block into the zone's buffer. The zone's
+ * device pulls from it on its own IO thread and runs the zone's chain there,
+ * so zones process in parallel with each other and with the main output, at
+ * the zone device's sample rate.
+ *
+ * The two devices run from different clocks, so the zone resamples as it
+ * reads. A PI controller trims the resampling ratio to hold the buffer at its
+ * target fill; the steady correction it settles on is the drift between the
+ * clocks. The target fill is the zone's buffering plus its alignment delay, so
+ * delaying a zone to line up with the others costs no extra delay line.
+ *
+ * If the buffer runs dry the zone plays silence until it has refilled to its
+ * target, and blocks that don't fit are dropped; both are counted.
+ */
+class AudioServer::OutputZone : public juce::AudioIODeviceCallback
+{
+public:
+    //==============================================================================
+    explicit OutputZone(const ZoneSettings& settings);
+    ~OutputZone() override;
+    
+    // Device thread
+    bool open(juce::String& errorMessage);
+    void close();
+    
+    const ZoneSettings& getSettings() const { return settings; }
+    ProcessorChain& getChain() { return chain; }
+    ZoneStatus getStatus() const;
+    
+    // Capture to output before any alignment delay: buffering, the device's
+    // output latency and the chain's plugin latency
+    float getPathLatencyMs() const;
+    void setAlignmentDelayMs(float newDelayMs);
+    
+    //==============================================================================
+    // Capture side. setSource() is called whenever the capture device
+    // (re)starts, and before the first push().
+    void setSource(double sampleRate);
+    void push(const juce::AudioBuffer<float>& capture, int numSamples);
+    
+    //==============================================================================
+    // Zone device thread
+    void audioDeviceIOCallbackWithContext(const float* const* inputChannelData,
+                                         int numInputChannels,
+                                         float* const* outputChannelData,
+                                         int numOutputChannels,
+                                         int numSamples,
+                                         const juce::AudioIODeviceCallbackContext& context) override;
+    
+    void audioDeviceAboutToStart(juce::AudioIODevice* device) override;
+    void audioDeviceStopped() override;
+    
+private:
+    //==============================================================================
+    // Enough for the largest buffering and alignment at 192 kHz
+    static constexpr double maxSourceRate = 192000.0;
+    static constexpr double maxBufferedSeconds = 1.0;
+    
+    // Drift controller. The ratio never moves more than 0.2% from nominal, so
+    // the correction stays inaudible.
+    static constexpr double fillSmoothingSeconds = 0.5;
+    static constexpr double proportionalGain = 0.01;    // Per second of excess buffered audio
+    static constexpr double integralGain = 0.0005;
+    static constexpr double maxCorrection = 0.002;
+    
+    double getTargetFill(double sourceRate) const;
+    bool render(int numSamples);
+    
+    //==============================================================================
+    const ZoneSettings settings;
+    const int numChannels;
+    
+    juce::AudioDeviceManager deviceManager;
+    ProcessorChain chain;
+    
+    // Capture-rate ring, written by the capture callback and read by the
+    // zone device
+    juce::AbstractFifo fifo { 1 };
+    juce::AudioBuffer<float> ring;
+    
+    std::atomic<double> sourceSampleRate { 0.0 };
+    std::atomic<float> alignmentDelayMs { 0.0f };
+    std::atomic<bool> refillRequested { false };
+    
+    // Zone device thread
+    double zoneSampleRate = 48000.0;
+    juce::AudioBuffer<float> scratch;
+    juce::AudioBuffer<float> zoneBuffer;
+    std::vector<juce::LagrangeInterpolator> interpolators;
+    bool primed = false;
+    double smoothedFill = 0.0;
+    double integral = 0.0;
+    
+    // Status
+    std::atomic<bool> running { false };
+    std::atomic<float> bufferedMs { 0.0f };
+    std::atomic<float> driftPpm { 0.0f };
+    std::atomic<int> outputLatencySamples { 0 };
+    std::atomic<int> numUnderruns { 0 };
+    std::atomic<int> numOverruns { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OutputZone)
+};
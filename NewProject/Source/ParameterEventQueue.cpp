@@ -0,0 +1,68 @@
+#include "ParameterEventQueue.h"
+
+//==============================================================================
+juce::uint64 ParameterEvent::getCurrentHostTimeNs() noexcept
+{
+    // On macOS both are mach_absolute_time(); CoreAudio converts its block
+    // timestamps to nanoseconds the same way
+    static const double nanosecondsPerTick = 1.0e9 / (double) juce::Time::getHighResolutionTicksPerSecond();
+    
+    return (juce::uint64) ((double) juce::Time::getHighResolutionTicks() * nanosecondsPerTick);
+}
+
+//==============================================================================
+ParameterEventQueue::ParameterEventQueue()
+{
+    static_assert(juce::isPowerOfTwo(capacity), "capacity must be a power of two");
+    
+    // Cell n is free for the write at position n
+    for (size_t i = 0; i < cells.size(); ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool ParameterEventQueue::push(const ParameterEvent& event) noexcept
+{
+    auto position = writePosition.load(std::memory_order_relaxed);
+    
+    for (;;)
+    {
+        auto& cell = cells[position & (cells.size() - 1)];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = (std::ptrdiff_t) sequence - (std::ptrdiff_t) position;
+        
+        if (difference == 0)
+        {
+            // Free for this position: claim it, or retry where the winner left off
+            if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.event = event;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Still holds an event the audio thread hasn't read
+            return false;
+        }
+        else
+        {
+            position = writePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool ParameterEventQueue::pop(ParameterEvent& event) noexcept
+{
+    auto& cell = cells[readPosition & (cells.size() - 1)];
+    
+    if (cell.sequence.load(std::memory_order_acquire) != readPosition + 1)
+        return false;
+    
+    event = cell.event;
+    
+    // Free the cell for the write one lap later
+    cell.sequence.store(readPosition + cells.size(), std::memory_order_release);
+    ++readPosition;
+    return true;
+}
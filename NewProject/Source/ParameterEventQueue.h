@@ -0,0 +1,68 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * A parameter change stamped with the host time it should take effect at, in
+ * the nanosecond clock devices stamp their blocks with.
+ */
+struct ParameterEvent
+{
+    enum class Parameter
+    {
+        Gain,           // dB
+        Frequency,      // Hz
+        Q,
+        Enabled         // 0 or 1
+    };
+    
+    juce::uint64 hostTimeNs = 0;        // 0 for the start of the next block
+    int group = 0;
+    int band = 0;
+    Parameter parameter = Parameter::Gain;
+    float value = 0.0f;
+    
+    // Now, in the same clock as AudioIODeviceCallbackContext::hostTimeNs
+    static juce::uint64 getCurrentHostTimeNs() noexcept;
+};
+
+//==============================================================================
+/**
+ * ParameterEventQueue carries ParameterEvents from any number of threads to
+ * the audio thread without locks or allocation.
+ *
+ * It is a bounded ring of cells, each with a sequence number that says
+ * whether it is free for the next write or holds the next read. Producers
+ * claim a cell with a single compare-and-swap on the write position, so none
+ * of them ever waits on another, and the audio thread reads with one acquire
+ * load per event. An empty queue costs the audio thread that one load.
+ */
+class ParameterEventQueue
+{
+public:
+    //==============================================================================
+    static constexpr int capacity = 1024;       // Must be a power of two
+    
+    ParameterEventQueue();
+    
+    // Any thread. Returns false if the queue is full.
+    bool push(const ParameterEvent& event) noexcept;
+    
+    // Audio thread only
+    bool pop(ParameterEvent& event) noexcept;
+    
+private:
+    //==============================================================================
+    struct Cell
+    {
+        std::atomic<size_t> sequence { 0 };
+        ParameterEvent event;
+    };
+    
+    std::array<Cell, (size_t) capacity> cells;
+    std::atomic<size_t> writePosition { 0 };
+    size_t readPosition = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ParameterEventQueue)
+};
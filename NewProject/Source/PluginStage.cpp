@@ -0,0 +1,467 @@
+#include "PluginStage.h"
+#include "Tracing.h"
+#include "RealtimeConfig.h"
+#include "Reclaimer.h"
+
+//==============================================================================
+/** Everything the audio thread needs to run one layout. Built on the loader
+    thread, owned by the audio thread while active, and deleted on the message
+    thread, by way of the Reclaimer, once replaced. */
+struct PluginStage::Graph
+{
+    struct Node
+    {
+        std::unique_ptr<juce::AudioPluginInstance> plugin;
+        int slot = 0;
+    };
+    
+    struct Branch
+    {
+        std::vector<Node> nodes;
+        int latency = 0;
+        
+        // Large enough for every plugin's bus layout, one block long
+        juce::AudioBuffer<float> buffer;
+        
+        // Delay that brings this branch in line with the slowest one
+        juce::AudioBuffer<float> delayLine;
+        int compensation = 0;
+        int delayPosition = 0;
+    };
+    
+    ~Graph()
+    {
+        for (auto* branch : branches)
+            for (auto& node : branch->nodes)
+                node.plugin->releaseResources();
+    }
+    
+    juce::OwnedArray<Branch> branches;
+    juce::MidiBuffer midi;
+    double sampleRate = 0.0;
+    int blockSize = 0;
+    int numChannels = 0;
+    int latency = 0;
+    float branchGain = 1.0f;
+    
+    // The graph and its buffers; the plugins' own memory can't be known
+    size_t bytes = sizeof(Graph);
+};
+
+struct PluginStage::PendingBuild
+{
+    int generation = 0;
+    Layout layout;
+    double sampleRate = 0.0;
+    int blockSize = 0;
+    int numChannels = 0;
+    
+    std::vector<std::unique_ptr<juce::AudioPluginInstance>> instances;
+    int numOutstanding = 0;
+    juce::StringArray errors;
+};
+
+//==============================================================================
+int PluginStage::Layout::getNumPlugins() const
+{
+    int total = 0;
+    
+    for (const auto& branch : branches)
+        total += branch.size();
+    
+    return total;
+}
+
+void PluginStage::TimingStats::reset()
+{
+    averageLoad.store(0.0f, std::memory_order_relaxed);
+    peakLoad.store(0.0f, std::memory_order_relaxed);
+    latencySamples.store(0, std::memory_order_relaxed);
+}
+
+//==============================================================================
+PluginStage::PluginStage()
+{
+    weakSelf = this;
+    formatManager.addDefaultFormats();
+}
+
+PluginStage::~PluginStage()
+{
+    loaderPool.removeAllJobs(true, 10000);
+    
+    // Like any other graph, so its plugins go on the message thread whichever
+    // thread the stage is destroyed on. This thread may delete, so a full
+    // ring is drained here first.
+    for (auto* graph : { pendingGraph.exchange(nullptr), activeGraph })
+    {
+        if (graph != nullptr && !Reclaimer::retireToMessageThread(graph, graph->bytes))
+        {
+            Reclaimer::collect();
+            Reclaimer::retireToMessageThread(graph, graph->bytes);
+        }
+    }
+}
+
+//==============================================================================
+bool PluginStage::describePlugin(const juce::String& fileOrIdentifier,
+                                 juce::PluginDescription& result,
+                                 juce::String& errorMessage)
+{
+    for (auto* format : formatManager.getFormats())
+    {
+        if (!format->fileMightContainThisPluginType(fileOrIdentifier))
+            continue;
+        
+        juce::OwnedArray<juce::PluginDescription> found;
+        format->findAllTypesForFile(found, fileOrIdentifier);
+        
+        if (!found.isEmpty())
+        {
+            result = *found.getFirst();
+            return true;
+        }
+    }
+    
+    errorMessage = "No VST3 or LV2 plugin found at " + fileOrIdentifier;
+    return false;
+}
+
+//==============================================================================
+void PluginStage::setLayout(const Layout& newLayout, std::function<void(const juce::String&)> onLoaded)
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    if (newLayout.getNumPlugins() > maxPlugins)
+        DBG("PluginStage: only the first " + juce::String(maxPlugins) + " plugins are loaded");
+    
+    layout = newLayout;
+    loadedCallback = std::move(onLoaded);
+    rebuild();
+}
+
+void PluginStage::prepare(double sampleRate, int samplesPerBlock, int numChannels)
+{
+    // The running graph was prepared for the old settings; process() passes
+    // audio through untouched until the rebuilt one arrives
+    currentSampleRate.store(sampleRate);
+    
+    juce::MessageManager::callAsync([weakThis = weakSelf, sampleRate, samplesPerBlock, numChannels]
+    {
+        if (weakThis == nullptr)
+            return;
+        
+        weakThis->preparedSampleRate = sampleRate;
+        weakThis->preparedBlockSize = samplesPerBlock;
+        weakThis->preparedNumChannels = numChannels;
+        
+        if (weakThis->layout.getNumPlugins() > 0)
+            weakThis->rebuild();
+    });
+}
+
+void PluginStage::rebuild()
+{
+    auto build = std::make_shared<PendingBuild>();
+    build->generation = ++generation;
+    build->layout = layout;
+    build->sampleRate = preparedSampleRate;
+    build->blockSize = preparedBlockSize;
+    build->numChannels = preparedNumChannels;
+    build->instances.resize((size_t) juce::jmin(layout.getNumPlugins(), maxPlugins));
+    build->numOutstanding = (int) build->instances.size();
+    
+    // Not prepared yet: prepare() rebuilds once the device is running
+    if (preparedSampleRate <= 0.0)
+        return;
+    
+    if (build->numOutstanding == 0)
+    {
+        instancesCreated(build);
+        return;
+    }
+    
+    // Some formats must be created on the message thread, so creation is
+    // asynchronous; everything after it happens on the loader thread
+    int slot = 0;
+    
+    for (const auto& branch : layout.branches)
+    {
+        for (const auto& plugin : branch)
+        {
+            if (slot == maxPlugins)
+                break;
+            
+            formatManager.createPluginInstanceAsync(plugin.description, preparedSampleRate, preparedBlockSize,
+                [weakThis = weakSelf, build, slot, name = plugin.description.name]
+                (std::unique_ptr<juce::AudioPluginInstance> instance, const juce::String& error)
+                {
+                    if (instance == nullptr)
+                        build->errors.add(name + ": " + error);
+                    
+                    build->instances[(size_t) slot] = std::move(instance);
+                    
+                    if (--build->numOutstanding == 0 && weakThis != nullptr)
+                        weakThis->instancesCreated(build);
+                });
+            
+            ++slot;
+        }
+    }
+}
+
+void PluginStage::instancesCreated(std::shared_ptr<PendingBuild> build)
+{
+    if (build->generation != generation)
+        return;
+    
+    loaderPool.addJob([weakThis = weakSelf, build]
+    {
+        RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Worker, "Plugin Loader");
+        Tracing::setThreadName("Plugin Loader");
+        TRACE_SCOPE("Plugin load");
+        
+        auto graph = std::make_unique<Graph>();
+        graph->sampleRate = build->sampleRate;
+        graph->blockSize = juce::jmax(1, build->blockSize);
+        graph->numChannels = juce::jmax(1, build->numChannels);
+        graph->midi.ensureSize(2048);
+        
+        auto channelSet = juce::AudioChannelSet::canonicalChannelSet(graph->numChannels);
+        int slot = 0;
+        
+        for (const auto& branchSlots : build->layout.branches)
+        {
+            auto* branch = graph->branches.add(new Graph::Branch());
+            auto bufferChannels = graph->numChannels;
+            
+            for (const auto& pluginSlot : branchSlots)
+            {
+                if (slot == maxPlugins)
+                    break;
+                
+                auto plugin = std::move(build->instances[(size_t) slot]);
+                
+                if (plugin != nullptr)
+                {
+                    // Match the chain's channel count where the plugin allows
+                    // it; otherwise keep its default buses
+                    auto buses = plugin->getBusesLayout();
+                    
+                    if (!buses.inputBuses.isEmpty())
+                        buses.inputBuses.getReference(0) = channelSet;
+                    
+                    if (!buses.outputBuses.isEmpty())
+                        buses.outputBuses.getReference(0) = channelSet;
+                    
+                    plugin->setBusesLayout(buses);
+                    
+                    if (!pluginSlot.state.isEmpty())
+                        plugin->setStateInformation(pluginSlot.state.getData(), (int) pluginSlot.state.getSize());
+                    
+                    plugin->prepareToPlay(graph->sampleRate, graph->blockSize);
+                    
+                    branch->latency += plugin->getLatencySamples();
+                    bufferChannels = juce::jmax(bufferChannels,
+                                                plugin->getTotalNumInputChannels(),
+                                                plugin->getTotalNumOutputChannels());
+                    
+                    branch->nodes.push_back({ std::move(plugin), slot });
+                }
+                
+                ++slot;
+            }
+            
+            branch->buffer.setSize(bufferChannels, graph->blockSize);
+            branch->buffer.clear();
+            graph->bytes += sizeof(Graph::Branch) + (size_t) (bufferChannels * graph->blockSize) * sizeof(float);
+            graph->latency = juce::jmax(graph->latency, branch->latency);
+        }
+        
+        if (build->layout.averageBranches && graph->branches.size() > 1)
+            graph->branchGain = 1.0f / (float) graph->branches.size();
+        
+        for (auto* branch : graph->branches)
+        {
+            branch->compensation = graph->latency - branch->latency;
+            
+            if (branch->compensation > 0)
+            {
+                branch->delayLine.setSize(graph->numChannels, branch->compensation);
+                branch->delayLine.clear();
+                graph->bytes += (size_t) (graph->numChannels * branch->compensation) * sizeof(float);
+            }
+        }
+        
+        auto* finished = graph.release();
+        
+        juce::MessageManager::callAsync([weakThis, finished, generation = build->generation, errors = build->errors]
+        {
+            std::unique_ptr<Graph> owner(finished);
+            
+            if (weakThis == nullptr || generation != weakThis->generation)
+                return;
+            
+            weakThis->publish(owner.release(), generation);
+            
+            if (weakThis->loadedCallback != nullptr)
+                weakThis->loadedCallback(errors.joinIntoString("\n"));
+        });
+    });
+}
+
+void PluginStage::publish(Graph* graph, int graphGeneration)
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    for (auto& stats : timings)
+        stats.reset();
+    
+    for (auto* branch : graph->branches)
+        for (const auto& node : branch->nodes)
+            timings[(size_t) node.slot].latencySamples.store(node.plugin->getLatencySamples(), std::memory_order_relaxed);
+    
+    latencySamples.store(graph->latency);
+    
+    // A graph the audio thread never picked up can be deleted right away
+    delete pendingGraph.exchange(graph, std::memory_order_acq_rel);
+    
+    DBG("PluginStage: layout " + juce::String(graphGeneration) + " ready, "
+        + juce::String(graph->branches.size()) + " branches, "
+        + juce::String(graph->latency) + " samples latency");
+}
+
+//==============================================================================
+juce::Array<PluginStage::PluginTiming> PluginStage::getPluginTimings() const
+{
+    juce::Array<PluginTiming> result;
+    int slot = 0;
+    
+    for (int b = 0; b < layout.branches.size(); ++b)
+    {
+        for (const auto& plugin : layout.branches.getReference(b))
+        {
+            if (slot == maxPlugins)
+                return result;
+            
+            const auto& stats = timings[(size_t) slot++];
+            
+            PluginTiming timing;
+            timing.name = plugin.description.name;
+            timing.branch = b;
+            timing.latencySamples = stats.latencySamples.load(std::memory_order_relaxed);
+            timing.averageLoad = stats.averageLoad.load(std::memory_order_relaxed);
+            timing.peakLoad = stats.peakLoad.load(std::memory_order_relaxed);
+            result.add(timing);
+        }
+    }
+    
+    return result;
+}
+
+//==============================================================================
+void PluginStage::process(juce::AudioBuffer<float>& buffer)
+{
+    // Take a newly published graph, but only once the Reclaimer has taken
+    // the previous one, so the audio thread never has to delete anything.
+    // Only this thread empties pendingGraph, so it can't vanish in between.
+    if (pendingGraph.load(std::memory_order_acquire) != nullptr
+        && Reclaimer::retireToMessageThread(activeGraph, activeGraph != nullptr ? activeGraph->bytes : 0))
+    {
+        activeGraph = pendingGraph.exchange(nullptr, std::memory_order_acq_rel);
+    }
+    
+    auto* graph = activeGraph;
+    
+    if (graph == nullptr || graph->branches.isEmpty()
+        || graph->sampleRate != currentSampleRate.load(std::memory_order_relaxed))
+        return;
+    
+    auto numSamples = buffer.getNumSamples();
+    
+    for (int start = 0; start < numSamples; start += graph->blockSize)
+        processChunk(*graph, buffer, start, juce::jmin(graph->blockSize, numSamples - start));
+}
+
+void PluginStage::release()
+{
+    // Kept for a later call if the Reclaimer's ring is full
+    if (activeGraph != nullptr && Reclaimer::retireToMessageThread(activeGraph, activeGraph->bytes))
+        activeGraph = nullptr;
+}
+
+void PluginStage::processChunk(Graph& graph, juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    auto numChannels = juce::jmin(buffer.getNumChannels(), graph.numChannels);
+    auto blockSeconds = numSamples / graph.sampleRate;
+    auto tickSeconds = 1.0 / (double) juce::Time::getHighResolutionTicksPerSecond();
+    
+    for (auto* branch : graph.branches)
+    {
+        auto& branchBuffer = branch->buffer;
+        
+        for (int channel = 0; channel < branchBuffer.getNumChannels(); ++channel)
+        {
+            if (channel < numChannels)
+                branchBuffer.copyFrom(channel, 0, buffer, channel, startSample, numSamples);
+            else
+                branchBuffer.clear(channel, 0, numSamples);
+        }
+        
+        // Refers to the branch buffer's channels without copying
+        juce::AudioBuffer<float> view(branchBuffer.getArrayOfWritePointers(), branchBuffer.getNumChannels(), numSamples);
+        
+        for (auto& node : branch->nodes)
+        {
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            node.plugin->processBlock(view, graph.midi);
+            auto elapsed = (double) (juce::Time::getHighResolutionTicks() - startTicks) * tickSeconds;
+            
+            graph.midi.clear();
+            
+            auto& stats = timings[(size_t) node.slot];
+            auto load = (float) (elapsed / blockSeconds);
+            auto average = stats.averageLoad.load(std::memory_order_relaxed);
+            stats.averageLoad.store(average + 0.05f * (load - average), std::memory_order_relaxed);
+            
+            if (load > stats.peakLoad.load(std::memory_order_relaxed))
+                stats.peakLoad.store(load, std::memory_order_relaxed);
+        }
+        
+        if (branch->compensation > 0)
+        {
+            auto length = branch->compensation;
+            auto position = branch->delayPosition;
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* samples = branchBuffer.getWritePointer(channel);
+                auto* line = branch->delayLine.getWritePointer(channel);
+                position = branch->delayPosition;
+                
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    auto delayed = line[position];
+                    line[position] = samples[i];
+                    samples[i] = delayed;
+                    
+                    if (++position == length)
+                        position = 0;
+                }
+            }
+            
+            branch->delayPosition = position;
+        }
+    }
+    
+    // Sum the branches back into the chain's buffer
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        buffer.copyFrom(channel, startSample, graph.branches.getUnchecked(0)->buffer.getReadPointer(channel),
+                        numSamples, graph.branchGain);
+        
+        for (int b = 1; b < graph.branches.size(); ++b)
+            buffer.addFrom(channel, startSample, graph.branches.getUnchecked(b)->buffer, channel, 0, numSamples,
+                           graph.branchGain);
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * PluginStage hosts VST3/LV2 plugins inside the ProcessorChain.
+ *
+ * Plugins are arranged as one or more parallel branches, each a series of
+ * plugins. Every branch receives the chain's signal and the branch outputs are
+ * summed, by default scaled to unity gain, with each branch delayed so that
+ * all of them line up with the slowest one (plugin delay compensation).
+ *
+ * Instantiation happens asynchronously on the message thread; state loading
+ * and prepareToPlay() happen on a loader thread. The finished graph is handed
+ * to the audio thread with an atomic swap, and the graph it replaces goes
+ * through the Reclaimer back to the message thread, where plugins have to be
+ * deleted. Each plugin's processing time is measured so slow plugins can be
+ * found.
+ */
+class PluginStage
+{
+public:
+    //==============================================================================
+    struct PluginSlot
+    {
+        juce::PluginDescription description;
+        juce::MemoryBlock state;        // Optional, from getStateInformation()
+    };
+    
+    using Branch = juce::Array<PluginSlot>;
+    
+    struct Layout
+    {
+        juce::Array<Branch> branches;   // Summed; a single branch is a plain series chain
+        
+        // Scales the sum by 1 / the number of branches, so branches that
+        // leave the signal as it is sum back to it; off, they add up
+        bool averageBranches = true;
+        
+        int getNumPlugins() const;
+    };
+    
+    struct PluginTiming
+    {
+        juce::String name;
+        int branch = 0;
+        int latencySamples = 0;
+        float averageLoad = 0.0f;       // Fraction of the block's real-time duration
+        float peakLoad = 0.0f;
+    };
+    
+    static constexpr int maxPlugins = 64;
+    
+    //==============================================================================
+    PluginStage();
+    ~PluginStage();
+    
+    juce::AudioPluginFormatManager& getFormatManager() { return formatManager; }
+    
+    // Fills in a description for a plugin file or identifier using any format
+    bool describePlugin(const juce::String& fileOrIdentifier,
+                        juce::PluginDescription& result,
+                        juce::String& errorMessage);
+    
+    //==============================================================================
+    // Message thread. onLoaded is called on the message thread once the new
+    // layout is running, with any errors from plugins that failed to load.
+    void setLayout(const Layout& newLayout, std::function<void(const juce::String&)> onLoaded = nullptr);
+    const Layout& getLayout() const { return layout; }
+    
+    int getLatencySamples() const { return latencySamples.load(); }
+    juce::Array<PluginTiming> getPluginTimings() const;
+    
+    //==============================================================================
+    void prepare(double sampleRate, int samplesPerBlock, int numChannels);
+    void process(juce::AudioBuffer<float>& buffer);   // Audio thread
+    
+    // Once processing has stopped: the running graph goes back to the
+    // message thread, where its plugins release their resources. prepare()
+    // builds it again.
+    void release();
+    
+private:
+    //==============================================================================
+    struct Graph;
+    struct PendingBuild;
+    
+    struct TimingStats
+    {
+        std::atomic<float> averageLoad { 0.0f };
+        std::atomic<float> peakLoad { 0.0f };
+        std::atomic<int> latencySamples { 0 };
+        
+        void reset();
+    };
+    
+    void rebuild();
+    void instancesCreated(std::shared_ptr<PendingBuild> build);
+    void publish(Graph* graph, int generation);
+    void processChunk(Graph& graph, juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    
+    //==============================================================================
+    juce::AudioPluginFormatManager formatManager;
+    juce::ThreadPool loaderPool { 1 };
+    
+    // Made up front: creating one from another thread would race
+    juce::WeakReference<PluginStage> weakSelf;
+    
+    Layout layout;
+    std::function<void(const juce::String&)> loadedCallback;
+    int generation = 0;
+    
+    double preparedSampleRate = 0.0;
+    int preparedBlockSize = 0;
+    int preparedNumChannels = 0;
+    
+    // Graph handover: the message thread publishes into pending, the audio
+    // thread swaps it in and retires the old graph
+    std::atomic<Graph*> pendingGraph { nullptr };
+    Graph* activeGraph = nullptr;
+    
+    std::atomic<double> currentSampleRate { 0.0 };
+    std::atomic<int> latencySamples { 0 };
+    std::array<TimingStats, maxPlugins> timings;
+    
+    JUCE_DECLARE_WEAK_REFERENCEABLE(PluginStage)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PluginStage)
+};
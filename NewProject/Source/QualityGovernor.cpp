@@ -0,0 +1,198 @@
+#include "QualityGovernor.h"
+#include "Tracing.h"
+
+//==============================================================================
+QualityGovernor::QualityGovernor()
+{
+    startTimer(tickMs);
+}
+
+QualityGovernor::~QualityGovernor()
+{
+    stopTimer();
+}
+
+//==============================================================================
+void QualityGovernor::addStage(const juce::String& name, const juce::StringArray& tierNames, ApplyTier apply)
+{
+    jassert(!tierNames.isEmpty() && apply != nullptr);
+    
+    // Added stages go to the end of the ladder, so the level doesn't change
+    stages.add({ name, tierNames, std::move(apply), 0 });
+}
+
+void QualityGovernor::setSettings(const Settings& newSettings)
+{
+    settings = newSettings;
+    settings.restoreLoad = juce::jmin(settings.restoreLoad, settings.degradeLoad);
+    
+    msOverLoad = 0;
+    msUnderLoad = 0;
+    
+    if (!settings.enabled)
+        reset();
+}
+
+void QualityGovernor::reset()
+{
+    msOverLoad = 0;
+    msUnderLoad = 0;
+    peakLoad.store(0.0f);
+    numCallbacks.store(0);
+    
+    if (level != 0)
+        setLevel(0, 0.0f);
+}
+
+//==============================================================================
+int QualityGovernor::getNumLevels() const
+{
+    int numLevels = 1;
+    
+    for (const auto& stage : stages)
+        numLevels += stage.tierNames.size() - 1;
+    
+    return numLevels;
+}
+
+juce::String QualityGovernor::getStageName(int stage) const
+{
+    return juce::isPositiveAndBelow(stage, stages.size()) ? stages.getReference(stage).name : juce::String();
+}
+
+int QualityGovernor::getTier(int stage) const
+{
+    return juce::isPositiveAndBelow(stage, stages.size()) ? stages.getReference(stage).tier : 0;
+}
+
+juce::String QualityGovernor::getTierName(int stage) const
+{
+    if (!juce::isPositiveAndBelow(stage, stages.size()))
+        return {};
+    
+    const auto& s = stages.getReference(stage);
+    return s.tierNames[s.tier];
+}
+
+juce::String QualityGovernor::getDescription() const
+{
+    juce::StringArray parts;
+    
+    for (int stage = 0; stage < stages.size(); ++stage)
+        parts.add(getStageName(stage) + ": " + getTierName(stage));
+    
+    return parts.joinIntoString(", ");
+}
+
+int QualityGovernor::getTierAt(int stage, int atLevel) const
+{
+    // Earlier stages go all the way down before later ones start
+    auto remaining = atLevel;
+    
+    for (int s = 0; s < stages.size(); ++s)
+    {
+        auto tier = juce::jmin(remaining, stages.getReference(s).tierNames.size() - 1);
+        
+        if (s == stage)
+            return tier;
+        
+        remaining -= tier;
+    }
+    
+    return 0;
+}
+
+//==============================================================================
+void QualityGovernor::addCallback(double callbackSeconds, double blockSeconds) noexcept
+{
+    if (blockSeconds <= 0.0)
+        return;
+    
+    auto load = (float) (callbackSeconds / blockSeconds);
+    
+    // Raise the peak unless the timer has taken a higher one since; the timer
+    // only ever resets it, so this rarely loops
+    auto peak = peakLoad.load(std::memory_order_relaxed);
+    
+    while (load > peak && !peakLoad.compare_exchange_weak(peak, load, std::memory_order_relaxed))
+    {
+    }
+    
+    numCallbacks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void QualityGovernor::timerCallback()
+{
+    // With the device stopped there is nothing to judge, so hold the level
+    if (numCallbacks.exchange(0) == 0)
+        return;
+    
+    auto load = peakLoad.exchange(0.0f);
+    lastLoad.store(load, std::memory_order_relaxed);
+    Tracing::counter("Callback load", load);
+    
+    if (!settings.enabled)
+        return;
+    
+    if (load > settings.degradeLoad)
+    {
+        msUnderLoad = 0;
+        msOverLoad += tickMs;
+        
+        if (msOverLoad >= settings.degradeAfterMs && level < getNumLevels() - 1)
+            setLevel(level + 1, load);
+    }
+    else if (load < settings.restoreLoad)
+    {
+        msOverLoad = 0;
+        msUnderLoad += tickMs;
+        
+        if (msUnderLoad >= settings.restoreAfterMs && level > 0)
+            setLevel(level - 1, load);
+    }
+    else
+    {
+        msOverLoad = 0;
+        msUnderLoad = 0;
+    }
+}
+
+void QualityGovernor::setLevel(int newLevel, float load)
+{
+    Change change;
+    change.time = juce::Time::getCurrentTime();
+    change.fromLevel = level;
+    change.toLevel = newLevel;
+    change.load = load;
+    
+    juce::StringArray switched;
+    
+    for (int stage = 0; stage < stages.size(); ++stage)
+    {
+        auto& s = stages.getReference(stage);
+        auto tier = getTierAt(stage, newLevel);
+        
+        if (tier != s.tier)
+        {
+            s.tier = tier;
+            s.apply(tier);
+            switched.add(s.name + " to " + s.tierNames[tier]);
+        }
+    }
+    
+    level = newLevel;
+    
+    // The new level has to prove itself before the next step
+    msOverLoad = 0;
+    msUnderLoad = 0;
+    
+    change.description = switched.joinIntoString(", ");
+    changes.add(change);
+    
+    if (changes.size() > maxChanges)
+        changes.remove(0);
+    
+    DBG("Quality level " + juce::String(change.fromLevel) + " -> " + juce::String(newLevel)
+        + " at " + juce::String(juce::roundToInt(load * 100.0f)) + "% load: " + change.description);
+    Tracing::counter("Quality level", newLevel);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * QualityGovernor trades processing quality for CPU time when the audio
+ * callback gets close to its deadline, and gives it back once there is room
+ * again, so a busy machine hears slightly cheaper processing instead of
+ * dropouts.
+ *
+ * Stages declare their quality tiers, best first, along with a function that
+ * switches them to a tier. The tiers form one ladder of levels: level 0 runs
+ * every stage at its best, and each level above it lowers one stage by one
+ * tier, going through the stages in the order they were added. So the
+ * cheapest sacrifices are added first.
+ *
+ * The audio thread reports how long each callback took against the length of
+ * its block; that is the only work it does here, a few atomic operations. A
+ * timer on the message thread looks at the highest load since its last tick:
+ *
+ * - above degradeLoad for degradeAfterMs, it moves up one level
+ * - below restoreLoad for restoreAfterMs, it moves down one level
+ * - anywhere in between, both counts start over
+ *
+ * The gap between the two loads and the longer wait before restoring keep it
+ * from flapping between levels. Only one stage changes per step, and stages
+ * switch tiers without a glitch, carrying their state across. Every change is
+ * logged and kept in a short history.
+ */
+class QualityGovernor : private juce::Timer
+{
+public:
+    //==============================================================================
+    // Called on the message thread with the tier to switch to, 0 for the best
+    using ApplyTier = std::function<void(int tier)>;
+    
+    struct Settings
+    {
+        bool enabled = true;
+        float degradeLoad = 0.7f;           // Callback time as a fraction of the block's length
+        float restoreLoad = 0.4f;
+        int degradeAfterMs = 250;
+        int restoreAfterMs = 5000;
+    };
+    
+    struct Change
+    {
+        juce::Time time;
+        int fromLevel = 0;
+        int toLevel = 0;
+        float load = 0.0f;                  // Peak load that prompted it
+        juce::String description;
+    };
+    
+    static constexpr int tickMs = 50;
+    static constexpr int maxChanges = 32;
+    
+    //==============================================================================
+    QualityGovernor();
+    ~QualityGovernor() override;
+    
+    // Message thread
+    void addStage(const juce::String& name, const juce::StringArray& tierNames, ApplyTier apply);
+    
+    void setSettings(const Settings& newSettings);
+    Settings getSettings() const { return settings; }
+    
+    // Back to full quality, e.g. when the device restarts
+    void reset();
+    
+    //==============================================================================
+    // Current state, message thread
+    int getLevel() const { return level; }
+    int getNumLevels() const;
+    
+    int getNumStages() const { return stages.size(); }
+    juce::String getStageName(int stage) const;
+    int getTier(int stage) const;
+    juce::String getTierName(int stage) const;
+    
+    // Every stage's tier, e.g. "Metering: Every block, EQ precision: ..."
+    juce::String getDescription() const;
+    
+    // Peak load over the latest tick, from any thread
+    float getLoad() const { return lastLoad.load(std::memory_order_relaxed); }
+    
+    // The latest changes, oldest first
+    juce::Array<Change> getChanges() const { return changes; }
+    
+    //==============================================================================
+    // Audio thread, after each callback
+    void addCallback(double callbackSeconds, double blockSeconds) noexcept;
+    
+private:
+    //==============================================================================
+    struct Stage
+    {
+        juce::String name;
+        juce::StringArray tierNames;
+        ApplyTier apply;
+        int tier = 0;
+    };
+    
+    void timerCallback() override;
+    void setLevel(int newLevel, float load);
+    int getTierAt(int stage, int atLevel) const;
+    
+    //==============================================================================
+    Settings settings;
+    juce::Array<Stage> stages;
+    juce::Array<Change> changes;
+    int level = 0;
+    int msOverLoad = 0;
+    int msUnderLoad = 0;
+    
+    // Written by the audio thread
+    std::atomic<float> peakLoad { 0.0f };
+    std::atomic<int> numCallbacks { 0 };
+    
+    std::atomic<float> lastLoad { 0.0f };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(QualityGovernor)
+};
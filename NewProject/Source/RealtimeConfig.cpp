@@ -0,0 +1,554 @@
+#include "RealtimeConfig.h"
+
+#if JUCE_LINUX
+ #include <sched.h>
+ #include <pthread.h>
+ #include <alloca.h>
+ #include <malloc.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
+ #include <sys/resource.h>
+ #include <sys/syscall.h>
+ #include <signal.h>
+#endif
+
+//==============================================================================
+namespace
+{
+    // The settings as the threads read them, with CPU lists as masks of the
+    // first 64 CPUs
+    struct ActiveThreadSettings
+    {
+        RealtimeConfig::Policy policy = RealtimeConfig::Policy::Unchanged;
+        int priority = 0;
+        juce::uint64 cpuMask = 0;
+    };
+    
+    struct ActiveSettings
+    {
+        ActiveThreadSettings audio, worker;
+        bool useRtkit = false;
+        int stackPrefaultBytes = 0;
+    };
+    
+    ActiveSettings activeSettings;
+    juce::SpinLock settingsLock;
+    std::atomic<juce::uint32> settingsGeneration { 1 };
+    
+    enum class RequestState
+    {
+        applied,
+        needsRtkit,
+        viaRtkit,
+        failed
+    };
+    
+    // One per thread that has called configureCurrentThread(). The owning
+    // thread fills it in; the message thread reads it and handles rtkit.
+    struct ThreadEntry
+    {
+        std::atomic<int> threadId { 0 };           // 0 while free
+        std::atomic<int> role { 0 };
+        std::atomic<const char*> name { nullptr };
+        std::atomic<RequestState> state { RequestState::applied };
+        std::atomic<int> rtkitPriority { 0 };
+        std::atomic<int> schedulerError { 0 };     // errno values
+        std::atomic<int> affinityError { 0 };
+        std::atomic<bool> demoted { false };       // Hit the soft real-time limit
+        juce::String rtkitError;                    // Message thread only
+    };
+    
+    std::array<ThreadEntry, RealtimeConfig::maxThreads> entries;
+    
+    // Frees the calling thread's entry when the thread exits
+    struct ThreadSlot
+    {
+        ~ThreadSlot()
+        {
+            if (entry != nullptr)
+                entry->threadId.store(0, std::memory_order_release);
+        }
+        
+        ThreadEntry* entry = nullptr;
+        juce::uint32 generation = 0;
+    };
+    
+    thread_local ThreadSlot threadSlot;
+    
+    juce::uint64 toCpuMask(const juce::Array<int>& cpus)
+    {
+        juce::uint64 mask = 0;
+        
+        for (auto cpu : cpus)
+            if (juce::isPositiveAndBelow(cpu, 64))
+                mask |= (juce::uint64) 1 << cpu;
+        
+        return mask;
+    }
+    
+    ActiveThreadSettings toActive(const RealtimeConfig::ThreadSettings& settings)
+    {
+        return { settings.policy, juce::jlimit(1, 99, settings.priority), toCpuMask(settings.cpus) };
+    }
+    
+    juce::String getPolicyName(RealtimeConfig::Policy policy)
+    {
+        switch (policy)
+        {
+            case RealtimeConfig::Policy::Unchanged:     return "unchanged";
+            case RealtimeConfig::Policy::Normal:        return "normal";
+            case RealtimeConfig::Policy::Fifo:          return "FIFO";
+            case RealtimeConfig::Policy::RoundRobin:    return "round-robin";
+        }
+        
+        return {};
+    }
+   
+   #if JUCE_LINUX
+    int toLinuxPolicy(RealtimeConfig::Policy policy)
+    {
+        switch (policy)
+        {
+            case RealtimeConfig::Policy::Fifo:          return SCHED_FIFO;
+            case RealtimeConfig::Policy::RoundRobin:    return SCHED_RR;
+            default:                                    return SCHED_OTHER;
+        }
+    }
+    
+    RealtimeConfig::Policy fromLinuxPolicy(int policy)
+    {
+        switch (policy & ~SCHED_RESET_ON_FORK)
+        {
+            case SCHED_FIFO:    return RealtimeConfig::Policy::Fifo;
+            case SCHED_RR:      return RealtimeConfig::Policy::RoundRobin;
+            default:            return RealtimeConfig::Policy::Normal;
+        }
+    }
+    
+    ThreadEntry* claimEntry() noexcept
+    {
+        auto threadId = (int) syscall(SYS_gettid);
+        
+        for (auto& entry : entries)
+        {
+            auto expected = 0;
+            
+            if (entry.threadId.compare_exchange_strong(expected, threadId, std::memory_order_acq_rel))
+                return &entry;
+        }
+        
+        return nullptr;
+    }
+    
+    // Maps the stack pages the thread will use, so the first deep call in a
+    // callback doesn't fault them in. Kept out of line so the space is
+    // released on return.
+    __attribute__((noinline)) void prefaultStack(int numBytes) noexcept
+    {
+        numBytes = juce::jlimit(0, 1 << 20, numBytes);
+        
+        if (numBytes == 0)
+            return;
+        
+        auto* stack = static_cast<volatile char*>(alloca((size_t) numBytes));
+        
+        for (int i = 0; i < numBytes; i += 4096)
+            stack[i] = 0;
+    }
+    
+    // SIGXCPU goes to the thread that overran the soft limit. Dropping it to
+    // normal scheduling stops its real-time clock before the hard limit, and
+    // SIGKILL, is reached. Only async-signal-safe calls here.
+    void demoteOnRealtimeLimit(int)
+    {
+        sched_param param {};
+        sched_setscheduler(0, SCHED_OTHER, &param);
+        
+        if (auto* entry = threadSlot.entry)
+            entry->demoted.store(true, std::memory_order_relaxed);
+    }
+    
+    bool makeRealtimeWithRtkit(int threadId, int priority, juce::String& errorMessage)
+    {
+        static const bool handlerInstalled = []
+        {
+            struct sigaction action {};
+            action.sa_handler = demoteOnRealtimeLimit;
+            sigemptyset(&action.sa_mask);
+            return sigaction(SIGXCPU, &action, nullptr) == 0;
+        }();
+        
+        if (!handlerInstalled)
+        {
+            errorMessage = "Could not handle SIGXCPU for rtkit";
+            return false;
+        }
+        
+        // rtkit only serves processes that limit their real-time CPU time,
+        // and the soft limit has to be below the hard one for SIGXCPU to come
+        // before SIGKILL
+        rlimit limit { (rlim_t) RealtimeConfig::rtkitSoftLimitMs * 1000, (rlim_t) RealtimeConfig::rtkitHardLimitMs * 1000 };
+        
+        if (setrlimit(RLIMIT_RTTIME, &limit) != 0)
+        {
+            errorMessage = "Could not set RLIMIT_RTTIME for rtkit";
+            return false;
+        }
+        
+        juce::ChildProcess dbus;
+        juce::StringArray arguments { "dbus-send", "--system", "--print-reply",
+                                      "--dest=org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+                                      "org.freedesktop.RealtimeKit1.MakeThreadRealtimeWithPID",
+                                      "uint64:" + juce::String((int) getpid()),
+                                      "uint64:" + juce::String(threadId),
+                                      "uint32:" + juce::String(juce::jmin(priority, RealtimeConfig::maxRtkitPriority)) };
+        
+        if (!dbus.start(arguments))
+        {
+            errorMessage = "Could not run dbus-send to reach rtkit";
+            return false;
+        }
+        
+        auto output = dbus.readAllProcessOutput();
+        
+        if (dbus.getExitCode() != 0)
+        {
+            errorMessage = "rtkit refused: " + output.trim();
+            return false;
+        }
+        
+        return true;
+    }
+    
+    juce::int64 readLockedBytes()
+    {
+        auto status = juce::File("/proc/self/status").loadFileAsString();
+        auto line = status.fromFirstOccurrenceOf("VmLck:", false, false).upToFirstOccurrenceOf("\n", false, false);
+        
+        return line.trim().getLargeIntValue() * 1024;
+    }
+   #endif
+}
+
+//==============================================================================
+juce::String RealtimeConfig::Report::toString() const
+{
+    juce::String text;
+    
+    if (platformError.isNotEmpty())
+        return platformError;
+    
+    for (const auto& thread : threads)
+    {
+        text << thread.name << " (thread " << thread.threadId << "): " << getPolicyName(thread.policy);
+        
+        if (thread.policy == Policy::Fifo || thread.policy == Policy::RoundRobin)
+            text << " " << thread.priority;
+        
+        juce::StringArray cpus;
+        
+        for (auto cpu : thread.cpus)
+            cpus.add(juce::String(cpu));
+        
+        text << ", CPUs " << cpus.joinIntoString(",");
+        
+        if (thread.viaRtkit)
+            text << ", via rtkit";
+        
+        if (thread.error.isNotEmpty())
+            text << " - " << thread.error;
+        
+        text << "\n";
+    }
+    
+    if (memoryLocked)
+        text << "Memory locked: " << juce::String(lockedBytes / (1024 * 1024)) << " MB\n";
+    else
+        text << "Memory not locked" << (memoryError.isNotEmpty() ? " - " + memoryError : juce::String()) << "\n";
+    
+    return text;
+}
+
+//==============================================================================
+RealtimeConfig::RealtimeConfig()
+{
+    // Nothing is changed until settings are given
+    settings.audio = {};
+    settings.useRtkit = false;
+    settings.lockMemory = false;
+    settings.stackPrefaultBytes = 0;
+}
+
+RealtimeConfig::~RealtimeConfig()
+{
+    stopTimer();
+   
+   #if JUCE_LINUX
+    if (memoryLocked)
+        munlockall();
+   #endif
+}
+
+void RealtimeConfig::setSettings(const Settings& newSettings)
+{
+    const juce::ScopedLock sl(stateLock);
+    settings = newSettings;
+    
+    ActiveSettings active;
+    active.audio = toActive(settings.audio);
+    active.worker = toActive(settings.worker);
+    active.useRtkit = settings.useRtkit;
+    active.stackPrefaultBytes = settings.stackPrefaultBytes;
+    
+    {
+        const juce::SpinLock::ScopedLockType lock(settingsLock);
+        activeSettings = active;
+        settingsGeneration.fetch_add(1, std::memory_order_release);
+    }
+   
+   #if JUCE_LINUX
+    if (settings.lockMemory)
+    {
+        prepareMemory();
+    }
+    else if (memoryLocked)
+    {
+        munlockall();
+        memoryLocked = false;
+    }
+   #endif
+    
+    auto wantsRealtime = [] (const ThreadSettings& thread)
+    {
+        return thread.policy == Policy::Fifo || thread.policy == Policy::RoundRobin;
+    };
+    
+    // rtkit requests from threads the scheduler refused are made from here
+    if (settings.useRtkit && (wantsRealtime(settings.audio) || wantsRealtime(settings.worker)))
+        startTimer(500);
+    else
+        stopTimer();
+    
+    DBG("Real-time settings: audio " + getPolicyName(settings.audio.policy)
+        + ", workers " + getPolicyName(settings.worker.policy)
+        + (settings.lockMemory ? ", memory locked" : ""));
+}
+
+RealtimeConfig::Settings RealtimeConfig::getSettings() const
+{
+    const juce::ScopedLock sl(stateLock);
+    return settings;
+}
+
+void RealtimeConfig::prepareMemory()
+{
+   #if JUCE_LINUX
+    const juce::ScopedLock sl(stateLock);
+    
+    if (!settings.lockMemory || memoryLocked)
+        return;
+    
+    // MCL_FUTURE also locks and maps everything allocated from now on, so
+    // buffers created in later prepare() calls never fault on the audio thread
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        auto error = errno;
+        rlimit limit {};
+        getrlimit(RLIMIT_MEMLOCK, &limit);
+        
+        memoryError = "mlockall failed: " + juce::String(strerror(error)) + " (memlock limit "
+                    + (limit.rlim_cur == RLIM_INFINITY ? juce::String("unlimited")
+                                                       : juce::String((juce::int64) limit.rlim_cur / 1024) + " kB")
+                    + ")";
+        DBG(memoryError);
+        return;
+    }
+   
+   #if defined(__GLIBC__)
+    // Keep freed memory in the heap, rather than handing it back to the
+    // system to be faulted in again
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+   #endif
+    
+    memoryLocked = true;
+    memoryError = {};
+    DBG("Memory locked");
+   #endif
+}
+
+//==============================================================================
+void RealtimeConfig::configureCurrentThread(Role role, const char* name) noexcept
+{
+   #if JUCE_LINUX
+    auto& slot = threadSlot;
+    
+    if (slot.generation == settingsGeneration.load(std::memory_order_acquire))
+        return;
+    
+    // A thread that finds the settings being changed tries again next time
+    const juce::SpinLock::ScopedTryLockType lock(settingsLock);
+    
+    if (!lock.isLocked())
+        return;
+    
+    slot.generation = settingsGeneration.load(std::memory_order_relaxed);
+    
+    if (slot.entry == nullptr)
+        slot.entry = claimEntry();
+    
+    auto* entry = slot.entry;
+    const auto& threadSettings = role == Role::Audio ? activeSettings.audio : activeSettings.worker;
+    
+    if (entry != nullptr)
+    {
+        entry->role.store((int) role, std::memory_order_relaxed);
+        entry->name.store(name, std::memory_order_relaxed);
+        entry->schedulerError.store(0, std::memory_order_relaxed);
+        entry->affinityError.store(0, std::memory_order_relaxed);
+        entry->demoted.store(false, std::memory_order_relaxed);
+        entry->state.store(RequestState::applied, std::memory_order_release);
+    }
+    
+    if (threadSettings.policy != Policy::Unchanged)
+    {
+        auto policy = toLinuxPolicy(threadSettings.policy);
+        sched_param param {};
+        
+        if (policy != SCHED_OTHER)
+            param.sched_priority = juce::jlimit(sched_get_priority_min(policy), sched_get_priority_max(policy),
+                                                threadSettings.priority);
+        
+        auto result = pthread_setschedparam(pthread_self(), policy, &param);
+        
+        if (result != 0 && entry != nullptr)
+        {
+            entry->schedulerError.store(result, std::memory_order_relaxed);
+            entry->rtkitPriority.store(param.sched_priority, std::memory_order_relaxed);
+            
+            auto canUseRtkit = policy != SCHED_OTHER && activeSettings.useRtkit;
+            entry->state.store(canUseRtkit ? RequestState::needsRtkit : RequestState::failed, std::memory_order_release);
+        }
+    }
+    
+    if (threadSettings.cpuMask != 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        
+        for (int cpu = 0; cpu < 64; ++cpu)
+            if ((threadSettings.cpuMask >> cpu) & 1)
+                CPU_SET(cpu, &cpus);
+        
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0 && entry != nullptr)
+            entry->affinityError.store(errno, std::memory_order_relaxed);
+    }
+    
+    if (role == Role::Audio)
+        prefaultStack(activeSettings.stackPrefaultBytes);
+   #else
+    juce::ignoreUnused(role, name);
+   #endif
+}
+
+void RealtimeConfig::timerCallback()
+{
+   #if JUCE_LINUX
+    for (auto& entry : entries)
+    {
+        auto threadId = entry.threadId.load(std::memory_order_acquire);
+        
+        if (threadId == 0 || entry.state.load(std::memory_order_acquire) != RequestState::needsRtkit)
+            continue;
+        
+        juce::String error;
+        
+        if (makeRealtimeWithRtkit(threadId, entry.rtkitPriority.load(std::memory_order_relaxed), error))
+        {
+            entry.state.store(RequestState::viaRtkit, std::memory_order_release);
+            DBG("rtkit made thread " + juce::String(threadId) + " real-time");
+        }
+        else
+        {
+            entry.rtkitError = error;
+            entry.state.store(RequestState::failed, std::memory_order_release);
+            DBG(error);
+        }
+    }
+   #endif
+}
+
+//==============================================================================
+RealtimeConfig::Report RealtimeConfig::getReport() const
+{
+    Report report;
+   
+   #if JUCE_LINUX
+    for (auto& entry : entries)
+    {
+        auto threadId = entry.threadId.load(std::memory_order_acquire);
+        
+        if (threadId == 0)
+            continue;
+        
+        // A thread that exited without its entry being freed is skipped
+        auto policy = sched_getscheduler(threadId);
+        
+        if (policy < 0)
+            continue;
+        
+        ThreadReport thread;
+        thread.threadId = threadId;
+        thread.role = (Role) entry.role.load(std::memory_order_relaxed);
+        thread.policy = fromLinuxPolicy(policy);
+        
+        if (auto* name = entry.name.load(std::memory_order_relaxed))
+            thread.name = name;
+        
+        sched_param param {};
+        
+        if (sched_getparam(threadId, &param) == 0)
+            thread.priority = param.sched_priority;
+        
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        
+        if (sched_getaffinity(threadId, sizeof(cpus), &cpus) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &cpus))
+                    thread.cpus.add(cpu);
+        
+        auto state = entry.state.load(std::memory_order_acquire);
+        thread.viaRtkit = state == RequestState::viaRtkit;
+        
+        juce::StringArray errors;
+        
+        if (auto error = entry.schedulerError.load(std::memory_order_relaxed); error != 0 && !thread.viaRtkit)
+            errors.add("scheduler: " + juce::String(strerror(error)));
+        
+        if (state == RequestState::failed && entry.rtkitError.isNotEmpty())
+            errors.add(entry.rtkitError);
+        
+        if (auto error = entry.affinityError.load(std::memory_order_relaxed); error != 0)
+            errors.add("affinity: " + juce::String(strerror(error)));
+        
+        if (entry.demoted.load(std::memory_order_relaxed))
+            errors.add("demoted after " + juce::String(rtkitSoftLimitMs) + " ms without blocking");
+        
+        thread.error = errors.joinIntoString("; ");
+        report.threads.add(thread);
+    }
+    
+    {
+        const juce::ScopedLock sl(stateLock);
+        report.memoryLocked = memoryLocked;
+        report.memoryError = memoryError;
+    }
+    
+    report.lockedBytes = readLockedBytes();
+   #else
+    report.platformError = "Real-time configuration is only supported on Linux";
+   #endif
+    
+    return report;
+}
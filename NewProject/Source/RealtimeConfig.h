@@ -0,0 +1,128 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * RealtimeConfig sets the scheduling, CPU affinity and memory locking that
+ * keep the audio thread from being preempted or page-faulting on a busy
+ * Linux host.
+ *
+ * Threads configure themselves by calling configureCurrentThread() from their
+ * own loop: the audio callback every block, workers when they start. It
+ * compares a generation number and returns straight away once the current
+ * settings have been applied, so it is cheap enough for every callback, and it
+ * only ever tries the settings lock. Each thread's settings are applied with
+ * plain system calls on that thread:
+ *
+ * - SCHED_FIFO or SCHED_RR at the chosen priority. Where that is refused for
+ *   lack of privileges, the request is passed on to rtkit, from the message
+ *   thread, so the audio thread never waits on D-Bus. rtkit insists on a
+ *   limit to real-time CPU time, so a thread that runs rtkitSoftLimitMs
+ *   without blocking drops back to normal scheduling before the hard limit
+ *   would kill the process.
+ * - the chosen CPUs, e.g. cores kept free of other work with isolcpus
+ * - audio threads also touch their stack up front, so its pages are mapped
+ *   before they are needed
+ *
+ * Memory is locked for the whole process with mlockall() when the engine is
+ * prepared; future allocations are locked too, so buffers allocated in later
+ * prepare() calls are mapped in as they are created.
+ *
+ * getReport() reads back from the kernel what each thread actually got.
+ * Settings are process-wide, like the threads and memory they apply to. On
+ * other platforms nothing is changed; CoreAudio already runs its IO thread
+ * with real-time constraints.
+ */
+class RealtimeConfig : private juce::Timer
+{
+public:
+    //==============================================================================
+    enum class Role
+    {
+        Audio,
+        Worker
+    };
+    
+    enum class Policy
+    {
+        Unchanged,      // Leave as the driver or JUCE set it
+        Normal,         // SCHED_OTHER
+        Fifo,           // SCHED_FIFO
+        RoundRobin      // SCHED_RR
+    };
+    
+    struct ThreadSettings
+    {
+        Policy policy = Policy::Unchanged;
+        int priority = 0;                   // 1-99 for Fifo and RoundRobin
+        juce::Array<int> cpus;              // Empty for any CPU
+    };
+    
+    struct Settings
+    {
+        ThreadSettings audio { Policy::Fifo, 70, {} };
+        ThreadSettings worker;
+        bool useRtkit = true;               // Ask rtkit when the scheduler refuses
+        bool lockMemory = true;
+        int stackPrefaultBytes = 256 * 1024;
+    };
+    
+    struct ThreadReport
+    {
+        juce::String name;
+        Role role = Role::Audio;
+        int threadId = 0;
+        Policy policy = Policy::Normal;     // As the kernel reports it now
+        int priority = 0;
+        juce::Array<int> cpus;
+        bool viaRtkit = false;
+        juce::String error;                 // Why a request was refused
+    };
+    
+    struct Report
+    {
+        juce::Array<ThreadReport> threads;
+        bool memoryLocked = false;
+        juce::int64 lockedBytes = 0;
+        juce::String memoryError;
+        juce::String platformError;
+        
+        juce::String toString() const;
+    };
+    
+    static constexpr int maxThreads = 32;
+    static constexpr int maxRtkitPriority = 20;     // rtkit's default ceiling
+    static constexpr int rtkitSoftLimitMs = 150;    // SIGXCPU, and the thread is demoted
+    static constexpr int rtkitHardLimitMs = 200;    // SIGKILL; rtkit's default ceiling
+    
+    //==============================================================================
+    RealtimeConfig();
+    ~RealtimeConfig() override;
+    
+    // Message thread. Threads pick the settings up on their next call to
+    // configureCurrentThread().
+    void setSettings(const Settings& newSettings);
+    Settings getSettings() const;
+    
+    // Any thread, from the engine's prepare()
+    void prepareMemory();
+    
+    Report getReport() const;
+    
+    // Any thread, from its own loop or callback
+    static void configureCurrentThread(Role role, const char* name) noexcept;
+    
+private:
+    //==============================================================================
+    void timerCallback() override;
+    
+    Settings settings;
+    bool memoryLocked = false;
+    juce::String memoryError;
+    
+    // Guards the above, since devices prepare the engine from their own threads
+    juce::CriticalSection stateLock;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RealtimeConfig)
+};
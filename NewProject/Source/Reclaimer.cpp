@@ -0,0 +1,171 @@
+#include "Reclaimer.h"
+#include "Tracing.h"
+#include "RealtimeConfig.h"
+
+//==============================================================================
+namespace
+{
+    /** The same bounded ring as ParameterEventQueue: any number of threads
+        push with one compare-and-swap, and one consumer at a time, here
+        under consumerLock, pops. */
+    struct RetireRing
+    {
+        struct Cell
+        {
+            std::atomic<size_t> sequence { 0 };
+            void* object = nullptr;
+            void (*destroy)(void*) = nullptr;
+            size_t bytes = 0;
+        };
+        
+        RetireRing()
+        {
+            for (size_t i = 0; i < cells.size(); ++i)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        
+        std::array<Cell, (size_t) Reclaimer::capacity> cells;
+        std::atomic<size_t> writePosition { 0 };
+        size_t readPosition = 0;
+        juce::CriticalSection consumerLock;
+        
+        std::atomic<int> pendingObjects { 0 };
+        std::atomic<juce::int64> pendingBytes { 0 };
+        std::atomic<juce::int64> reclaimedObjects { 0 };
+        std::atomic<juce::int64> reclaimedBytes { 0 };
+        std::atomic<juce::int64> numRefused { 0 };
+    };
+    
+    RetireRing& getRing() noexcept
+    {
+        static RetireRing ring;
+        return ring;
+    }
+}
+
+//==============================================================================
+Reclaimer::Reclaimer()
+    : juce::Thread("Reclaimer")
+{
+    static_assert(juce::isPowerOfTwo(capacity), "capacity must be a power of two");
+    
+    // Built here rather than on the first retire(), which may be on the audio thread
+    getRing();
+    startThread();
+}
+
+Reclaimer::~Reclaimer()
+{
+    stopThread(2000);
+    collect();
+}
+
+//==============================================================================
+bool Reclaimer::push(void* object, DestroyFunction destroy, size_t bytes) noexcept
+{
+    auto& ring = getRing();
+    auto position = ring.writePosition.load(std::memory_order_relaxed);
+    
+    for (;;)
+    {
+        auto& cell = ring.cells[position & (ring.cells.size() - 1)];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto difference = (std::ptrdiff_t) sequence - (std::ptrdiff_t) position;
+        
+        if (difference == 0)
+        {
+            if (ring.writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.object = object;
+                cell.destroy = destroy;
+                cell.bytes = bytes;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                
+                ring.pendingObjects.fetch_add(1, std::memory_order_relaxed);
+                ring.pendingBytes.fetch_add((juce::int64) bytes, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            ring.numRefused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = ring.writePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Reclaimer::deleteOnMessageThread(std::function<void()> deleteObject)
+{
+    if (juce::MessageManager::existsAndIsCurrentThread())
+    {
+        deleteObject();
+        return;
+    }
+    
+    // With no message loop left to run it, there's nowhere better
+    if (!juce::MessageManager::callAsync(deleteObject))
+        deleteObject();
+}
+
+void Reclaimer::collect()
+{
+    auto& ring = getRing();
+    const juce::ScopedLock lock(ring.consumerLock);
+    
+    for (;;)
+    {
+        auto& cell = ring.cells[ring.readPosition & (ring.cells.size() - 1)];
+        
+        if (cell.sequence.load(std::memory_order_acquire) != ring.readPosition + 1)
+            return;
+        
+        auto* object = cell.object;
+        auto* destroy = cell.destroy;
+        auto bytes = cell.bytes;
+        
+        // Free the cell before the delete, which may take a while
+        cell.sequence.store(ring.readPosition + ring.cells.size(), std::memory_order_release);
+        ++ring.readPosition;
+        
+        {
+            TRACE_SCOPE("Reclaim");
+            destroy(object);
+        }
+        
+        ring.pendingObjects.fetch_sub(1, std::memory_order_relaxed);
+        ring.pendingBytes.fetch_sub((juce::int64) bytes, std::memory_order_relaxed);
+        ring.reclaimedObjects.fetch_add(1, std::memory_order_relaxed);
+        ring.reclaimedBytes.fetch_add((juce::int64) bytes, std::memory_order_relaxed);
+    }
+}
+
+Reclaimer::Stats Reclaimer::getStats()
+{
+    auto& ring = getRing();
+    
+    Stats stats;
+    stats.pendingObjects = ring.pendingObjects.load(std::memory_order_relaxed);
+    stats.pendingBytes = ring.pendingBytes.load(std::memory_order_relaxed);
+    stats.reclaimedObjects = ring.reclaimedObjects.load(std::memory_order_relaxed);
+    stats.reclaimedBytes = ring.reclaimedBytes.load(std::memory_order_relaxed);
+    stats.numRefused = ring.numRefused.load(std::memory_order_relaxed);
+    return stats;
+}
+
+//==============================================================================
+void Reclaimer::run()
+{
+    RealtimeConfig::configureCurrentThread(RealtimeConfig::Role::Worker, "Reclaimer");
+    Tracing::setThreadName("Reclaimer");
+    
+    // Polled rather than woken, since waking a thread isn't real-time safe
+    while (!threadShouldExit())
+    {
+        collect();
+        wait(intervalMs);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * Reclaimer deletes objects the audio thread has finished with, on a thread
+ * of its own, so the audio callback never runs their destructors or frees
+ * their memory.
+ *
+ * When the audio thread swaps in a new plugin graph, plan or buffer set, it
+ * hands the old one to retire() instead of deleting it. retire() only writes
+ * the pointer, a destroy function and a size into a fixed ring, with one
+ * compare-and-swap and no allocation, so any real-time thread can call it.
+ * The reclaimer thread drains the ring every few milliseconds and deletes
+ * what it finds there.
+ *
+ * The ring is process-wide, like the audio threads that feed it, so stages
+ * deep in a chain can retire objects without being handed the reclaimer. The
+ * AudioServer owns the thread; objects retired while no Reclaimer exists wait
+ * for the next one, or for collect().
+ *
+ * Some objects may only be destroyed on the message thread, hosted plugins
+ * among them. retireToMessageThread() queues them the same way, and the
+ * reclaimer thread passes them on to the message thread to delete.
+ *
+ * If the ring is full, retire() refuses the object and the caller keeps it,
+ * and tries again on a later block. Objects the audio thread still holds
+ * shared ownership of must be retired as a whole, since dropping the last
+ * reference would delete them in place.
+ */
+class Reclaimer : private juce::Thread
+{
+public:
+    //==============================================================================
+    static constexpr int capacity = 1024;       // Must be a power of two
+    static constexpr int intervalMs = 20;
+    
+    struct Stats
+    {
+        int pendingObjects = 0;
+        juce::int64 pendingBytes = 0;
+        juce::int64 reclaimedObjects = 0;
+        juce::int64 reclaimedBytes = 0;
+        juce::int64 numRefused = 0;             // retire() calls that found the ring full
+    };
+    
+    //==============================================================================
+    Reclaimer();
+    
+    // Deletes everything still waiting
+    ~Reclaimer() override;
+    
+    // Any thread, real-time ones included. bytes is for the counters only:
+    // the object's size plus whatever it owns, as far as the caller knows.
+    // Retiring nullptr does nothing and succeeds.
+    template <typename Type>
+    static bool retire(Type* object, size_t bytes = sizeof(Type)) noexcept
+    {
+        if (object == nullptr)
+            return true;
+        
+        return push(object, [] (void* retired) { delete static_cast<Type*>(retired); }, bytes);
+    }
+    
+    // As retire(), for objects that must be deleted on the message thread.
+    // They count as reclaimed once handed over.
+    template <typename Type>
+    static bool retireToMessageThread(Type* object, size_t bytes = sizeof(Type)) noexcept
+    {
+        if (object == nullptr)
+            return true;
+        
+        return push(object, [] (void* retired)
+        {
+            deleteOnMessageThread([retired] { delete static_cast<Type*>(retired); });
+        }, bytes);
+    }
+    
+    // Any thread that may delete: destroys everything retired so far
+    static void collect();
+    
+    static Stats getStats();
+    
+private:
+    //==============================================================================
+    using DestroyFunction = void (*)(void*);
+    
+    static bool push(void* object, DestroyFunction destroy, size_t bytes) noexcept;
+    static void deleteOnMessageThread(std::function<void()> deleteObject);
+    
+    void run() override;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Reclaimer)
+};
@@ -0,0 +1,296 @@
+#include "ResponseEvaluator.h"
+
+//==============================================================================
+void ResponseEvaluator::ResponseBuffer::allocate(int size)
+{
+    storage.malloc((size_t) (size * 4) + Vec::SIMDNumElements);
+    
+    numeratorReal = Vec::getNextSIMDAlignedPtr(storage.getData());
+    numeratorImag = numeratorReal + size;
+    denominatorReal = numeratorImag + size;
+    denominatorImag = denominatorReal + size;
+    
+    setToUnity(size);
+}
+
+void ResponseEvaluator::ResponseBuffer::setToUnity(int size)
+{
+    using FVO = juce::FloatVectorOperations;
+    
+    FVO::fill(numeratorReal, 1.0, size);
+    FVO::clear(numeratorImag, size);
+    FVO::fill(denominatorReal, 1.0, size);
+    FVO::clear(denominatorImag, size);
+    isUnity = true;
+}
+
+//==============================================================================
+void ResponseEvaluator::prepare(int newNumPoints, double minFrequency, double maxFrequency, double newSampleRate)
+{
+    constexpr auto lanes = (int) Vec::SIMDNumElements;
+    
+    numPoints = juce::jmax(2, newNumPoints);
+    paddedSize = (numPoints + lanes - 1) / lanes * lanes;
+    sampleRate = newSampleRate;
+    
+    gridStorage.malloc((size_t) (paddedSize * 4) + Vec::SIMDNumElements);
+    cosW = Vec::getNextSIMDAlignedPtr(gridStorage.getData());
+    sinW = cosW + paddedSize;
+    cos2W = sinW + paddedSize;
+    sin2W = cos2W + paddedSize;
+    
+    frequencies.malloc((size_t) numPoints);
+    magnitudeDb.calloc((size_t) numPoints);
+    phase.calloc((size_t) numPoints);
+    
+    minFrequency = juce::jmax(1.0, minFrequency);
+    maxFrequency = juce::jlimit(minFrequency, sampleRate * 0.5, maxFrequency);
+    auto ratio = maxFrequency / minFrequency;
+    
+    for (int i = 0; i < paddedSize; ++i)
+    {
+        // Padding points sit at DC, where every response is finite
+        auto w = 0.0;
+        
+        if (i < numPoints)
+        {
+            auto frequency = minFrequency * std::pow(ratio, (double) i / (numPoints - 1));
+            frequencies[i] = (float) frequency;
+            w = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+        }
+        
+        cosW[i] = std::cos(w);
+        sinW[i] = std::sin(w);
+        cos2W[i] = std::cos(2.0 * w);
+        sin2W[i] = std::sin(2.0 * w);
+    }
+    
+    complement.allocate(paddedSize);
+    total.allocate(paddedSize);
+    
+    for (int b = 0; b < bandResponses.size(); ++b)
+    {
+        bandResponses[b]->allocate(paddedSize);
+        evaluateBand(b);
+    }
+    
+    rebuildComplement(-1);
+    copyComplementToTotal();
+    updateOutput();
+}
+
+void ResponseEvaluator::setPhaseEnabled(bool shouldComputePhase)
+{
+    if (phaseEnabled != shouldComputePhase)
+    {
+        phaseEnabled = shouldComputePhase;
+        updateOutput();
+    }
+}
+
+//==============================================================================
+void ResponseEvaluator::setBands(const juce::Array<EQBand>& newBands)
+{
+    if (paddedSize == 0)
+    {
+        bands = newBands;
+        bandResponses.clear();
+        
+        for (int b = 0; b < bands.size(); ++b)
+            bandResponses.add(new ResponseBuffer());
+        
+        return;
+    }
+    
+    if (newBands.size() == bands.size())
+    {
+        int numChanged = 0;
+        int lastChanged = -1;
+        
+        for (int b = 0; b < bands.size(); ++b)
+        {
+            if (newBands.getReference(b) != bands.getReference(b))
+            {
+                ++numChanged;
+                lastChanged = b;
+            }
+        }
+        
+        if (numChanged == 0)
+            return;
+        
+        if (numChanged == 1)
+        {
+            setBand(lastChanged, newBands.getReference(lastChanged));
+            return;
+        }
+    }
+    
+    while (bandResponses.size() > newBands.size())
+        bandResponses.removeLast();
+    
+    for (int b = 0; b < newBands.size(); ++b)
+    {
+        auto isNew = b >= bands.size();
+        
+        if (isNew)
+        {
+            bandResponses.add(new ResponseBuffer())->allocate(paddedSize);
+            bands.add(newBands.getReference(b));
+        }
+        
+        if (isNew || newBands.getReference(b) != bands.getReference(b))
+        {
+            bands.set(b, newBands.getReference(b));
+            evaluateBand(b);
+        }
+    }
+    
+    bands.resize(newBands.size());
+    
+    rebuildComplement(-1);
+    copyComplementToTotal();
+    updateOutput();
+}
+
+void ResponseEvaluator::setBand(int index, const EQBand& band)
+{
+    if (!juce::isPositiveAndBelow(index, bands.size()) || bands.getReference(index) == band)
+        return;
+    
+    bands.set(index, band);
+    
+    if (paddedSize == 0)
+        return;
+    
+    evaluateBand(index);
+    
+    // The first change to a band pays O(points * bands) for the product of
+    // the others; every following change to it is O(points)
+    if (complementBand != index)
+        rebuildComplement(index);
+    
+    multiply(total, complement, *bandResponses[index]);
+    updateOutput();
+}
+
+//==============================================================================
+void ResponseEvaluator::evaluateBand(int index)
+{
+    auto& response = *bandResponses[index];
+    const auto& band = bands.getReference(index);
+    
+    if (!band.enabled)
+    {
+        response.setToUnity(paddedSize);
+        return;
+    }
+    
+    auto c = BiquadCoefficients::design(band, sampleRate);
+    
+    auto b0 = Vec::expand(c.b0), b1 = Vec::expand(c.b1), b2 = Vec::expand(c.b2);
+    auto a1 = Vec::expand(c.a1), a2 = Vec::expand(c.a2);
+    auto one = Vec::expand(1.0), zero = Vec::expand(0.0);
+    
+    // H(e^jw) = (b0 + b1 e^-jw + b2 e^-2jw) / (1 + a1 e^-jw + a2 e^-2jw)
+    for (int i = 0; i < paddedSize; i += (int) Vec::SIMDNumElements)
+    {
+        auto c1 = Vec::fromRawArray(cosW + i);
+        auto s1 = Vec::fromRawArray(sinW + i);
+        auto c2 = Vec::fromRawArray(cos2W + i);
+        auto s2 = Vec::fromRawArray(sin2W + i);
+        
+        (b0 + b1 * c1 + b2 * c2).copyToRawArray(response.numeratorReal + i);
+        (zero - (b1 * s1 + b2 * s2)).copyToRawArray(response.numeratorImag + i);
+        (one + a1 * c1 + a2 * c2).copyToRawArray(response.denominatorReal + i);
+        (zero - (a1 * s1 + a2 * s2)).copyToRawArray(response.denominatorImag + i);
+    }
+    
+    response.isUnity = false;
+}
+
+void ResponseEvaluator::rebuildComplement(int excludedBand)
+{
+    complement.setToUnity(paddedSize);
+    
+    for (int b = 0; b < bandResponses.size(); ++b)
+        if (b != excludedBand && !bandResponses[b]->isUnity)
+            multiply(complement, complement, *bandResponses[b]);
+    
+    complementBand = excludedBand;
+}
+
+void ResponseEvaluator::multiply(ResponseBuffer& dest, const ResponseBuffer& a, const ResponseBuffer& b) const
+{
+    auto multiplyComplex = [this] (double* destReal, double* destImag,
+                                   const double* aReal, const double* aImag,
+                                   const double* bReal, const double* bImag)
+    {
+        for (int i = 0; i < paddedSize; i += (int) Vec::SIMDNumElements)
+        {
+            auto ar = Vec::fromRawArray(aReal + i), ai = Vec::fromRawArray(aImag + i);
+            auto br = Vec::fromRawArray(bReal + i), bi = Vec::fromRawArray(bImag + i);
+            
+            (ar * br - ai * bi).copyToRawArray(destReal + i);
+            (ar * bi + ai * br).copyToRawArray(destImag + i);
+        }
+    };
+    
+    multiplyComplex(dest.numeratorReal, dest.numeratorImag,
+                    a.numeratorReal, a.numeratorImag, b.numeratorReal, b.numeratorImag);
+    multiplyComplex(dest.denominatorReal, dest.denominatorImag,
+                    a.denominatorReal, a.denominatorImag, b.denominatorReal, b.denominatorImag);
+    
+    dest.isUnity = a.isUnity && b.isUnity;
+}
+
+void ResponseEvaluator::copyComplementToTotal()
+{
+    // With no band excluded the complement is the full product. The four
+    // arrays of a buffer are contiguous, so this is a single copy.
+    juce::FloatVectorOperations::copy(total.numeratorReal, complement.numeratorReal, paddedSize * 4);
+    total.isUnity = complement.isUnity;
+}
+
+//==============================================================================
+void ResponseEvaluator::updateOutput()
+{
+    if (paddedSize == 0)
+        return;
+    
+    for (int i = 0; i < numPoints; ++i)
+    {
+        auto nr = total.numeratorReal[i], ni = total.numeratorImag[i];
+        auto dr = total.denominatorReal[i], di = total.denominatorImag[i];
+        
+        auto numeratorPower = nr * nr + ni * ni;
+        auto denominatorPower = dr * dr + di * di;
+        
+        magnitudeDb[i] = (float) (10.0 * std::log10(juce::jmax(numeratorPower / denominatorPower, 1.0e-30)));
+        
+        // arg(N / D) == arg(N * conj(D))
+        if (phaseEnabled)
+            phase[i] = (float) std::atan2(ni * dr - nr * di, nr * dr + ni * di);
+    }
+}
+
+void ResponseEvaluator::getBandMagnitudeDb(int index, float* dest) const
+{
+    if (!juce::isPositiveAndBelow(index, bandResponses.size()) || paddedSize == 0)
+    {
+        juce::FloatVectorOperations::clear(dest, numPoints);
+        return;
+    }
+    
+    const auto& response = *bandResponses[index];
+    
+    for (int i = 0; i < numPoints; ++i)
+    {
+        auto numeratorPower = response.numeratorReal[i] * response.numeratorReal[i]
+                            + response.numeratorImag[i] * response.numeratorImag[i];
+        auto denominatorPower = response.denominatorReal[i] * response.denominatorReal[i]
+                              + response.denominatorImag[i] * response.denominatorImag[i];
+        
+        dest[i] = (float) (10.0 * std::log10(juce::jmax(numeratorPower / denominatorPower, 1.0e-30)));
+    }
+}
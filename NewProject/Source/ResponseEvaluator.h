@@ -0,0 +1,94 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EQBand.h"
+
+//==============================================================================
+/**
+ * ResponseEvaluator computes the combined magnitude and phase response of the
+ * chain's EQ bands on a log-frequency grid, for drawing the EQ curve.
+ *
+ * Each band's complex response is cached, so changing one band only
+ * re-evaluates that band. While the same band keeps changing (a drag), the
+ * product of all the other bands is kept too, so combining is a single
+ * complex multiply per point.
+ *
+ * Not thread safe: use it from the message thread only.
+ */
+class ResponseEvaluator
+{
+public:
+    //==============================================================================
+    ResponseEvaluator() = default;
+    
+    void prepare(int numPoints, double minFrequency, double maxFrequency, double sampleRate);
+    
+    // Diffs against the cached bands and re-evaluates only those that changed
+    void setBands(const juce::Array<EQBand>& bands);
+    void setBand(int index, const EQBand& band);
+    
+    //==============================================================================
+    int getNumPoints() const                { return numPoints; }
+    int getNumBands() const                 { return bands.size(); }
+    
+    const float* getFrequencies() const     { return frequencies.getData(); }
+    const float* getMagnitudeDb() const     { return magnitudeDb.getData(); }
+    const float* getPhase() const           { return phase.getData(); }   // Radians
+    
+    // Phase costs an atan2 per point, so it can be skipped if not drawn
+    void setPhaseEnabled(bool shouldComputePhase);
+    
+    // Magnitude of a single band, e.g. for drawing the selected band's curve
+    void getBandMagnitudeDb(int index, float* dest) const;
+    
+private:
+    //==============================================================================
+    using Vec = juce::dsp::SIMDRegister<double>;
+    
+    /** A transfer function's numerator and denominator evaluated at every
+        point, as SIMD-aligned split real/imaginary arrays. Keeping the two
+        apart means combining bands never needs a division. */
+    struct ResponseBuffer
+    {
+        void allocate(int size);
+        void setToUnity(int size);
+        
+        juce::HeapBlock<double> storage;
+        double* numeratorReal = nullptr;
+        double* numeratorImag = nullptr;
+        double* denominatorReal = nullptr;
+        double* denominatorImag = nullptr;
+        bool isUnity = true;
+    };
+    
+    void evaluateBand(int index);
+    void rebuildComplement(int excludedBand);
+    void multiply(ResponseBuffer& dest, const ResponseBuffer& a, const ResponseBuffer& b) const;
+    void copyComplementToTotal();
+    void updateOutput();
+    
+    //==============================================================================
+    int numPoints = 0;
+    int paddedSize = 0;
+    double sampleRate = 48000.0;
+    bool phaseEnabled = true;
+    
+    // Per-point terms of e^-jw and e^-2jw
+    juce::HeapBlock<double> gridStorage;
+    double* cosW = nullptr;
+    double* sinW = nullptr;
+    double* cos2W = nullptr;
+    double* sin2W = nullptr;
+    
+    juce::Array<EQBand> bands;
+    juce::OwnedArray<ResponseBuffer> bandResponses;
+    
+    // Product of every band except complementBand, and the full product
+    ResponseBuffer complement;
+    int complementBand = -1;
+    ResponseBuffer total;
+    
+    juce::HeapBlock<float> frequencies, magnitudeDb, phase;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ResponseEvaluator)
+};
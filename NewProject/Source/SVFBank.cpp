@@ -0,0 +1,210 @@
+#include "SVFBank.h"
+
+//==============================================================================
+void SVFBank::prepare(int newNumChannels, int maxBlockSize, double newSampleRate, const DSPKernels& kernelsToUse)
+{
+    kernels = &kernelsToUse;
+    lanes = kernels->biquadLanes;
+    numGroups = (juce::jmax(1, newNumChannels) + lanes - 1) / lanes;
+    chunkSize = juce::jlimit(1, (int) SvfFrames::maxFrames, maxBlockSize);
+    sampleRate = newSampleRate;
+    glideSamples = juce::jmax(1, juce::roundToInt(glideSeconds * sampleRate));
+    
+    state.calloc((size_t) getStateSize());
+    previousState.calloc((size_t) getStateSize());
+    glideCoefficients.calloc((size_t) maxBands);
+    frames.calloc((size_t) (chunkSize * lanes));
+    
+    // Settings depend on the sample rate, so the bands have to be set again
+    numBands = 0;
+}
+
+void SVFBank::reset()
+{
+    if (state != nullptr)
+        juce::zeromem(state.getData(), sizeof(float) * (size_t) getStateSize());
+    
+    for (int b = 0; b < numBands; ++b)
+    {
+        auto& band = bands[(size_t) b];
+        band.current = band.target;
+        band.glideRemaining = 0;
+    }
+}
+
+bool SVFBank::isGliding() const
+{
+    for (int b = 0; b < numBands; ++b)
+        if (bands[(size_t) b].glideRemaining > 0)
+            return true;
+    
+    return false;
+}
+
+//==============================================================================
+SVFBank::Settings SVFBank::getSettings(const EQBand& band) const
+{
+    // The same limits as SvfCoefficients::design()
+    Settings settings;
+    settings.log2Frequency = (float) std::log2(juce::jlimit(1.0, sampleRate * 0.49, (double) band.frequency) / sampleRate);
+    settings.log2Q = (float) std::log2(juce::jmax(0.01, (double) band.q));
+    settings.gainDb = band.gainDb;
+    return settings;
+}
+
+void SVFBank::setBands(const EQBand* newBands, int numNewBands)
+{
+    if (state == nullptr)
+        return;
+    
+    auto previousBands = bands;
+    auto numPreviousBands = numBands;
+    state.swapWith(previousState);
+    numBands = 0;
+    
+    for (int b = 0; b < numNewBands && numBands < maxBands; ++b)
+    {
+        const auto& source = newBands[b];
+        
+        if (!source.enabled || source.filter != EQBand::Filter::Svf)
+            continue;
+        
+        // Find where this band ran before; new bands start from silence
+        int previous = -1;
+        
+        for (int p = 0; p < numPreviousBands && previous < 0; ++p)
+            if (previousBands[(size_t) p].sourceBand == b)
+                previous = p;
+        
+        auto index = numBands++;
+        auto& band = bands[(size_t) index];
+        auto target = getSettings(source);
+        
+        if (previous >= 0 && previousBands[(size_t) previous].type == source.type)
+        {
+            // Glide from wherever it is now, mid-glide or not
+            band = previousBands[(size_t) previous];
+            
+            if (target != band.target)
+            {
+                band.target = target;
+                band.step.log2Frequency = (target.log2Frequency - band.current.log2Frequency) / (float) glideSamples;
+                band.step.log2Q = (target.log2Q - band.current.log2Q) / (float) glideSamples;
+                band.step.gainDb = (target.gainDb - band.current.gainDb) / (float) glideSamples;
+                band.glideRemaining = glideSamples;
+            }
+        }
+        else
+        {
+            // A new band, or one that changed type, has nothing to glide from
+            band.type = source.type;
+            band.current = band.target = target;
+            band.glideRemaining = 0;
+        }
+        
+        band.sourceBand = b;
+        targetKernels[(size_t) index] = SvfKernel(SvfCoefficients::design(source, sampleRate));
+        
+        for (int group = 0; group < numGroups; ++group)
+        {
+            auto* s = state.getData() + getStateOffset(group, index);
+            
+            if (previous >= 0)
+                std::copy_n(previousState.getData() + getStateOffset(group, previous), 2 * lanes, s);
+            else
+                juce::zeromem(s, sizeof(float) * (size_t) (2 * lanes));
+        }
+    }
+}
+
+//==============================================================================
+void SVFBank::designGlide(int index, int numFrames)
+{
+    auto& band = bands[(size_t) index];
+    auto rampFrames = juce::jmin(numFrames, band.glideRemaining);
+    
+    for (int i = 0; i < rampFrames; ++i)
+    {
+        auto n = (float) (i + 1);
+        log2Frequencies[(size_t) i] = band.current.log2Frequency + n * band.step.log2Frequency;
+        log2Qs[(size_t) i] = band.current.log2Q + n * band.step.log2Q;
+        gains[(size_t) i] = band.current.gainDb + n * band.step.gainDb;
+    }
+    
+    for (int i = rampFrames; i < numFrames; ++i)
+    {
+        log2Frequencies[(size_t) i] = band.target.log2Frequency;
+        log2Qs[(size_t) i] = band.target.log2Q;
+        gains[(size_t) i] = band.target.gainDb;
+    }
+    
+    kernels->svfDesign(glideCoefficients[index], numFrames, band.type,
+                       log2Frequencies.data(), log2Qs.data(), gains.data());
+}
+
+void SVFBank::advanceGlide(Band& band, int numFrames)
+{
+    band.glideRemaining -= numFrames;
+    
+    if (band.glideRemaining <= 0)
+    {
+        band.current = band.target;
+        band.glideRemaining = 0;
+        return;
+    }
+    
+    auto n = (float) numFrames;
+    band.current.log2Frequency += n * band.step.log2Frequency;
+    band.current.log2Q += n * band.step.log2Q;
+    band.current.gainDb += n * band.step.gainDb;
+}
+
+void SVFBank::process(float* const* channelData, int numChannels, int numSamples)
+{
+    if (numBands == 0 || state == nullptr)
+        return;
+    
+    auto channels = juce::jmin(numChannels, numGroups * lanes);
+    
+    for (int start = 0; start < numSamples; start += chunkSize)
+    {
+        auto numFrames = juce::jmin(chunkSize, numSamples - start);
+        
+        // Coefficients depend only on the band, so every group shares them
+        for (int b = 0; b < numBands; ++b)
+            if (bands[(size_t) b].glideRemaining > 0)
+                designGlide(b, numFrames);
+        
+        for (int group = 0; group * lanes < channels; ++group)
+        {
+            auto firstChannel = group * lanes;
+            auto groupChannels = juce::jmin(lanes, channels - firstChannel);
+            
+            kernels->interleave(frames, channelData + firstChannel, groupChannels, start, numFrames);
+            
+            for (int b = 0; b < numBands;)
+            {
+                if (bands[(size_t) b].glideRemaining > 0)
+                {
+                    kernels->svfModulated(frames, numFrames, glideCoefficients[b], state + getStateOffset(group, b));
+                    ++b;
+                    continue;
+                }
+                
+                auto first = b;
+                
+                while (b < numBands && bands[(size_t) b].glideRemaining == 0)
+                    ++b;
+                
+                kernels->svfCascade(frames, numFrames, &targetKernels[(size_t) first], b - first,
+                                    state + getStateOffset(group, first));
+            }
+            
+            kernels->deinterleave(channelData + firstChannel, groupChannels, start, frames, numFrames);
+        }
+        
+        for (int b = 0; b < numBands; ++b)
+            if (bands[(size_t) b].glideRemaining > 0)
+                advanceGlide(bands[(size_t) b], numFrames);
+    }
+}
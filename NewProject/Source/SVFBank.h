@@ -0,0 +1,111 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DSPKernels.h"
+
+//==============================================================================
+/**
+ * SVFBank runs the EQ bands set to EQBand::Filter::Svf as trapezoidal
+ * state-variable filters, which can be moved while they play.
+ *
+ * A biquad band that changes steps to its new coefficients at the start of a
+ * block; a direct-form filter can't take new coefficients every sample without
+ * risking instability, and designing them per sample costs a tan, a pow and a
+ * handful of divisions. An SVF band instead glides: frequency (in octaves),
+ * gain (in dB) and Q (in octaves) move in a straight line to their new values
+ * over glideSeconds, and the kernels design fresh coefficients for every
+ * sample from polynomial tan and exp2, vectorised across the block. The SVF
+ * stays stable under any such modulation. Once a glide ends the band runs on
+ * exact coefficients with the same static response as the biquad.
+ *
+ * A static SVF costs more than a biquad section, but far less than gliding a
+ * biquad by redesigning it every sample, which isn't stable anyway. So bands
+ * that stay put are best left as biquads and bands that move set to Svf; the
+ * README has the numbers.
+ *
+ * Like EQFilterBank, the filter interleaves channels into groups as wide as
+ * the kernels' lanes, state follows each band from one setBands() to the
+ * next, and nothing here allocates or locks after prepare().
+ */
+class SVFBank
+{
+public:
+    //==============================================================================
+    static constexpr int maxBands = 8;
+    static constexpr double glideSeconds = 0.02;
+    
+    SVFBank() = default;
+    
+    void prepare(int numChannels, int maxBlockSize, double sampleRate,
+                 const DSPKernels& kernelsToUse = DSPKernels::get());
+    void reset();
+    
+    // Audio thread. Takes the enabled SVF bands from a full band list, up to
+    // maxBands of them; bands that changed glide to their new settings.
+    void setBands(const EQBand* bands, int numBands);
+    
+    void process(float* const* channels, int numChannels, int numSamples);
+    
+    int getNumBands() const     { return numBands; }
+    bool isGliding() const;
+    
+private:
+    //==============================================================================
+    // A band's settings in the terms the design kernel takes
+    struct Settings
+    {
+        float log2Frequency = 0.0f;     // log2 of frequency / sample rate
+        float log2Q = 0.0f;
+        float gainDb = 0.0f;
+        
+        bool operator== (const Settings& other) const
+        {
+            return log2Frequency == other.log2Frequency && log2Q == other.log2Q && gainDb == other.gainDb;
+        }
+        
+        bool operator!= (const Settings& other) const { return !(*this == other); }
+    };
+    
+    struct Band
+    {
+        int sourceBand = -1;
+        EQBand::Type type = EQBand::Type::Bell;
+        Settings current, target, step;
+        int glideRemaining = 0;
+    };
+    
+    Settings getSettings(const EQBand& band) const;
+    void designGlide(int band, int numFrames);
+    void advanceGlide(Band& band, int numFrames);
+    
+    int getStateOffset(int group, int band) const   { return (group * maxBands + band) * 2 * lanes; }
+    int getStateSize() const                        { return numGroups * maxBands * 2 * lanes; }
+    
+    //==============================================================================
+    const DSPKernels* kernels = &DSPKernels::get(DSPKernels::Variant::Generic);
+    int lanes = 1;
+    int numGroups = 0;
+    int chunkSize = 0;
+    double sampleRate = 48000.0;
+    int glideSamples = 1;
+    
+    std::array<Band, maxBands> bands;
+    int numBands = 0;
+    
+    // Exact coefficients for each band's target, so runs of bands that aren't
+    // gliding are one cascade call
+    std::array<SvfKernel, maxBands> targetKernels;
+    
+    // State, plus a second set to remap into when the bands change
+    juce::HeapBlock<float> state, previousState;
+    
+    // Per-frame coefficients for each gliding band, and the settings they're
+    // designed from, for one chunk
+    juce::HeapBlock<SvfFrames> glideCoefficients;
+    std::array<float, SvfFrames::maxFrames> log2Frequencies, log2Qs, gains;
+    
+    // One chunk of lane-interleaved frames
+    juce::HeapBlock<float> frames;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SVFBank)
+};
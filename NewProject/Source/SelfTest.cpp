@@ -0,0 +1,1936 @@
+#include "SelfTest.h"
+#include "ResponseEvaluator.h"
+#include "ChainAnalyser.h"
+
+#if JUCE_LINUX
+ #include <unistd.h>
+#endif
+
+namespace
+{
+    // Resident memory, or 0 where it can't be read
+    juce::int64 getResidentBytes()
+    {
+       #if JUCE_LINUX
+        auto fields = juce::StringArray::fromTokens(juce::File("/proc/self/statm").loadFileAsString(), true);
+        return fields[1].getLargeIntValue() * (juce::int64) sysconf(_SC_PAGESIZE);
+       #else
+        return 0;
+       #endif
+    }
+    
+    juce::String toMegabytes(juce::int64 bytes)
+    {
+        return juce::String((double) bytes / (1024.0 * 1024.0), 1) + " MB";
+    }
+}
+
+//==============================================================================
+bool SelfTest::isRequested(const juce::String& commandLine)
+{
+    return commandLine.contains("--self-test");
+}
+
+SelfTest::SelfTest(const juce::String& commandLine, Finished finished)
+    : juce::Thread("Self Test"),
+      onFinished(std::move(finished))
+{
+    for (const auto& argument : juce::StringArray::fromTokens(commandLine, true))
+    {
+        if (argument.startsWith("--self-test="))
+            requestedChecks.addTokens(argument.fromFirstOccurrenceOf("=", false, false), ",", "");
+        else if (argument.startsWith("--soak-seconds="))
+            soakSeconds = juce::jmax(1.0, argument.fromFirstOccurrenceOf("=", false, false).getDoubleValue());
+    }
+    
+    requestedChecks.removeEmptyStrings();
+    startThread();
+}
+
+SelfTest::~SelfTest()
+{
+    stopThread(10000);
+}
+
+//==============================================================================
+void SelfTest::run()
+{
+    const Check checks[] = {
+        { "soak", &SelfTest::runSoak },
+        { "measurement", &SelfTest::runMeasurement },
+        { "governor", &SelfTest::runGovernor },
+        { "realtime", &SelfTest::runRealtime },
+        { "background", &SelfTest::runBackground },
+        { "metrics", &SelfTest::runMetrics },
+        { "autoeq", &SelfTest::runAutoEQ },
+        { "response", &SelfTest::runResponse },
+        { "accuracy", &SelfTest::runAccuracy },
+        { "precision", &SelfTest::runPrecision },
+        { "crossover", &SelfTest::runCrossover },
+        { "compressor", &SelfTest::runCompressor },
+        { "svf", &SelfTest::runSvf },
+        { "kernels", &SelfTest::runKernels }
+    };
+    
+    int numFailedChecks = 0;
+    
+    for (const auto& name : requestedChecks)
+    {
+        if (std::none_of(std::begin(checks), std::end(checks), [&] (const Check& check) { return check.name == name; }))
+        {
+            log("No such check: " + name);
+            ++numFailedChecks;
+        }
+    }
+    
+    for (const auto& check : checks)
+    {
+        if (threadShouldExit())
+            return;
+        
+        if (!requestedChecks.isEmpty() && !requestedChecks.contains(check.name))
+            continue;
+        
+        log("Running " + check.name);
+        numFailures = 0;
+        auto startMs = juce::Time::getMillisecondCounterHiRes();
+        
+        (this->*check.function)();
+        
+        // Every check starts from a stopped server
+        onMessageThread([this] { server.stopAudioProcessing(); });
+        
+        auto seconds = (juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001;
+        log(check.name + (numFailures == 0 ? " passed" : " FAILED") + " in " + juce::String(seconds, 1) + " s");
+        
+        if (numFailures > 0)
+            ++numFailedChecks;
+    }
+    
+    juce::MessageManager::callAsync([finished = onFinished, numFailedChecks]
+    {
+        if (finished != nullptr)
+            finished(numFailedChecks);
+    });
+}
+
+//==============================================================================
+void SelfTest::runSoak()
+{
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = 48000.0;
+    device.defaultBufferSize = 128;
+    device.driftPpm = 100.0;
+    device.accelerated = true;
+    
+    bool started = false;
+    juce::String error;
+    
+    onMessageThread([&]
+    {
+        // Asked for, but a device that never blocks has to be left alone
+        RealtimeConfig::Settings realtime;
+        realtime.lockMemory = false;
+        server.setRealtimeSettings(realtime);
+        
+        started = server.initializeSynthetic(device, error) && server.startAudioProcessing();
+    });
+    
+    expect(started, "the synthetic device to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    
+    if (!started)
+        return;
+    
+    // Every change recompiles the plan, and the SVF band glides
+    juce::Array<EQBand> bands;
+    
+    for (auto frequency : { 60.0f, 250.0f, 1000.0f, 4000.0f, 12000.0f })
+    {
+        EQBand band;
+        band.frequency = frequency;
+        band.q = 1.0f;
+        bands.add(band);
+    }
+    
+    bands.getReference(2).filter = EQBand::Filter::Svf;
+    
+    auto startMs = juce::Time::getMillisecondCounterHiRes();
+    auto elapsedSeconds = [startMs] { return (juce::Time::getMillisecondCounterHiRes() - startMs) * 0.001; };
+    bool formatChanged = false;
+    juce::int64 settledBytes = 0;
+    
+    for (int step = 0; elapsedSeconds() < soakSeconds; ++step)
+    {
+        for (int b = 0; b < bands.size(); ++b)
+            bands.getReference(b).gainDb = (float) ((step + 3 * b) % 13 - 6);
+        
+        onMessageThread([&] { server.getProcessorChain().setBands(bands); });
+        
+        if (!formatChanged && elapsedSeconds() > soakSeconds * 0.25)
+        {
+            formatChanged = true;
+            onMessageThread([this]
+            {
+                if (auto* synthetic = server.getSyntheticDevice())
+                    synthetic->simulateFormatChange(96000.0, 256);
+            });
+            
+            expect(waitFor([this] { return server.getSampleRate() == 96000.0; }, 5.0),
+                   "the server to follow a format change to 96 kHz");
+        }
+        
+        // Measured once everything has been allocated for the new format
+        if (settledBytes == 0 && elapsedSeconds() > soakSeconds * 0.5)
+            settledBytes = getResidentBytes();
+        
+        if (!sleep(0.05))
+            return;
+    }
+    
+    SyntheticAudioDevice::Statistics stats;
+    RealtimeConfig::Report realtime;
+    bool hasDevice = false;
+    float clockPpm = 0.0f;
+    
+    onMessageThread([&]
+    {
+        if (auto* synthetic = server.getSyntheticDevice())
+        {
+            stats = synthetic->getStatistics();
+            hasDevice = true;
+        }
+        
+        realtime = server.getRealtimeReport();
+        clockPpm = server.getDeviceClockPpm();
+    });
+    
+    expect(hasDevice, "the synthetic device to still be open");
+    
+    auto grownBytes = getResidentBytes() - settledBytes;
+    
+    log(juce::String(juce::roundToInt(stats.deviceSeconds)) + " s of audio in "
+        + juce::String(stats.wallSeconds, 1) + " s, " + juce::String(stats.numCallbacks) + " callbacks, mean " + juce::String(stats.meanCallbackMs, 3)
+        + " ms, p99.9 " + juce::String(stats.p999CallbackMs, 3) + " ms, max load "
+        + juce::String(stats.maxLoad, 2) + ", " + juce::String(stats.numDeadlineMisses) + " deadline misses, clock "
+        + juce::String(clockPpm, 2) + " ppm; resident memory grew " + toMegabytes(grownBytes) + " in the second half");
+    
+    expect(stats.numNonFiniteBlocks == 0,
+           "no output block to hold a NaN or infinity (" + juce::String(stats.numNonFiniteBlocks) + " did)");
+    expect(stats.numFormatChanges == 1, "the device to make one format change");
+    expect(stats.deviceSeconds > stats.wallSeconds, "accelerated audio to run faster than real time");
+    expect((juce::int64) stats.numDeadlineMisses * 1000 <= stats.numCallbacks,
+           "no more than 0.1% of callbacks to miss their deadline");
+    expect(settledBytes == 0 || grownBytes < 8 * 1024 * 1024, "resident memory to grow less than 8 MB once settled");
+    expect(std::abs(clockPpm - device.driftPpm) < 1.0,
+           "the server to measure the device clock " + juce::String(device.driftPpm, 0) + " ppm fast ("
+           + juce::String(clockPpm, 2) + " ppm)");
+    
+    for (const auto& thread : realtime.threads)
+        expect(thread.role != RealtimeConfig::Role::Audio || thread.policy == RealtimeConfig::Policy::Normal,
+               "accelerated callbacks to stay at normal priority (" + thread.name + " was promoted)");
+    
+    // Unplugged, then plugged back in and opened again as an app would
+    onMessageThread([this]
+    {
+        if (auto* synthetic = server.getSyntheticDevice())
+            synthetic->simulateDisappearance();
+    });
+    
+    expect(waitFor([this] { return server.getSyntheticDevice() == nullptr; }, 5.0),
+           "the device to close when it disappears");
+    
+    started = false;
+    onMessageThread([&] { started = server.initializeSynthetic(device, error); });
+    
+    expect(started && waitFor([this]
+    {
+        auto* synthetic = server.getSyntheticDevice();
+        return synthetic != nullptr && synthetic->getStatistics().numCallbacks > 100;
+    }, 5.0), "processing to resume once the device is back");
+}
+
+//==============================================================================
+void SelfTest::runMeasurement()
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int bufferSize = 256;
+    
+    // Short, so the room can be convolved faster than real time
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = sampleRate;
+    device.defaultBufferSize = bufferSize;
+    device.roomResponse = SyntheticAudioDevice::createRoomResponse(sampleRate, 0.1f);
+    device.roomNoiseDb = -90.0f;
+    device.roomDistortion = 0.1f;
+    device.accelerated = true;
+    
+    bool started = false;
+    juce::String error;
+    
+    onMessageThread([&] { started = server.initializeSynthetic(device, error) && server.startAudioProcessing(); });
+    expect(started, "the synthetic device to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    
+    if (!started)
+        return;
+    
+    MeasurementEngine::Settings settings;
+    settings.sweepSeconds = 1.0f;
+    settings.silenceSeconds = 0.5f;
+    settings.numRuns = 2;
+    settings.impulseSeconds = 0.1f;
+    
+    struct Outcome
+    {
+        juce::WaitableEvent done;
+        MeasurementEngine::Result result;
+        juce::String errorMessage;
+    };
+    
+    auto outcome = std::make_shared<Outcome>();
+    bool measuring = false;
+    
+    onMessageThread([&]
+    {
+        measuring = server.startMeasurement(settings, [outcome] (const MeasurementEngine::Result& result,
+                                                                 const juce::String& errorMessage)
+        {
+            outcome->result = result;
+            outcome->errorMessage = errorMessage;
+            outcome->done.signal();
+        }, error);
+    });
+    
+    expect(measuring, "the measurement to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    
+    if (!measuring)
+        return;
+    
+    auto deadlineMs = juce::Time::getMillisecondCounterHiRes() + 60000.0;
+    
+    while (!outcome->done.wait(100))
+    {
+        if (threadShouldExit())
+            return;
+        
+        if (juce::Time::getMillisecondCounterHiRes() > deadlineMs)
+        {
+            expect(false, "the measurement to finish within a minute");
+            return;
+        }
+    }
+    
+    expect(outcome->errorMessage.isEmpty(), "the measurement to succeed (" + outcome->errorMessage + ")");
+    
+    if (outcome->errorMessage.isNotEmpty())
+        return;
+    
+    const auto& result = outcome->result;
+    
+    // The device plays the room's input a block late, and the direct sound
+    // arrives 2 ms into the room
+    auto directSample = juce::roundToInt(0.002 * sampleRate);
+    auto expectedLatency = bufferSize + directSample;
+    
+    // The response starts 1 ms ahead of its peak, at the direct sound
+    auto preRing = juce::roundToInt(0.001 * sampleRate);
+    auto* measured = result.impulseResponse.getReadPointer(0);
+    double product = 0.0, measuredEnergy = 0.0, roomEnergy = 0.0;
+    
+    for (int i = 0; i < result.impulseResponse.getNumSamples(); ++i)
+    {
+        auto room = (double) device.roomResponse[directSample - preRing + i];
+        product += room * measured[i];
+        measuredEnergy += (double) measured[i] * measured[i];
+        roomEnergy += room * room;
+    }
+    
+    auto correlation = measuredEnergy > 0.0 ? product / std::sqrt(measuredEnergy * roomEnergy) : 0.0;
+    auto distortionDb = result.totalHarmonicDistortion.getGainAt(1000.0);
+    
+    log("Latency " + juce::String(result.latencySamples) + " samples, signal to noise "
+        + juce::String(result.signalToNoiseDb, 1) + " dB, correlation with the room "
+        + juce::String(correlation, 3) + ", distortion at 1 kHz " + juce::String(distortionDb, 1) + " dB, analysed in "
+        + juce::String(result.analysisMs, 0) + " ms");
+    
+    expect(std::abs(result.latencySamples - expectedLatency) <= 1,
+           "a latency of " + juce::String(expectedLatency) + " samples");
+    expect(result.signalToNoiseDb > 40.0f, "a signal to noise ratio above 40 dB");
+    
+    // Band-limited to the sweep, so not exactly the room
+    expect(correlation > 0.8, "the impulse response to match the room's");
+    
+    // x^2 at -12 dB full scale puts the harmonics around -40 dB
+    expect(distortionDb > -50.0 && distortionDb < -25.0, "distortion between -50 and -25 dB at 1 kHz");
+}
+
+//==============================================================================
+void SelfTest::runGovernor()
+{
+    // Spinning back to back at normal priority, the callback gets preempted
+    // whenever the hog threads outnumber the cores, and a preempted callback
+    // takes several blocks' worth of time
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = 48000.0;
+    device.defaultBufferSize = 128;
+    device.accelerated = true;
+    
+    auto hogged = device;
+    hogged.numLoadThreads = 2 * juce::SystemStats::getNumCpus();
+    
+    QualityGovernor::Settings oldSettings;
+    bool started = false;
+    juce::String error;
+    
+    onMessageThread([&]
+    {
+        auto& governor = server.getQualityGovernor();
+        oldSettings = governor.getSettings();
+        
+        // Restore sooner, so the check doesn't take a minute
+        auto settings = oldSettings;
+        settings.enabled = true;
+        settings.restoreAfterMs = 500;
+        governor.setSettings(settings);
+        governor.reset();
+        
+        started = server.initializeSynthetic(hogged, error) && server.startAudioProcessing();
+    });
+    
+    expect(started, "the synthetic device to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    
+    if (started)
+    {
+        auto& governor = server.getQualityGovernor();
+        
+        expect(waitFor([&] { return governor.getLevel() > 0; }, 10.0),
+               "the governor to lower quality with " + juce::String(hogged.numLoadThreads) + " threads hogging the CPU");
+        
+        int hoggedLevel = 0;
+        onMessageThread([&] { hoggedLevel = governor.getLevel(); });
+        log("Level " + juce::String(hoggedLevel) + " under load");
+        
+        // The same device without the hog
+        started = false;
+        onMessageThread([&] { started = server.initializeSynthetic(device, error) && server.startAudioProcessing(); });
+        expect(started, "the synthetic device to restart without the load");
+        
+        // One level per restoreAfterMs, with room for a noisy machine
+        int numLevels = 0;
+        onMessageThread([&] { numLevels = governor.getNumLevels(); });
+        
+        expect(started && waitFor([&] { return governor.getLevel() == 0; }, numLevels * 0.5 + 10.0),
+               "the governor to restore full quality once the load has gone");
+        
+        juce::Array<QualityGovernor::Change> changes;
+        onMessageThread([&] { changes = governor.getChanges(); });
+        
+        for (const auto& change : changes)
+            log("  Level " + juce::String(change.fromLevel) + " to " + juce::String(change.toLevel) + " at load "
+                + juce::String(change.load, 2) + ": " + change.description);
+    }
+    
+    onMessageThread([&]
+    {
+        auto& governor = server.getQualityGovernor();
+        governor.setSettings(oldSettings);
+        governor.reset();
+    });
+}
+
+//==============================================================================
+void SelfTest::runRealtime()
+{
+    constexpr double seconds = 10.0;
+    
+    // The README's comparison: small blocks in real time with every core
+    // busy streaming through memory, at normal priority and then with the
+    // default real-time settings
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = 48000.0;
+    device.defaultBufferSize = 64;
+    device.numLoadThreads = 2 * juce::SystemStats::getNumCpus();
+    
+    RealtimeConfig::Settings normal, realtime, oldSettings;
+    normal.audio = { RealtimeConfig::Policy::Normal, 0, {} };
+    normal.lockMemory = false;
+    
+    onMessageThread([&] { oldSettings = server.getRealtimeSettings(); });
+    
+    struct Run
+    {
+        SyntheticAudioDevice::Statistics stats;
+        RealtimeConfig::Report report;
+        bool completed = false;
+    };
+    
+    auto measure = [&] (const juce::String& name, const RealtimeConfig::Settings& settings)
+    {
+        Run run;
+        bool started = false;
+        juce::String error;
+        
+        onMessageThread([&]
+        {
+            server.setRealtimeSettings(settings);
+            started = server.initializeSynthetic(device, error) && server.startAudioProcessing();
+        });
+        
+        expect(started, "the synthetic device to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+        
+        if (!started || !sleep(seconds))
+            return run;
+        
+        onMessageThread([&]
+        {
+            if (auto* synthetic = server.getSyntheticDevice())
+            {
+                run.stats = synthetic->getStatistics();
+                run.completed = true;
+            }
+            
+            run.report = server.getRealtimeReport();
+            server.stopAudioProcessing();
+        });
+        
+        log(name + ": " + juce::String(run.stats.numDeadlineMisses) + " of " + juce::String(run.stats.numCallbacks)
+            + " deadlines missed, wake-up latency p99 " + juce::String(run.stats.p99WakeLatencyMs, 2) + " ms, max "
+            + juce::String(run.stats.maxWakeLatencyMs, 2) + " ms");
+        
+        return run;
+    };
+    
+    log(juce::String(device.numLoadThreads) + " load threads, " + juce::String(seconds, 0) + " s each");
+    
+    auto normalRun = measure("Normal scheduling", normal);
+    auto realtimeRun = measure("Real-time settings", realtime);
+    
+    onMessageThread([&] { server.setRealtimeSettings(oldSettings); });
+    
+    expect(normalRun.completed && realtimeRun.completed, "both runs to complete");
+    
+    // Without the privileges or rtkit there is nothing to compare
+    auto isFifo = [] (const RealtimeConfig::ThreadReport& thread)
+    {
+        return thread.role == RealtimeConfig::Role::Audio && thread.policy == RealtimeConfig::Policy::Fifo;
+    };
+    
+    if (std::none_of(realtimeRun.report.threads.begin(), realtimeRun.report.threads.end(), isFifo))
+    {
+        log("The audio thread wasn't given SCHED_FIFO, so the runs aren't compared:");
+        
+        for (const auto& line : juce::StringArray::fromLines(realtimeRun.report.toString()))
+            log("  " + line);
+        
+        return;
+    }
+    
+    const auto& stats = realtimeRun.stats;
+    
+    expect(stats.numDeadlineMisses <= normalRun.stats.numDeadlineMisses,
+           "no more missed deadlines in real time than at normal priority");
+    expect((juce::int64) stats.numDeadlineMisses * 100 <= stats.numCallbacks,
+           "no more than 1% of deadlines missed in real time");
+}
+
+//==============================================================================
+void SelfTest::runBackground()
+{
+    using Mode = BackgroundProcessor::Mode;
+    constexpr double secondsPerMode = 2.0;
+    constexpr int numSwitches = 4;
+    
+    // In real time, since the worker only keeps up with a device that waits
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = 48000.0;
+    device.defaultBufferSize = 256;
+    
+    juce::Array<EQBand> bands;
+    
+    for (int b = 0; b < 8; ++b)
+    {
+        EQBand band;
+        band.frequency = 40.0f * std::pow(2.0f, (float) b * 1.3f);
+        band.gainDb = b % 2 == 0 ? 3.0f : -3.0f;
+        band.q = 1.0f;
+        bands.add(band);
+    }
+    
+    bool started = false;
+    juce::String error;
+    
+    onMessageThread([&]
+    {
+        RealtimeConfig::Settings realtime;
+        realtime.lockMemory = false;
+        server.setRealtimeSettings(realtime);
+        server.setProcessingMode(Mode::Direct);
+        server.getProcessorChain().setBands(bands);
+        
+        started = server.initializeSynthetic(device, error) && server.startAudioProcessing();
+    });
+    
+    expect(started, "the synthetic device to start" + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    
+    if (!started || !sleep(secondsPerMode))
+        return;
+    
+    auto getStatistics = [this]
+    {
+        SyntheticAudioDevice::Statistics stats;
+        
+        onMessageThread([&]
+        {
+            if (auto* synthetic = server.getSyntheticDevice())
+                stats = synthetic->getStatistics();
+        });
+        
+        return stats;
+    };
+    
+    // The sine's own steps through the EQ, before any switch
+    auto directStep = getStatistics().maxOutputStep;
+    BackgroundProcessor::Status highLatencyStatus;
+    
+    for (int i = 0; i < numSwitches; ++i)
+    {
+        auto mode = i % 2 == 0 ? Mode::HighLatency : Mode::Direct;
+        onMessageThread([&] { server.setProcessingMode(mode); });
+        
+        expect(waitFor([&] { return server.getProcessingStatus().mode == mode; }, 5.0),
+               juce::String("the switch to ") + (mode == Mode::Direct ? "direct" : "high-latency") + " mode to complete");
+        
+        if (!sleep(secondsPerMode))
+            return;
+        
+        if (mode == Mode::HighLatency)
+            onMessageThread([&] { highLatencyStatus = server.getProcessingStatus(); });
+    }
+    
+    auto stats = getStatistics();
+    BackgroundProcessor::Status status;
+    onMessageThread([&] { status = server.getProcessingStatus(); });
+    
+    // A fade moves the gain by 1 / fadeSamples a sample on top of the sine's
+    // own step, which is 2 sin(pi f / fs) of its peak
+    auto fadeSamples = BackgroundProcessor::fadeSeconds * device.defaultSampleRate;
+    auto sineStep = 2.0 * std::sin(juce::MathConstants<double>::pi * device.inputFrequency / device.defaultSampleRate);
+    auto allowedStep = directStep * (1.0 + 1.0 / (fadeSamples * sineStep)) * 1.1;
+    auto saving = status.directLoad > 0.0f ? 1.0f - status.highLatencyLoad / status.directLoad : 0.0f;
+    
+    log(juce::String(numSwitches) + " switches at " + juce::String(status.blockSize) + "-sample blocks: "
+        + juce::String(highLatencyStatus.latencyMs, 1) + " ms added latency, chain load "
+        + juce::String(status.directLoad * 100.0f, 2) + "% direct and " + juce::String(status.highLatencyLoad * 100.0f, 2)
+        + "% high latency (" + juce::String(saving * 100.0f, 0) + "% saved), largest output step "
+        + juce::String(stats.maxOutputStep, 4) + " against " + juce::String(directStep, 4) + " before switching, "
+        + juce::String(status.numUnderruns) + " underruns, " + juce::String(stats.numDeadlineMisses) + " deadline misses");
+    
+    expect(status.blockSize == BackgroundProcessor::defaultBlockSize, "the default high-latency block size");
+    expect(stats.maxOutputStep <= allowedStep, "no jump in the output beyond what the fade allows ("
+                                               + juce::String(stats.maxOutputStep, 4) + ", at most "
+                                               + juce::String(allowedStep, 4) + ")");
+    expect(status.numUnderruns == 0, "the worker never to fall behind (" + juce::String(status.numUnderruns) + " underruns)");
+    expect(status.numOverruns == 0, "every block to fit the input ring (" + juce::String(status.numOverruns) + " overruns)");
+    expect(stats.numNonFiniteBlocks == 0, "finite output");
+    
+    onMessageThread([this] { server.setProcessingMode(Mode::Direct); });
+}
+
+//==============================================================================
+void SelfTest::runMetrics()
+{
+    SyntheticAudioDevice::Settings device;
+    device.defaultSampleRate = 48000.0;
+    device.defaultBufferSize = 256;
+    
+    MetricsExporter::Settings settings;
+    settings.port = 0;
+    
+    bool started = false, serving = false;
+    int port = 0;
+    juce::String error;
+    
+    onMessageThread([&]
+    {
+        RealtimeConfig::Settings realtime;
+        realtime.lockMemory = false;
+        server.setRealtimeSettings(realtime);
+        
+        started = server.initializeSynthetic(device, error) && server.startAudioProcessing();
+        serving = started && server.startMetricsExporter(settings, error);
+        port = server.getMetricsExporter().getPort();
+    });
+    
+    expect(started && serving, "the synthetic device and the exporter to start"
+                               + (error.isNotEmpty() ? " (" + error + ")" : juce::String()));
+    expect(port > 0, "the exporter to report the port it was given");
+    
+    if (!started || !serving || port <= 0 || !sleep(0.5))
+        return;
+    
+    // One request per connection, as Prometheus scrapes; the exporter closes
+    // the connection once it has answered
+    auto scrape = [this, port]
+    {
+        juce::StreamingSocket socket;
+        
+        if (!socket.connect("127.0.0.1", port, 2000))
+            return juce::String();
+        
+        juce::String request("GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n");
+        socket.write(request.toRawUTF8(), (int) request.getNumBytesAsUTF8());
+        
+        juce::MemoryOutputStream response;
+        char buffer[4096];
+        
+        while (!threadShouldExit() && socket.waitUntilReady(true, 2000) == 1)
+        {
+            auto n = socket.read(buffer, (int) sizeof(buffer), false);
+            
+            if (n <= 0)
+                break;
+            
+            response.write(buffer, (size_t) n);
+        }
+        
+        return response.toString();
+    };
+    
+    // Every value of a metric by its full name, labels and all
+    auto parse = [] (const juce::String& response)
+    {
+        juce::StringPairArray values;
+        auto body = response.fromFirstOccurrenceOf("\r\n\r\n", false, false);
+        
+        for (const auto& line : juce::StringArray::fromLines(body))
+            if (line.isNotEmpty() && !line.startsWith("#"))
+                values.set(line.upToLastOccurrenceOf(" ", false, false), line.fromLastOccurrenceOf(" ", false, false));
+        
+        return values;
+    };
+    
+    const juce::String histogram = juce::String(MetricsExporter::prefix) + "callback_load_ratio";
+    const juce::String xruns = juce::String(MetricsExporter::prefix) + "xruns_total";
+    double previousCount = 0.0;
+    
+    for (int i = 0; i < 2; ++i)
+    {
+        auto response = scrape();
+        auto values = parse(response);
+        
+        expect(response.startsWith("HTTP/1.1 200"), "the scrape to get 200 OK (got \""
+                                                    + response.upToFirstOccurrenceOf("\r\n", false, false) + "\")");
+        
+        SyntheticAudioDevice::Statistics stats;
+        onMessageThread([&]
+        {
+            if (auto* synthetic = server.getSyntheticDevice())
+                stats = synthetic->getStatistics();
+        });
+        
+        // Only ever catches up with the device, after a callback
+        expect(values.containsKey(xruns), xruns + " in the scrape");
+        auto numXRuns = values[xruns].getLargeIntValue();
+        expect(values[xruns].containsOnly("0123456789") && numXRuns <= stats.numDeadlineMisses,
+               xruns + " to be a count no higher than the device's " + juce::String(stats.numDeadlineMisses)
+               + " (got " + values[xruns] + ")");
+        
+        // Buckets count everything up to their bound, so they only go up,
+        // and +Inf holds every observation
+        double previousBucket = 0.0;
+        bool cumulative = true;
+        int numBuckets = 0;
+        
+        for (const auto& key : values.getAllKeys())
+        {
+            if (!key.startsWith(histogram + "_bucket{le=\""))
+                continue;
+            
+            auto bucket = values[key].getDoubleValue();
+            cumulative = cumulative && bucket >= previousBucket;
+            previousBucket = bucket;
+            ++numBuckets;
+        }
+        
+        auto infinity = histogram + "_bucket{le=\"+Inf\"}";
+        auto count = values[histogram + "_count"].getDoubleValue();
+        
+        expect(numBuckets > 1 && values.containsKey(infinity), histogram + " buckets ending in +Inf");
+        expect(cumulative, histogram + " buckets to be cumulative");
+        expect(values[infinity].getDoubleValue() == count, histogram + "'s +Inf bucket to equal its count");
+        expect(values.containsKey(histogram + "_sum") && std::isfinite(values[histogram + "_sum"].getDoubleValue()),
+               histogram + "_sum in the scrape");
+        expect(count > previousCount, histogram + "_count to grow as callbacks run (" + juce::String(count, 0)
+                                      + " after " + juce::String(previousCount, 0) + ")");
+        
+        log("Scrape " + juce::String(i + 1) + " on port " + juce::String(port) + ": " + juce::String(values.size())
+            + " series, " + juce::String(numXRuns) + " xruns, " + juce::String(count, 0) + " callbacks");
+        
+        previousCount = count;
+        
+        if (i == 0 && !sleep(0.5))
+            return;
+    }
+    
+    int numScrapes = 0;
+    onMessageThread([&]
+    {
+        numScrapes = server.getMetricsExporter().getNumScrapes();
+        server.stopMetricsExporter();
+    });
+    
+    expect(numScrapes == 2, "the exporter to count both scrapes (" + juce::String(numScrapes) + ")");
+}
+
+//==============================================================================
+void SelfTest::runAutoEQ()
+{
+    constexpr double sampleRate = 48000.0;
+    
+    // A response the fitter can undo exactly, with a broadband offset it
+    // should ignore
+    juce::Array<EQBand> known;
+    
+    auto addBand = [&known] (EQBand::Type type, float frequency, float gainDb, float q)
+    {
+        EQBand band;
+        band.type = type;
+        band.frequency = frequency;
+        band.gainDb = gainDb;
+        band.q = q;
+        known.add(band);
+    };
+    
+    addBand(EQBand::Type::LowShelf, 100.0f, 4.0f, 0.7f);
+    addBand(EQBand::Type::Bell, 300.0f, -3.0f, 1.4f);
+    addBand(EQBand::Type::Bell, 1200.0f, 2.0f, 2.0f);
+    addBand(EQBand::Type::Bell, 3500.0f, -5.0f, 4.0f);
+    addBand(EQBand::Type::Bell, 7000.0f, 3.0f, 3.0f);
+    addBand(EQBand::Type::HighShelf, 10000.0f, -3.0f, 0.7f);
+    
+    auto responseDb = [sampleRate] (const juce::Array<EQBand>& bands, double frequency)
+    {
+        double gainDb = 0.0;
+        
+        for (const auto& band : bands)
+            gainDb += BiquadCoefficients::design(band, sampleRate).getMagnitudeDb(frequency, sampleRate);
+        
+        return gainDb;
+    };
+    
+    AutoEQ::Curve measured, target;
+    target.add(20.0f, 0.0f);
+    target.add(20000.0f, 0.0f);
+    
+    for (int i = 0; i <= 240; ++i)
+    {
+        auto frequency = 20.0 * std::pow(1000.0, i / 240.0);
+        measured.add((float) frequency, (float) (6.0 - responseDb(known, frequency)));
+    }
+    
+    AutoEQ::Settings settings;
+    settings.numBands = 8;
+    settings.sampleRate = sampleRate;
+    
+    auto result = AutoEQ::fit(measured, target, settings);
+    
+    // Checked against the exact designs, not the fitter's own grid, with the
+    // broadband offset taken out
+    juce::Array<double> errors;
+    
+    for (int i = 0; i <= 480; ++i)
+    {
+        auto frequency = 20.0 * std::pow(1000.0, i / 480.0);
+        errors.add(responseDb(result.bands, frequency) + measured.getGainAt(frequency) - target.getGainAt(frequency));
+    }
+    
+    auto mean = std::accumulate(errors.begin(), errors.end(), 0.0) / errors.size();
+    double sumSquares = 0.0, maxError = 0.0;
+    
+    for (auto error : errors)
+    {
+        sumSquares += (error - mean) * (error - mean);
+        maxError = juce::jmax(maxError, std::abs(error - mean));
+    }
+    
+    auto rmsError = std::sqrt(sumSquares / errors.size());
+    
+    log(juce::String(result.bands.size()) + " bands from " + juce::String(result.numStarts) + " searches, "
+        + juce::String(result.numEvaluations) + " evaluations in " + juce::String(result.elapsedMs, 0)
+        + " ms; error " + juce::String(rmsError, 2) + " dB RMS, " + juce::String(maxError, 2) + " dB max");
+    
+    expect(result.bands.size() == settings.numBands, juce::String(settings.numBands) + " bands");
+    expect(rmsError < 0.25, "an RMS error below 0.25 dB");
+    expect(maxError < 1.0, "no error above 1 dB");
+    expect(result.elapsedMs < 5000.0, "the fit to take less than 5 seconds");
+}
+
+//==============================================================================
+void SelfTest::runResponse()
+{
+    constexpr int numPoints = 512;
+    constexpr double toleranceDb = 0.01;
+    
+    // Deep in a notch, float dB can't be that close; nobody reads it there
+    constexpr double floorDb = -60.0;
+    
+    const EQBand::Type types[] = { EQBand::Type::Bell, EQBand::Type::LowShelf, EQBand::Type::HighShelf,
+                                   EQBand::Type::LowPass, EQBand::Type::HighPass, EQBand::Type::Notch };
+    
+    for (auto sampleRate : { 44100.0, 48000.0, 192000.0 })
+    {
+        ResponseEvaluator evaluator;
+        evaluator.prepare(numPoints, 10.0, juce::jmin(24000.0, sampleRate * 0.49), sampleRate);
+        
+        double worstDb = 0.0;
+        juce::String worstCase;
+        
+        auto compare = [&] (const juce::Array<EQBand>& bands, const juce::String& description)
+        {
+            for (int i = 0; i < numPoints; ++i)
+            {
+                auto frequency = (double) evaluator.getFrequencies()[i];
+                double expectedDb = 0.0;
+                
+                for (const auto& band : bands)
+                    expectedDb += BiquadCoefficients::design(band, sampleRate).getMagnitudeDb(frequency, sampleRate);
+                
+                if (expectedDb < floorDb)
+                    continue;
+                
+                auto error = std::abs(evaluator.getMagnitudeDb()[i] - expectedDb);
+                
+                if (error > worstDb)
+                {
+                    worstDb = error;
+                    worstCase = description + " at " + juce::String(frequency, 1) + " Hz";
+                }
+            }
+        };
+        
+        juce::Array<EQBand> all;
+        
+        for (auto type : types)
+        {
+            for (auto frequency : { 10.0f, 20.0f, 1000.0f, 20000.0f })
+            {
+                for (auto q : { 0.1f, 0.707f, 10.0f, 40.0f })
+                {
+                    for (auto gainDb : { -24.0f, 24.0f })
+                    {
+                        EQBand band;
+                        band.type = type;
+                        band.frequency = frequency;
+                        band.q = q;
+                        band.gainDb = gainDb;
+                        
+                        evaluator.setBands({ band });
+                        compare({ band }, EQBand::getTypeName(type) + " " + juce::String(frequency) + " Hz, Q "
+                                          + juce::String(q) + ", " + juce::String(gainDb) + " dB");
+                    }
+                }
+            }
+            
+            EQBand band;
+            band.type = type;
+            band.frequency = 50.0f * (float) (all.size() + 1) * (float) (all.size() + 1);
+            band.q = 2.0f;
+            band.gainDb = all.size() % 2 == 0 ? 6.0f : -6.0f;
+            all.add(band);
+        }
+        
+        evaluator.setBands(all);
+        compare(all, "every type combined");
+        
+        // A drag: the same band over and over, through the cached complement
+        for (int step = 0; step < 50; ++step)
+        {
+            auto& band = all.getReference(2);
+            band.frequency = (float) (20.0 * std::pow(1000.0, step / 49.0));
+            band.q = 0.1f + 0.8f * (float) step;
+            
+            evaluator.setBand(2, band);
+            compare(all, "dragging a band to " + juce::String(band.frequency, 0) + " Hz");
+        }
+        
+        log(juce::String(sampleRate / 1000.0, 1) + " kHz: worst error " + juce::String(worstDb, 5) + " dB ("
+            + worstCase + ")");
+        expect(worstDb <= toleranceDb, "the curve within " + juce::String(toleranceDb) + " dB of the exact response at "
+                                       + juce::String(sampleRate / 1000.0, 1) + " kHz");
+    }
+}
+
+//==============================================================================
+void SelfTest::runAccuracy()
+{
+    auto makeBand = [] (EQBand::Type type, float frequency, float gainDb, float q)
+    {
+        EQBand band;
+        band.type = type;
+        band.frequency = frequency;
+        band.gainDb = gainDb;
+        band.q = q;
+        return band;
+    };
+    
+    // Settings people use, rather than the extremes the response check covers
+    juce::Array<ChainAnalyser::Preset> presets;
+    
+    presets.add({ "Bass boost", { makeBand(EQBand::Type::LowShelf, 100.0f, 6.0f, 0.707f) } });
+    
+    presets.add({ "Loudness", { makeBand(EQBand::Type::LowShelf, 60.0f, 8.0f, 0.707f),
+                                makeBand(EQBand::Type::HighShelf, 12000.0f, 6.0f, 0.707f) } });
+    
+    presets.add({ "Vocal presence", { makeBand(EQBand::Type::HighPass, 80.0f, 0.0f, 0.707f),
+                                      makeBand(EQBand::Type::Bell, 250.0f, -3.0f, 1.0f),
+                                      makeBand(EQBand::Type::Bell, 3000.0f, 4.0f, 1.4f),
+                                      makeBand(EQBand::Type::HighShelf, 10000.0f, 2.0f, 0.707f) } });
+    
+    presets.add({ "Hum removal", { makeBand(EQBand::Type::Notch, 50.0f, 0.0f, 10.0f),
+                                   makeBand(EQBand::Type::Notch, 100.0f, 0.0f, 10.0f),
+                                   makeBand(EQBand::Type::Notch, 150.0f, 0.0f, 10.0f) } });
+    
+    presets.add({ "Speaker correction", { makeBand(EQBand::Type::Bell, 45.0f, 4.0f, 2.0f),
+                                          makeBand(EQBand::Type::Bell, 120.0f, -5.0f, 4.0f),
+                                          makeBand(EQBand::Type::Bell, 900.0f, -2.0f, 2.0f),
+                                          makeBand(EQBand::Type::Bell, 2500.0f, 3.0f, 3.0f),
+                                          makeBand(EQBand::Type::Bell, 6300.0f, -4.0f, 5.0f),
+                                          makeBand(EQBand::Type::LowPass, 18000.0f, 0.0f, 0.707f) } });
+    
+    // The chains are built on the calling thread, which has to be the
+    // message thread since they set up plugin formats
+    ChainAnalyser::Report report;
+    onMessageThread([&] { report = ChainAnalyser::run(presets); });
+    
+    for (const auto& line : juce::StringArray::fromLines(report.toString()))
+        log("  " + line);
+    
+    log(juce::String(report.cases.size()) + " cases in " + juce::String(report.elapsedMs / 1000.0, 1) + " s");
+    expect(report.cases.size() == presets.size() * ChainAnalyser::Settings().sampleRates.size(),
+           "a case for every preset at every sample rate");
+    expect(report.passed(), "every case within ChainAnalyser's default tolerances");
+}
+
+//==============================================================================
+void SelfTest::runPrecision()
+{
+    // The error of a +6 dB, Q 1 band on -6 dBFS noise, in dB relative to
+    // full scale, once the filter has settled
+    auto measureError = [] (const EQBand& band, double sampleRate, auto stateType)
+    {
+        using StateType = decltype(stateType);
+        
+        auto coefficients = BiquadCoefficients::design(band, sampleRate);
+        BiquadKernel<StateType> kernel(coefficients);
+        StateType state[2] = {};
+        long double reference1 = 0, reference2 = 0;
+        
+        juce::Random random(7);
+        auto numSamples = (int) (sampleRate * 4.0);
+        double sumSquares = 0.0;
+        juce::HeapBlock<float> input(1024), block(1024);
+        
+        for (int start = 0; start < numSamples; start += 1024)
+        {
+            for (int i = 0; i < 1024; ++i)
+                input[i] = block[i] = (random.nextFloat() * 2.0f - 1.0f) * 0.5f;
+            
+            kernel.process(block.get(), state, 1024);
+            
+            for (int i = 0; i < 1024; ++i)
+            {
+                long double x = input[i];
+                auto y = coefficients.b0 * x + reference1;
+                reference1 = coefficients.b1 * x - coefficients.a1 * y + reference2;
+                reference2 = coefficients.b2 * x - coefficients.a2 * y;
+                
+                if (start >= numSamples / 4)
+                {
+                    auto error = (double) block[i] - (double) y;
+                    sumSquares += error * error;
+                }
+            }
+        }
+        
+        return 10.0 * std::log10(sumSquares / (numSamples - numSamples / 4) + 1.0e-300);
+    };
+    
+    struct Case
+    {
+        double frequency, sampleRate;
+    };
+    
+    const Case cases[] = { { 20.0, 192000.0 }, { 20.0, 48000.0 }, { 100.0, 48000.0 },
+                           { 500.0, 48000.0 }, { 1000.0, 48000.0 }, { 5000.0, 48000.0 } };
+    
+    log("Error of a +6 dB, Q 1 band on -6 dBFS noise, float state / double state:");
+    
+    for (auto type : { EQBand::Type::Bell, EQBand::Type::LowShelf })
+    {
+        for (const auto& c : cases)
+        {
+            EQBand band;
+            band.type = type;
+            band.frequency = (float) c.frequency;
+            band.gainDb = 6.0f;
+            band.q = 1.0f;
+            
+            auto floatDb = measureError(band, c.sampleRate, 0.0f);
+            auto doubleDb = measureError(band, c.sampleRate, 0.0);
+            auto pickedDb = EQPlan::needsDoublePrecision(band, c.sampleRate) ? doubleDb : floatDb;
+            auto name = EQBand::getTypeName(type) + " at " + juce::String(c.frequency, 0) + " Hz, "
+                      + juce::String(c.sampleRate / 1000.0, 0) + " kHz";
+            
+            log("  " + name + " (f/fs " + juce::String(c.frequency / c.sampleRate, 4) + "): "
+                + juce::String(floatDb, 0) + " / " + juce::String(doubleDb, 0) + " dBFS");
+            
+            expect(doubleDb < -150.0, name + " in double state to stay below -150 dBFS");
+            expect(pickedDb < -120.0, name + " in the state EQPlan picks to stay below -120 dBFS");
+        }
+    }
+    
+    // Throughput with every band in one precision: 32 bands, stereo,
+    // 512-sample blocks, on the kernels the chain would pick
+    constexpr int numChannels = 2, blockSize = 512, numBlocks = 4000;
+    juce::ScopedNoDenormals noDenormals;
+    
+    for (auto useDouble : { false, true })
+    {
+        EQBand bands[EQPlan::maxSections];
+        
+        for (int b = 0; b < EQPlan::maxSections; ++b)
+        {
+            bands[b].frequency = useDouble ? 20.0f + (float) b * 30.0f : 1500.0f + (float) b * 400.0f;
+            bands[b].gainDb = b % 2 == 0 ? -3.0f : 3.0f;
+            bands[b].q = 1.0f;
+        }
+        
+        EQFilterBank<float> bank;
+        bank.prepare(numChannels, blockSize, DSPKernels::getForChannels(numChannels));
+        bank.setBands(bands, EQPlan::maxSections, 48000.0);
+        
+        // The same noise every block, so the bands' gain doesn't compound
+        juce::AudioBuffer<float> noise(numChannels, blockSize), buffer(numChannels, blockSize);
+        juce::Random random(1);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                noise.setSample(channel, i, (random.nextFloat() - 0.5f) * 0.5f);
+        
+        auto startTicks = juce::Time::getHighResolutionTicks();
+        
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.copyFrom(channel, 0, noise, channel, 0, blockSize);
+            
+            bank.process(buffer);
+        }
+        
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        auto nanoseconds = seconds * 1.0e9 / ((double) numBlocks * blockSize * numChannels * EQPlan::maxSections);
+        
+        log(juce::String(useDouble ? "Double" : "Float") + " state: " + juce::String(nanoseconds, 2)
+            + " ns per band per sample (" + DSPKernels::getVariantName(bank.getKernels().variant) + ")");
+        expect(std::isfinite(buffer.getSample(0, 0)), "the benchmark's output to stay finite");
+    }
+}
+
+//==============================================================================
+void SelfTest::runCrossover()
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 512;
+    const float allFrequencies[] = { 100.0f, 1000.0f, 8000.0f };
+    
+    auto makeSettings = [&] (CrossoverStage::Slope slope, int numWays, int numInputs, int lfeInput, bool bassManagement)
+    {
+        CrossoverStage::Settings settings;
+        settings.enabled = true;
+        settings.numInputs = numInputs;
+        settings.frequencies = juce::Array<float>(allFrequencies, numWays - 1);
+        settings.slope = slope;
+        settings.lfeInput = lfeInput;
+        settings.bassManagement = bassManagement;
+        return settings;
+    };
+    
+    // Runs the stage over the input, in blocks, and returns every channel
+    auto runStage = [&] (const CrossoverStage::Settings& settings, const juce::AudioBuffer<float>& input)
+    {
+        auto numChannels = settings.getNumProcessingChannels();
+        juce::AudioBuffer<float> output(numChannels, input.getNumSamples()), block(numChannels, blockSize);
+        
+        CrossoverStage stage;
+        stage.prepare(sampleRate, blockSize, numChannels, DSPKernels::getForChannels(numChannels));
+        juce::String error;
+        expect(stage.setSettings(settings, error), "the crossover settings to be valid (" + error + ")");
+        
+        for (int start = 0; start < input.getNumSamples(); start += blockSize)
+        {
+            block.clear();
+            
+            for (int channel = 0; channel < input.getNumChannels(); ++channel)
+                block.copyFrom(channel, 0, input, channel, start, blockSize);
+            
+            stage.process(block);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                output.copyFrom(channel, start, block, channel, 0, blockSize);
+        }
+        
+        return output;
+    };
+    
+    // The ways of one input, summed, have to be an all-pass: flat from 10 Hz
+    // to 20 kHz
+    constexpr int irLength = 16384, numFrequencies = 200;
+    
+    for (auto slope : { CrossoverStage::Slope::LR4, CrossoverStage::Slope::LR8 })
+    {
+        for (int numWays = 2; numWays <= CrossoverStage::maxWays; ++numWays)
+        {
+            auto settings = makeSettings(slope, numWays, 1, -1, false);
+            juce::AudioBuffer<float> impulse(1, irLength);
+            impulse.clear();
+            impulse.setSample(0, 0, 1.0f);
+            
+            auto ways = runStage(settings, impulse);
+            std::vector<double> sum((size_t) irLength, 0.0);
+            
+            for (int way = 0; way < numWays; ++way)
+                for (int i = 0; i < irLength; ++i)
+                    sum[(size_t) i] += ways.getSample(settings.getOutputChannel(0, way), i);
+            
+            double worstDb = 0.0;
+            
+            for (int f = 0; f < numFrequencies; ++f)
+            {
+                auto frequency = 10.0 * std::pow(2000.0, f / (double) (numFrequencies - 1));
+                auto w = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+                std::complex<double> response;
+                
+                for (int i = 0; i < irLength; ++i)
+                    response += sum[(size_t) i] * std::polar(1.0, -w * i);
+                
+                auto errorDb = 20.0 * std::log10(std::abs(response));
+                
+                if (std::abs(errorDb) > std::abs(worstDb))
+                    worstDb = errorDb;
+            }
+            
+            auto name = juce::String(slope == CrossoverStage::Slope::LR4 ? "LR4" : "LR8") + ", "
+                      + juce::String(numWays) + " ways";
+            log("  " + name + ": summed ways within " + juce::String(std::abs(worstDb), 4) + " dB of flat");
+            expect(std::abs(worstDb) < 0.01, name + " to sum to within 0.01 dB of flat");
+        }
+    }
+    
+    // Where every way of 5.1 and 7.1 ends up, worked out independently of
+    // getOutputChannel(), and an impulse on each input only reaching those
+    // outputs
+    struct Layout
+    {
+        const char* name;
+        int numInputs, lfeInput;
+    };
+    
+    for (const auto& layout : { Layout { "5.1", 6, 3 }, Layout { "7.1", 8, 3 } })
+    {
+        for (auto bassManagement : { false, true })
+        {
+            for (int numWays = 2; numWays <= 3; ++numWays)
+            {
+                auto settings = makeSettings(CrossoverStage::Slope::LR4, numWays, layout.numInputs, layout.lfeInput, bassManagement);
+                auto name = juce::String(layout.name) + ", " + juce::String(numWays) + " ways"
+                          + (bassManagement ? ", bass managed" : "");
+                
+                int next = 0;
+                bool mappingMatches = true;
+                
+                for (int input = 0; input < layout.numInputs; ++input)
+                {
+                    for (int way = 0; way < numWays; ++way)
+                    {
+                        auto expected = input == layout.lfeInput || (bassManagement && way == 0) ? -1 : next++;
+                        mappingMatches = mappingMatches && settings.getOutputChannel(input, way) == expected;
+                    }
+                }
+                
+                auto sub = next++;
+                
+                expect(mappingMatches, name + ": every way to map to its output, input by input from the lowest way");
+                expect(settings.getSubOutputChannel() == sub, name + ": the subwoofer on output " + juce::String(sub)
+                                                             + ", not " + juce::String(settings.getSubOutputChannel()));
+                expect(settings.getNumOutputs() == next, name + ": " + juce::String(next) + " outputs, not "
+                                                         + juce::String(settings.getNumOutputs()));
+                
+                for (int input = 0; input < layout.numInputs; ++input)
+                {
+                    juce::AudioBuffer<float> impulse(layout.numInputs, 4096);
+                    impulse.clear();
+                    impulse.setSample(input, 0, 1.0f);
+                    
+                    auto output = runStage(settings, impulse);
+                    juce::Array<int> reached;
+                    
+                    for (int way = 0; way < numWays; ++way)
+                        reached.addIfNotAlreadyThere(settings.getOutputChannel(input, way));
+                    
+                    if (input == layout.lfeInput || bassManagement)
+                        reached.add(settings.getSubOutputChannel());
+                    
+                    for (int channel = 0; channel < output.getNumChannels(); ++channel)
+                    {
+                        auto energy = output.getMagnitude(channel, 0, output.getNumSamples());
+                        
+                        if (reached.contains(channel) != (energy > 1.0e-4f))
+                            expect(false, name + ": input " + juce::String(input) + (reached.contains(channel) ? " to reach" : " not to reach")
+                                          + " output " + juce::String(channel));
+                    }
+                }
+            }
+        }
+    }
+    
+    // Time per 64-sample block of the 7.1 three-way split with bass
+    // management, on the kernels the chain would pick
+    constexpr int benchmarkBlockSize = 64, numBlocks = 20000;
+    juce::ScopedNoDenormals noDenormals;
+    
+    for (auto slope : { CrossoverStage::Slope::LR4, CrossoverStage::Slope::LR8 })
+    {
+        auto settings = makeSettings(slope, 3, 8, 3, true);
+        settings.frequencies = { 80.0f, 2000.0f };
+        
+        auto numChannels = settings.getNumProcessingChannels();
+        const auto& kernels = DSPKernels::getForChannels(numChannels);
+        
+        CrossoverStage stage;
+        stage.prepare(sampleRate, benchmarkBlockSize, numChannels, kernels);
+        juce::String error;
+        stage.setSettings(settings, error);
+        
+        juce::AudioBuffer<float> noise(numChannels, benchmarkBlockSize), buffer(numChannels, benchmarkBlockSize);
+        juce::Random random(3);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            for (int i = 0; i < benchmarkBlockSize; ++i)
+                noise.setSample(channel, i, (random.nextFloat() - 0.5f) * 0.5f);
+        
+        auto startTicks = juce::Time::getHighResolutionTicks();
+        
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.copyFrom(channel, 0, noise, channel, 0, benchmarkBlockSize);
+            
+            stage.process(buffer);
+        }
+        
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        
+        log(juce::String(slope == CrossoverStage::Slope::LR4 ? "LR4" : "LR8") + " 7.1 three-way split: "
+            + juce::String(seconds * 1.0e6 / numBlocks, 1) + " us per 64-sample block at 48 kHz ("
+            + DSPKernels::getVariantName(kernels.variant) + ")");
+        expect(std::isfinite(buffer.getSample(0, 0)), "the benchmark's output to stay finite");
+    }
+}
+
+//==============================================================================
+void SelfTest::runCompressor()
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 32;
+    
+    auto makeSettings = [] (int numBands, CompressorStage::Link link)
+    {
+        const float allFrequencies[] = { 150.0f, 600.0f, 2500.0f, 8000.0f };
+        
+        CompressorStage::Settings settings;
+        settings.enabled = true;
+        settings.frequencies = numBands == 3 ? juce::Array<float> { 150.0f, 2500.0f }
+                                             : juce::Array<float>(allFrequencies, numBands - 1);
+        settings.link = link;
+        
+        CompressorStage::Band band;
+        band.thresholdDb = -30.0f;
+        band.ratio = 4.0f;
+        
+        for (int b = 0; b < numBands; ++b)
+            settings.bands.add(band);
+        
+        return settings;
+    };
+    
+    // Runs a 1 kHz tone at -6 dBFS through a stage prepared for
+    // numPreparedChannels, in blocks of numChannels
+    auto runTone = [&] (int numPreparedChannels, int numChannels, CompressorStage::Link link)
+    {
+        CompressorStage stage;
+        stage.prepare(sampleRate, blockSize, numPreparedChannels, DSPKernels::getForChannels(numPreparedChannels));
+        juce::String error;
+        expect(stage.setSettings(makeSettings(3, link), error), "the compressor settings to be valid (" + error + ")");
+        
+        constexpr int numSamples = 24000;
+        juce::AudioBuffer<float> output(numChannels, numSamples), block(numChannels, blockSize);
+        
+        for (int start = 0; start < numSamples; start += blockSize)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    block.setSample(channel, i, 0.5f * (float) std::sin(juce::MathConstants<double>::twoPi * 1000.0
+                                                                        * (start + i) / sampleRate));
+            
+            stage.process(block);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                output.copyFrom(channel, start, block, channel, 0, blockSize);
+        }
+        
+        return output;
+    };
+    
+    // As many channels as the chain allows, each compressed on its own
+    auto wide = runTone(CompressorStage::maxChannels, CompressorStage::maxChannels, CompressorStage::Link::None);
+    auto wideGainDb = juce::Decibels::gainToDecibels(wide.getRMSLevel(CompressorStage::maxChannels - 1, 12000, 12000)
+                                                     / (0.5f * juce::MathConstants<float>::sqrt2 * 0.5f));
+    log("  " + juce::String(CompressorStage::maxChannels) + " channels: last channel at " + juce::String(wideGainDb, 1)
+        + " dB");
+    expect(wideGainDb < -6.0f, juce::String(CompressorStage::maxChannels) + " channels to be compressed, the last "
+                               "one included");
+    
+    // A block narrower than the stage was prepared for links only the
+    // channels it has, so it matches a stage prepared for just those
+    auto narrow = runTone(8, 2, CompressorStage::Link::All);
+    auto exact = runTone(2, 2, CompressorStage::Link::All);
+    bool matches = true;
+    
+    for (int channel = 0; channel < 2; ++channel)
+        matches = matches && std::memcmp(narrow.getReadPointer(channel), exact.getReadPointer(channel),
+                                         sizeof(float) * (size_t) narrow.getNumSamples()) == 0;
+    
+    expect(matches, "2 channels linked in a stage prepared for 8 to get the gain they get in one prepared for 2");
+    
+    // Time per 32-sample block, on the kernels the chain would pick
+    constexpr int numBlocks = 20000;
+    juce::ScopedNoDenormals noDenormals;
+    
+    for (auto numChannels : { 2, 8 })
+    {
+        for (auto numBands : { 3, 5 })
+        {
+            const auto& kernels = DSPKernels::getForChannels(numChannels);
+            
+            CompressorStage stage;
+            stage.prepare(sampleRate, blockSize, numChannels, kernels);
+            juce::String error;
+            stage.setSettings(makeSettings(numBands, CompressorStage::Link::Stereo), error);
+            
+            juce::AudioBuffer<float> noise(numChannels, blockSize), buffer(numChannels, blockSize);
+            juce::Random random(5);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    noise.setSample(channel, i, (random.nextFloat() - 0.5f) * 0.5f);
+            
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    buffer.copyFrom(channel, 0, noise, channel, 0, blockSize);
+                
+                stage.process(buffer);
+            }
+            
+            auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+            
+            log(juce::String(numChannels) + " channels, " + juce::String(numBands) + " bands: "
+                + juce::String(seconds * 1.0e6 / numBlocks, 1) + " us per 32-sample block at 48 kHz ("
+                + DSPKernels::getVariantName(kernels.variant) + ")");
+            expect(std::isfinite(buffer.getSample(0, 0)), "the benchmark's output to stay finite");
+        }
+    }
+}
+
+//==============================================================================
+void SelfTest::runSvf()
+{
+    // Time per band per channel-sample of 8 bells in 512-sample blocks: as
+    // biquads, as settled SVFs, as SVFs that are always gliding, and as
+    // biquads redesigned every sample, the way a biquad would have to glide
+    constexpr double sampleRate = 48000.0;
+    constexpr int numBands = SVFBank::maxBands, blockSize = 512, numBlocks = 1000, numRedesignedBlocks = 50;
+    juce::ScopedNoDenormals noDenormals;
+    
+    auto makeBands = [] (float frequencyScale, EQBand::Filter filter)
+    {
+        std::array<EQBand, (size_t) numBands> bands;
+        
+        for (int b = 0; b < numBands; ++b)
+        {
+            auto& band = bands[(size_t) b];
+            band.frequency = frequencyScale * 60.0f * std::pow(2.0f, (float) b * 1.2f);
+            band.gainDb = b % 2 == 0 ? -4.0f : 4.0f;
+            band.q = 1.5f;
+            band.filter = filter;
+        }
+        
+        return bands;
+    };
+    
+    auto biquadBands = makeBands(1.0f, EQBand::Filter::Biquad);
+    auto svfBands = makeBands(1.0f, EQBand::Filter::Svf);
+    auto movedSvfBands = makeBands(1.5f, EQBand::Filter::Svf);
+    
+    log("Time per band per channel-sample, " + juce::String(numBands) + " bands in "
+        + juce::String(blockSize) + "-sample blocks: biquad / SVF settled / SVF gliding / biquad redesigned every sample");
+    
+    for (int numChannels : { 2, 8 })
+    {
+        const auto& kernels = DSPKernels::getForChannels(numChannels);
+        
+        // The same noise every block, so the bands' gain doesn't compound
+        juce::AudioBuffer<float> noise(numChannels, blockSize), buffer(numChannels, blockSize);
+        juce::Random random(1);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                noise.setSample(channel, i, (random.nextFloat() - 0.5f) * 0.5f);
+        
+        auto timeBlocks = [&] (int blocks, auto&& processBlock)
+        {
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            
+            for (int block = 0; block < blocks; ++block)
+            {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    buffer.copyFrom(channel, 0, noise, channel, 0, blockSize);
+                
+                processBlock(block);
+            }
+            
+            auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+            expect(std::isfinite(buffer.getSample(0, 0)), "the benchmark's output to stay finite");
+            
+            return seconds * 1.0e9 / ((double) blocks * blockSize * numChannels * numBands);
+        };
+        
+        EQFilterBank<float> biquads;
+        biquads.prepare(numChannels, blockSize, kernels);
+        biquads.setBands(biquadBands.data(), numBands, sampleRate);
+        
+        auto biquadNs = timeBlocks(numBlocks, [&] (int) { biquads.process(buffer); });
+        
+        SVFBank svf;
+        svf.prepare(numChannels, blockSize, sampleRate, kernels);
+        svf.setBands(svfBands.data(), numBands);
+        
+        // Past any glide from the first setBands(), so every block runs on
+        // exact coefficients
+        for (int block = 0; block < 4; ++block)
+            svf.process(buffer.getArrayOfWritePointers(), numChannels, blockSize);
+        
+        expect(!svf.isGliding(), "SVF bands to settle within " + juce::String(4 * blockSize) + " samples");
+        
+        auto settledNs = timeBlocks(numBlocks, [&] (int)
+        {
+            svf.process(buffer.getArrayOfWritePointers(), numChannels, blockSize);
+        });
+        
+        // A glide lasts longer than a block, so moving the bands every block
+        // keeps them gliding
+        bool glidedThroughout = true;
+        
+        auto glidingNs = timeBlocks(numBlocks, [&] (int block)
+        {
+            svf.setBands(block % 2 == 0 ? movedSvfBands.data() : svfBands.data(), numBands);
+            svf.process(buffer.getArrayOfWritePointers(), numChannels, blockSize);
+            glidedThroughout = glidedThroughout && svf.isGliding();
+        });
+        
+        expect(glidedThroughout, "SVF bands moved every block to glide throughout");
+        
+        // The frequency of every band moves by up to half an octave and back
+        // once a block, with fresh coefficients every sample
+        std::vector<float> state((size_t) (numChannels * numBands * 2));
+        auto movingBands = biquadBands;
+        
+        auto redesignedNs = timeBlocks(numRedesignedBlocks, [&] (int)
+        {
+            auto* const* channels = buffer.getArrayOfWritePointers();
+            std::fill(state.begin(), state.end(), 0.0f);
+            
+            for (int i = 0; i < blockSize; ++i)
+            {
+                auto scale = std::pow(2.0f, 0.5f * std::sin(juce::MathConstants<float>::twoPi * (float) i / (float) blockSize));
+                
+                for (int b = 0; b < numBands; ++b)
+                {
+                    auto& band = movingBands[(size_t) b];
+                    band.frequency = biquadBands[(size_t) b].frequency * scale;
+                    auto c = BiquadCoefficients::design(band, sampleRate);
+                    
+                    for (int channel = 0; channel < numChannels; ++channel)
+                    {
+                        auto* s = state.data() + 2 * (channel * numBands + b);
+                        auto x = channels[channel][i];
+                        auto y = (float) c.b0 * x + s[0];
+                        s[0] = (float) c.b1 * x - (float) c.a1 * y + s[1];
+                        s[1] = (float) c.b2 * x - (float) c.a2 * y;
+                        channels[channel][i] = y;
+                    }
+                }
+            }
+        });
+        
+        log("  " + juce::String(numChannels) + " channels (" + DSPKernels::getVariantName(kernels.variant) + "): "
+            + juce::String(biquadNs, 2) + " / " + juce::String(settledNs, 2) + " / "
+            + juce::String(glidingNs, 2) + " / " + juce::String(redesignedNs, 1) + " ns");
+    }
+}
+
+//==============================================================================
+void SelfTest::runKernels()
+{
+    using Variant = DSPKernels::Variant;
+    
+    constexpr double sampleRate = 48000.0;
+    constexpr int blockSize = 256, numBlocks = 8;
+    
+    auto randomBands = [] (juce::Random& random, int numBands, EQBand::Filter filter)
+    {
+        juce::Array<EQBand> bands;
+        
+        for (int b = 0; b < numBands; ++b)
+        {
+            EQBand band;
+            band.type = (EQBand::Type) random.nextInt(6);
+            band.frequency = 20.0f * std::pow(1000.0f, random.nextFloat());
+            band.gainDb = random.nextFloat() * 30.0f - 15.0f;
+            band.q = 0.2f * std::pow(50.0f, random.nextFloat());
+            band.filter = filter;
+            bands.add(band);
+        }
+        
+        return bands;
+    };
+    
+    // The same random bands, settings and noise for every variant: an EQ
+    // with float and double sections, SVFs that glide halfway through, then
+    // a compressor
+    auto runChain = [&] (const DSPKernels& kernels, int numChannels, juce::int64 seed)
+    {
+        juce::Random random(seed);
+        auto eqBands = randomBands(random, EQPlan::maxSections / 2, EQBand::Filter::Biquad);
+        auto svfBands = randomBands(random, SVFBank::maxBands, EQBand::Filter::Svf);
+        auto movedSvfBands = randomBands(random, SVFBank::maxBands, EQBand::Filter::Svf);
+        
+        CompressorStage::Settings settings;
+        settings.enabled = true;
+        settings.frequencies = { 100.0f + 200.0f * random.nextFloat(), 1000.0f + 2000.0f * random.nextFloat() };
+        settings.detector = random.nextBool() ? CompressorStage::Detector::Peak : CompressorStage::Detector::Rms;
+        settings.link = (CompressorStage::Link) random.nextInt(3);
+        
+        for (int b = 0; b < settings.getNumBands(); ++b)
+        {
+            CompressorStage::Band band;
+            band.thresholdDb = -30.0f + 20.0f * random.nextFloat();
+            band.ratio = 1.0f + 7.0f * random.nextFloat();
+            band.attackMs = 0.5f + 20.0f * random.nextFloat();
+            settings.bands.add(band);
+        }
+        
+        EQFilterBank<float> eq;
+        eq.prepare(numChannels, blockSize, kernels);
+        eq.setBands(eqBands.getRawDataPointer(), eqBands.size(), sampleRate);
+        
+        SVFBank svf;
+        svf.prepare(numChannels, blockSize, sampleRate, kernels);
+        svf.setBands(svfBands.getRawDataPointer(), svfBands.size());
+        
+        CompressorStage compressor;
+        compressor.prepare(sampleRate, blockSize, numChannels, kernels);
+        juce::String error;
+        expect(compressor.setSettings(settings, error), "random compressor settings to be valid (" + error + ")");
+        
+        juce::AudioBuffer<float> block(numChannels, blockSize), output(numChannels, blockSize * numBlocks);
+        
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    block.setSample(channel, i, (random.nextFloat() - 0.5f) * 1.5f);
+            
+            if (b == numBlocks / 2)
+                svf.setBands(movedSvfBands.getRawDataPointer(), movedSvfBands.size());
+            
+            eq.process(block);
+            svf.process(block.getArrayOfWritePointers(), numChannels, blockSize);
+            compressor.process(block);
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                output.copyFrom(channel, b * blockSize, block, channel, 0, blockSize);
+        }
+        
+        return output;
+    };
+    
+    auto isIdentical = [] (const juce::AudioBuffer<float>& a, const juce::AudioBuffer<float>& b)
+    {
+        for (int channel = 0; channel < a.getNumChannels(); ++channel)
+            if (std::memcmp(a.getReadPointer(channel), b.getReadPointer(channel),
+                            sizeof(float) * (size_t) a.getNumSamples()) != 0)
+                return false;
+        
+        return true;
+    };
+    
+    // The kernels that don't depend on lanes, on data of odd lengths
+    auto runOthers = [] (const DSPKernels& kernels, juce::int64 seed)
+    {
+        juce::Random random(seed);
+        juce::Array<float> results;
+        
+        constexpr int maxLength = 67, numSources = 5, numDestinations = 3;
+        float samples[maxLength], window[maxLength], complexData[2 * maxLength], dest[2 * maxLength];
+        double doubles[maxLength];
+        float sourceData[numSources][maxLength], destinationData[numDestinations][maxLength];
+        
+        for (int length = 1; length <= maxLength; length += 6)
+        {
+            for (int i = 0; i < 2 * maxLength; ++i)
+                complexData[i] = random.nextFloat() - 0.5f;
+            
+            for (int i = 0; i < maxLength; ++i)
+            {
+                samples[i] = random.nextFloat() * 2.0f - 1.0f;
+                window[i] = random.nextFloat();
+                
+                for (auto& source : sourceData)
+                    source[i] = random.nextFloat() - 0.5f;
+            }
+            
+            results.add(kernels.findAbsolutePeak(samples, length));
+            results.add(kernels.sumOfSquares(samples, length));
+            
+            kernels.copy(dest, samples, length);
+            results.addArray(dest, length);
+            
+            kernels.floatToDouble(doubles, samples, length);
+            kernels.doubleToFloat(dest, doubles, length);
+            results.addArray(dest, length);
+            
+            kernels.applyWindow(dest, samples, window, length);
+            results.addArray(dest, length);
+            
+            kernels.magnitudeSquared(dest, complexData, length);
+            results.addArray(dest, length);
+            
+            // Destination 1 has no entries, so it's cleared
+            const float* sources[numSources] = { sourceData[0], sourceData[1], sourceData[2], sourceData[3], sourceData[4] };
+            float* destinations[numDestinations] = { destinationData[0], destinationData[1], destinationData[2] };
+            const int rowStart[] = { 0, 3, 3, 5 };
+            const int sourceIndex[] = { 0, 2, 4, 1, 3 };
+            float gains[5];
+            
+            for (auto& gain : gains)
+                gain = random.nextFloat() * 2.0f - 1.0f;
+            
+            kernels.sparseMix(destinations, numDestinations, sources, rowStart, sourceIndex, gains, length);
+            
+            for (auto* destination : destinations)
+                results.addArray(destination, length);
+        }
+        
+        return results;
+    };
+    
+    // 32 bands in 512-sample blocks, in ns per band per channel-sample
+    auto timeBiquads = [] (const DSPKernels& kernels, int numChannels)
+    {
+        constexpr int timedBlockSize = 512, numTimedBlocks = 500;
+        juce::ScopedNoDenormals noDenormals;
+        
+        EQBand bands[EQPlan::maxSections];
+        
+        for (int b = 0; b < EQPlan::maxSections; ++b)
+        {
+            bands[b].frequency = 25.0f * std::pow(1.22f, (float) b);
+            bands[b].gainDb = b % 2 == 0 ? -3.0f : 4.0f;
+            bands[b].q = 1.2f;
+        }
+        
+        EQFilterBank<float> bank;
+        bank.prepare(numChannels, timedBlockSize, kernels);
+        bank.setBands(bands, EQPlan::maxSections, sampleRate);
+        
+        juce::AudioBuffer<float> noise(numChannels, timedBlockSize), buffer(numChannels, timedBlockSize);
+        juce::Random random(3);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            for (int i = 0; i < timedBlockSize; ++i)
+                noise.setSample(channel, i, random.nextFloat() - 0.5f);
+        
+        double seconds = 0.0;
+        
+        for (int block = 0; block < numTimedBlocks; ++block)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.copyFrom(channel, 0, noise, channel, 0, timedBlockSize);
+            
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            bank.process(buffer);
+            seconds += juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        }
+        
+        return seconds * 1.0e9 / ((double) numTimedBlocks * timedBlockSize * numChannels * EQPlan::maxSections);
+    };
+    
+    auto logTimes = [&] (const DSPKernels& kernels)
+    {
+        log("  " + DSPKernels::getVariantName(kernels.variant) + ": " + juce::String(timeBiquads(kernels, 2), 2)
+            + " ns per band per channel-sample on 2 channels, " + juce::String(timeBiquads(kernels, 16), 2) + " ns on 16");
+    };
+    
+    log("Biquad time, 32 bands:");
+    logTimes(DSPKernels::get(Variant::Generic));
+    
+    int numCompared = 0;
+    
+    for (auto variant : { Variant::SSE2, Variant::AVX2, Variant::AVX512, Variant::Neon })
+    {
+        auto name = DSPKernels::getVariantName(variant);
+        
+        if (!DSPKernels::isSupported(variant))
+        {
+            log("  " + name + ": not supported here, skipped");
+            continue;
+        }
+        
+        const auto& generic = DSPKernels::get(Variant::Generic);
+        const auto& kernels = DSPKernels::get(variant);
+        int numDiffering = 0;
+        
+        for (auto numChannels : { 1, 2, 3, 5, 8, 13, 16, 24 })
+        {
+            for (juce::int64 seed = 1; seed <= 3; ++seed)
+            {
+                if (!isIdentical(runChain(generic, numChannels, seed), runChain(kernels, numChannels, seed)))
+                {
+                    log("  " + name + " differs from Generic on " + juce::String(numChannels) + " channels, seed "
+                        + juce::String(seed));
+                    ++numDiffering;
+                }
+            }
+        }
+        
+        for (juce::int64 seed = 1; seed <= 3; ++seed)
+        {
+            auto expected = runOthers(generic, seed);
+            auto actual = runOthers(kernels, seed);
+            
+            if (std::memcmp(expected.begin(), actual.begin(), sizeof(float) * (size_t) expected.size()) != 0)
+            {
+                log("  " + name + "'s metering, copy, mix or FFT kernels differ from Generic, seed " + juce::String(seed));
+                ++numDiffering;
+            }
+        }
+        
+        logTimes(kernels);
+        log("  " + name + " (" + juce::String(kernels.biquadLanes) + " lanes): "
+            + (numDiffering == 0 ? juce::String("identical to Generic") : juce::String(numDiffering) + " cases differ"));
+        expect(numDiffering == 0, name + " to give the same output as Generic, bit for bit");
+        ++numCompared;
+    }
+    
+    if (numCompared == 0)
+        log("Only Generic is supported here; nothing to compare");
+}
+
+//==============================================================================
+void SelfTest::onMessageThread(std::function<void()> function)
+{
+    // Shared with the call, so a test being stopped can return without it:
+    // once this holds the lock, the call has either finished or won't run
+    struct Call
+    {
+        juce::CriticalSection lock;
+        bool cancelled = false;
+        juce::WaitableEvent done;
+    };
+    
+    auto call = std::make_shared<Call>();
+    
+    juce::MessageManager::callAsync([function = std::move(function), call]
+    {
+        const juce::ScopedLock lock(call->lock);
+        
+        if (!call->cancelled)
+            function();
+        
+        call->done.signal();
+    });
+    
+    // The message thread may be waiting in stopThread() for this one, so a
+    // call still queued is cancelled rather than waited for
+    while (!call->done.wait(100))
+    {
+        if (threadShouldExit())
+        {
+            const juce::ScopedLock lock(call->lock);
+            call->cancelled = true;
+            return;
+        }
+    }
+}
+
+bool SelfTest::waitFor(std::function<bool()> condition, double timeoutSeconds)
+{
+    auto deadlineMs = juce::Time::getMillisecondCounterHiRes() + timeoutSeconds * 1000.0;
+    
+    for (;;)
+    {
+        bool holds = false;
+        onMessageThread([&] { holds = condition(); });
+        
+        if (holds)
+            return true;
+        
+        if (juce::Time::getMillisecondCounterHiRes() > deadlineMs || !sleep(0.02))
+            return false;
+    }
+}
+
+bool SelfTest::sleep(double seconds)
+{
+    auto endMs = juce::Time::getMillisecondCounterHiRes() + seconds * 1000.0;
+    
+    for (;;)
+    {
+        auto remainingMs = endMs - juce::Time::getMillisecondCounterHiRes();
+        
+        if (threadShouldExit())
+            return false;
+        
+        if (remainingMs <= 0.0)
+            return true;
+        
+        wait(juce::jmin(100.0, remainingMs));
+    }
+}
+
+void SelfTest::expect(bool condition, const juce::String& description)
+{
+    if (condition)
+        return;
+    
+    log("  Expected " + description);
+    ++numFailures;
+}
+
+void SelfTest::log(const juce::String& message)
+{
+    // Straight to stdout, so CI logs show it in release builds too
+    std::cout << message << std::endl;
+}
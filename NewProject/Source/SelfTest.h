@@ -0,0 +1,139 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "AudioServer.h"
+
+//==============================================================================
+/**
+ * SelfTest runs AudioServer against a SyntheticAudioDevice with no window, so
+ * its real-time behaviour can be checked on headless CI:
+ *
+ *     MacEQ --self-test                           every check
+ *     MacEQ --self-test=soak --soak-seconds=3600  one check, for an hour
+ *
+ * Checks run one after another on a thread of their own, driving the server
+ * from the message thread as the app would. Each logs what it measured and
+ * every expectation that failed. When they are done the app quits with the
+ * number of failed checks as its exit code.
+ *
+ * - soak: an accelerated device under a stream of band changes, with clock
+ *   drift, a format change, and the device disappearing and coming back.
+ *   Expects finite output, no more than 0.1% of callbacks over their
+ *   deadline, no accelerated callback promoted to real-time, resident
+ *   memory to stop growing once the new format has been allocated for, and
+ *   the server to measure the drift to within 1 ppm.
+ * - measurement: sweeps through a simulated room with noise and distortion.
+ *   Expects the latency the device adds, an impulse response that matches
+ *   the room's, and the distortion that was put in.
+ * - governor: an accelerated device with more busy threads than cores.
+ *   Expects the quality governor to step down under the load and back up to
+ *   full quality once it has gone.
+ * - realtime: a real-time device at 48 kHz in 64-sample blocks with every
+ *   core busy, for 10 seconds at normal priority and 10 with the default
+ *   real-time settings. Where the audio thread gets SCHED_FIFO, expects no
+ *   more missed deadlines than at normal priority, and at most 1%.
+ * - background: a real-time device under an EQ, switched between direct and
+ *   high-latency processing four times mid-stream. Expects no jump in the
+ *   output beyond what the fades allow, no worker underruns at the default
+ *   block size, and reports the added latency and the CPU saved.
+ * - metrics: the metrics exporter on a free port while a real-time device
+ *   runs, scraped twice over a socket as a monitoring agent would. Expects
+ *   200 OK, an xrun count no higher than the device's, and a callback load
+ *   histogram whose buckets are cumulative, end in +Inf at its count, and
+ *   grow between scrapes.
+ * - autoeq: fits bands to a response made from known bands, offline. Expects
+ *   the fitted bands to correct it to within 0.25 dB RMS and 1 dB at worst,
+ *   in under 5 seconds.
+ * - response: the EQ curve's ResponseEvaluator against the exact biquad
+ *   magnitudes, for every band type at 10 Hz to 20 kHz and Q from 0.1 to 40,
+ *   alone, combined and while one band is dragged. Expects 0.01 dB or better
+ *   wherever the response is above -60 dB.
+ * - accuracy: ChainAnalyser on five typical presets at 44.1 to 192 kHz, on a
+ *   real ProcessorChain. Expects every case within its default tolerances:
+ *   0.01 dB and 0.1 degrees of the curve, THD+N below -100 dB, a noise floor
+ *   below -110 dBFS and the float path within -90 dB of double.
+ * - precision: the error of float and double filter state against an
+ *   extended-precision reference, for bells and low shelves from 0.0001 to
+ *   0.1 of the sample rate, and float and double throughput. Expects double
+ *   state below -150 dBFS, and the state EQPlan picks below -120 dBFS.
+ * - crossover: CrossoverStage's ways summed, for LR4 and LR8 with 2 to 4
+ *   ways, and where each way of 5.1 and 7.1 goes, with and without bass
+ *   management, then the time a 7.1 three-way split takes. Expects the sum
+ *   within 0.01 dB of flat and every input to reach exactly its outputs.
+ * - compressor: CompressorStage on a loud tone over 64 unlinked channels,
+ *   and over fewer channels than it was prepared for, then its time per
+ *   32-sample block for 2 and 8 channels with 3 and 5 bands. Expects every
+ *   channel compressed, and a narrower block linked as if prepared for it.
+ * - svf: the time 8 bells take per channel-sample in 512-sample blocks on 2
+ *   and 8 channels, as biquads, settled SVFs, always-gliding SVFs and
+ *   biquads redesigned every sample. Expects settled SVFs to stop gliding,
+ *   moved ones to keep gliding, and finite output.
+ * - kernels: every DSPKernels variant this CPU supports against Generic, on
+ *   random bands, gliding SVFs and compressor settings over 1 to 24
+ *   channels, and the other kernels on random data of odd lengths. Forces
+ *   each variant, since the chain uses Generic for mono and stereo. Expects
+ *   bit-identical output.
+ */
+class SelfTest : private juce::Thread
+{
+public:
+    //==============================================================================
+    using Finished = std::function<void(int numFailedChecks)>;
+    
+    static constexpr double defaultSoakSeconds = 60.0;
+    
+    // Whether the command line asks for a self-test
+    static bool isRequested(const juce::String& commandLine);
+    
+    // Message thread. Starts straight away; onFinished is called on the
+    // message thread.
+    SelfTest(const juce::String& commandLine, Finished onFinished);
+    ~SelfTest() override;
+    
+private:
+    //==============================================================================
+    struct Check
+    {
+        juce::String name;
+        void (SelfTest::*function)();
+    };
+    
+    void run() override;
+    void runSoak();
+    void runMeasurement();
+    void runGovernor();
+    void runRealtime();
+    void runBackground();
+    void runMetrics();
+    void runAutoEQ();
+    void runResponse();
+    void runAccuracy();
+    void runPrecision();
+    void runCrossover();
+    void runCompressor();
+    void runSvf();
+    void runKernels();
+    
+    // Runs the function on the message thread and waits for it. If the test
+    // is stopped first, a call that hasn't started is cancelled.
+    void onMessageThread(std::function<void()> function);
+    
+    // Polls the condition on the message thread until it holds
+    bool waitFor(std::function<bool()> condition, double timeoutSeconds);
+    
+    // Sleeps, returning false if the test is being stopped
+    bool sleep(double seconds);
+    
+    void expect(bool condition, const juce::String& description);
+    static void log(const juce::String& message);
+    
+    //==============================================================================
+    juce::StringArray requestedChecks;
+    double soakSeconds = defaultSoakSeconds;
+    Finished onFinished;
+    
+    AudioServer server;
+    int numFailures = 0;                // In the running check
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SelfTest)
+};
@@ -0,0 +1,576 @@
+#include "SyntheticAudioDevice.h"
+
+//==============================================================================
+namespace
+{
+    void storeMax(std::atomic<double>& target, double value)
+    {
+        auto current = target.load(std::memory_order_relaxed);
+        
+        while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+    
+    template <size_t numBins>
+    void addToHistogram(std::array<std::atomic<juce::uint32>, numBins>& histogram, double binWidth, double value)
+    {
+        auto bin = juce::jlimit(0, (int) numBins - 1, (int) (value / binWidth));
+        histogram[(size_t) bin].fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Upper edge of the bin holding the given fraction of the values
+    template <size_t numBins>
+    double getPercentile(const std::array<std::atomic<juce::uint32>, numBins>& histogram, double binWidth, double fraction)
+    {
+        juce::uint64 total = 0;
+        
+        for (auto& count : histogram)
+            total += count.load(std::memory_order_relaxed);
+        
+        if (total == 0)
+            return 0.0;
+        
+        auto target = (juce::uint64) std::ceil(fraction * (double) total);
+        juce::uint64 sum = 0;
+        
+        for (size_t bin = 0; bin < numBins; ++bin)
+        {
+            sum += histogram[bin].load(std::memory_order_relaxed);
+            
+            if (sum >= target)
+                return (double) (bin + 1) * binWidth;
+        }
+        
+        return (double) numBins * binWidth;
+    }
+    
+    // Streams through more memory than the caches hold, so it competes with
+    // the callback for the memory bus as well as the CPU
+    class LoadThread : public juce::Thread
+    {
+    public:
+        explicit LoadThread(int index)
+            : juce::Thread("Synthetic Load " + juce::String(index))
+        {
+        }
+        
+        void run() override
+        {
+            constexpr int numValues = 8 * 1024 * 1024;
+            juce::HeapBlock<float> data((size_t) numValues, true);
+            
+            while (!threadShouldExit())
+                for (int i = 0; i < numValues; i += 16)
+                    data[i] += 1.0f;
+        }
+    };
+}
+
+//==============================================================================
+SyntheticAudioDevice::SyntheticAudioDevice(const Settings& deviceSettings, SyntheticAudioDeviceType& deviceType)
+    : juce::AudioIODevice(deviceSettings.deviceName, SyntheticAudioDeviceType::typeName),
+      juce::Thread("Synthetic Audio Device"),
+      settings(deviceSettings),
+      type(&deviceType)
+{
+    jitterMs.store(juce::jmax(0.0, settings.jitterMs));
+    driftPpm.store(settings.driftPpm);
+}
+
+SyntheticAudioDevice::~SyntheticAudioDevice()
+{
+    close();
+}
+
+juce::Array<float> SyntheticAudioDevice::createRoomResponse(double sampleRate, float decaySeconds, juce::int64 seed)
+{
+    juce::Random random(seed);
+    juce::Array<float> response;
+    
+    auto length = juce::jmax(1, juce::roundToInt(decaySeconds * sampleRate));
+    auto directSample = juce::roundToInt(0.002 * sampleRate);
+    auto tailStart = juce::roundToInt(0.005 * sampleRate);
+    auto decayRate = std::log(1000.0) / (decaySeconds * sampleRate);
+    
+    response.insertMultiple(0, 0.0f, juce::jmax(length, directSample + 1));
+    response.set(directSample, 0.5f);
+    
+    // Reflections, duller as they go on
+    float lowpassed = 0.0f;
+    
+    for (int i = tailStart; i < length; ++i)
+    {
+        auto noise = random.nextFloat() * 2.0f - 1.0f;
+        auto coefficient = (float) juce::jmin(0.9, 0.2 + 0.7 * i / length);
+        lowpassed += (1.0f - coefficient) * (noise - lowpassed);
+        response.set(i, response[i] + 0.1f * lowpassed * (float) std::exp(-decayRate * (i - tailStart)));
+    }
+    
+    return response;
+}
+
+//==============================================================================
+juce::StringArray SyntheticAudioDevice::getOutputChannelNames()
+{
+    juce::StringArray names;
+    
+    for (int channel = 0; channel < settings.numOutputChannels; ++channel)
+        names.add("Output " + juce::String(channel + 1));
+    
+    return names;
+}
+
+juce::StringArray SyntheticAudioDevice::getInputChannelNames()
+{
+    juce::StringArray names;
+    
+    for (int channel = 0; channel < settings.numInputChannels; ++channel)
+        names.add("Input " + juce::String(channel + 1));
+    
+    return names;
+}
+
+juce::String SyntheticAudioDevice::open(const juce::BigInteger& inputChannels,
+                                        const juce::BigInteger& outputChannels,
+                                        double sampleRate,
+                                        int bufferSizeSamples)
+{
+    close();
+    
+    if (disappeared)
+    {
+        lastError = "Device is no longer available";
+        return lastError;
+    }
+    
+    currentSampleRate = sampleRate > 0.0 ? sampleRate : settings.defaultSampleRate;
+    currentBufferSize = bufferSizeSamples > 0 ? bufferSizeSamples : settings.defaultBufferSize;
+    
+    activeInputs = inputChannels;
+    activeInputs.setRange(settings.numInputChannels, juce::jmax(0, activeInputs.getHighestBit() + 1), false);
+    activeOutputs = outputChannels;
+    activeOutputs.setRange(settings.numOutputChannels, juce::jmax(0, activeOutputs.getHighestBit() + 1), false);
+    
+    allocateBuffers();
+    
+    opened = true;
+    lastError = {};
+    
+    DBG("Synthetic device opened: " + juce::String(currentSampleRate.load()) + " Hz, "
+        + juce::String(currentBufferSize.load()) + " samples");
+    return {};
+}
+
+void SyntheticAudioDevice::close()
+{
+    stop();
+    opened = false;
+}
+
+void SyntheticAudioDevice::start(juce::AudioIODeviceCallback* newCallback)
+{
+    if (!opened || newCallback == nullptr || isThreadRunning())
+        return;
+    
+    newCallback->audioDeviceAboutToStart(this);
+    
+    {
+        const juce::ScopedLock sl(callbackLock);
+        callback = newCallback;
+    }
+    
+    for (int i = 0; i < settings.numLoadThreads; ++i)
+    {
+        loadThreads.add(new LoadThread(i + 1));
+        loadThreads.getLast()->startThread();
+    }
+    
+    // Spinning back to back, the thread shouldn't also preempt everything
+    // else on a CI machine
+    if (settings.accelerated)
+        startThread();
+    else
+        startRealtimeThread(juce::Thread::RealtimeOptions().withApproximateAudioProcessingTime(currentBufferSize.load(),
+                                                                                              currentSampleRate.load()));
+}
+
+void SyntheticAudioDevice::stop()
+{
+    stopThread(2000);
+    loadThreads.clear();
+    
+    juce::AudioIODeviceCallback* oldCallback = nullptr;
+    
+    {
+        const juce::ScopedLock sl(callbackLock);
+        std::swap(oldCallback, callback);
+    }
+    
+    if (oldCallback != nullptr)
+        oldCallback->audioDeviceStopped();
+}
+
+//==============================================================================
+void SyntheticAudioDevice::simulateFormatChange(double newSampleRate, int newBufferSize)
+{
+    pendingSampleRate.store(newSampleRate > 0.0 ? newSampleRate : currentSampleRate.load());
+    pendingBufferSize.store(newBufferSize > 0 ? newBufferSize : currentBufferSize.load());
+    formatChangePending.store(true);
+}
+
+void SyntheticAudioDevice::simulateDisappearance()
+{
+    disappeared.store(true);
+}
+
+SyntheticAudioDevice::Statistics SyntheticAudioDevice::getStatistics() const
+{
+    Statistics statistics;
+    statistics.numCallbacks = numCallbacks.load();
+    statistics.numSamples = numSamples.load();
+    statistics.numDeadlineMisses = deadlineMisses.load();
+    statistics.numNonFiniteBlocks = nonFiniteBlocks.load();
+    statistics.numFormatChanges = formatChanges.load();
+    statistics.maxCallbackMs = maxCallbackMs.load();
+    statistics.p99CallbackMs = getPercentile(callbackHistogram, histogramBinMs, 0.99);
+    statistics.p999CallbackMs = getPercentile(callbackHistogram, histogramBinMs, 0.999);
+    statistics.maxLoad = maxLoad.load();
+    statistics.maxOutputStep = maxOutputStep.load();
+    statistics.maxWakeLatencyMs = maxWakeLatencyMs.load();
+    statistics.p99WakeLatencyMs = getPercentile(wakeHistogram, histogramBinMs, 0.99);
+    statistics.p999WakeLatencyMs = getPercentile(wakeHistogram, histogramBinMs, 0.999);
+    statistics.deviceSeconds = deviceSeconds.load();
+    statistics.wallSeconds = wallSeconds.load();
+    
+    if (statistics.numCallbacks > 0)
+        statistics.meanCallbackMs = totalCallbackMs.load() / (double) statistics.numCallbacks;
+    
+    return statistics;
+}
+
+//==============================================================================
+void SyntheticAudioDevice::allocateBuffers()
+{
+    auto bufferSize = currentBufferSize.load();
+    inputBuffer.setSize(juce::jmax(1, settings.numInputChannels), bufferSize);
+    outputBuffer.setSize(juce::jmax(1, settings.numOutputChannels), bufferSize);
+    inputPointers.calloc((size_t) juce::jmax(1, settings.numInputChannels));
+    outputPointers.calloc((size_t) juce::jmax(1, settings.numOutputChannels));
+    inputBuffer.clear();
+    outputBuffer.clear();
+    
+    auto roomLength = settings.roomResponse.size();
+    
+    if (roomLength > 0)
+    {
+        roomKernel.malloc((size_t) roomLength);
+        roomHistory.calloc((size_t) roomLength * 2);
+        roomOutput.setSize(1, bufferSize);
+        roomOutput.clear();
+        roomPosition = 0;
+        
+        for (int i = 0; i < roomLength; ++i)
+            roomKernel[i] = settings.roomResponse[roomLength - 1 - i];
+    }
+}
+
+void SyntheticAudioDevice::applyFormatChange()
+{
+    // Hardware stops and restarts its client on a format change, from its
+    // own thread
+    const juce::ScopedLock sl(callbackLock);
+    
+    if (callback != nullptr)
+        callback->audioDeviceStopped();
+    
+    currentSampleRate = pendingSampleRate.load();
+    currentBufferSize = pendingBufferSize.load();
+    allocateBuffers();
+    formatChanges.fetch_add(1, std::memory_order_relaxed);
+    
+    DBG("Synthetic device format changed: " + juce::String(currentSampleRate.load()) + " Hz, "
+        + juce::String(currentBufferSize.load()) + " samples");
+    
+    if (callback != nullptr)
+        callback->audioDeviceAboutToStart(this);
+}
+
+void SyntheticAudioDevice::fillInputs(int numSamplesToFill)
+{
+    auto level = juce::Decibels::decibelsToGain(settings.inputLevelDb);
+    auto increment = juce::MathConstants<double>::twoPi * settings.inputFrequency / currentSampleRate.load();
+    auto* first = inputBuffer.getWritePointer(0);
+    
+    if (!settings.roomResponse.isEmpty())
+    {
+        // The last block's output, after the room, over the background noise
+        auto noiseLevel = juce::Decibels::decibelsToGain(settings.roomNoiseDb) * std::sqrt(3.0f);
+        auto* heard = roomOutput.getReadPointer(0);
+        
+        for (int i = 0; i < numSamplesToFill; ++i)
+            first[i] = heard[i] + noiseLevel * (random.nextFloat() * 2.0f - 1.0f);
+    }
+    else
+    {
+        for (int i = 0; i < numSamplesToFill; ++i)
+        {
+            first[i] = level * (float) std::sin(inputPhase);
+            inputPhase += increment;
+        }
+        
+        inputPhase = std::fmod(inputPhase, juce::MathConstants<double>::twoPi);
+    }
+    
+    for (int channel = 1; channel < settings.numInputChannels; ++channel)
+        inputBuffer.copyFrom(channel, 0, first, numSamplesToFill);
+    
+    int numActive = 0;
+    
+    for (int channel = 0; channel < settings.numInputChannels; ++channel)
+        if (activeInputs[channel])
+            inputPointers[numActive++] = inputBuffer.getReadPointer(channel);
+}
+
+void SyntheticAudioDevice::checkOutputs(int numSamplesToCheck)
+{
+    // Carried across blocks, so a click at a block boundary counts too
+    auto* first = outputBuffer.getReadPointer(0);
+    auto largestStep = 0.0f;
+    
+    for (int i = 0; i < numSamplesToCheck; ++i)
+    {
+        largestStep = juce::jmax(largestStep, std::abs(first[i] - lastOutputSample));
+        lastOutputSample = first[i];
+    }
+    
+    storeMax(maxOutputStep, largestStep);
+    
+    for (int channel = 0; channel < settings.numOutputChannels; ++channel)
+    {
+        auto* data = outputBuffer.getReadPointer(channel);
+        
+        for (int i = 0; i < numSamplesToCheck; ++i)
+        {
+            if (!std::isfinite(data[i]))
+            {
+                nonFiniteBlocks.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+}
+
+void SyntheticAudioDevice::playThroughRoom(int numSamplesToPlay)
+{
+    auto roomLength = settings.roomResponse.size();
+    
+    if (roomLength == 0)
+        return;
+    
+    auto distortion = settings.roomDistortion;
+    auto* played = outputBuffer.getReadPointer(0);
+    auto* heard = roomOutput.getWritePointer(0);
+    
+    for (int i = 0; i < numSamplesToPlay; ++i)
+    {
+        auto x = played[i];
+        x += distortion * (x * x + x * x * x);
+        
+        roomPosition = (roomPosition + 1) % roomLength;
+        roomHistory[roomPosition] = x;
+        roomHistory[roomPosition + roomLength] = x;
+        
+        // Oldest first, ending with this sample
+        const auto* window = roomHistory + roomPosition + 1;
+        float sums[4] = {};
+        int j = 0;
+        
+        for (; j + 4 <= roomLength; j += 4)
+            for (int k = 0; k < 4; ++k)
+                sums[k] += window[j + k] * roomKernel[j + k];
+        
+        for (; j < roomLength; ++j)
+            sums[0] += window[j] * roomKernel[j];
+        
+        heard[i] = sums[0] + sums[1] + sums[2] + sums[3];
+    }
+}
+
+//==============================================================================
+void SyntheticAudioDevice::run()
+{
+    auto startMs = juce::Time::getMillisecondCounterHiRes();
+    auto startNs = (uint64_t) (startMs * 1.0e6);
+    
+    // Device clock time of the next block, in ms since starting
+    double blockStartMs = 0.0;
+    
+    while (!threadShouldExit())
+    {
+        if (disappeared)
+        {
+            {
+                const juce::ScopedLock sl(callbackLock);
+                
+                if (callback != nullptr)
+                    callback->audioDeviceError("Device disappeared");
+            }
+            
+            // The device manager closes the device once it sees the new list
+            juce::MessageManager::callAsync([weakType = type]
+            {
+                if (weakType != nullptr)
+                    weakType->deviceDisappeared();
+            });
+            
+            DBG("Synthetic device disappeared");
+            return;
+        }
+        
+        if (formatChangePending.exchange(false))
+            applyFormatChange();
+        
+        auto numSamplesInBlock = currentBufferSize.load();
+        auto sampleRate = currentSampleRate.load();
+        auto clockRate = sampleRate * (1.0 + driftPpm.load(std::memory_order_relaxed) * 1.0e-6);
+        auto blockMs = 1000.0 * numSamplesInBlock / clockRate;
+        
+        if (!settings.accelerated)
+        {
+            auto wakeMs = startMs + blockStartMs + random.nextDouble() * jitterMs.load(std::memory_order_relaxed);
+            
+            for (;;)
+            {
+                auto remainingMs = wakeMs - juce::Time::getMillisecondCounterHiRes();
+                
+                if (remainingMs <= 0.0 || threadShouldExit())
+                    break;
+                
+                // Sleep most of the way, then yield for precision
+                if (remainingMs > 2.0)
+                    wait((int) remainingMs - 1);
+                else
+                    juce::Thread::yield();
+            }
+            
+            if (threadShouldExit())
+                break;
+            
+            auto wakeLatencyMs = juce::Time::getMillisecondCounterHiRes() - wakeMs;
+            addToHistogram(wakeHistogram, histogramBinMs, wakeLatencyMs);
+            storeMax(maxWakeLatencyMs, wakeLatencyMs);
+        }
+        
+        fillInputs(numSamplesInBlock);
+        
+        int numActiveOutputs = 0;
+        
+        for (int channel = 0; channel < settings.numOutputChannels; ++channel)
+            if (activeOutputs[channel])
+                outputPointers[numActiveOutputs++] = outputBuffer.getWritePointer(channel);
+        
+        auto hostTimeNs = startNs + (uint64_t) (blockStartMs * 1.0e6);
+        juce::AudioIODeviceCallbackContext context;
+        context.hostTimeNs = &hostTimeNs;
+        
+        auto callbackStartMs = juce::Time::getMillisecondCounterHiRes();
+        
+        {
+            const juce::ScopedLock sl(callbackLock);
+            
+            if (callback != nullptr)
+                callback->audioDeviceIOCallbackWithContext(inputPointers.getData(), activeInputs.countNumberOfSetBits(),
+                                                           outputPointers.getData(), numActiveOutputs,
+                                                           numSamplesInBlock, context);
+        }
+        
+        auto callbackEndMs = juce::Time::getMillisecondCounterHiRes();
+        auto callbackMs = callbackEndMs - callbackStartMs;
+        
+        checkOutputs(numSamplesInBlock);
+        playThroughRoom(numSamplesInBlock);
+        
+        // In real time the block is due one period after it was scheduled;
+        // accelerated, there is no schedule, so only the callback time counts
+        auto deadlineMs = settings.accelerated ? callbackStartMs + blockMs
+                                               : startMs + blockStartMs + blockMs;
+        
+        if (callbackEndMs > deadlineMs)
+            deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+        
+        numCallbacks.fetch_add(1, std::memory_order_relaxed);
+        numSamples.fetch_add(numSamplesInBlock, std::memory_order_relaxed);
+        totalCallbackMs.store(totalCallbackMs.load(std::memory_order_relaxed) + callbackMs, std::memory_order_relaxed);
+        storeMax(maxCallbackMs, callbackMs);
+        addToHistogram(callbackHistogram, histogramBinMs, callbackMs);
+        storeMax(maxLoad, callbackMs / blockMs);
+        
+        blockStartMs += blockMs;
+        deviceSeconds.store(deviceSeconds.load(std::memory_order_relaxed) + numSamplesInBlock / sampleRate,
+                            std::memory_order_relaxed);
+        wallSeconds.store((callbackEndMs - startMs) * 0.001, std::memory_order_relaxed);
+        
+        // Hardware that falls this far behind drops the audio rather than
+        // catching up with a burst of callbacks
+        if (!settings.accelerated && callbackEndMs - startMs > blockStartMs + 4.0 * blockMs)
+            blockStartMs = callbackEndMs - startMs;
+    }
+}
+
+//==============================================================================
+SyntheticAudioDeviceType::SyntheticAudioDeviceType(const SyntheticAudioDevice::Settings& deviceSettings)
+    : juce::AudioIODeviceType(typeName),
+      settings(deviceSettings)
+{
+}
+
+SyntheticAudioDeviceType::~SyntheticAudioDeviceType()
+{
+}
+
+void SyntheticAudioDeviceType::restoreDevice()
+{
+    if (!present.exchange(true))
+        callDeviceChangeListeners();
+}
+
+void SyntheticAudioDeviceType::deviceDisappeared()
+{
+    if (present.exchange(false))
+        callDeviceChangeListeners();
+}
+
+juce::StringArray SyntheticAudioDeviceType::getDeviceNames(bool wantInputNames) const
+{
+    juce::ignoreUnused(wantInputNames);
+    
+    if (!present)
+        return {};
+    
+    return { settings.deviceName };
+}
+
+int SyntheticAudioDeviceType::getDefaultDeviceIndex(bool forInput) const
+{
+    juce::ignoreUnused(forInput);
+    return present ? 0 : -1;
+}
+
+int SyntheticAudioDeviceType::getIndexOfDevice(juce::AudioIODevice* device, bool asInput) const
+{
+    juce::ignoreUnused(asInput);
+    return device != nullptr && present && device->getName() == settings.deviceName ? 0 : -1;
+}
+
+juce::AudioIODevice* SyntheticAudioDeviceType::createDevice(const juce::String& outputDeviceName,
+                                                            const juce::String& inputDeviceName)
+{
+    if (!present)
+        return nullptr;
+    
+    if (outputDeviceName != settings.deviceName && inputDeviceName != settings.deviceName)
+        return nullptr;
+    
+    return new SyntheticAudioDevice(settings, *this);
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+class SyntheticAudioDeviceType;
+
+//==============================================================================
+/**
+ * SyntheticAudioDevice is an audio device with no hardware behind it, so the
+ * real-time behaviour of AudioServer can be tested on any machine, including
+ * headless Linux CI.
+ *
+ * A thread drives the callback from a high-resolution clock at the chosen
+ * rate, block size and channel count, feeding each input a sine. Faults can be
+ * injected while it runs:
+ *
+ * - jitter delays each callback by a random amount up to the given time
+ * - drift runs the device clock fast or slow by some parts per million
+ * - a format change restarts the callback at a new rate and block size, as
+ *   hardware does when another app changes it
+ * - disappearance removes the device, as unplugging it would
+ *
+ * For testing measurements end to end the inputs can instead hear output 1
+ * played through a simulated room, a block later, with noise and distortion.
+ *
+ * In accelerated mode the callback runs back to back with no waiting, so a
+ * soak test covers hours of audio in minutes. Time still advances by the
+ * device clock in the callback's host time, and a callback that took longer
+ * than its block lasts counts as a missed deadline either way.
+ *
+ * Create these through SyntheticAudioDeviceType, which AudioServer installs
+ * with initializeSynthetic().
+ */
+class SyntheticAudioDevice : public juce::AudioIODevice,
+                             private juce::Thread
+{
+public:
+    //==============================================================================
+    struct Settings
+    {
+        juce::String deviceName = "Synthetic";
+        juce::Array<double> sampleRates { 44100.0, 48000.0, 88200.0, 96000.0, 192000.0 };
+        juce::Array<int> bufferSizes { 32, 64, 128, 256, 512, 1024, 2048 };
+        double defaultSampleRate = 48000.0;
+        int defaultBufferSize = 512;
+        int numInputChannels = 2;
+        int numOutputChannels = 2;
+        
+        // Input stimulus: a sine on every channel
+        float inputFrequency = 997.0f;
+        float inputLevelDb = -20.0f;
+        
+        // Or, with an impulse response here, output 1 played through it into
+        // every input, e.g. from createRoomResponse(). It is convolved
+        // directly, so keep it to a few hundred milliseconds.
+        juce::Array<float> roomResponse;
+        float roomNoiseDb = -100.0f;    // RMS
+        float roomDistortion = 0.0f;    // Of the x^2 and x^3 terms added ahead of the room
+        
+        // Faults, also adjustable while running
+        double jitterMs = 0.0;
+        double driftPpm = 0.0;
+        
+        bool accelerated = false;       // Run callbacks back to back for soak tests
+        
+        // Busy threads competing with the callback for CPU and memory, to
+        // show what real-time scheduling is worth
+        int numLoadThreads = 0;
+    };
+    
+    struct Statistics
+    {
+        juce::int64 numCallbacks = 0;
+        juce::int64 numSamples = 0;
+        int numDeadlineMisses = 0;      // Callbacks that overran their block
+        int numNonFiniteBlocks = 0;     // Blocks whose output held a NaN or infinity
+        double maxOutputStep = 0.0;     // Largest jump between two samples of output 1, where clicks show
+        int numFormatChanges = 0;
+        double meanCallbackMs = 0.0;
+        double maxCallbackMs = 0.0;
+        double p99CallbackMs = 0.0;
+        double p999CallbackMs = 0.0;
+        double maxLoad = 0.0;           // Worst callback time as a fraction of its block
+        
+        // How late the thread woke for each block, in real time only
+        double maxWakeLatencyMs = 0.0;
+        double p99WakeLatencyMs = 0.0;
+        double p999WakeLatencyMs = 0.0;
+        
+        double deviceSeconds = 0.0;     // Audio delivered, at the nominal sample rate
+        double wallSeconds = 0.0;       // Real time the device has been running
+    };
+    
+    //==============================================================================
+    ~SyntheticAudioDevice() override;
+    
+    // A room to measure: the direct sound after 2 ms, then an exponentially
+    // decaying tail that is 60 dB down after decaySeconds
+    static juce::Array<float> createRoomResponse(double sampleRate, float decaySeconds = 0.2f, juce::int64 seed = 1);
+    
+    // Fault injection, from any thread
+    void setJitterMs(double newJitterMs) { jitterMs.store(juce::jmax(0.0, newJitterMs)); }
+    void setDriftPpm(double newDriftPpm) { driftPpm.store(newDriftPpm); }
+    void simulateFormatChange(double newSampleRate, int newBufferSize);
+    void simulateDisappearance();
+    
+    Statistics getStatistics() const;
+    
+    bool isAccelerated() const { return settings.accelerated; }
+    
+    //==============================================================================
+    juce::StringArray getOutputChannelNames() override;
+    juce::StringArray getInputChannelNames() override;
+    juce::Array<double> getAvailableSampleRates() override { return settings.sampleRates; }
+    juce::Array<int> getAvailableBufferSizes() override { return settings.bufferSizes; }
+    int getDefaultBufferSize() override { return settings.defaultBufferSize; }
+    
+    juce::String open(const juce::BigInteger& inputChannels,
+                      const juce::BigInteger& outputChannels,
+                      double sampleRate,
+                      int bufferSizeSamples) override;
+    void close() override;
+    bool isOpen() override { return opened; }
+    
+    void start(juce::AudioIODeviceCallback* newCallback) override;
+    void stop() override;
+    bool isPlaying() override { return isThreadRunning(); }
+    
+    juce::String getLastError() override { return lastError; }
+    int getCurrentBufferSizeSamples() override { return currentBufferSize.load(); }
+    double getCurrentSampleRate() override { return currentSampleRate.load(); }
+    int getCurrentBitDepth() override { return 32; }
+    juce::BigInteger getActiveOutputChannels() const override { return activeOutputs; }
+    juce::BigInteger getActiveInputChannels() const override { return activeInputs; }
+    int getOutputLatencyInSamples() override { return currentBufferSize.load(); }
+    int getInputLatencyInSamples() override { return currentBufferSize.load(); }
+    int getXRunCount() const noexcept override { return deadlineMisses.load(std::memory_order_relaxed); }
+    
+private:
+    friend class SyntheticAudioDeviceType;
+    
+    SyntheticAudioDevice(const Settings& settings, SyntheticAudioDeviceType& type);
+    
+    void run() override;
+    
+    void allocateBuffers();
+    void applyFormatChange();
+    void fillInputs(int numSamples);
+    void checkOutputs(int numSamples);
+    void playThroughRoom(int numSamples);
+    
+    //==============================================================================
+    const Settings settings;
+    juce::WeakReference<SyntheticAudioDeviceType> type;
+    
+    bool opened = false;
+    juce::String lastError;
+    
+    // Written by the device thread on a format change, read from any
+    std::atomic<double> currentSampleRate { 48000.0 };
+    std::atomic<int> currentBufferSize { 512 };
+    juce::BigInteger activeInputs, activeOutputs;
+    
+    juce::CriticalSection callbackLock;
+    juce::AudioIODeviceCallback* callback = nullptr;
+    
+    // Device thread
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+    juce::HeapBlock<const float*> inputPointers;
+    juce::HeapBlock<float*> outputPointers;
+    double inputPhase = 0.0;
+    float lastOutputSample = 0.0f;
+    juce::Random random;
+    
+    // The room's reversed impulse response, and the output's recent history
+    // twice over, so the convolution always reads it in one run
+    juce::HeapBlock<float> roomKernel, roomHistory;
+    juce::AudioBuffer<float> roomOutput;
+    int roomPosition = 0;
+    
+    std::atomic<double> jitterMs { 0.0 };
+    std::atomic<double> driftPpm { 0.0 };
+    std::atomic<bool> formatChangePending { false };
+    std::atomic<double> pendingSampleRate { 0.0 };
+    std::atomic<int> pendingBufferSize { 0 };
+    std::atomic<bool> disappeared { false };
+    
+    juce::OwnedArray<juce::Thread> loadThreads;
+    
+    // Statistics, written by the device thread. Times are also kept in 10 us
+    // bins up to 20 ms for the percentiles; the last bin holds anything longer.
+    static constexpr int numHistogramBins = 2001;
+    static constexpr double histogramBinMs = 0.01;
+    
+    std::atomic<juce::int64> numCallbacks { 0 };
+    std::atomic<juce::int64> numSamples { 0 };
+    std::atomic<int> deadlineMisses { 0 };
+    std::atomic<int> nonFiniteBlocks { 0 };
+    std::atomic<int> formatChanges { 0 };
+    std::atomic<double> totalCallbackMs { 0.0 };
+    std::atomic<double> maxCallbackMs { 0.0 };
+    std::atomic<double> maxLoad { 0.0 };
+    std::atomic<double> maxOutputStep { 0.0 };
+    std::atomic<double> maxWakeLatencyMs { 0.0 };
+    std::array<std::atomic<juce::uint32>, numHistogramBins> callbackHistogram {};
+    std::array<std::atomic<juce::uint32>, numHistogramBins> wakeHistogram {};
+    std::atomic<double> deviceSeconds { 0.0 };
+    std::atomic<double> wallSeconds { 0.0 };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SyntheticAudioDevice)
+};
+
+//==============================================================================
+/**
+ * The device type that lists and creates a SyntheticAudioDevice, so it can be
+ * added to an AudioDeviceManager like any other driver.
+ */
+class SyntheticAudioDeviceType : public juce::AudioIODeviceType
+{
+public:
+    static constexpr const char* typeName = "Synthetic";
+    
+    explicit SyntheticAudioDeviceType(const SyntheticAudioDevice::Settings& settings);
+    ~SyntheticAudioDeviceType() override;
+    
+    // Lists the device again after simulateDisappearance()
+    void restoreDevice();
+    
+    //==============================================================================
+    void scanForDevices() override {}
+    juce::StringArray getDeviceNames(bool wantInputNames = false) const override;
+    int getDefaultDeviceIndex(bool forInput) const override;
+    int getIndexOfDevice(juce::AudioIODevice* device, bool asInput) const override;
+    bool hasSeparateInputsAndOutputs() const override { return false; }
+    juce::AudioIODevice* createDevice(const juce::String& outputDeviceName,
+                                      const juce::String& inputDeviceName) override;
+                                      
+private:
+    friend class SyntheticAudioDevice;
+    
+    void deviceDisappeared();
+    
+    const SyntheticAudioDevice::Settings settings;
+    std::atomic<bool> present { true };
+    
+    JUCE_DECLARE_WEAK_REFERENCEABLE(SyntheticAudioDeviceType)
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SyntheticAudioDeviceType)
+};
@@ -0,0 +1,293 @@
+#include "Tracing.h"
+
+//==============================================================================
+namespace
+{
+    // A slot in a ring. The dump reads slots while their owner may be
+    // overwriting them, so the fields are relaxed atomics, and a slot that
+    // changed under the dump is left out.
+    struct Event
+    {
+        std::atomic<juce::int64> ticks { 0 };
+        std::atomic<const char*> name { nullptr };
+        std::atomic<double> value { 0.0 };
+        std::atomic<juce::uint32> threadId { 0 };
+        std::atomic<juce::uint8> type { 0 };
+    };
+    
+    // What the dump copies out of a slot
+    struct EventCopy
+    {
+        juce::int64 ticks;
+        const char* name;
+        double value;
+        juce::uint32 threadId;
+        juce::uint8 type;
+    };
+    
+    // Written only by the thread that claimed it; the dump reads it while
+    // that thread may still be writing
+    struct ThreadRing
+    {
+        std::atomic<bool> claimed { false };
+        std::atomic<juce::uint32> threadId { 0 };
+        std::atomic<const char*> threadName { nullptr };
+        std::atomic<juce::uint64> numWritten { 0 };
+        std::unique_ptr<Event[]> events;
+    };
+    
+    std::array<ThreadRing, Tracing::maxThreads> rings;
+    std::atomic<juce::uint32> nextThreadId { 1 };
+    std::atomic<int> numDroppedThreads { 0 };
+    std::atomic<juce::int64> startTicks { 0 };
+    
+    // Hands the calling thread's ring back when the thread exits
+    struct ThreadSlot
+    {
+        ~ThreadSlot()
+        {
+            if (ring != nullptr)
+                ring->claimed.store(false, std::memory_order_release);
+        }
+        
+        ThreadRing* ring = nullptr;
+        bool dropped = false;
+    };
+    
+    thread_local ThreadSlot threadSlot;
+    
+    ThreadRing* getThreadRing() noexcept
+    {
+        auto& slot = threadSlot;
+        
+        if (slot.ring != nullptr || slot.dropped)
+            return slot.ring;
+        
+        // Unused rings first, so exited threads' events survive as long as
+        // there are rings to spare
+        for (auto reuse : { false, true })
+        {
+            for (auto& ring : rings)
+            {
+                if (ring.events == nullptr || (!reuse && ring.numWritten.load(std::memory_order_relaxed) > 0))
+                    continue;
+                
+                auto expected = false;
+                
+                if (ring.claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    // Earlier events in the ring keep the previous owner's id
+                    ring.threadId.store(nextThreadId.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+                    ring.threadName.store(nullptr, std::memory_order_relaxed);
+                    slot.ring = &ring;
+                    return slot.ring;
+                }
+            }
+        }
+        
+        slot.dropped = true;
+        numDroppedThreads.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    
+    juce::String escape(const char* text)
+    {
+        return juce::String(text).replace("\\", "\\\\").replace("\"", "\\\"");
+    }
+}
+
+//==============================================================================
+void Tracing::setEnabled(bool shouldBeEnabled)
+{
+    if (shouldBeEnabled)
+    {
+        // Rings are allocated once and kept, so a thread's pointer to its
+        // ring stays valid for good
+        for (auto& ring : rings)
+            if (ring.events == nullptr)
+                ring.events.reset(new Event[(size_t) eventsPerThread]);
+        
+        auto expected = (juce::int64) 0;
+        startTicks.compare_exchange_strong(expected, juce::Time::getHighResolutionTicks());
+    }
+    
+    enabled.store(shouldBeEnabled, std::memory_order_release);
+    DBG("Tracing " + juce::String(shouldBeEnabled ? "enabled" : "disabled"));
+}
+
+void Tracing::clear()
+{
+    jassert(!isEnabled());
+    
+    for (auto& ring : rings)
+        ring.numWritten.store(0, std::memory_order_relaxed);
+    
+    startTicks.store(juce::Time::getHighResolutionTicks());
+}
+
+int Tracing::getNumDroppedThreads()
+{
+    return numDroppedThreads.load(std::memory_order_relaxed);
+}
+
+//==============================================================================
+void Tracing::record(EventType type, const char* name, double value) noexcept
+{
+    auto* ring = getThreadRing();
+    
+    if (ring == nullptr)
+        return;
+    
+    auto index = ring->numWritten.load(std::memory_order_relaxed);
+    auto& event = ring->events[(size_t) (index & (eventsPerThread - 1))];
+    
+    // Keeps the count published for the previous event ahead of these
+    // writes, so a dump that sees any of them also sees the slot was reused
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    event.ticks.store(juce::Time::getHighResolutionTicks(), std::memory_order_relaxed);
+    event.name.store(name, std::memory_order_relaxed);
+    event.value.store(value, std::memory_order_relaxed);
+    event.threadId.store(ring->threadId.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    event.type.store((juce::uint8) type, std::memory_order_relaxed);
+    
+    ring->numWritten.store(index + 1, std::memory_order_release);
+}
+
+void Tracing::nameThread(const char* name) noexcept
+{
+    if (auto* ring = getThreadRing())
+        ring->threadName.store(name, std::memory_order_relaxed);
+}
+
+//==============================================================================
+juce::String Tracing::toJson()
+{
+    juce::MemoryOutputStream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    
+    auto isFirst = true;
+    
+    auto add = [&] (const juce::String& event)
+    {
+        if (!isFirst)
+            json << ",\n";
+        
+        json << event;
+        isFirst = false;
+    };
+    
+    auto start = startTicks.load();
+    auto microsecondsPerTick = 1.0e6 / (double) juce::Time::getHighResolutionTicksPerSecond();
+    juce::HeapBlock<EventCopy> copy((size_t) eventsPerThread);
+    
+    for (auto& ring : rings)
+    {
+        if (ring.events == nullptr)
+            continue;
+        
+        // Copy, then drop anything the owner may have overwritten meanwhile
+        auto numWritten = ring.numWritten.load(std::memory_order_acquire);
+        auto copyStart = numWritten > (juce::uint64) eventsPerThread ? numWritten - (juce::uint64) eventsPerThread : 0;
+        
+        for (auto index = copyStart; index < numWritten; ++index)
+        {
+            const auto& event = ring.events[(size_t) (index & (eventsPerThread - 1))];
+            copy[(int) (index - copyStart)] = { event.ticks.load(std::memory_order_relaxed),
+                                                event.name.load(std::memory_order_relaxed),
+                                                event.value.load(std::memory_order_relaxed),
+                                                event.threadId.load(std::memory_order_relaxed),
+                                                event.type.load(std::memory_order_relaxed) };
+        }
+        
+        // Pairs with the fence in record(): a slot rewritten during the copy
+        // shows up in this count, and is dropped below
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto numWrittenAfter = ring.numWritten.load(std::memory_order_relaxed);
+        auto first = copyStart;
+        
+        if (numWrittenAfter >= (juce::uint64) eventsPerThread)
+            first = juce::jmax(first, numWrittenAfter - (juce::uint64) eventsPerThread + 1);
+        
+        // The begin of an end near the start of the ring may have been
+        // overwritten, so track depth per thread and skip unmatched ends
+        juce::uint32 currentThread = 0;
+        int depth = 0;
+        
+        for (auto index = first; index < numWritten; ++index)
+        {
+            const auto& event = copy[(int) (index - copyStart)];
+            
+            if (event.threadId != currentThread)
+            {
+                currentThread = event.threadId;
+                depth = 0;
+            }
+            
+            auto common = "\"name\":\"" + escape(event.name) + "\",\"pid\":1,\"tid\":" + juce::String(event.threadId)
+                        + ",\"ts\":" + juce::String((double) (event.ticks - start) * microsecondsPerTick, 3);
+            
+            switch ((EventType) event.type)
+            {
+                case EventType::begin:
+                    ++depth;
+                    add("{\"ph\":\"B\"," + common + "}");
+                    break;
+                
+                case EventType::end:
+                    if (depth == 0)
+                        break;
+                    
+                    --depth;
+                    add("{\"ph\":\"E\"," + common + "}");
+                    break;
+                
+                case EventType::counter:
+                    add("{\"ph\":\"C\"," + common + ",\"args\":{\"value\":" + juce::String(event.value) + "}}");
+                    break;
+            }
+        }
+        
+        if (auto* threadName = ring.threadName.load(std::memory_order_relaxed))
+            add("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+                + juce::String(ring.threadId.load(std::memory_order_relaxed))
+                + ",\"args\":{\"name\":\"" + escape(threadName) + "\"}}");
+    }
+    
+    json << "]}\n";
+    return json.toString();
+}
+
+bool Tracing::writeJson(const juce::File& file, juce::String& errorMessage)
+{
+    if (file == juce::File())
+    {
+        errorMessage = "No trace file specified";
+        return false;
+    }
+    
+    if (!file.replaceWithText(toJson()))
+    {
+        errorMessage = "Could not write " + file.getFullPathName();
+        return false;
+    }
+    
+    DBG("Trace written to " + file.getFullPathName());
+    return true;
+}
+
+juce::File Tracing::getRequestedFile(const juce::String& commandLine)
+{
+    for (const auto& argument : juce::StringArray::fromTokens(commandLine, true))
+    {
+        if (argument.startsWith("--trace="))
+        {
+            auto path = argument.fromFirstOccurrenceOf("=", false, false).unquoted();
+            
+            if (path.isNotEmpty())
+                return juce::File::getCurrentWorkingDirectory().getChildFile(path);
+        }
+    }
+    
+    return {};
+}
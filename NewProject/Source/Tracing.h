@@ -0,0 +1,102 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * Tracing records what each thread was doing and when, so a glitch can be
+ * traced back to its cause, and writes it as Chrome Trace Event JSON for
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * Each thread records into its own ring of events, claimed from a pool that
+ * setEnabled() allocates up front, so recording never locks or allocates.
+ * When a ring is full the oldest events are overwritten, so a dump holds the
+ * most recent stretch of every thread. A ring is returned to the pool when
+ * its thread exits, so worker threads that come and go don't use them up.
+ *
+ * With tracing disabled, each call is one relaxed load and a branch that is
+ * never taken.
+ *
+ * Only the name pointers are stored, so names must be string literals or
+ * otherwise outlive the trace.
+ *
+ *     MacEQ --trace=trace.json     records from startup and writes the file on quit
+ */
+class Tracing
+{
+public:
+    //==============================================================================
+    static constexpr int maxThreads = 32;
+    static constexpr int eventsPerThread = 1 << 15;     // Must be a power of two
+    
+    // Message thread
+    static void setEnabled(bool shouldBeEnabled);
+    static bool isEnabled() noexcept { return enabled.load(std::memory_order_relaxed); }
+    
+    // Drops everything recorded so far. Only call this while disabled.
+    static void clear();
+    
+    //==============================================================================
+    // Any thread
+    static void begin(const char* name) noexcept                    { if (isEnabled()) record(EventType::begin, name, 0.0); }
+    static void end(const char* name) noexcept                      { if (isEnabled()) record(EventType::end, name, 0.0); }
+    static void counter(const char* name, double value) noexcept    { if (isEnabled()) record(EventType::counter, name, value); }
+    
+    // Labels the calling thread's track in the trace
+    static void setThreadName(const char* name) noexcept            { if (isEnabled()) nameThread(name); }
+    
+    // Begins on construction and ends on destruction; see TRACE_SCOPE
+    class Scope
+    {
+    public:
+        explicit Scope(const char* scopeName) noexcept
+            : name(isEnabled() ? scopeName : nullptr)
+        {
+            if (name != nullptr)
+                record(EventType::begin, name, 0.0);
+        }
+        
+        ~Scope() noexcept
+        {
+            if (name != nullptr)
+                record(EventType::end, name, 0.0);
+        }
+        
+    private:
+        const char* name;
+        
+        JUCE_DECLARE_NON_COPYABLE(Scope)
+    };
+    
+    //==============================================================================
+    // Everything still in the rings, as Chrome Trace Event JSON. Safe while
+    // recording; events overwritten during the dump are left out.
+    static juce::String toJson();
+    static bool writeJson(const juce::File& file, juce::String& errorMessage);
+    
+    // Threads that recorded nothing because every ring was taken
+    static int getNumDroppedThreads();
+    
+    // The file a --trace=<file> argument names, relative to the working
+    // directory, or File() if there isn't one
+    static juce::File getRequestedFile(const juce::String& commandLine);
+    
+private:
+    //==============================================================================
+    enum class EventType : juce::uint8
+    {
+        begin,
+        end,
+        counter
+    };
+    
+    static void record(EventType type, const char* name, double value) noexcept;
+    static void nameThread(const char* name) noexcept;
+    
+    static inline std::atomic<bool> enabled { false };
+    
+    Tracing() = delete;
+};
+
+// Traces the rest of the enclosing scope
+#define TRACE_SCOPE(name) const Tracing::Scope JUCE_JOIN_MACRO(traceScope, __LINE__) (name)